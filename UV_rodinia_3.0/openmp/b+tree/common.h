@@ -112,15 +112,34 @@ typedef struct node {
 	struct node * next; // Used for queue.
 } node;
 
-// 
+// keys are 64 byte (cache line) aligned for the vector search of kernel/knode_search.h, which makes a knode 4096 bytes
+// version is the optimistic lock of the concurrent inserts (kernel/kernel_cpu_insert.c): odd while a writer changes the
+// knode, and bumped by every change, so that a lookup that read the same even version before and after is consistent
 typedef struct knode {
 	int location;
 	int indices [DEFAULT_ORDER + 1];
-	int  keys [DEFAULT_ORDER + 1];
+	int  keys [DEFAULT_ORDER + 1] __attribute__((aligned(64)));
 	bool is_leaf;
 	int num_keys;
+	unsigned int version;
 } knode; 
 
+// the knodes and records of a transformed or bulk loaded tree, with the room left for the concurrent inserts: the first
+// *_used are in use and the rest up to *_max are free. The root is knodes[0] and all the leaves are maxheight levels below
+typedef struct knode_store {
+	record *records;
+	long records_used;
+	long records_max;
+	knode *knodes;
+	long knodes_used;
+	long knodes_max;
+	long maxheight;
+	int order;
+} knode_store;
+
+// records left free for the concurrent inserts into a tree of n records (the knodes their splits need are reserved with them)
+#define KNODE_SPARE_RECORDS(n, order) ((n) / 4 > (order) ? (n) / 4 : (order))
+
 struct list_item {
   struct list_item *pred, *next;
   void *datum;
@@ -290,7 +309,7 @@ list_reverse_iterator_is_valid(list_reverse_iterator_t *li);
 //======================================================================================================================================================150
 
 void *
-kmalloc(int size);
+kmalloc(long size);
 
 long 
 transform_to_cuda(	node *n, 
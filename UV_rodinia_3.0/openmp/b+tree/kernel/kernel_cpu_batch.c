@@ -0,0 +1,502 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	DEFINE/INCLUDE
+//========================================================================================================================================================================================================200
+
+//======================================================================================================================================================150
+//	LIBRARIES
+//======================================================================================================================================================150
+
+#include <omp.h>									// (in directory known to compiler)			needed by openmp
+#include <stdlib.h>									// (in directory known to compiler)			needed by malloc
+#include <stdio.h>									// (in directory known to compiler)			needed by printf, stderr
+#include <string.h>									// (in directory known to compiler)			needed by memset, strerror
+#include <errno.h>									// (in directory known to compiler)			needed by errno
+#include <unistd.h>									// (in directory known to compiler)			needed by read, close
+
+#ifdef __linux__
+#include <sys/syscall.h>							// (in directory known to compiler)			needed by SYS_perf_event_open
+#include <linux/perf_event.h>						// (in directory known to compiler)			needed by perf_event_attr
+#endif
+
+//======================================================================================================================================================150
+//	COMMON
+//======================================================================================================================================================150
+
+#include "../common.h"								// (in directory provided here)
+
+//======================================================================================================================================================150
+//	UTILITIES
+//======================================================================================================================================================150
+
+#include "../util/timer/timer.h"					// (in directory provided here)
+
+//======================================================================================================================================================150
+//	HEADER
+//======================================================================================================================================================150
+
+#include "./kernel_cpu_batch.h"						// (in directory provided here)
+#include "./knode_search.h"							// (in directory provided here)
+
+//========================================================================================================================================================================================================200
+//	LOOKUP SLOTS
+//========================================================================================================================================================================================================200
+
+// A thread keeps group lookups in flight, one per slot, and advances them round robin one step at a time: a step
+// searches the node of the lookup, which was prefetched when the lookup took its previous step, and prefetches the next
+// node (or record). While a lookup waits for its prefetch, the steps of the other group - 1 lookups run. A lookup that
+// is done hands its slot to the next query of the thread, so the slots stay busy whatever the depth each lookup has
+// reached (the lookups of a slot are not in lockstep, unlike the batches of kernel_cpu_simd).
+
+typedef struct knode_lookup {
+	int bid;										// query of the slot, -1 if the slot is empty
+	int level;										// levels walked, a leaf at maxheight, its record at maxheight+1
+	long node;										// knode of the next step (the start of a range)
+	long node_2;									// knode of the next step of the end of a range
+	int record;										// record found at the leaf
+} knode_lookup;
+
+static int
+knode_group(int group)
+{
+	return group < 1 ? 1 : group > KNODE_GROUP_MAX ? KNODE_GROUP_MAX : group;
+}
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_BATCH FUNCTION
+//========================================================================================================================================================================================================200
+
+// same queries and results as kernel_cpu, interleaving group lookups per thread
+void
+kernel_cpu_batch(	int cores_arg,
+					int group,
+
+					record *records,
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					int *keys,
+					record *ans)
+{
+
+	//======================================================================================================================================================150
+	//	Variables
+	//======================================================================================================================================================150
+
+	// timer
+	long long time0;
+	long long time1;
+	long long time2;
+
+	time0 = get_time();
+
+	//======================================================================================================================================================150
+	//	MCPU SETUP
+	//======================================================================================================================================================150
+
+	omp_set_num_threads(cores_arg);
+	group = knode_group(group);
+
+	time1 = get_time();
+
+	//======================================================================================================================================================150
+	//	PROCESS INTERACTIONS
+	//======================================================================================================================================================150
+
+	#pragma omp parallel
+	{
+
+		// contiguous queries of the thread
+		int nthreads = omp_get_num_threads();
+		int tid = omp_get_thread_num();
+		int next = (int)((long)count * tid / nthreads);
+		int last = (int)((long)count * (tid + 1) / nthreads);
+
+		knode_lookup slots[KNODE_GROUP_MAX];
+		knode_lookup *q;
+		const knode *n;
+		int active = 0;
+		int thid;
+		int s;
+
+		for(s = 0; s < group; s++){
+			slots[s].bid = -1;
+		}
+
+		do{
+
+			for(s = 0; s < group; s++){
+
+				q = &slots[s];
+
+				// start the next query of the thread in an empty slot
+				if(q->bid < 0){
+					if(next == last){
+						continue;
+					}
+					q->bid = next++;
+					q->level = 0;
+					q->node = currKnode[q->bid];
+					knode_prefetch(&knodes[q->node]);
+					active++;
+					continue;
+				}
+
+				// the record of the key, prefetched at the leaf
+				if(q->level > maxheight){
+					ans[q->bid].value = records[q->record].value;
+					q->bid = -1;
+					active--;
+					continue;
+				}
+
+				n = &knodes[q->node];
+				thid = knode_search(n, keys[q->bid]);
+
+				// inner node, same bound check as kernel_cpu
+				if(q->level < maxheight){
+					if(n->indices[thid] < knodes_elem){
+						q->node = n->indices[thid];
+					}
+					q->level++;
+					knode_prefetch(&knodes[q->node]);
+					continue;
+				}
+
+				// leaf
+				currKnode[q->bid] = offset[q->bid] = q->node;
+				if(n->keys[thid] == keys[q->bid]){
+					q->record = n->indices[thid];
+					q->level++;
+					__builtin_prefetch(&records[q->record], 0, 3);
+				}
+				else{
+					q->bid = -1;
+					active--;
+				}
+
+			}
+
+		} while(active > 0 || next < last);
+
+	}
+
+	time2 = get_time();
+
+	//======================================================================================================================================================150
+	//	DISPLAY TIMING
+	//======================================================================================================================================================150
+
+	printf("Time spent in different stages of CPU/MCPU BATCH (group %d, %s) KERNEL:\n", group, KNODE_SEARCH_ISA);
+
+	printf("%15.12f s, %15.12f %% : MCPU: SET DEVICE\n",					(float) (time1-time0) / 1000000, (float) (time1-time0) / (float) (time2-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: KERNEL\n",					(float) (time2-time1) / 1000000, (float) (time2-time1) / (float) (time2-time0) * 100);
+
+	printf("Total time:\n");
+	printf("%.12f s\n", 												(float) (time2-time0) / 1000000);
+	printf("%.0f queries/s\n",											count / ((time2-time1 > 0 ? time2-time1 : 1) / 1000000.0));
+
+}
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_2_BATCH FUNCTION
+//========================================================================================================================================================================================================200
+
+// same ranges and results as kernel_cpu_2, interleaving group lookups per thread, each walking down to the leaves of
+// both the start and the end of its range
+void
+kernel_cpu_2_batch(	int cores_arg,
+					int group,
+
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					long *lastKnode,
+					long *offset_2,
+					int *start,
+					int *end,
+					int *recstart,
+					int *reclength)
+{
+
+	//======================================================================================================================================================150
+	//	Variables
+	//======================================================================================================================================================150
+
+	// timer
+	long long time0;
+	long long time1;
+	long long time2;
+
+	time0 = get_time();
+
+	//======================================================================================================================================================150
+	//	MCPU SETUP
+	//======================================================================================================================================================150
+
+	omp_set_num_threads(cores_arg);
+	group = knode_group(group);
+
+	time1 = get_time();
+
+	//======================================================================================================================================================150
+	//	PROCESS INTERACTIONS
+	//======================================================================================================================================================150
+
+	#pragma omp parallel
+	{
+
+		// contiguous queries of the thread
+		int nthreads = omp_get_num_threads();
+		int tid = omp_get_thread_num();
+		int next = (int)((long)count * tid / nthreads);
+		int last = (int)((long)count * (tid + 1) / nthreads);
+
+		knode_lookup slots[KNODE_GROUP_MAX];
+		knode_lookup *q;
+		const knode *n;
+		int active = 0;
+		int thid;
+		int s;
+
+		for(s = 0; s < group; s++){
+			slots[s].bid = -1;
+		}
+
+		do{
+
+			for(s = 0; s < group; s++){
+
+				q = &slots[s];
+
+				// start the next query of the thread in an empty slot
+				if(q->bid < 0){
+					if(next == last){
+						continue;
+					}
+					q->bid = next++;
+					q->level = 0;
+					q->node = currKnode[q->bid];
+					q->node_2 = lastKnode[q->bid];
+					knode_prefetch(&knodes[q->node]);
+					knode_prefetch(&knodes[q->node_2]);
+					active++;
+					continue;
+				}
+
+				// inner nodes, same bound checks as kernel_cpu_2
+				if(q->level < maxheight){
+					n = &knodes[q->node];
+					thid = knode_search(n, start[q->bid]);
+					if(n->indices[thid] < knodes_elem){
+						q->node = n->indices[thid];
+					}
+					n = &knodes[q->node_2];
+					thid = knode_search(n, end[q->bid]);
+					if(n->indices[thid] < knodes_elem){
+						q->node_2 = n->indices[thid];
+					}
+					q->level++;
+					knode_prefetch(&knodes[q->node]);
+					knode_prefetch(&knodes[q->node_2]);
+					continue;
+				}
+
+				// leaves
+				currKnode[q->bid] = offset[q->bid] = q->node;
+				lastKnode[q->bid] = offset_2[q->bid] = q->node_2;
+				n = &knodes[q->node];
+				thid = knode_search(n, start[q->bid]);
+				if(n->keys[thid] == start[q->bid]){
+					recstart[q->bid] = n->indices[thid];
+				}
+				n = &knodes[q->node_2];
+				thid = knode_search(n, end[q->bid]);
+				if(n->keys[thid] == end[q->bid]){
+					reclength[q->bid] = n->indices[thid] - recstart[q->bid]+1;
+				}
+				q->bid = -1;
+				active--;
+
+			}
+
+		} while(active > 0 || next < last);
+
+	}
+
+	time2 = get_time();
+
+	//======================================================================================================================================================150
+	//	DISPLAY TIMING
+	//======================================================================================================================================================150
+
+	printf("Time spent in different stages of CPU/MCPU BATCH (group %d, %s) KERNEL:\n", group, KNODE_SEARCH_ISA);
+
+	printf("%15.12f s, %15.12f %% : MCPU: SET DEVICE\n",					(float) (time1-time0) / 1000000, (float) (time1-time0) / (float) (time2-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: KERNEL\n",					(float) (time2-time1) / 1000000, (float) (time2-time1) / (float) (time2-time0) * 100);
+
+	printf("Total time:\n");
+	printf("%.12f s\n", 												(float) (time2-time0) / 1000000);
+	printf("%.0f queries/s\n",											count / ((time2-time1 > 0 ? time2-time1 : 1) / 1000000.0));
+
+}
+
+//========================================================================================================================================================================================================200
+//	LEVEL PROFILE
+//========================================================================================================================================================================================================200
+
+// hardware cache counters of the calling thread (perf_event_open), -1 if they are not available
+
+enum { KNODE_L1D_ACCESS, KNODE_L1D_MISS, KNODE_LLC_ACCESS, KNODE_LLC_MISS, KNODE_COUNTERS };
+
+static int
+knode_counter_open(	int cache,
+					int result)
+{
+
+#ifdef __linux__
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+
+}
+
+static void
+knode_counters_read(	int *fd,
+						long long *value)
+{
+
+	int c;
+	for(c = 0; c < KNODE_COUNTERS; c++){
+		if(fd[c] < 0 || read(fd[c], &value[c], sizeof(long long)) != sizeof(long long)){
+			value[c] = -1;
+		}
+	}
+
+}
+
+// walks the count lookups of keys down the tree on the calling thread, one level of all of them after the other and
+// without prefetch, and prints for each level the knodes visited, the time per visit and the L1D and LLC read miss
+// rates of the searches (the misses of a level are those the prefetch of the batched kernels has to hide)
+void
+kernel_cpu_levels(	knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					int *keys)
+{
+
+	int fd[KNODE_COUNTERS];
+	long long before[KNODE_COUNTERS];
+	long long after[KNODE_COUNTERS];
+	int c;
+
+#ifdef __linux__
+	fd[KNODE_L1D_ACCESS] = knode_counter_open(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+	fd[KNODE_L1D_MISS] = knode_counter_open(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS);
+	fd[KNODE_LLC_ACCESS] = knode_counter_open(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+	fd[KNODE_LLC_MISS] = knode_counter_open(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS);
+#else
+	for(c = 0; c < KNODE_COUNTERS; c++){
+		fd[c] = knode_counter_open(0, 0);
+	}
+#endif
+	if(fd[KNODE_L1D_MISS] < 0 && fd[KNODE_LLC_MISS] < 0){
+		printf("Level profile: no cache counters (perf_event_open: %s), miss rates are n/a\n", strerror(errno));
+	}
+
+	long *node = (long *)malloc(count*sizeof(long));
+	memset(node, 0, count*sizeof(long));
+	char *visited = (char *)malloc(knodes_elem);
+
+	printf("level\tvisits\tknodes\tns/visit\tL1D miss %%\tLLC miss %%\tLLC misses/visit\n");
+
+	long level;
+	int bid;
+	int thid;
+	for(level = 0; level <= maxheight; level++){
+
+		memset(visited, 0, knodes_elem);
+		long nodes = 0;
+
+		knode_counters_read(fd, before);
+		long long time0 = get_time();
+
+		for(bid = 0; bid < count; bid++){
+			const knode *n = &knodes[node[bid]];
+			thid = knode_search(n, keys[bid]);
+			if(!visited[node[bid]]){
+				visited[node[bid]] = 1;
+				nodes++;
+			}
+			if(level < maxheight && n->indices[thid] < knodes_elem){
+				node[bid] = n->indices[thid];
+			}
+		}
+
+		long long time1 = get_time();
+		knode_counters_read(fd, after);
+
+		printf("%ld%s\t%d\t%ld\t%.1f", level, level == maxheight ? " (leaf)" : "", count, nodes, (time1-time0) * 1000.0 / count);
+		if(before[KNODE_L1D_ACCESS] >= 0 && before[KNODE_L1D_MISS] >= 0 && after[KNODE_L1D_ACCESS] > before[KNODE_L1D_ACCESS]){
+			printf("\t\t%.2f", 100.0 * (after[KNODE_L1D_MISS] - before[KNODE_L1D_MISS]) / (after[KNODE_L1D_ACCESS] - before[KNODE_L1D_ACCESS]));
+		}
+		else{
+			printf("\t\tn/a");
+		}
+		if(before[KNODE_LLC_ACCESS] >= 0 && before[KNODE_LLC_MISS] >= 0 && after[KNODE_LLC_ACCESS] > before[KNODE_LLC_ACCESS]){
+			printf("\t\t%.2f", 100.0 * (after[KNODE_LLC_MISS] - before[KNODE_LLC_MISS]) / (after[KNODE_LLC_ACCESS] - before[KNODE_LLC_ACCESS]));
+		}
+		else{
+			printf("\t\tn/a");
+		}
+		if(before[KNODE_LLC_MISS] >= 0){
+			printf("\t\t%.3f\n", (double)(after[KNODE_LLC_MISS] - before[KNODE_LLC_MISS]) / count);
+		}
+		else{
+			printf("\t\tn/a\n");
+		}
+
+	}
+
+	free(node);
+	free(visited);
+	for(c = 0; c < KNODE_COUNTERS; c++){
+		if(fd[c] >= 0){
+			close(fd[c]);
+		}
+	}
+
+}
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
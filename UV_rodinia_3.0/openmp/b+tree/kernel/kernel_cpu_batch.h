@@ -0,0 +1,62 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_BATCH HEADER
+//========================================================================================================================================================================================================200
+
+// most lookups a thread keeps in flight (the group of the batch command line parameter)
+#define KNODE_GROUP_MAX 64
+
+void
+kernel_cpu_batch(	int cores_arg,
+					int group,
+
+					record *records,
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					int *keys,
+					record *ans);
+
+void
+kernel_cpu_2_batch(	int cores_arg,
+					int group,
+
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					long *lastKnode,
+					long *offset_2,
+					int *start,
+					int *end,
+					int *recstart,
+					int *reclength);
+
+void
+kernel_cpu_levels(	knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					int *keys);
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
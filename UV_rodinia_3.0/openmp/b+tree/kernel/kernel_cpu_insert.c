@@ -0,0 +1,441 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	DEFINE/INCLUDE
+//========================================================================================================================================================================================================200
+
+//======================================================================================================================================================150
+//	LIBRARIES
+//======================================================================================================================================================150
+
+#include <omp.h>									// (in directory known to compiler)			needed by openmp
+#include <stdlib.h>									// (in directory known to compiler)			needed by malloc
+#include <stdio.h>									// (in directory known to compiler)			needed by printf, stderr
+#include <limits.h>									// (in directory known to compiler)			needed by INT_MIN, INT_MAX
+#include <sched.h>									// (in directory known to compiler)			needed by sched_yield
+
+//======================================================================================================================================================150
+//	COMMON
+//======================================================================================================================================================150
+
+#include "../common.h"								// (in directory provided here)
+
+//======================================================================================================================================================150
+//	UTILITIES
+//======================================================================================================================================================150
+
+#include "../util/timer/timer.h"					// (in directory provided here)
+
+//======================================================================================================================================================150
+//	HEADER
+//======================================================================================================================================================150
+
+#include "./kernel_cpu_insert.h"					// (in directory provided here)
+#include "./knode_search.h"							// (in directory provided here)
+
+//========================================================================================================================================================================================================200
+//	OPTIMISTIC LOCKS
+//========================================================================================================================================================================================================200
+
+// The version of a knode is its optimistic lock (optimistic lock coupling). A lookup never writes: it reads the version
+// of a knode (waiting while it is odd, locked), searches it and reads the child, then checks that the version did not
+// change before it follows the child, and restarts from the root if it did. A writer locks a knode by a compare and swap
+// of the version it read to version + 1, so that it fails (and restarts) if the knode changed since, and unlocks it with
+// version + 2. Keys can move while a lookup reads them, but every knode keeps an INT_MAX at or before keys[order], so the
+// search of knode_search always stops inside the knode, and the version check throws away what it found.
+
+static unsigned int
+knode_read_lock(const knode *n)
+{
+
+	unsigned int v;
+	int spins = 0;
+	while((v = __atomic_load_n(&n->version, __ATOMIC_ACQUIRE)) & 1){
+		if(++spins == 64){
+			spins = 0;
+			sched_yield();
+		}
+	}
+	return v;
+
+}
+
+static int
+knode_validate(	const knode *n,
+				unsigned int v)
+{
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&n->version, __ATOMIC_RELAXED) == v;
+
+}
+
+static int
+knode_upgrade(	knode *n,
+				unsigned int v)
+{
+
+	if(!__atomic_compare_exchange_n(&n->version, &v, v + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		return 0;
+	}
+	// the odd version is seen before any change of the knode
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return 1;
+
+}
+
+static void
+knode_unlock(knode *n)
+{
+
+	__atomic_store_n(&n->version, n->version + 1, __ATOMIC_RELEASE);
+
+}
+
+//========================================================================================================================================================================================================200
+//	KNODE CHANGES (the knodes are locked)
+//========================================================================================================================================================================================================200
+
+// makes room at slot s of knode k, moving the slots s..num_keys-1 one up from the top, so that the INT_MAX after the
+// keys is copied first and stays in the knode while the keys move
+static void
+knode_shift(	knode *k,
+				int s)
+{
+
+	int j;
+	for(j = k->num_keys; j > s; j--){
+		k->keys[j] = k->keys[j - 1];
+		k->indices[j] = k->indices[j - 1];
+	}
+	k->num_keys++;
+
+}
+
+// splits the full knode x (under its parent p, which has room) at the free knode y: y takes the upper half of the
+// keys of x, and its smallest key goes up to p as the separator of y, in the slot after x
+static void
+knode_split(	knode_store *store,
+				knode *p,
+				knode *x,
+				long y_location)
+{
+
+	knode *y = &store->knodes[y_location];
+	int order = store->order;
+	int m = x->num_keys - 2;
+	int h = m / 2;
+	int separator = x->keys[h + 1];
+	int j;
+
+	// y, not yet reachable
+	y->location = y_location;
+	y->is_leaf = x->is_leaf;
+	y->version = 0;
+	y->keys[0] = INT_MIN;
+	if(x->is_leaf){
+		// keys h+1..m, and the link to the next leaf of x
+		y->indices[0] = 0;
+		for(j = h + 1; j <= m; j++){
+			y->keys[j - h] = x->keys[j];
+			y->indices[j - h] = x->indices[j];
+		}
+		y->num_keys = m - h + 2;
+		y->indices[m - h + 1] = x->indices[m + 1];
+	}
+	else{
+		// the children h+1..m, under the keys h+2..m
+		for(j = h + 1; j <= m; j++){
+			y->keys[j - h - 1] = x->keys[j];
+			y->indices[j - h - 1] = x->indices[j];
+		}
+		y->keys[0] = INT_MIN;
+		y->num_keys = m - h + 1;
+		y->indices[m - h] = y_location + 1;
+	}
+	for(j = y->num_keys - 1; j <= order; j++){
+		y->keys[j] = INT_MAX;
+	}
+
+	// y goes into p after x
+	int s = knode_search(p, separator);
+	knode_shift(p, s + 1);
+	p->keys[s + 1] = separator;
+	p->indices[s + 1] = y_location;
+
+	// x keeps the keys up to h
+	for(j = h + 1; j <= m + 1; j++){
+		x->keys[j] = INT_MAX;
+	}
+	x->num_keys = h + 2;
+	x->indices[h + 1] = x->is_leaf ? y_location : x->location + 1;
+
+}
+
+//========================================================================================================================================================================================================200
+//	KNODE_FIND_OPTIMISTIC FUNCTION
+//========================================================================================================================================================================================================200
+
+// looks key up while inserts run, returns 1 and the value of its record if it is in the tree, 0 if not
+int
+knode_find_optimistic(	knode_store *store,
+						int key,
+						int *value,
+						long *restarts)
+{
+
+	knode *knodes = store->knodes;
+	long level;
+	long node;
+	long child;
+	unsigned int v;
+	unsigned int child_v;
+	const knode *n;
+	int thid;
+
+restart:
+	node = 0;
+	v = knode_read_lock(&knodes[0]);
+
+	for(level = 0; level < store->maxheight; level++){
+		n = &knodes[node];
+		thid = knode_search(n, key);
+		child = n->indices[thid];
+		if(!knode_validate(n, v)){
+			(*restarts)++;
+			goto restart;
+		}
+		child_v = knode_read_lock(&knodes[child]);
+		if(!knode_validate(n, v)){
+			(*restarts)++;
+			goto restart;
+		}
+		node = child;
+		v = child_v;
+	}
+
+	// the records are written before the leaf that holds them is unlocked, and never change
+	n = &knodes[node];
+	thid = knode_search(n, key);
+	int found = n->keys[thid] == key;
+	int record = n->indices[thid];
+	if(!knode_validate(n, v)){
+		(*restarts)++;
+		goto restart;
+	}
+	if(found){
+		*value = store->records[record].value;
+	}
+	return found;
+
+}
+
+//========================================================================================================================================================================================================200
+//	KNODE_INSERT_OPTIMISTIC FUNCTION
+//========================================================================================================================================================================================================200
+
+// inserts key with value while lookups and other inserts run. The way down is that of a lookup, except that a full
+// knode is split on the way (locking it and its parent), before the insert restarts. At the leaf, only the leaf is
+// locked. The tree does not grow a level (a lookup walks maxheight levels), so a full root cannot be split and the
+// insert returns KNODE_INSERT_FULL, as it does when the room of store is used up: the tree needs a bulk load again.
+int
+knode_insert_optimistic(	knode_store *store,
+							int key,
+							int value,
+							long *restarts)
+{
+
+	knode *knodes = store->knodes;
+	int order = store->order;
+	long level;
+	long node;
+	long parent;
+	long child;
+	unsigned int v;
+	unsigned int parent_v;
+	unsigned int child_v;
+	knode *n;
+	int thid;
+
+restart:
+	parent = -1;
+	parent_v = 0;
+	node = 0;
+	v = knode_read_lock(&knodes[0]);
+
+	for(level = 0; ; level++){
+
+		n = &knodes[node];
+
+		// a full knode (order - 1 keys) is split before going further
+		if(n->num_keys - 2 >= order - 1){
+			if(!knode_validate(n, v)){
+				(*restarts)++;
+				goto restart;
+			}
+			if(parent < 0){
+				return KNODE_INSERT_FULL;
+			}
+			if(!knode_upgrade(&knodes[parent], parent_v)){
+				(*restarts)++;
+				goto restart;
+			}
+			if(!knode_upgrade(n, v)){
+				knode_unlock(&knodes[parent]);
+				(*restarts)++;
+				goto restart;
+			}
+			long y = __atomic_fetch_add(&store->knodes_used, 1, __ATOMIC_RELAXED);
+			if(y >= store->knodes_max){
+				knode_unlock(n);
+				knode_unlock(&knodes[parent]);
+				return KNODE_INSERT_FULL;
+			}
+			knode_split(store, &knodes[parent], n, y);
+			knode_unlock(n);
+			knode_unlock(&knodes[parent]);
+			goto restart;
+		}
+
+		if(level == store->maxheight){
+			break;
+		}
+
+		thid = knode_search(n, key);
+		child = n->indices[thid];
+		if(!knode_validate(n, v)){
+			(*restarts)++;
+			goto restart;
+		}
+		child_v = knode_read_lock(&knodes[child]);
+		if(!knode_validate(n, v)){
+			(*restarts)++;
+			goto restart;
+		}
+		parent = node;
+		parent_v = v;
+		node = child;
+		v = child_v;
+
+	}
+
+	// the leaf has room, and still holds the range of key if its version did not change
+	if(!knode_upgrade(n, v)){
+		(*restarts)++;
+		goto restart;
+	}
+	thid = knode_search(n, key);
+	if(n->keys[thid] == key){
+		knode_unlock(n);
+		return KNODE_INSERT_EXISTS;
+	}
+	long r = __atomic_fetch_add(&store->records_used, 1, __ATOMIC_RELAXED);
+	if(r >= store->records_max){
+		knode_unlock(n);
+		return KNODE_INSERT_FULL;
+	}
+	store->records[r].value = value;
+	knode_shift(n, thid + 1);
+	n->keys[thid + 1] = key;
+	n->indices[thid + 1] = r;
+	knode_unlock(n);
+	return KNODE_INSERT_DONE;
+
+}
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_UPDATE FUNCTION
+//========================================================================================================================================================================================================200
+
+// runs count inserts of keys (each key as its value) and count lookups of find together, interleaved over the threads,
+// and returns in status the result of each insert and in found the value found by each lookup (-1 if none)
+void
+kernel_cpu_update(	int cores_arg,
+
+					knode_store *store,
+
+					int count,
+					int *keys,
+					int *status,
+					int *find,
+					int *found)
+{
+
+	//======================================================================================================================================================150
+	//	Variables
+	//======================================================================================================================================================150
+
+	// timer
+	long long time0;
+	long long time1;
+	long long time2;
+
+	time0 = get_time();
+
+	//======================================================================================================================================================150
+	//	MCPU SETUP
+	//======================================================================================================================================================150
+
+	omp_set_num_threads(cores_arg);
+
+	time1 = get_time();
+
+	//======================================================================================================================================================150
+	//	PROCESS INTERACTIONS
+	//======================================================================================================================================================150
+
+	long restarts = 0;
+	long op;
+
+	// even operations insert, odd ones look up, so that every thread does both
+	#pragma omp parallel for reduction(+:restarts) schedule(dynamic, 64)
+	for(op = 0; op < 2 * (long)count; op++){
+
+		int bid = (int)(op / 2);
+		if(op % 2 == 0){
+			status[bid] = knode_insert_optimistic(store, keys[bid], keys[bid], &restarts);
+		}
+		else{
+			found[bid] = -1;
+			knode_find_optimistic(store, find[bid], &found[bid], &restarts);
+		}
+
+	}
+
+	time2 = get_time();
+
+	//======================================================================================================================================================150
+	//	DISPLAY TIMING
+	//======================================================================================================================================================150
+
+	int inserted = 0;
+	int exists = 0;
+	int full = 0;
+	int bid;
+	for(bid = 0; bid < count; bid++){
+		inserted += status[bid] == KNODE_INSERT_DONE;
+		exists += status[bid] == KNODE_INSERT_EXISTS;
+		full += status[bid] == KNODE_INSERT_FULL;
+	}
+
+	printf("Time spent in different stages of CPU/MCPU UPDATE KERNEL:\n");
+
+	printf("%15.12f s, %15.12f %% : MCPU: SET DEVICE\n",					(float) (time1-time0) / 1000000, (float) (time1-time0) / (float) (time2-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: KERNEL\n",					(float) (time2-time1) / 1000000, (float) (time2-time1) / (float) (time2-time0) * 100);
+
+	printf("Total time:\n");
+	printf("%.12f s\n", 												(float) (time2-time0) / 1000000);
+	printf("%d inserted, %d already in, %d no room, %d lookups, %ld restarts, %.0f operations/s\n", inserted, exists, full, count,
+			restarts, 2 * count / ((time2-time1 > 0 ? time2-time1 : 1) / 1000000.0));
+
+}
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
@@ -0,0 +1,43 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_INSERT HEADER
+//========================================================================================================================================================================================================200
+
+// results of knode_insert_optimistic
+#define KNODE_INSERT_DONE 0
+#define KNODE_INSERT_EXISTS 1
+#define KNODE_INSERT_FULL 2
+
+int
+knode_find_optimistic(	knode_store *store,
+						int key,
+						int *value,
+						long *restarts);
+
+int
+knode_insert_optimistic(	knode_store *store,
+							int key,
+							int value,
+							long *restarts);
+
+void
+kernel_cpu_update(	int cores_arg,
+
+					knode_store *store,
+
+					int count,
+					int *keys,
+					int *status,
+					int *find,
+					int *found);
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
@@ -0,0 +1,390 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	DEFINE/INCLUDE
+//========================================================================================================================================================================================================200
+
+//======================================================================================================================================================150
+//	LIBRARIES
+//======================================================================================================================================================150
+
+#include <omp.h>									// (in directory known to compiler)			needed by openmp
+#include <stdlib.h>									// (in directory known to compiler)			needed by malloc, posix_memalign
+#include <stdio.h>									// (in directory known to compiler)			needed by printf, stderr
+#include <string.h>									// (in directory known to compiler)			needed by memset
+#include <limits.h>									// (in directory known to compiler)			needed by INT_MIN, INT_MAX
+
+//======================================================================================================================================================150
+//	COMMON
+//======================================================================================================================================================150
+
+#include "../common.h"								// (in directory provided here)
+
+//======================================================================================================================================================150
+//	UTILITIES
+//======================================================================================================================================================150
+
+#include "../util/timer/timer.h"					// (in directory provided here)
+
+//======================================================================================================================================================150
+//	HEADER
+//======================================================================================================================================================150
+
+#include "./kernel_cpu_load.h"						// (in directory provided here)
+
+//========================================================================================================================================================================================================200
+//	PARALLEL SORT
+//========================================================================================================================================================================================================200
+
+// LSD radix sort of the n keys, 8 bits a pass, with tmp (n keys) as the other buffer. Each thread counts the digits of
+// its contiguous chunk, the counts give each thread its offset in every bucket, and the threads scatter their chunks
+// stably. A pass in which all the keys have the same digit is skipped. The sorted keys are in keys or tmp, returned.
+static int *
+knode_sort(	int *keys,
+			int *tmp,
+			long n)
+{
+
+	int nthreads = omp_get_max_threads();
+	long *counts = (long *)malloc(sizeof(long) * 256 * nthreads);
+	int *src = keys;
+	int *dst = tmp;
+	int shift;
+
+	for(shift = 0; shift < 32; shift += 8){
+
+		int skip = 0;
+
+		#pragma omp parallel
+		{
+
+			int tid = omp_get_thread_num();
+			int nth = omp_get_num_threads();
+			long lo = n * tid / nth;
+			long hi = n * (tid + 1) / nth;
+			long *count = &counts[256 * tid];
+			long i;
+			int d;
+			int t;
+
+			for(d = 0; d < 256; d++){
+				count[d] = 0;
+			}
+			// the sign bit is flipped so that the negative keys sort first
+			for(i = lo; i < hi; i++){
+				count[(((unsigned int)src[i] ^ 0x80000000u) >> shift) & 255]++;
+			}
+
+			#pragma omp barrier
+			#pragma omp single
+			{
+				long sum = 0;
+				for(d = 0; d < 256; d++){
+					long bucket = 0;
+					for(t = 0; t < nth; t++){
+						long c = counts[256 * t + d];
+						counts[256 * t + d] = sum + bucket;
+						bucket += c;
+					}
+					if(bucket == n){
+						skip = 1;
+					}
+					sum += bucket;
+				}
+			}
+
+			if(!skip){
+				for(i = lo; i < hi; i++){
+					dst[count[(((unsigned int)src[i] ^ 0x80000000u) >> shift) & 255]++] = src[i];
+				}
+			}
+
+		}
+
+		if(!skip){
+			int *swap = src;
+			src = dst;
+			dst = swap;
+		}
+
+	}
+
+	free(counts);
+	return src;
+
+}
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_BULK_LOAD FUNCTION
+//========================================================================================================================================================================================================200
+
+// builds the knodes of a tree of the n keys (sorted or not, duplicates are dropped like insert does) bottom up in
+// parallel, and returns the memory block of its records (at the start, each record holds its key as value) and knodes
+// (64 byte aligned after the records), which it describes in store:
+//	1. sort the keys, unless they are sorted already, and drop the duplicates
+//	2. pack the u unique keys in order into leaves of fill percent of order - 1 keys, evenly spread
+//	3. build each inner level from the one below, with fill percent of order children per knode, up to the root
+// The knodes are those transform_to_cuda makes (level by level from the root, each level left to right), written
+// directly and each level in parallel, so that they are first touched by the threads that will search them. The room
+// left for the concurrent inserts is a quarter of u records and the knodes their splits could need.
+char *
+kernel_cpu_bulk_load(	int cores_arg,
+
+						int *keys,
+						long n,
+
+						int order,
+						int fill,
+
+						knode_store *store)
+{
+
+	//======================================================================================================================================================150
+	//	Variables
+	//======================================================================================================================================================150
+
+	// timer
+	long long time0;
+	long long time1;
+	long long time2;
+	long long time3;
+	long long time4;
+
+	time0 = get_time();
+
+	//======================================================================================================================================================150
+	//	MCPU SETUP
+	//======================================================================================================================================================150
+
+	omp_set_num_threads(cores_arg);
+
+	long i;
+	long j;
+	int l;
+
+	//======================================================================================================================================================150
+	//	SORT AND DROP DUPLICATES
+	//======================================================================================================================================================150
+
+	long unsorted = 0;
+	#pragma omp parallel for reduction(+:unsorted)
+	for(i = 1; i < n; i++){
+		if(keys[i-1] > keys[i]){
+			unsorted++;
+		}
+	}
+
+	int *tmp = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+	int *sorted = unsorted ? knode_sort(keys, tmp, n) : keys;
+	int *unique = sorted == keys ? tmp : keys;
+
+	// each thread keeps the keys of its chunk that differ from the one before, at the offset of its chunk's first
+	int nthreads = omp_get_max_threads();
+	long *offsets = (long *)malloc(sizeof(long) * (nthreads + 1));
+	long u;
+
+	#pragma omp parallel private (i)
+	{
+
+		int tid = omp_get_thread_num();
+		int nth = omp_get_num_threads();
+		long lo = n * tid / nth;
+		long hi = n * (tid + 1) / nth;
+		long c = 0;
+
+		for(i = lo; i < hi; i++){
+			if(i == 0 || sorted[i] != sorted[i-1]){
+				c++;
+			}
+		}
+		offsets[tid + 1] = c;
+
+		#pragma omp barrier
+		#pragma omp single
+		{
+			int t;
+			offsets[0] = 0;
+			for(t = 0; t < nth; t++){
+				offsets[t + 1] += offsets[t];
+			}
+			u = offsets[nth];
+		}
+
+		c = offsets[tid];
+		for(i = lo; i < hi; i++){
+			if(i == 0 || sorted[i] != sorted[i-1]){
+				unique[c++] = sorted[i];
+			}
+		}
+
+	}
+
+	free(offsets);
+
+	time1 = get_time();
+
+	//======================================================================================================================================================150
+	//	LEVEL SIZES AND MEMORY
+	//======================================================================================================================================================150
+
+	if(fill < 1 || fill > 100){
+		fill = 100;
+	}
+	long per_leaf = (long)(order - 1) * fill / 100;
+	long per_inner = (long)order * fill / 100;
+	per_leaf = per_leaf < 1 ? 1 : per_leaf;
+	per_inner = per_inner < 2 ? 2 : per_inner;
+
+	// the knodes of each level, 0 are the leaves, and the index of the first of them
+	long count[64];
+	long base[64];
+	int height = 0;
+	count[0] = u > 0 ? (u + per_leaf - 1) / per_leaf : 1;
+	while(count[height] > 1){
+		count[height + 1] = (count[height] + per_inner - 1) / per_inner;
+		height++;
+	}
+	base[height] = 0;
+	for(l = height - 1; l >= 0; l--){
+		base[l] = base[l + 1] + count[l + 1];
+	}
+	long nodes = base[0] + count[0];
+
+	// the room for the inserts, a leaf split needs at least (order - 1) / 2 inserts once a leaf is full
+	long spare = KNODE_SPARE_RECORDS(u, order);
+	store->records_used = u;
+	store->records_max = u + spare;
+	store->knodes_used = nodes;
+	store->knodes_max = nodes + count[0] + 2 * spare / (order - 1) + count[height > 0 ? 1 : 0] + 1;
+	store->maxheight = height;
+	store->order = order;
+
+	long records_size = (store->records_max * sizeof(record) + 63) & ~63L;
+	char *mem;
+	if(posix_memalign((void **)&mem, 64, records_size + store->knodes_max * sizeof(knode))){
+		printf("Initial malloc error\n");
+		exit(1);
+	}
+	store->records = (record *)mem;
+	store->knodes = (knode *)(mem + records_size);
+
+	record *records = store->records;
+	knode *knodes = store->knodes;
+
+	// the smallest key under each knode of a level, the separators of the level above
+	int *low = (int *)malloc(sizeof(int) * count[0]);
+	int *low_above = (int *)malloc(sizeof(int) * count[0]);
+
+	time2 = get_time();
+
+	//======================================================================================================================================================150
+	//	RECORDS AND LEAVES
+	//======================================================================================================================================================150
+
+	#pragma omp parallel for schedule(static)
+	for(i = 0; i < u; i++){
+		records[i].value = unique[i];
+	}
+
+	// leaf i has the keys first..last-1, with keys[0] INT_MIN and keys[num_keys-1] and the rest INT_MAX as in transform_to_cuda
+	#pragma omp parallel for private (j) schedule(static)
+	for(i = 0; i < count[0]; i++){
+
+		knode *k = &knodes[base[0] + i];
+		long first = u * i / count[0];
+		long last = u * (i + 1) / count[0];
+		int m = (int)(last - first);
+
+		k->location = base[0] + i;
+		k->is_leaf = true;
+		k->num_keys = m + 2;
+		k->version = 0;
+		k->keys[0] = INT_MIN;
+		k->indices[0] = 0;
+		for(j = 0; j < m; j++){
+			k->keys[j + 1] = unique[first + j];
+			k->indices[j + 1] = first + j;
+		}
+		for(j = m + 1; j <= order; j++){
+			k->keys[j] = INT_MAX;
+		}
+		k->indices[m + 1] = k->location + 1;
+		low[i] = m > 0 ? k->keys[1] : INT_MIN;
+
+	}
+
+	time3 = get_time();
+
+	//======================================================================================================================================================150
+	//	INNER LEVELS
+	//======================================================================================================================================================150
+
+	// knode i of level l has the children first..last-1 of level l - 1, child c > first under the separator low[c]
+	for(l = 1; l <= height; l++){
+
+		#pragma omp parallel for private (j) schedule(static)
+		for(i = 0; i < count[l]; i++){
+
+			knode *k = &knodes[base[l] + i];
+			long first = count[l - 1] * i / count[l];
+			long last = count[l - 1] * (i + 1) / count[l];
+			int m = (int)(last - first) - 1;
+
+			k->location = base[l] + i;
+			k->is_leaf = false;
+			k->num_keys = m + 2;
+			k->version = 0;
+			k->keys[0] = INT_MIN;
+			k->indices[0] = base[l - 1] + first;
+			for(j = 1; j <= m; j++){
+				k->keys[j] = low[first + j];
+				k->indices[j] = base[l - 1] + first + j;
+			}
+			for(j = m + 1; j <= order; j++){
+				k->keys[j] = INT_MAX;
+			}
+			k->indices[m + 1] = k->location + 1;
+			low_above[i] = low[first];
+
+		}
+
+		int *swap = low;
+		low = low_above;
+		low_above = swap;
+
+	}
+
+	free(low);
+	free(low_above);
+	free(tmp);
+
+	time4 = get_time();
+
+	//======================================================================================================================================================150
+	//	DISPLAY TIMING
+	//======================================================================================================================================================150
+
+	printf("Bulk load of %ld keys (%ld unique, %s), %ld knodes, height %d, fill %d%%:\n", n, u, unsorted ? "unsorted input" : "sorted input",
+			nodes, height, fill);
+
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: SORT\n",					(float) (time1-time0) / 1000000, (float) (time1-time0) / (float) (time4-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: ALLOCATE\n",				(float) (time2-time1) / 1000000, (float) (time2-time1) / (float) (time4-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: RECORDS AND LEAVES\n",		(float) (time3-time2) / 1000000, (float) (time3-time2) / (float) (time4-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: INNER LEVELS\n",			(float) (time4-time3) / 1000000, (float) (time4-time3) / (float) (time4-time0) * 100);
+
+	printf("Total time:\n");
+	printf("%.12f s\n", 												(float) (time4-time0) / 1000000);
+
+	return mem;
+
+}
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
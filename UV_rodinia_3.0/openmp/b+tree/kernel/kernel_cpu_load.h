@@ -0,0 +1,26 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_LOAD HEADER
+//========================================================================================================================================================================================================200
+
+char *
+kernel_cpu_bulk_load(	int cores_arg,
+
+						int *keys,
+						long n,
+
+						int order,
+						int fill,
+
+						knode_store *store);
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
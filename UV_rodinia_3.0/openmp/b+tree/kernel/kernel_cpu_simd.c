@@ -0,0 +1,282 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	DEFINE/INCLUDE
+//========================================================================================================================================================================================================200
+
+//======================================================================================================================================================150
+//	LIBRARIES
+//======================================================================================================================================================150
+
+#include <omp.h>									// (in directory known to compiler)			needed by openmp
+#include <stdlib.h>									// (in directory known to compiler)			needed by malloc
+#include <stdio.h>									// (in directory known to compiler)			needed by printf, stderr
+
+//======================================================================================================================================================150
+//	COMMON
+//======================================================================================================================================================150
+
+#include "../common.h"								// (in directory provided here)
+
+//======================================================================================================================================================150
+//	UTILITIES
+//======================================================================================================================================================150
+
+#include "../util/timer/timer.h"					// (in directory provided here)
+
+//======================================================================================================================================================150
+//	HEADER
+//======================================================================================================================================================150
+
+#include "./kernel_cpu_simd.h"						// (in directory provided here)
+#include "./knode_search.h"							// (in directory provided here)
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_SIMD FUNCTION
+//========================================================================================================================================================================================================200
+
+// same queries and results as kernel_cpu, with the CPU native search: each thread walks a batch of KNODE_BATCH queries
+// down the tree level by level, searches a node with the vector compare of knode_search (which stops at the first
+// vector past the key instead of comparing all the order keys) and prefetches the node of the next level of the query
+// while the other queries of the batch are searched
+void 
+kernel_cpu_simd(	int cores_arg,
+
+					record *records,
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					int *keys,
+					record *ans)
+{
+
+	//======================================================================================================================================================150
+	//	Variables
+	//======================================================================================================================================================150
+
+	// timer
+	long long time0;
+	long long time1;
+	long long time2;
+
+	time0 = get_time();
+
+	//======================================================================================================================================================150
+	//	MCPU SETUP
+	//======================================================================================================================================================150
+
+	omp_set_num_threads(cores_arg);
+
+	time1 = get_time();
+
+	//======================================================================================================================================================150
+	//	PROCESS INTERACTIONS
+	//======================================================================================================================================================150
+
+	int first;
+	int last;
+	int bid;
+	int thid;
+	int i;
+	const knode *n;
+
+	// process batches of querries
+	#pragma omp parallel for private (last, bid, thid, i, n) schedule(static)
+	for(first = 0; first < count; first += KNODE_BATCH){
+
+		last = first + KNODE_BATCH < count ? first + KNODE_BATCH : count;
+
+		for(bid = first; bid < last; bid++){
+			knode_prefetch(&knodes[currKnode[bid]]);
+		}
+
+		// process levels of the tree, one query of the batch after the other
+		for(i = 0; i < maxheight; i++){
+			for(bid = first; bid < last; bid++){
+
+				n = &knodes[currKnode[bid]];
+				thid = knode_search(n, keys[bid]);
+				// same bound check as kernel_cpu
+				if(n->indices[thid] < knodes_elem){
+					offset[bid] = n->indices[thid];
+				}
+
+				// set for next tree level
+				currKnode[bid] = offset[bid];
+				knode_prefetch(&knodes[currKnode[bid]]);
+
+			}
+		}
+
+		// process leaves, the slot of the key is the only one that can hold it
+		for(bid = first; bid < last; bid++){
+
+			n = &knodes[currKnode[bid]];
+			thid = knode_search(n, keys[bid]);
+			if(n->keys[thid] == keys[bid]){
+				ans[bid].value = records[n->indices[thid]].value;
+			}
+
+		}
+
+	}
+
+	time2 = get_time();
+
+	//======================================================================================================================================================150
+	//	DISPLAY TIMING
+	//======================================================================================================================================================150
+
+	printf("Time spent in different stages of CPU/MCPU SIMD (%s) KERNEL:\n", KNODE_SEARCH_ISA);
+
+	printf("%15.12f s, %15.12f %% : MCPU: SET DEVICE\n",					(float) (time1-time0) / 1000000, (float) (time1-time0) / (float) (time2-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: KERNEL\n",					(float) (time2-time1) / 1000000, (float) (time2-time1) / (float) (time2-time0) * 100);
+
+	printf("Total time:\n");
+	printf("%.12f s\n", 												(float) (time2-time0) / 1000000);
+
+}
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_2_SIMD
+//========================================================================================================================================================================================================200
+
+// same ranges and results as kernel_cpu_2, with the batched vector search and prefetch of kernel_cpu_simd for both
+// the start and the end of each range
+void 
+kernel_cpu_2_simd(	int cores_arg,
+
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					long *lastKnode,
+					long *offset_2,
+					int *start,
+					int *end,
+					int *recstart,
+					int *reclength)
+{
+
+	//======================================================================================================================================================150
+	//	Variables
+	//======================================================================================================================================================150
+
+	// timer
+	long long time0;
+	long long time1;
+	long long time2;
+
+	time0 = get_time();
+
+	//======================================================================================================================================================150
+	//	MCPU SETUP
+	//======================================================================================================================================================150
+
+	omp_set_num_threads(cores_arg);
+
+	time1 = get_time();
+
+	//======================================================================================================================================================150
+	//	PROCESS INTERACTIONS
+	//======================================================================================================================================================150
+
+	int first;
+	int last;
+	int bid;
+	int thid;
+	int i;
+	const knode *n;
+
+	// process batches of querries
+	#pragma omp parallel for private (last, bid, thid, i, n) schedule(static)
+	for(first = 0; first < count; first += KNODE_BATCH){
+
+		last = first + KNODE_BATCH < count ? first + KNODE_BATCH : count;
+
+		for(bid = first; bid < last; bid++){
+			knode_prefetch(&knodes[currKnode[bid]]);
+			knode_prefetch(&knodes[lastKnode[bid]]);
+		}
+
+		// process levels of the tree, one query of the batch after the other
+		for(i = 0; i < maxheight; i++){
+			for(bid = first; bid < last; bid++){
+
+				// same bound checks as kernel_cpu_2
+				n = &knodes[currKnode[bid]];
+				thid = knode_search(n, start[bid]);
+				if(n->indices[thid] < knodes_elem){
+					offset[bid] = n->indices[thid];
+				}
+
+				n = &knodes[lastKnode[bid]];
+				thid = knode_search(n, end[bid]);
+				if(n->indices[thid] < knodes_elem){
+					offset_2[bid] = n->indices[thid];
+				}
+
+				// set for next tree level
+				currKnode[bid] = offset[bid];
+				lastKnode[bid] = offset_2[bid];
+				knode_prefetch(&knodes[currKnode[bid]]);
+				knode_prefetch(&knodes[lastKnode[bid]]);
+
+			}
+		}
+
+		// process leaves
+		for(bid = first; bid < last; bid++){
+
+			// Find the index of the starting record
+			n = &knodes[currKnode[bid]];
+			thid = knode_search(n, start[bid]);
+			if(n->keys[thid] == start[bid]){
+				recstart[bid] = n->indices[thid];
+			}
+
+			// Find the index of the ending record
+			n = &knodes[lastKnode[bid]];
+			thid = knode_search(n, end[bid]);
+			if(n->keys[thid] == end[bid]){
+				reclength[bid] = n->indices[thid] - recstart[bid]+1;
+			}
+
+		}
+
+	}
+
+	time2 = get_time();
+
+	//======================================================================================================================================================150
+	//	DISPLAY TIMING
+	//======================================================================================================================================================150
+
+	printf("Time spent in different stages of CPU/MCPU SIMD (%s) KERNEL:\n", KNODE_SEARCH_ISA);
+
+	printf("%15.12f s, %15.12f %% : MCPU: SET DEVICE\n",					(float) (time1-time0) / 1000000, (float) (time1-time0) / (float) (time2-time0) * 100);
+	printf("%15.12f s, %15.12f %% : CPU/MCPU: KERNEL\n",					(float) (time2-time1) / 1000000, (float) (time2-time1) / (float) (time2-time0) * 100);
+
+	printf("Total time:\n");
+	printf("%.12f s\n", 												(float) (time2-time0) / 1000000);
+
+}
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
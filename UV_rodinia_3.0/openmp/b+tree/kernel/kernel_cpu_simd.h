@@ -0,0 +1,48 @@
+// #ifdef __cplusplus
+// extern "C" {
+// #endif
+
+//========================================================================================================================================================================================================200
+//	KERNEL_CPU_SIMD HEADER
+//========================================================================================================================================================================================================200
+
+void 
+kernel_cpu_simd(	int cores_arg,
+
+					record *records,
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					int *keys,
+					record *ans);
+
+void 
+kernel_cpu_2_simd(	int cores_arg,
+
+					knode *knodes,
+					long knodes_elem,
+
+					long maxheight,
+					int count,
+
+					long *currKnode,
+					long *offset,
+					long *lastKnode,
+					long *offset_2,
+					int *start,
+					int *end,
+					int *recstart,
+					int *reclength);
+
+//========================================================================================================================================================================================================200
+//	END
+//========================================================================================================================================================================================================200
+
+// #ifdef __cplusplus
+// }
+// #endif
@@ -0,0 +1,96 @@
+#ifndef KNODE_SEARCH_H
+#define KNODE_SEARCH_H
+
+// included after ../common.h (which has no include guard), like the other kernel headers
+
+//========================================================================================================================================================================================================200
+//	DEFINE/INCLUDE
+//========================================================================================================================================================================================================200
+
+//======================================================================================================================================================150
+//	LIBRARIES
+//======================================================================================================================================================150
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>								// (in directory known to compiler)			needed by AVX2/AVX-512 intrinsics
+#endif
+
+//======================================================================================================================================================150
+//	DEFINE
+//======================================================================================================================================================150
+
+// queries that each thread walks down the tree together, level by level, so that the node of the next level of a query
+// is prefetched while the nodes of the other queries of the batch are searched
+#define KNODE_BATCH 16
+
+// cache lines of the keys of a node that are prefetched for the next level, the scan of a node starts at keys[0]
+#define KNODE_PREFETCH_LINES 4
+
+#if defined(__AVX512F__)
+	#define KNODE_SEARCH_ISA "AVX-512"
+#elif defined(__AVX2__)
+	#define KNODE_SEARCH_ISA "AVX2"
+#else
+	#define KNODE_SEARCH_ISA "scalar"
+#endif
+
+//========================================================================================================================================================================================================200
+//	KNODE SEARCH
+//========================================================================================================================================================================================================200
+
+// returns the slot thid of knode n for which keys[thid] <= key < keys[thid+1], the one the kernels descend into (or
+// match at a leaf). keys[0] is INT_MIN and keys[num_keys-1] and the rest are INT_MAX (see transform_to_cuda), so for
+// key < INT_MAX the keys are scanned from the start, a vector at a time over the 64 byte aligned keys, and the scan
+// stops at the first vector holding a key greater than key: the number of keys before it that are <= key is the
+// count of trailing zeros of the greater-than mask. A vector never reads past the padding at the end of the knode.
+static inline int
+knode_search(	const knode *n,
+				int key)
+{
+
+#if defined(__AVX512F__)
+
+	__m512i k = _mm512_set1_epi32(key);
+	int j;
+	for(j = 0; ; j += 16){
+		unsigned int gt = _mm512_cmpgt_epi32_mask(_mm512_load_si512((const void *)&n->keys[j]), k);
+		if(gt){
+			return j + __builtin_ctz(gt) - 1;
+		}
+	}
+
+#elif defined(__AVX2__)
+
+	__m256i k = _mm256_set1_epi32(key);
+	int j;
+	for(j = 0; ; j += 8){
+		__m256i gt = _mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)&n->keys[j]), k);
+		unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(gt));
+		if(mask){
+			return j + __builtin_ctz(mask) - 1;
+		}
+	}
+
+#else
+
+	int j;
+	for(j = 1; n->keys[j] <= key; j++);
+	return j - 1;
+
+#endif
+
+}
+
+// prefetches the first KNODE_PREFETCH_LINES cache lines of the keys of knode n, those that its search reads first
+static inline void
+knode_prefetch(const knode *n)
+{
+
+	int l;
+	for(l = 0; l < KNODE_PREFETCH_LINES; l++){
+		__builtin_prefetch((const char *)n->keys + l*64, 0, 3);
+	}
+
+}
+
+#endif
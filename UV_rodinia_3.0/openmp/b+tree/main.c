@@ -33,6 +33,8 @@
 
 // EXAMPLE:
 // ./a.out -file ./input/mil.txt -cores 16
+// ./a.out -file ./input/mil.txt -cores 16 -batch 16 (k and j also run the batched kernels, 16 lookups in flight per core)
+// ./a.out -file ./input/mil.txt -cores 16 -bulk 90 (bulk load the knodes in parallel, 90% full, instead of inserting the keys one by one)
 // ...then enter any of the following commands after the prompt > :
 // f <x>  -- Find the value under key <x>
 // p <x> -- Print the path from the root to key k and its associated value
@@ -43,6 +45,8 @@
 // j <x> <y> -- Run a range search of <x> bundled queries on the CPU and GPU (B+Tree) with the range of each search of size <y>
 // x <z> -- Run a single search for value z on the GPU and CPU
 // y <a> <b> -- Run a single range search for range a-b on the GPU and CPU
+// u <x> -- Run <x> inserts of random values into the knodes, concurrently with <x> lookups (the records of the inserted keys are
+//          added after the others, so j gives record index differences, not range lengths, once they are in a range)
 // q -- Quit. (Or use Ctl-D.)
 
 //======================================================================================================================================================150
@@ -86,6 +90,10 @@
 
 #include "./kernel/kernel_cpu.h"					// (in directory provided here)
 #include "./kernel/kernel_cpu_2.h"					// (in directory provided here)
+#include "./kernel/kernel_cpu_simd.h"				// (in directory provided here)
+#include "./kernel/kernel_cpu_batch.h"				// (in directory provided here)
+#include "./kernel/kernel_cpu_load.h"				// (in directory provided here)
+#include "./kernel/kernel_cpu_insert.h"				// (in directory provided here)
 
 //======================================================================================================================================================150
 //	HEADER
@@ -109,6 +117,7 @@ long freeptr;
 long malloc_size;
 long size;
 long maxheight;
+knode_store kstore;
 
 /* The order determines the maximum and minimum
 * number of entries (keys and pointers) in any
@@ -628,12 +637,13 @@ list_reverse_iterator_is_valid(list_reverse_iterator_t *li)
 
 /*   */
 void *
-kmalloc(int size)
+kmalloc(long size)
 {
 
 	//printf("size: %d, current offset: %p\n",size,freeptr);
 	void * r = (void *)freeptr;
-	freeptr+=size;
+	// keep the next block (the knodes after the records) 64 byte aligned, for the aligned keys of the knodes
+	freeptr+=(size+63) & ~63;
 	if(freeptr > malloc_size+(long)mem){
 		printf("Memory Overflow\n");
 		exit(1);
@@ -651,17 +661,23 @@ transform_to_cuda(	node * root,
 	double time;
 	gettimeofday (&one, NULL);
 	long max_nodes = (long)(pow(order,log(size)/log(order/2.0)-1) + 1);
-	malloc_size = size*sizeof(record) + max_nodes*sizeof(knode); 
-	mem = (char*)malloc(malloc_size);
+	// room for the concurrent inserts (u command), as the bulk load leaves: the spare records, one split of every knode
+	// (max_nodes bounds the knodes) and the splits of the leaves the spare records fill; the pages stay untouched until used
+	long spare_records = KNODE_SPARE_RECORDS(size, order);
+	long spare_knodes = max_nodes + 2 * spare_records / (order - 1) + 1;
+	malloc_size = (size+spare_records)*sizeof(record) + 64 + (max_nodes+spare_knodes)*sizeof(knode); 
+	if(posix_memalign((void **)&mem, 64, malloc_size)){
+		mem = NULL;
+	}
 	if(mem==NULL){
 		printf("Initial malloc error\n");
 		exit(1);
 	}
 	freeptr = (long)mem;
 
-	krecords = (record * )kmalloc(size*sizeof(record));
+	krecords = (record * )kmalloc((size+spare_records)*sizeof(record));
 	// printf("%d records\n", size);
-	knodes = (knode *)kmalloc(max_nodes*sizeof(knode));
+	knodes = (knode *)kmalloc((max_nodes+spare_knodes)*sizeof(knode));
 	// printf("%d knodes\n", max_nodes);
 
 	queue = NULL;
@@ -679,6 +695,7 @@ transform_to_cuda(	node * root,
 		k = &knodes[queueindex];
 		k->location = queueindex++;
 		k->is_leaf = n->is_leaf;
+		k->version = 0;
 		k->num_keys = n->num_keys+2;
 		//start at 1 because 0 is set to INT_MIN
 		k->keys[0]=INT_MIN; 
@@ -730,7 +747,14 @@ transform_to_cuda(	node * root,
 			printf("\n\n");
 		}
 	}
-	long mem_used = size*sizeof(record)+(nodeindex)*sizeof(knode);
+	long mem_used = ((long)knodes - (long)mem)+(nodeindex)*sizeof(knode);
+	kstore.records = krecords;
+	kstore.records_used = recordindex;
+	kstore.records_max = size + spare_records;
+	kstore.knodes = knodes;
+	kstore.knodes_used = nodeindex;
+	kstore.knodes_max = max_nodes + spare_knodes;
+	kstore.order = order;
 	if(verbose){
 		for(i = 0; i < size; i++)
 			printf("%d ", krecords[i].value);
@@ -1847,6 +1871,8 @@ main(	int argc,
 	// assing default values
 	int cur_arg;
 	int cores_arg =1;
+	int batch_arg =0;
+	int bulk_arg =0;
 	char *input_file = NULL;
 	char *command_file = NULL;
 	char *output="output.txt";
@@ -1874,6 +1900,40 @@ main(	int argc,
 	      }
 	    }
 	  }
+	  // check if -batch
+	  else if(strcmp(argv[cur_arg], "batch")==0){
+	    // check if value provided
+	    if(argc>cur_arg+1 && isInteger(argv[cur_arg+1])==1){
+	      batch_arg = atoi(argv[cur_arg+1]);
+	      if(batch_arg<1 || batch_arg>KNODE_GROUP_MAX){
+		printf("ERROR: Wrong value to batch parameter, must be 1 to %d\n", KNODE_GROUP_MAX);
+		return -1;
+	      }
+	      cur_arg = cur_arg+1;
+	    }
+	    // value not provided or not a number
+	    else{
+	      printf("ERROR: Missing value to batch parameter\n");
+	      return -1;
+	    }
+	  }
+	  // check if -bulk
+	  else if(strcmp(argv[cur_arg], "bulk")==0){
+	    // check if value provided
+	    if(argc>cur_arg+1 && isInteger(argv[cur_arg+1])==1){
+	      bulk_arg = atoi(argv[cur_arg+1]);
+	      if(bulk_arg<1 || bulk_arg>100){
+		printf("ERROR: Wrong value to bulk parameter, must be a fill percentage of 1 to 100\n");
+		return -1;
+	      }
+	      cur_arg = cur_arg+1;
+	    }
+	    // value not provided or not a number
+	    else{
+	      printf("ERROR: Missing value to bulk parameter\n");
+	      return -1;
+	    }
+	  }
 	  // check if -file
 	  else if(strcmp(argv[cur_arg], "file")==0){
 	    // check if value provided
@@ -1957,6 +2017,8 @@ main(	int argc,
 	FILE *file_pointer;
 	node *root;
 	root = NULL;
+	int *bulk_keys = NULL;
+	long bulk_elem = 0;
 	record *r;
 	int input;
 	char instruction;
@@ -1985,10 +2047,23 @@ main(	int argc,
 		fscanf(file_pointer, "%d\n", &input);
 		size = input;
 
-		// save all numbers
-		while (!feof(file_pointer)) {
-			fscanf(file_pointer, "%d\n", &input);
-			root = insert(root, input, input);
+		// save all numbers, in the tree or, for the bulk load, in an array
+		long long time_build = get_time();
+		if(bulk_arg > 0){
+			bulk_keys = (int *)malloc((size > 0 ? size : 1)*sizeof(int));
+			while (bulk_elem < size && !feof(file_pointer)) {
+				if(fscanf(file_pointer, "%d\n", &input) != 1){
+					break;
+				}
+				bulk_keys[bulk_elem++] = input;
+			}
+		}
+		else{
+			while (!feof(file_pointer)) {
+				fscanf(file_pointer, "%d\n", &input);
+				root = insert(root, input, input);
+			}
+			printf("Tree build by inserts took %f\n", (get_time() - time_build) / 1000000.0);
 		}
 
 		// close file
@@ -2006,9 +2081,22 @@ main(	int argc,
 	// get tree statistics
 	// ------------------------------------------------------------60
 
-	printf("Transforming data to a GPU suitable structure...\n");
-	long mem_used = transform_to_cuda(root,0);
-	maxheight = height(root);
+	long mem_used;
+	if(bulk_arg > 0){
+		// the knodes directly, with no node tree (the commands on the node tree find it empty)
+		mem = kernel_cpu_bulk_load(cores_arg, bulk_keys, bulk_elem, order, bulk_arg, &kstore);
+		krecords = kstore.records;
+		knodes = kstore.knodes;
+		maxheight = kstore.maxheight;
+		mem_used = ((long)knodes - (long)mem) + kstore.knodes_used*sizeof(knode);
+		free(bulk_keys);
+	}
+	else{
+		printf("Transforming data to a GPU suitable structure...\n");
+		mem_used = transform_to_cuda(root,0);
+		maxheight = height(root);
+		kstore.maxheight = maxheight;
+	}
 	long rootLoc = (long)knodes - (long)mem;
 
 	// ------------------------------------------------------------60
@@ -2187,6 +2275,7 @@ main(	int argc,
 				}
 
 				// New OpenMP kernel, same algorighm across all versions(OpenMP, CUDA, OpenCL) for comparison purposes
+				long long time_kernel = get_time();
 				kernel_cpu(	cores_arg,
 
 							records,
@@ -2201,6 +2290,79 @@ main(	int argc,
 							offset,
 							keys,
 							ans);
+				time_kernel = get_time() - time_kernel;
+
+				// CPU native kernel (vector search of aligned keys, prefetch across a batch of queries), checked against the one above
+				memset(currKnode, 0, count*sizeof(long));
+				memset(offset, 0, count*sizeof(long));
+				record *ans_simd = (record *)malloc(sizeof(record)*count);
+				for(i = 0; i < count; i++){
+					ans_simd[i].value = -1;
+				}
+
+				long long time_simd = get_time();
+				kernel_cpu_simd(	cores_arg,
+
+									records,
+									knodes,
+									knodes_elem,
+
+									maxheight,
+									count,
+
+									currKnode,
+									offset,
+									keys,
+									ans_simd);
+				time_simd = get_time() - time_simd;
+
+				int mismatches = 0;
+				for(i = 0; i < count; i++){
+					if(ans_simd[i].value != ans[i].value){
+						mismatches++;
+					}
+				}
+				printf("SIMD kernel: %d of %d answers differ, %.3f ms vs %.3f ms, speedup %.2f\n",
+						mismatches, count, time_simd / 1000.0, time_kernel / 1000.0, (double)time_kernel / (time_simd > 0 ? time_simd : 1));
+				free(ans_simd);
+
+				// batched kernel, group lookups in flight per core, checked against the one above
+				if(batch_arg > 0){
+					memset(currKnode, 0, count*sizeof(long));
+					memset(offset, 0, count*sizeof(long));
+					record *ans_batch = (record *)malloc(sizeof(record)*count);
+					for(i = 0; i < count; i++){
+						ans_batch[i].value = -1;
+					}
+
+					long long time_batch = get_time();
+					kernel_cpu_batch(	cores_arg,
+										batch_arg,
+
+										records,
+										knodes,
+										knodes_elem,
+
+										maxheight,
+										count,
+
+										currKnode,
+										offset,
+										keys,
+										ans_batch);
+					time_batch = get_time() - time_batch;
+
+					mismatches = 0;
+					for(i = 0; i < count; i++){
+						if(ans_batch[i].value != ans[i].value){
+							mismatches++;
+						}
+					}
+					printf("BATCH kernel: %d of %d answers differ, %.3f ms vs %.3f ms, speedup %.2f\n",
+							mismatches, count, time_batch / 1000.0, time_kernel / 1000.0, (double)time_kernel / (time_batch > 0 ? time_batch : 1));
+					kernel_cpu_levels(knodes, knodes_elem, maxheight, count, keys);
+					free(ans_batch);
+				}
 
 				// Original OpenMP kernel, different algorithm
 				// int j;
@@ -2342,6 +2504,7 @@ main(	int argc,
 				}
 
 				// New kernel, same algorighm across all versions(OpenMP, CUDA, OpenCL) for comparison purposes
+				long long time_kernel = get_time();
 				kernel_cpu_2(	cores_arg,
 
 								knodes,
@@ -2359,6 +2522,88 @@ main(	int argc,
 								end,
 								recstart,
 								reclength);
+				time_kernel = get_time() - time_kernel;
+
+				// CPU native kernel (vector search of aligned keys, prefetch across a batch of queries), checked against the one above
+				memset (currKnode, 0, count*sizeof(long));
+				memset (offset, 0, count*sizeof(long));
+				memset (lastKnode, 0, count*sizeof(long));
+				memset (offset_2, 0, count*sizeof(long));
+				int *recstart_simd = (int *)malloc(count*sizeof(int));
+				memset (recstart_simd, 0, count*sizeof(int));
+				int *reclength_simd = (int *)malloc(count*sizeof(int));
+				memset (reclength_simd, 0, count*sizeof(int));
+
+				long long time_simd = get_time();
+				kernel_cpu_2_simd(	cores_arg,
+
+									knodes,
+									knodes_elem,
+
+									maxheight,
+									count,
+
+									currKnode,
+									offset,
+									lastKnode,
+									offset_2,
+									start,
+									end,
+									recstart_simd,
+									reclength_simd);
+				time_simd = get_time() - time_simd;
+
+				int mismatches = 0;
+				for(i = 0; i < count; i++){
+					if(recstart_simd[i] != recstart[i] || reclength_simd[i] != reclength[i]){
+						mismatches++;
+					}
+				}
+				printf("SIMD kernel: %d of %d ranges differ, %.3f ms vs %.3f ms, speedup %.2f\n",
+						mismatches, count, time_simd / 1000.0, time_kernel / 1000.0, (double)time_kernel / (time_simd > 0 ? time_simd : 1));
+
+				// batched kernel, group lookups in flight per core, checked against the one above
+				if(batch_arg > 0){
+					memset (currKnode, 0, count*sizeof(long));
+					memset (offset, 0, count*sizeof(long));
+					memset (lastKnode, 0, count*sizeof(long));
+					memset (offset_2, 0, count*sizeof(long));
+					memset (recstart_simd, 0, count*sizeof(int));
+					memset (reclength_simd, 0, count*sizeof(int));
+
+					long long time_batch = get_time();
+					kernel_cpu_2_batch(	cores_arg,
+										batch_arg,
+
+										knodes,
+										knodes_elem,
+
+										maxheight,
+										count,
+
+										currKnode,
+										offset,
+										lastKnode,
+										offset_2,
+										start,
+										end,
+										recstart_simd,
+										reclength_simd);
+					time_batch = get_time() - time_batch;
+
+					mismatches = 0;
+					for(i = 0; i < count; i++){
+						if(recstart_simd[i] != recstart[i] || reclength_simd[i] != reclength[i]){
+							mismatches++;
+						}
+					}
+					printf("BATCH kernel: %d of %d ranges differ, %.3f ms vs %.3f ms, speedup %.2f\n",
+							mismatches, count, time_batch / 1000.0, time_kernel / 1000.0, (double)time_kernel / (time_batch > 0 ? time_batch : 1));
+					// the levels of the starts, the ends take the same path down to the neighbour leaves
+					kernel_cpu_levels(knodes, knodes_elem, maxheight, count, start);
+				}
+				free(recstart_simd);
+				free(reclength_simd);
 
 				// Original [CPU] kernel, different algorithm
 				// int k;
@@ -2396,6 +2641,87 @@ main(	int argc,
 
 			}
 
+			// ----------------------------------------40
+			// [OpenMP] concurrent inserts and lookups (initU, updateK)
+			// ----------------------------------------40
+
+			case 'u':
+			{
+
+				// get # of inserts from user
+				int count;
+				sscanf(commandPointer, "%d", &count);
+				while(*commandPointer!=32 && commandPointer!='\n')
+				  commandPointer++;
+
+				printf("\n ******command: u count=%d \n",count);
+
+				// INPUT: keys to insert (half of them new for a tree of the keys 0..size-1) and keys to look up
+				int *keys = (int *)malloc(count*sizeof(int));
+				int *find = (int *)malloc(count*sizeof(int));
+				int i;
+				for(i = 0; i < count; i++){
+					keys[i] = (rand()/(float)RAND_MAX)*size*2;
+					find[i] = (rand()/(float)RAND_MAX)*size;
+				}
+
+				// OUTPUT: insert results and values found
+				int *status = (int *)malloc(count*sizeof(int));
+				int *found = (int *)malloc(count*sizeof(int));
+
+				kernel_cpu_update(	cores_arg,
+
+									&kstore,
+
+									count,
+									keys,
+									status,
+									find,
+									found);
+
+				// the new knodes are searched by the next commands
+				long knodes_used = kstore.knodes_used < kstore.knodes_max ? kstore.knodes_used : kstore.knodes_max;
+				mem_used = rootLoc + knodes_used*sizeof(knode);
+
+				// every key inserted (or in already) is found afterwards, and every lookup found its key or none
+				long restarts = 0;
+				int missing = 0;
+				int wrong = 0;
+				for(i = 0; i < count; i++){
+					int value = -1;
+					if(status[i] != KNODE_INSERT_FULL && (!knode_find_optimistic(&kstore, keys[i], &value, &restarts) || value != keys[i])){
+						missing++;
+					}
+					if(found[i] != -1 && found[i] != find[i]){
+						wrong++;
+					}
+				}
+				printf("UPDATE check: %d inserted keys missing, %d wrong lookups\n", missing, wrong);
+
+				pFile = fopen (output,"aw+");
+				if (pFile==NULL)
+				  {
+				    fputs ("Fail to open %s !\n",output);
+				  }
+
+				fprintf(pFile,"\n ******command: u count=%d \n",count);
+				for(i = 0; i < count; i++){
+				  fprintf(pFile, "%d    %d    %d    %d\n",i, keys[i], status[i], found[i]);
+				}
+				fprintf(pFile, " \n");
+				fclose(pFile);
+
+				// free memory
+				free(keys);
+				free(find);
+				free(status);
+				free(found);
+
+				// break out of case
+				break;
+
+			}
+
 			// ----------------------------------------40
 			// default
 			// ----------------------------------------40
@@ -3,6 +3,11 @@
 #include <math.h>
 #include <stdlib.h>
 #include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "csr_graph.h"
 //#define NUM_THREAD 4
 #define OPEN
 
@@ -17,11 +22,36 @@ struct Node
 	int no_of_edges;
 };
 
+//Compressed sparse row graph, the out edges of node i are edges[offsets[i]..offsets[i+1]), the in edges
+//(for the bottom-up steps) are in_edges[in_offsets[i]..in_offsets[i+1]). The arrays of a graph loaded from a binary CSR
+//file (see csr_graph.h) may point into its mapping, mapped is NULL otherwise
+struct CSRGraph
+{
+	int num_nodes;
+	int num_edges;
+	int *offsets;
+	int *edges;
+	int *in_offsets;
+	int *in_edges;
+	char *mapped;
+	size_t mapped_size;
+};
+
+//Direction-optimizing BFS (Beamer et al.): a top-down step expands the frontier queue, a bottom-up step lets every
+//unvisited node look for a parent in the frontier bitmap. Top-down switches to bottom-up when the edges out of the
+//frontier exceed 1/ALPHA of the edges out of the unvisited nodes, and back when the frontier shrinks below
+//num_nodes/BETA nodes
+#define BFS_ALPHA 14
+#define BFS_BETA 24
+#define BITS_PER_WORD ((int)(8*sizeof(unsigned long)))
+
 void BFSGraph(int argc, char** argv);
 
 void Usage(int argc, char**argv){
 
-fprintf(stderr,"Usage: %s <num_threads> <input_file>\n", argv[0]);
+fprintf(stderr,"Usage: %s <num_threads> <input_file> [-first-touch]\n", argv[0]);
+fprintf(stderr,"\tinput_file: a graph of the text format, or of the binary CSR format from graph2csr, which is mapped\n");
+fprintf(stderr,"\t-first-touch: copy the arrays of a binary CSR graph out of the mapping by the threads that traverse them\n");
 
 }
 ////////////////////////////////////////////////////////////////////////////////
@@ -36,6 +66,373 @@ int main( int argc, char** argv)
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// CSR graph and the direction-optimizing BFS engine
+////////////////////////////////////////////////////////////////////////////////
+
+//exclusive prefix sum of counts[0..n) into offsets[0..n], returns the total
+static long long PrefixSum(const int *counts, int *offsets, int n)
+{
+	int num_threads = omp_get_max_threads();
+	long long *partial = (long long*) calloc(num_threads+1, sizeof(long long));
+	long long total = 0;
+	#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int begin = (long long)n*t/nt, end = (long long)n*(t+1)/nt;
+		long long sum = 0;
+		for (int i = begin; i < end; i++) sum += counts[i];
+		partial[t+1] = sum;
+		#pragma omp barrier
+		#pragma omp single
+		{
+			for (int i = 1; i <= nt; i++) partial[i] += partial[i-1];
+			total = partial[nt];
+		}
+		sum = partial[t];
+		for (int i = begin; i < end; i++) {
+			offsets[i] = sum;
+			sum += counts[i];
+		}
+	}
+	offsets[n] = total;
+	free(partial);
+	return total;
+}
+
+static void BuildInEdges(CSRGraph *g);
+
+//build the CSR (out and in edges) from the Rodinia node array and edge list
+static void BuildCSR(CSRGraph *g, Node *nodes, int *edge_list, int num_nodes)
+{
+	g->num_nodes = num_nodes;
+	g->offsets = (int*) malloc(sizeof(int)*(num_nodes+1));
+	g->mapped = NULL;
+	g->mapped_size = 0;
+	int *degree = (int*) malloc(sizeof(int)*num_nodes);
+
+	#pragma omp parallel for
+	for (int i = 0; i < num_nodes; i++) degree[i] = nodes[i].no_of_edges;
+	g->num_edges = PrefixSum(degree, g->offsets, num_nodes);
+	g->edges = (int*) malloc(sizeof(int)*g->num_edges);
+
+	//the edges of a node are packed even if the node array leaves gaps in the edge list
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int i = 0; i < num_nodes; i++)
+		memcpy(&g->edges[g->offsets[i]], &edge_list[nodes[i].starting], sizeof(int)*nodes[i].no_of_edges);
+	free(degree);
+	BuildInEdges(g);
+}
+
+//build the in edges of g from its out edges
+static void BuildInEdges(CSRGraph *g)
+{
+	int num_nodes = g->num_nodes;
+	int *degree = (int*) malloc(sizeof(int)*num_nodes);
+	g->in_offsets = (int*) malloc(sizeof(int)*(num_nodes+1));
+	g->in_edges = (int*) malloc(sizeof(int)*g->num_edges);
+
+	#pragma omp parallel for
+	for (int i = 0; i < num_nodes; i++) degree[i] = 0;
+	#pragma omp parallel for
+	for (int e = 0; e < g->num_edges; e++) __sync_fetch_and_add(&degree[g->edges[e]], 1);
+	PrefixSum(degree, g->in_offsets, num_nodes);
+	#pragma omp parallel for
+	for (int i = 0; i < num_nodes; i++) degree[i] = g->in_offsets[i]; //the next free slot of the in edges of i
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int u = 0; u < num_nodes; u++)
+		for (int e = g->offsets[u]; e < g->offsets[u+1]; e++)
+			g->in_edges[__sync_fetch_and_add(&degree[g->edges[e]], 1)] = u;
+	free(degree);
+}
+
+//a copy of the size bytes at src in memory advised for huge pages, each page first touched by the thread that
+//traverses it with a static schedule
+static int* FirstTouchCopy(const int *src, long long count)
+{
+	size_t size = sizeof(int)*count;
+	void *dst = NULL;
+	if (posix_memalign(&dst, 2*1024*1024, size > 0 ? size : 1)) {
+		fprintf(stderr, "cannot allocate %zu bytes\n", size);
+		exit(1);
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(dst, size, MADV_HUGEPAGE);
+#endif
+	#pragma omp parallel for schedule(static)
+	for (long long i = 0; i < count; i++) ((int*)dst)[i] = src[i];
+	return (int*)dst;
+}
+
+//map a binary CSR graph file, the arrays point into the mapping (zero-copy), or are copied out of it by the threads
+//if first_touch. The in edges are built if the file has none. Returns false on error
+static bool LoadCSR(CSRGraph *g, const char *file, bool first_touch, int *source)
+{
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		printf("Error Reading graph file\n");
+		return false;
+	}
+	struct stat st;
+	CSRHeader header;
+	if (fstat(fd, &st) || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    memcmp(header.magic, CSR_MAGIC, sizeof(header.magic)) || header.version != CSR_VERSION ||
+	    header.num_nodes <= 0 || header.num_nodes >= 0x7fffffff || header.num_edges < 0 || header.num_edges >= 0x7fffffff ||
+	    header.source < 0 || header.source >= header.num_nodes) {
+		fprintf(stderr, "%s: not a binary CSR graph of version %d\n", file, CSR_VERSION);
+		close(fd);
+		return false;
+	}
+	CSRLayout layout;
+	CSRGetLayout(&header, &layout);
+	if (st.st_size < layout.size) {
+		fprintf(stderr, "%s: truncated, %lld bytes instead of %lld\n", file, (long long)st.st_size, layout.size);
+		close(fd);
+		return false;
+	}
+	char *mapped = (char*) mmap(NULL, layout.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+	//read ahead the whole file, and use huge pages where the file system supports them for the mapping
+	madvise(mapped, layout.size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	madvise(mapped, layout.size, MADV_HUGEPAGE);
+#endif
+
+	g->num_nodes = header.num_nodes;
+	g->num_edges = header.num_edges;
+	g->offsets = (int*)(mapped + layout.offsets);
+	g->edges = (int*)(mapped + layout.targets);
+	g->in_offsets = layout.in_offsets ? (int*)(mapped + layout.in_offsets) : NULL;
+	g->in_edges = layout.in_targets ? (int*)(mapped + layout.in_targets) : NULL;
+	g->mapped = mapped;
+	g->mapped_size = layout.size;
+	*source = header.source;
+
+	if (first_touch) {
+		g->offsets = FirstTouchCopy(g->offsets, g->num_nodes+1);
+		g->edges = FirstTouchCopy(g->edges, g->num_edges);
+		if (g->in_offsets) {
+			g->in_offsets = FirstTouchCopy(g->in_offsets, g->num_nodes+1);
+			g->in_edges = FirstTouchCopy(g->in_edges, g->num_edges);
+		}
+		munmap(mapped, layout.size);
+		g->mapped = NULL;
+		g->mapped_size = 0;
+	}
+	if (g->in_offsets == NULL) BuildInEdges(g);
+	return true;
+}
+
+//whether file starts with the magic of the binary CSR format
+static bool IsBinaryCSR(const char *file)
+{
+	char magic[8];
+	FILE *f = fopen(file, "rb");
+	if (!f) return false;
+	bool binary = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && !memcmp(magic, CSR_MAGIC, sizeof(magic));
+	fclose(f);
+	return binary;
+}
+
+//free an array of g unless it is in the mapping of the file
+static void FreeCSRArray(CSRGraph *g, int *array)
+{
+	if (g->mapped && (char*)array >= g->mapped && (char*)array < g->mapped + g->mapped_size) return;
+	free(array);
+}
+
+static void FreeCSR(CSRGraph *g)
+{
+	FreeCSRArray(g, g->offsets);
+	FreeCSRArray(g, g->edges);
+	FreeCSRArray(g, g->in_offsets);
+	FreeCSRArray(g, g->in_edges);
+	if (g->mapped) munmap(g->mapped, g->mapped_size);
+}
+
+//top-down step: expand frontier[0..frontier_size) into next, each thread fills a local queue and the local queues are
+//merged by a prefix sum of their sizes. Returns the size of next, *scanned is the number of edges examined and
+//*next_edges the out degree of next
+static int TopDownStep(CSRGraph *g, int *cost, int level, const int *frontier, int frontier_size, int *next,
+                       long long *scanned, long long *next_edges)
+{
+	int *local_count = (int*) calloc(omp_get_max_threads()+1, sizeof(int));
+	int next_size = 0;
+	long long edges = 0, degree = 0;
+	#pragma omp parallel reduction(+:edges, degree)
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int capacity = 1024, count = 0;
+		int *local = (int*) malloc(sizeof(int)*capacity);
+		#pragma omp for schedule(dynamic, 64) nowait
+		for (int f = 0; f < frontier_size; f++) {
+			int u = frontier[f];
+			for (int e = g->offsets[u]; e < g->offsets[u+1]; e++) {
+				int v = g->edges[e];
+				if (cost[v] < 0 && __sync_bool_compare_and_swap(&cost[v], -1, level+1)) {
+					if (count == capacity) {
+						capacity *= 2;
+						local = (int*) realloc(local, sizeof(int)*capacity);
+					}
+					local[count++] = v;
+					degree += g->offsets[v+1] - g->offsets[v];
+				}
+			}
+			edges += g->offsets[u+1] - g->offsets[u];
+		}
+		local_count[t+1] = count;
+		#pragma omp barrier
+		#pragma omp single
+		{
+			for (int i = 1; i <= nt; i++) local_count[i] += local_count[i-1];
+			next_size = local_count[nt];
+		}
+		memcpy(&next[local_count[t]], local, sizeof(int)*count);
+		free(local);
+	}
+	free(local_count);
+	*scanned = edges;
+	*next_edges = degree;
+	return next_size;
+}
+
+//bottom-up step: every unvisited node looks for a parent in the frontier bitmap and stops at the first one, the found
+//ones are set in next. Returns the number of nodes found, *scanned is the number of edges examined and *next_edges the
+//out degree of the found nodes
+static int BottomUpStep(CSRGraph *g, int *cost, int level, const unsigned long *frontier, unsigned long *next,
+                        long long *scanned, long long *next_edges)
+{
+	int num_words = (g->num_nodes + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	int found = 0;
+	long long edges = 0, degree = 0;
+	#pragma omp parallel for schedule(dynamic, 64) reduction(+:found, edges, degree)
+	for (int w = 0; w < num_words; w++) {
+		unsigned long bits = 0;
+		int last = (w+1)*BITS_PER_WORD < g->num_nodes ? (w+1)*BITS_PER_WORD : g->num_nodes;
+		for (int v = w*BITS_PER_WORD; v < last; v++) {
+			if (cost[v] >= 0) continue;
+			for (int e = g->in_offsets[v]; e < g->in_offsets[v+1]; e++) {
+				int u = g->in_edges[e];
+				edges++;
+				if ((frontier[u/BITS_PER_WORD] >> (u%BITS_PER_WORD)) & 1UL) {
+					cost[v] = level+1;
+					bits |= 1UL << (v%BITS_PER_WORD);
+					found++;
+					degree += g->offsets[v+1] - g->offsets[v];
+					break;
+				}
+			}
+		}
+		next[w] = bits; //a word of nodes is owned by one thread, no atomics needed
+	}
+	*scanned = edges;
+	*next_edges = degree;
+	return found;
+}
+
+static void QueueToBitmap(const int *queue, int size, unsigned long *bitmap, int num_words)
+{
+	#pragma omp parallel for
+	for (int w = 0; w < num_words; w++) bitmap[w] = 0;
+	#pragma omp parallel for
+	for (int i = 0; i < size; i++)
+		__sync_fetch_and_or(&bitmap[queue[i]/BITS_PER_WORD], 1UL << (queue[i]%BITS_PER_WORD));
+}
+
+//the set bits of bitmap in increasing order, merged from the per-thread ranges by a prefix sum
+static int BitmapToQueue(const unsigned long *bitmap, int num_words, int *queue)
+{
+	int *local_count = (int*) calloc(omp_get_max_threads()+1, sizeof(int));
+	int size = 0;
+	#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		int begin = (long long)num_words*t/nt, end = (long long)num_words*(t+1)/nt;
+		int count = 0;
+		for (int w = begin; w < end; w++) count += __builtin_popcountl(bitmap[w]);
+		local_count[t+1] = count;
+		#pragma omp barrier
+		#pragma omp single
+		{
+			for (int i = 1; i <= nt; i++) local_count[i] += local_count[i-1];
+			size = local_count[nt];
+		}
+		int pos = local_count[t];
+		for (int w = begin; w < end; w++) {
+			unsigned long bits = bitmap[w];
+			while (bits) {
+				queue[pos++] = w*BITS_PER_WORD + __builtin_ctzl(bits);
+				bits &= bits - 1;
+			}
+		}
+	}
+	free(local_count);
+	return size;
+}
+
+//BFS from source into cost (-1 for unreached nodes), printing the direction, frontier, edges examined and TEPS of each level
+static void BFSDirectionOptimizing(CSRGraph *g, int source, int *cost)
+{
+	int n = g->num_nodes;
+	int num_words = (n + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	int *queue = (int*) malloc(sizeof(int)*n);
+	int *next_queue = (int*) malloc(sizeof(int)*n);
+	unsigned long *bitmap = (unsigned long*) malloc(sizeof(unsigned long)*num_words);
+	unsigned long *next_bitmap = (unsigned long*) malloc(sizeof(unsigned long)*num_words);
+
+	queue[0] = source;
+	int frontier_size = 1, last_size = 0;
+	long long frontier_edges = g->offsets[source+1] - g->offsets[source]; //m_f, the out degree of the frontier
+	long long unexplored_edges = g->num_edges - frontier_edges;           //m_u, the out degree of the unvisited nodes
+	long long total_scanned = 0, traversed_edges = frontier_edges;
+	bool bottom_up = false;
+	int level = 0;
+
+	printf("level\tdirection\tfrontier\tedges\t\ttime(s)\t\tTEPS\n");
+	double start_bfs = omp_get_wtime();
+	while (frontier_size > 0) {
+		double start_level = omp_get_wtime();
+		if (!bottom_up && frontier_edges > unexplored_edges / BFS_ALPHA) {
+			bottom_up = true;
+			QueueToBitmap(queue, frontier_size, bitmap, num_words);
+		} else if (bottom_up && frontier_size < n / BFS_BETA && frontier_size < last_size) {
+			bottom_up = false;
+			BitmapToQueue(bitmap, num_words, queue);
+		}
+		last_size = frontier_size;
+		long long scanned;
+		if (bottom_up) {
+			frontier_size = BottomUpStep(g, cost, level, bitmap, next_bitmap, &scanned, &frontier_edges);
+			unsigned long *tmp = bitmap; bitmap = next_bitmap; next_bitmap = tmp;
+		} else {
+			frontier_size = TopDownStep(g, cost, level, queue, frontier_size, next_queue, &scanned, &frontier_edges);
+			int *tmp = queue; queue = next_queue; next_queue = tmp;
+		}
+		unexplored_edges -= frontier_edges;
+		traversed_edges += frontier_edges;
+		total_scanned += scanned;
+		double level_time = omp_get_wtime() - start_level;
+		printf("%d\t%s\t%d\t\t%lld\t\t%.6f\t%.3e\n", level, bottom_up ? "bottom-up" : "top-down ", last_size, scanned,
+		       level_time, level_time > 0 ? scanned / level_time : 0.0);
+		level++;
+	}
+	double bfs_time = omp_get_wtime() - start_bfs;
+	printf("%d levels, %lld edges examined, %lld edges in the traversed component, %.3e TEPS\n", level, total_scanned,
+	       traversed_edges, bfs_time > 0 ? traversed_edges / bfs_time : 0.0);
+
+	free(queue);
+	free(next_queue);
+	free(bitmap);
+	free(next_bitmap);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //Apply BFS on a Graph using CUDA
 ////////////////////////////////////////////////////////////////////////////////
@@ -44,15 +441,40 @@ void BFSGraph( int argc, char** argv)
     char *input_f;
 	int	 num_omp_threads;
 	
-	if(argc!=3){
+	if((argc!=3 && argc!=4) || (argc==4 && strcmp(argv[3], "-first-touch"))){
 	Usage(argc, argv);
 	exit(0);
 	}
     
 	num_omp_threads = atoi(argv[1]);
 	input_f = argv[2];
-	
+	bool first_touch = argc == 4;
+#ifdef OPEN
+	omp_set_num_threads(num_omp_threads);
+#endif
+
+	int source = 0;
+	Node* h_graph_nodes;
+	int* h_graph_edges;
+	CSRGraph graph;
+	bool binary = IsBinaryCSR(input_f);
+
 	printf("Reading File\n");
+	double start_read = omp_get_wtime();
+	if (binary) {
+		//the binary CSR graph is mapped, the edge list of the legacy BFS is the one of the CSR
+		if (!LoadCSR(&graph, input_f, first_touch, &source))
+			return;
+		no_of_nodes = graph.num_nodes;
+		edge_list_size = graph.num_edges;
+		h_graph_nodes = (Node*) malloc(sizeof(Node)*no_of_nodes);
+		#pragma omp parallel for
+		for (int i = 0; i < no_of_nodes; i++) {
+			h_graph_nodes[i].starting = graph.offsets[i];
+			h_graph_nodes[i].no_of_edges = graph.offsets[i+1] - graph.offsets[i];
+		}
+		h_graph_edges = graph.edges;
+	} else {
 	//Read in Graph from a file
 	fp = fopen(input_f,"r");
 	if(!fp)
@@ -61,15 +483,10 @@ void BFSGraph( int argc, char** argv)
 		return;
 	}
 
-	int source = 0;
-
 	fscanf(fp,"%d",&no_of_nodes);
    
 	// allocate host memory
-	Node* h_graph_nodes = (Node*) malloc(sizeof(Node)*no_of_nodes);
-	bool *h_graph_mask = (bool*) malloc(sizeof(bool)*no_of_nodes);
-	bool *h_updating_graph_mask = (bool*) malloc(sizeof(bool)*no_of_nodes);
-	bool *h_graph_visited = (bool*) malloc(sizeof(bool)*no_of_nodes);
+	h_graph_nodes = (Node*) malloc(sizeof(Node)*no_of_nodes);
 
 	int start, edgeno;   
 	// initalize the memory
@@ -78,23 +495,16 @@ void BFSGraph( int argc, char** argv)
 		fscanf(fp,"%d %d",&start,&edgeno);
 		h_graph_nodes[i].starting = start;
 		h_graph_nodes[i].no_of_edges = edgeno;
-		h_graph_mask[i]=false;
-		h_updating_graph_mask[i]=false;
-		h_graph_visited[i]=false;
 	}
 
 	//read the source node from the file
 	fscanf(fp,"%d",&source);
 	// source=0; //tesing code line
 
-	//set the source node as true in the mask
-	h_graph_mask[source]=true;
-	h_graph_visited[source]=true;
-
 	fscanf(fp,"%d",&edge_list_size);
 
 	int id,cost;
-	int* h_graph_edges = (int*) malloc(sizeof(int)*edge_list_size);
+	h_graph_edges = (int*) malloc(sizeof(int)*edge_list_size);
 	for(int i=0; i < edge_list_size ; i++)
 	{
 		fscanf(fp,"%d",&id);
@@ -104,7 +514,25 @@ void BFSGraph( int argc, char** argv)
 
 	if(fp)
 		fclose(fp);    
-	
+	}
+	printf("Graph read in %.6f s\n", omp_get_wtime() - start_read);
+
+#ifdef BFS_LEGACY
+	//the masks of the level synchronous scan, the CSR BFS has its own frontier and marks the visited nodes in the cost
+	bool *h_graph_mask = (bool*) malloc(sizeof(bool)*no_of_nodes);
+	bool *h_updating_graph_mask = (bool*) malloc(sizeof(bool)*no_of_nodes);
+	bool *h_graph_visited = (bool*) malloc(sizeof(bool)*no_of_nodes);
+	for (int i = 0; i < no_of_nodes; i++)
+	{
+		h_graph_mask[i]=false;
+		h_updating_graph_mask[i]=false;
+		h_graph_visited[i]=false;
+	}
+
+	//set the source node as true in the mask
+	h_graph_mask[source]=true;
+	h_graph_visited[source]=true;
+#endif
 	
 	// allocate mem for the result on host side
 	int* h_cost = (int*) malloc( sizeof(int)*no_of_nodes);
@@ -112,8 +540,20 @@ void BFSGraph( int argc, char** argv)
 		h_cost[i]=-1;
 	h_cost[source]=0;
 	
+#ifndef BFS_LEGACY
+	if (!binary) {
+		double start_csr = omp_get_wtime();
+		BuildCSR(&graph, h_graph_nodes, h_graph_edges, no_of_nodes);
+		printf("CSR built in %.6f s\n", omp_get_wtime() - start_csr);
+	}
+#endif
+
 	printf("Start traversing the tree\n");
 	double start_timer = omp_get_wtime();
+#ifndef BFS_LEGACY
+	BFSDirectionOptimizing(&graph, source, h_cost);
+#else
+	//the level synchronous scan of all the nodes in every level, compile with -DBFS_LEGACY for a comparison
 	int k=0;
     
 	bool stop;
@@ -154,6 +594,7 @@ void BFSGraph( int argc, char** argv)
 		k++;
 	}
 	while(stop);
+#endif
 	
 	double end_timer = omp_get_wtime();
 	printf("%.8f",(end_timer-start_timer));
@@ -167,11 +608,18 @@ void BFSGraph( int argc, char** argv)
 
 	// cleanup memory
 	free( h_graph_nodes);
-	free( h_graph_edges);
+	if (!binary)
+		free( h_graph_edges);
+	free( h_cost);
+#ifndef BFS_LEGACY
+	FreeCSR(&graph);
+#else
 	free( h_graph_mask);
 	free( h_updating_graph_mask);
 	free( h_graph_visited);
-	free( h_cost);
+	if (binary)
+		FreeCSR(&graph);
+#endif
 
 }
 
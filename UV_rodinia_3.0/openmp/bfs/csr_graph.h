@@ -0,0 +1,69 @@
+#ifndef CSR_GRAPH_H
+#define CSR_GRAPH_H
+
+//Binary CSR graph file, written by graph2csr from the text format and mapped by bfs without parsing or copying.
+//A 64 byte header is followed by the sections below, each starting at a multiple of CSR_ALIGNMENT bytes (a page) so
+//they can be mapped, advised and first-touched separately. All the arrays are int32 in the byte order of the machine.
+//	offsets[num_nodes+1]		the out edges of node i are targets[offsets[i]..offsets[i+1])
+//	targets[num_edges]
+//	in_offsets[num_nodes+1]		if CSR_HAS_IN_EDGES, the transposed graph (in edges) for the bottom-up BFS steps
+//	in_targets[num_edges]
+//	weights[num_edges]		if CSR_HAS_WEIGHTS, the edge costs of the text format, in the order of targets
+
+#define CSR_MAGIC "RODCSR\0"
+#define CSR_VERSION 1
+#define CSR_ALIGNMENT 4096
+#define CSR_HAS_IN_EDGES 0x1
+#define CSR_HAS_WEIGHTS 0x2
+
+struct CSRHeader
+{
+	char magic[8];
+	int version;
+	int flags;
+	long long num_nodes;
+	long long num_edges;
+	long long source;
+	char reserved[24];
+};
+
+//the file positions of the sections of a header, 0 for those not in the file, and the file size
+struct CSRLayout
+{
+	long long offsets;
+	long long targets;
+	long long in_offsets;
+	long long in_targets;
+	long long weights;
+	long long size;
+};
+
+static inline long long CSRAlign(long long pos)
+{
+	return (pos + CSR_ALIGNMENT - 1) / CSR_ALIGNMENT * CSR_ALIGNMENT;
+}
+
+static inline void CSRGetLayout(const CSRHeader *header, CSRLayout *layout)
+{
+	long long offsets_size = sizeof(int) * (header->num_nodes + 1);
+	long long targets_size = sizeof(int) * header->num_edges;
+	long long pos = CSRAlign(sizeof(CSRHeader));
+	layout->offsets = pos;
+	pos = CSRAlign(pos + offsets_size);
+	layout->targets = pos;
+	pos = CSRAlign(pos + targets_size);
+	layout->in_offsets = layout->in_targets = layout->weights = 0;
+	if (header->flags & CSR_HAS_IN_EDGES) {
+		layout->in_offsets = pos;
+		pos = CSRAlign(pos + offsets_size);
+		layout->in_targets = pos;
+		pos = CSRAlign(pos + targets_size);
+	}
+	if (header->flags & CSR_HAS_WEIGHTS) {
+		layout->weights = pos;
+		pos = CSRAlign(pos + targets_size);
+	}
+	layout->size = pos;
+}
+
+#endif
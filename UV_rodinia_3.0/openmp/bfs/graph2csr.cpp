@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "csr_graph.h"
+
+//Converts a graph of the text format of bfs (the number of nodes, "starting no_of_edges" of each node, the source, the
+//number of edges and "id cost" of each edge) into the binary CSR format of csr_graph.h, with the in edges and
+//optionally the edge costs as weights
+
+void Usage(int argc, char**argv){
+
+fprintf(stderr,"Usage: %s <input_file> <output_file> [-w]\n", argv[0]);
+fprintf(stderr,"\t-w: keep the edge costs as weights\n");
+
+}
+
+//buffered reader of the non-negative integers of a text file, much faster than fscanf for big graphs
+struct Reader
+{
+	FILE *fp;
+	char buffer[1<<20];
+	size_t pos, len;
+};
+
+static int ReadChar(Reader *r)
+{
+	if (r->pos == r->len) {
+		r->len = fread(r->buffer, 1, sizeof(r->buffer), r->fp);
+		r->pos = 0;
+		if (r->len == 0) return EOF;
+	}
+	return r->buffer[r->pos++];
+}
+
+static bool ReadInt(Reader *r, long long *value)
+{
+	int c = ReadChar(r);
+	while (c != EOF && (c < '0' || c > '9') && c != '-') c = ReadChar(r);
+	if (c == EOF) return false;
+	bool negative = c == '-';
+	if (negative) c = ReadChar(r);
+	long long v = 0;
+	while (c >= '0' && c <= '9') {
+		v = v*10 + (c - '0');
+		c = ReadChar(r);
+	}
+	*value = negative ? -v : v;
+	return true;
+}
+
+//write size bytes of data and pad the file to pos, a multiple of CSR_ALIGNMENT
+static bool WriteSection(FILE *fp, const void *data, long long size, long long pos)
+{
+	static const char zeros[CSR_ALIGNMENT] = {0};
+	if (size > 0 && fwrite(data, 1, size, fp) != (size_t)size) return false;
+	long long pad = CSRAlign(ftell(fp)) - ftell(fp);
+	if (pad > 0 && fwrite(zeros, 1, pad, fp) != (size_t)pad) return false;
+	return ftell(fp) == CSRAlign(pos);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "-w"))) {
+		Usage(argc, argv);
+		exit(1);
+	}
+	bool weights = argc == 4;
+
+	Reader *r = (Reader*) malloc(sizeof(Reader));
+	r->fp = fopen(argv[1], "r");
+	r->pos = r->len = 0;
+	if (!r->fp) {
+		printf("Error Reading graph file\n");
+		exit(1);
+	}
+
+	long long n, m, source, start, degree, id, cost;
+	if (!ReadInt(r, &n) || n <= 0 || n >= 0x7fffffff) {
+		fprintf(stderr, "%s: bad number of nodes\n", argv[1]);
+		exit(1);
+	}
+	long long *starting = (long long*) malloc(sizeof(long long)*n);
+	int *offsets = (int*) malloc(sizeof(int)*(n+1));
+	long long total = 0;
+	for (long long i = 0; i < n; i++) {
+		if (!ReadInt(r, &start) || !ReadInt(r, &degree)) {
+			fprintf(stderr, "%s: truncated node list\n", argv[1]);
+			exit(1);
+		}
+		if (start < 0 || degree < 0 || degree >= 0x7fffffff) {
+			fprintf(stderr, "%s: bad start or degree of node %lld\n", argv[1], i);
+			exit(1);
+		}
+		starting[i] = start;
+		offsets[i] = total;
+		total += degree;
+		if (total >= 0x7fffffff) {
+			fprintf(stderr, "%s: more than 2^31 edges are not supported\n", argv[1]);
+			exit(1);
+		}
+	}
+	offsets[n] = total;
+	if (!ReadInt(r, &source) || !ReadInt(r, &m) || source < 0 || source >= n || m < 0 || m >= 0x7fffffff) {
+		fprintf(stderr, "%s: bad source or number of edges\n", argv[1]);
+		exit(1);
+	}
+	int *edge_list = (int*) malloc(sizeof(int)*m);
+	int *cost_list = weights ? (int*) malloc(sizeof(int)*m) : NULL;
+	for (long long i = 0; i < m; i++) {
+		if (!ReadInt(r, &id) || !ReadInt(r, &cost) || id < 0 || id >= n) {
+			fprintf(stderr, "%s: bad edge %lld\n", argv[1], i);
+			exit(1);
+		}
+		edge_list[i] = id;
+		if (weights) cost_list[i] = cost;
+	}
+	fclose(r->fp);
+	free(r);
+
+	//pack the edges of the nodes in order, the text format allows gaps or a different order in the edge list
+	int *targets = (int*) malloc(sizeof(int)*total);
+	int *edge_weights = weights ? (int*) malloc(sizeof(int)*total) : NULL;
+	for (long long i = 0; i < n; i++) {
+		long long deg = offsets[i+1] - offsets[i];
+		if (starting[i] < 0 || starting[i] + deg > m) {
+			fprintf(stderr, "%s: the edges of node %lld are out of the edge list\n", argv[1], i);
+			exit(1);
+		}
+		memcpy(&targets[offsets[i]], &edge_list[starting[i]], sizeof(int)*deg);
+		if (weights) memcpy(&edge_weights[offsets[i]], &cost_list[starting[i]], sizeof(int)*deg);
+	}
+	free(starting);
+	free(edge_list);
+	free(cost_list);
+
+	//the transposed graph by a counting sort of the targets
+	int *in_offsets = (int*) calloc(n+1, sizeof(int));
+	int *in_targets = (int*) malloc(sizeof(int)*total);
+	for (long long e = 0; e < total; e++) in_offsets[targets[e]+1]++;
+	for (long long i = 0; i < n; i++) in_offsets[i+1] += in_offsets[i];
+	int *next = (int*) malloc(sizeof(int)*n);
+	memcpy(next, in_offsets, sizeof(int)*n);
+	for (long long u = 0; u < n; u++)
+		for (int e = offsets[u]; e < offsets[u+1]; e++) in_targets[next[targets[e]]++] = u;
+	free(next);
+
+	CSRHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CSR_MAGIC, sizeof(header.magic));
+	header.version = CSR_VERSION;
+	header.flags = CSR_HAS_IN_EDGES | (weights ? CSR_HAS_WEIGHTS : 0);
+	header.num_nodes = n;
+	header.num_edges = total;
+	header.source = source;
+	CSRLayout layout;
+	CSRGetLayout(&header, &layout);
+
+	FILE *fpo = fopen(argv[2], "wb");
+	if (!fpo) {
+		fprintf(stderr, "cannot open %s for writing\n", argv[2]);
+		exit(1);
+	}
+	long long offsets_size = sizeof(int)*(n+1), targets_size = sizeof(int)*total;
+	bool ok = WriteSection(fpo, &header, sizeof(header), layout.offsets) &&
+	          WriteSection(fpo, offsets, offsets_size, layout.offsets + offsets_size) &&
+	          WriteSection(fpo, targets, targets_size, layout.targets + targets_size) &&
+	          WriteSection(fpo, in_offsets, offsets_size, layout.in_offsets + offsets_size) &&
+	          WriteSection(fpo, in_targets, targets_size, layout.in_targets + targets_size) &&
+	          (!weights || WriteSection(fpo, edge_weights, targets_size, layout.weights + targets_size));
+	if (fclose(fpo) || !ok) {
+		fprintf(stderr, "error writing %s\n", argv[2]);
+		exit(1);
+	}
+	printf("%s: %lld nodes, %lld edges, source %lld, %lld bytes%s\n", argv[2], n, total, source, layout.size,
+	       weights ? ", with weights" : "");
+
+	free(offsets);
+	free(targets);
+	free(in_offsets);
+	free(in_targets);
+	free(edge_weights);
+	return 0;
+}
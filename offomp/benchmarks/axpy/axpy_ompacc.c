@@ -68,6 +68,24 @@ struct OUT__3__5904__other_args {
 	REAL *y;
 };
 
+struct OUT__3__5904__team_args {
+	REAL a;
+	REAL *x;
+	REAL *y;
+};
+
+/* the loop body for a sub-range, run by the team of a host device */
+static void OUT__3__5904__team_body(long start_n, long length_n, void *args) {
+	struct OUT__3__5904__team_args * targs = (struct OUT__3__5904__team_args*) args;
+	REAL a = targs->a;
+	REAL * x = targs->x;
+	REAL * y = targs->y;
+	long i;
+	for (i=start_n; i<start_n + length_n; i++) {
+		y[i] += a*x[i];
+	}
+}
+
 /* called by the helper thread */
 void OUT__3__5904__launcher (omp_offloading_t * off, void *args) {
     struct OUT__3__5904__other_args * iargs = (struct OUT__3__5904__other_args*) args; 
@@ -103,12 +121,8 @@ void OUT__3__5904__launcher (omp_offloading_t * off, void *args) {
 	} else
 #endif
 	if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
-		int i;
-//#pragma omp parallel for shared(y, x, a, start_n, length_n) private(i)
-		for (i=start_n; i<start_n + length_n; i++) {
-			y[i] += a*x[i];
-//			printf("x[%d]: %f, y[%d]: %f\n", i, x[i], i, y[i]);
-		}
+		struct OUT__3__5904__team_args targs = {a, x, y};
+		omp_dev_team_for(off->dev, start_n, length_n, 0, OUT__3__5904__team_body, &targs);
 	} else {
 		fprintf(stderr, "device type is not supported for this call\n");
 		abort();
@@ -134,6 +148,7 @@ double axpy_ompacc_mdev(REAL *x, REAL *y,  long n,REAL a) {
 	omp_offloading_info_t *__off_info__ = omp_offloading_init_info("axpy kernel", __top__, 1, OMP_OFFLOADING_DATA_CODE,
 																   __num_maps__, OUT__3__5904__launcher, &args, 1);
 	omp_offloading_append_profile_per_iteration(__off_info__, 2, 1, 1);
+	omp_offloading_set_pipeline_chunks(__off_info__, 4); /* the kernel only touches x[i] and y[i] of its own iterations */
 
 	omp_data_map_info_t *__x_map_info__ = &__off_info__->data_map_info[0];
 	omp_data_map_init_info("x", __x_map_info__, __off_info__, x, 1, sizeof(REAL), OMP_DATA_MAP_TO, OMP_DATA_MAP_AUTO);
@@ -154,6 +169,11 @@ double axpy_ompacc_mdev(REAL *x, REAL *y,  long n,REAL a) {
 		omp_data_map_dist_align_with_loop(__x_map_info__, 0, 0, __off_info__, 0);
 		omp_data_map_dist_align_with_loop(__y_map_info__, 0, 0, __off_info__, 0);
 		printf("version 4: AUTO dist policy for loop, and x and y align with loop dist\n");
+	} else if (axpy_mdev_v == 5 || axpy_mdev_v == 6) { /* version 5 and 6 */
+		omp_loop_dist_init_info(__off_info__, 0, axpy_mdev_v == 5 ? OMP_DIST_POLICY_DYNAMIC : OMP_DIST_POLICY_GUIDED, 0, n, 0);
+		omp_data_map_dist_align_with_loop(__x_map_info__, 0, 0, __off_info__, 0);
+		omp_data_map_dist_align_with_loop(__y_map_info__, 0, 0, __off_info__, 0);
+		printf("version %d: %s dist policy for loop, and x and y align with loop dist\n", axpy_mdev_v, axpy_mdev_v == 5 ? "DYNAMIC" : "GUIDED");
 	} else { /* default, version 2, block */
 		omp_data_map_dist_init_info(__x_map_info__, 0, OMP_DIST_POLICY_BLOCK, 0, n, 0);
 		omp_data_map_dist_init_info(__y_map_info__, 0, OMP_DIST_POLICY_BLOCK, 0, n, 0);
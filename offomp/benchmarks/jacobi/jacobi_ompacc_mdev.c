@@ -518,7 +518,6 @@ struct OUT__1__10550__args {
 	REAL b;
 	REAL omega;
 	REAL resid;
-	REAL *error;
 
 	REAL * u;
 	REAL * uold;
@@ -534,7 +533,7 @@ void OUT__1__10550__launcher(omp_offloading_t * off, void *args) {
     REAL ay = iargs->ay;
     REAL b = iargs->b;
     REAL omega = iargs->omega;
-	REAL error = iargs->error[off->devseqid];
+	REAL error = 0.0;
 	REAL resid = iargs->resid;
 
     omp_data_map_t * map_f = omp_map_get_map(off, iargs->f, -1); /* 0 is for the map f, here we use -1 so it will search the offloading stack */
@@ -605,10 +604,8 @@ void OUT__1__10550__launcher(omp_offloading_t * off, void *args) {
 		int threads_per_team = omp_get_optimal_threads_per_team(off->dev);
 		int teams_per_league = omp_get_optimal_teams_per_league(off->dev, threads_per_team, n*m);
 
-		/* for reduction operation */
-		REAL * _dev_per_block_error = (REAL*)omp_map_malloc_dev(off->dev, teams_per_league * sizeof(REAL));
-		//printf("dev: %d teams per league, err block mem: %X\n", teams_per_league, _dev_per_block_error);
-		REAL _host_per_block_error[teams_per_league];
+		/* for reduction operation, the runtime copies back and combines the per-block errors after the kernel */
+		REAL * _dev_per_block_error = (REAL*)omp_offloading_reduction_dev_blocks(off, 0, teams_per_league);
 		//printf("%d device: original offset: %d, mapped_offset: %d, length: %d\n", __i__, offset_n, start_n, length_n);
 		/* Launch CUDA kernel ... */
 		/** since here we do the same mapping, so will reuse the _threads_per_block and _num_blocks */
@@ -616,15 +613,6 @@ void OUT__1__10550__launcher(omp_offloading_t * off, void *args) {
 				off->stream->systream.cudaStream>>>(n, m,
 				omega, ax, ay, b, (REAL*)u, (REAL*)f, (REAL*)uold,uold_1_length, uold_0_offset, uold_1_offset, i_start, j_start, _dev_per_block_error);
 
-		/* copy back the results of reduction in blocks */
-		//printf("copy back reduced error: %X <-- %X\n", _host_per_block_error, _dev_per_block_error);
-		omp_map_memcpy_from_async(_host_per_block_error, _dev_per_block_error, off->dev, sizeof(REAL)*teams_per_league, off->stream);
-		omp_stream_sync(off->stream);
-
-		iargs->error[off->devseqid] = xomp_beyond_block_reduction_float(_host_per_block_error, teams_per_league, XOMP_REDUCTION_PLUS);
-		//cudaStreamAddCallback(__dev_stream__[__i__].systream.cudaStream, xomp_beyond_block_reduction_float_stream_callback, args, 0);
-		omp_map_free_dev(off->dev, _dev_per_block_error);
-
 	} else
 #endif
 	if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
@@ -650,7 +638,7 @@ void OUT__1__10550__launcher(omp_offloading_t * off, void *args) {
 				error = error + resid * resid;
 			}
 		}
-		iargs->error[off->devseqid] = error;
+		*(REAL*)omp_offloading_reduction_partial(off, 0) += error;
 
 	} else {
 		fprintf(stderr, "device type is not supported for this call\n");
@@ -839,13 +827,14 @@ loop1:for (i=0;i<n;i++) {
 	__jacobi_off_info__.offloadings = __offs_2__;	  	/* we use universal args and launcher because axpy can do it */
 	struct OUT__1__10550__args args_2;
 	args_2.n = n; args_2.m = m; args_2.ax = ax; args_2.ay = ay; args_2.b = b; args_2.omega = omega;args_2.u = (REAL*)u_p; args_2.uold = (REAL*)uold; args_2.f = (REAL*) f_p;
-	REAL __reduction_error__[__num_target_devices__]; args_2.error = __reduction_error__;
 
 	__jacobi_off_info__.per_iteration_profile.num_fp_operations = 13*m;
 	__jacobi_off_info__.per_iteration_profile.num_load = 7;
 	__jacobi_off_info__.per_iteration_profile.num_store = 1;
 	omp_dist_info_t __jacobi_off_loop_dist__[1];
 	omp_offloading_init_info("jacobi kernel", &__top__, 1, OMP_OFFLOADING_CODE, 0, OUT__1__10550__launcher, &args_2, 1);
+	/* reduction(+:error), REAL is float */
+	omp_offloading_append_reduction(&__jacobi_off_info__, &error, OMP_REDUCTION_FLOAT, OMP_REDUCTION_PLUS);
 
   	/* f map info */
   	omp_data_map_info_t * __info__ = &__data_map_infos__[0];
@@ -986,23 +975,26 @@ loop1:for (i=0;i<n;i++) {
 	omp_offloading_start(&__copy_data_off_info__, 0);
 	//printf("data copied\n");
 
+	/* Copy new solution into old for the first iteration */
+	omp_offloading_handle_t __uuold_exchange_handle__ = omp_offloading_start_async(&__uuold_exchange_off_info__, 0, NULL, 0);
 	while ((k <= mits) && (error > tol)) {
 		error = 0.0;
-		/* Copy new solution into old */
-		omp_offloading_start(&__uuold_exchange_off_info__, 0);
 
 #if defined (STANDALONE_DATA_X)
 		/** option 2 halo exchange */
 		//printf("----- u <-> uold halo exchange, k: %d, off_info: %X\n", k, &__uuold_exchange_off_info__);
-	  	omp_offloading_start(&uuold_halo_x_off_info);
+		__uuold_exchange_handle__ = omp_offloading_start_async(&uuold_halo_x_off_info, 0, &__uuold_exchange_handle__, 1);
 #endif
 		//printf("u->uold exchanged: %d\n", k);
 		/* jacobi */
-		omp_offloading_start(&__jacobi_off_info__, 0);
-		int __i__;
-		for (__i__ = 0; __i__ < __num_target_devices__;__i__++) {
-			error += __reduction_error__[__i__];
-		}
+		omp_offloading_handle_t __jacobi_handle__ = omp_offloading_start_async(&__jacobi_off_info__, 0, &__uuold_exchange_handle__, 1);
+		omp_offloading_wait(__jacobi_handle__);
+		omp_offloading_wait(__uuold_exchange_handle__);
+
+		/* Copy new solution into old for the next iteration (nowait), so the devices work on it while the host
+		 * computes the residual below. If the loop exits after this iteration, the copy is harmless since u is not changed */
+		__uuold_exchange_handle__ = omp_offloading_start_async(&__uuold_exchange_off_info__, 0, NULL, 0);
+		/* error is combined from the devices by the runtime once the jacobi offloading completes */
 
 		/* Error check */
 #if 0
@@ -1013,6 +1005,7 @@ loop1:for (i=0;i<n;i++) {
 		k = (k + 1);
 		/*  End iteration loop */
 	}
+	omp_offloading_wait(__uuold_exchange_handle__);
 	/* copy back u from each device and free others */
 	omp_offloading_start(&__copy_data_off_info__, 1);
 	compl_time = read_timer_ms();
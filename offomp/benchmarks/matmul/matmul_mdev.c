@@ -201,22 +201,22 @@ int main(int argc, char *argv[]) {
     double seq_elapsed;
     double ompacc_elapsed;
     if (argc < 2) {
-        fprintf(stderr, "Usage: matmul <n> [dist_dim(1|2|3)] [dist_policy(1|2|3)]\\n");
+        fprintf(stderr, "Usage: matmul <n> [dist_dim(1|2|3)] [dist_policy(1|2|3|4|5)]\\n");
         fprintf(stderr, "\tn: matrix size (nxn)\n");
         fprintf(stderr, "\tdist_dim: 1: row dist; 2: column dist; 3: both row/column dist; default 1\n");
-        fprintf(stderr, "\tdist_policy: 1: block_block; 2: block_align; 3: auto_align; default 1\n");
+        fprintf(stderr, "\tdist_policy: 1: block_block; 2: block_align; 3: auto_align; 4: dynamic_align; 5: guided_align (row dist only); default 1\n");
         exit(1);
     }
     n = atoi(argv[1]);
     int dist_dim = 1;
     int dist_policy = 1;
-    if (argc == 3) dist_dim = atoi(argv[2]);
-    if (argc == 4) dist_policy = atoi(argv[3]);
+    if (argc >= 3) dist_dim = atoi(argv[2]);
+    if (argc >= 4) dist_policy = atoi(argv[3]);
     if (dist_dim != 1 && dist_dim != 2 && dist_dim != 3) {
         fprintf(stderr, "Unknown dist dimensions: %d, now fall to default (1)\n", dist_dim);
         dist_dim = 1;
     }
-    if (dist_policy != 1 && dist_policy != 2 && dist_policy != 3) {
+    if (dist_policy < 1 || dist_policy > 5 || (dist_dim != 1 && dist_policy > 3)) {
         fprintf(stderr, "Unknown dist policy: %d, now fall to default (1)\n", dist_policy);
         dist_policy = 1;
     }
@@ -324,6 +324,34 @@ struct OUT__1__11058__args {
     int dist;
 };
 
+struct OUT__1__11058__team_args {
+    long j;
+    long k;
+    REAL *A;
+    REAL *B;
+    REAL *C;
+};
+
+/* the rows of a sub-range, run by the team of a host device */
+static void OUT__1__11058__team_body(long start, long length, void *args) {
+    struct OUT__1__11058__team_args *targs = (struct OUT__1__11058__team_args *) args;
+    long j = targs->j;
+    long k = targs->k;
+    REAL *A = targs->A;
+    REAL *B = targs->B;
+    REAL *C = targs->C;
+    long ii, jj, kk;
+    for (ii = start; ii < start + length; ii++) {
+        for (jj = 0; jj < j; jj++) {
+            REAL sum = 0.0;
+            for (kk = 0; kk < k; kk++) {
+                sum += A[ii * k + kk] * B[kk * j + jj];
+            }
+            C[ii * j + jj] = sum;
+        }
+    }
+}
+
 void OUT__1__11058__launcher(omp_offloading_t *off, void *args) {
     struct OUT__1__11058__args *iargs = (struct OUT__1__11058__args *) args;
     long i = iargs->i;
@@ -347,6 +375,8 @@ void OUT__1__11058__launcher(omp_offloading_t *off, void *args) {
     long start;
     if (dist == 1) {
         omp_loop_get_range(off, 0, &start, &i);
+        A += start * k; /* the rows of a chunk, start is 0 unless the loop is run in chunks */
+        C += start * j;
     } else if (dist == 2) {
         omp_loop_get_range(off, 0, &start, &j);
     } else /* vx == 3) */ {
@@ -364,19 +394,8 @@ void OUT__1__11058__launcher(omp_offloading_t *off, void *args) {
 	} else
 #endif
     if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
-        long ii, jj, kk;
-        //	omp_set_num_threads(off->dev->num_cores);
-        //printf("%d cores on host\n", off->dev->num_cores);
-//#pragma omp parallel for shared(A, B, C, i,j,k) private(ii, jj, kk)
-        for (ii = 0; ii < i; ii++) {
-            for (jj = 0; jj < j; jj++) {
-                REAL sum = 0.0;
-                for (kk = 0; kk < k; kk++) {
-                    sum += A[ii * k + kk] * B[kk * j + jj];
-                }
-                C[ii * j + jj] = sum;
-            }
-        }
+        struct OUT__1__11058__team_args targs = {j, k, A, B, C};
+        omp_dev_team_for(off->dev, 0, i, 0, OUT__1__11058__team_body, &targs);
     } else {
         fprintf(stderr, "device type is not supported for this call\n");
     }
@@ -422,7 +441,7 @@ double matmul_ompacc_mdev(REAL *A, REAL *B, REAL *C, long n, int dist_dim, int d
     omp_data_map_info_set_dims_2d(__C_map_info__, n, n);
 
     /**************************************** dist-specific *****************************************/
-    /* dist_policy: block_block: 1, block_align: 2, align_auto: 3 */
+    /* dist_policy: block_block: 1, block_align: 2, align_auto: 3, align_dynamic: 4, align_guided: 5 */
     if (dist_dim == 1) {
         if (dist_policy == 1) {
             /* block_block */
@@ -443,6 +462,13 @@ double matmul_ompacc_mdev(REAL *A, REAL *B, REAL *C, long n, int dist_dim, int d
             omp_data_map_dist_init_info(__C_map_info__, 1, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
 
             printf("AUTO dist policy for loop dist and array align with loops\n");
+        } else if (dist_policy == 4 || dist_policy == 5) {
+            /* align_dynamic and align_guided */
+            omp_loop_dist_init_info(__off_info__, 0, dist_policy == 4 ? OMP_DIST_POLICY_DYNAMIC : OMP_DIST_POLICY_GUIDED, 0, n, 0);
+            omp_data_map_dist_align_with_loop(__C_map_info__, 0, 0, __off_info__, 0);
+            omp_data_map_dist_init_info(__C_map_info__, 1, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
+
+            printf("%s dist policy for loop dist and array align with loops\n", dist_policy == 4 ? "DYNAMIC" : "GUIDED");
         } else {
 
         }
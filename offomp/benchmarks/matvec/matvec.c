@@ -50,7 +50,7 @@ int main(int argc, char *argv[]) {
     REAL *x;
     REAL *a;
     //n = 500000;
-    printf("usage: matvec [n] (default %d) [2|3|4], 2: block_block, 3: block_align, 4 align_auto (policy), default 2\n\n", n);
+    printf("usage: matvec [n] (default %d) [2|3|4|5|6|7], 2: block_block, 3: block_align, 4 align_auto, 5 align_dynamic, 6 align_guided, 7 align_cyclic (policy), default 2\n\n", n);
     if (argc >= 2) n = atoi(argv[1]);
     if (argc >= 3) matvec_mdev_v = atoi(argv[2]);
 
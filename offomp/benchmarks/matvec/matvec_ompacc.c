@@ -79,6 +79,27 @@ struct OUT__3__5904__other_args {
     REAL *y;
 };
 
+struct OUT__3__5904__team_args {
+    long n;
+    REAL *a;
+    REAL *x;
+    REAL *y;
+};
+
+/* the rows of a sub-range, run by the team of a host device */
+static void OUT__3__5904__team_body(long start_n, long length_n, void *args) {
+    struct OUT__3__5904__team_args *targs = (struct OUT__3__5904__team_args *) args;
+    long n = targs->n;
+    REAL *a = targs->a;
+    REAL *x = targs->x;
+    REAL *y = targs->y;
+    long i, j;
+    for (i = start_n; i < start_n + length_n; i++) {
+        for (j = 0; j < n; j++)
+            y[i] += a[i*n + j] * x[j];
+    }
+}
+
 /* called by the helper thread */
 void OUT__3__5904__launcher(omp_offloading_t *off, void *args) {
     struct OUT__3__5904__other_args *iargs = (struct OUT__3__5904__other_args *) args;
@@ -106,13 +127,8 @@ void OUT__3__5904__launcher(omp_offloading_t *off, void *args) {
 	} else
 #endif
     if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
-        int i, j;
-//#pragma omp parallel for shared(y, x, a, start_n, length_n) private(i,j)
-        for (i = start_n; i < start_n + length_n; i++) {
-            for (j = 0; j < n; j++)
-                y[i] += a[i*n + j] * x[j];
-            //printf ("error part!!");
-        }
+        struct OUT__3__5904__team_args targs = {n, a, x, y};
+        omp_dev_team_for(off->dev, start_n, length_n, 0, OUT__3__5904__team_body, &targs);
     } else {
         fprintf(stderr, "device type is not supported for this call\n");
         abort();
@@ -137,6 +153,7 @@ double matvec_ompacc_mdev(REAL *a, REAL *x, REAL *y, long n) {
     omp_offloading_info_t *__off_info__ = omp_offloading_init_info("matvec kernel", __top__, 1, OMP_OFFLOADING_DATA_CODE,
                                                                    __num_maps__, OUT__3__5904__launcher, &args, 1);
     omp_offloading_append_profile_per_iteration(__off_info__, n * n, 1, 1);
+    omp_offloading_set_pipeline_chunks(__off_info__, 4); /* y and rows of a are aligned with the loop, x is copied as a whole */
 
     omp_data_map_info_t *__x_map_info__ = &__off_info__->data_map_info[0];
     omp_data_map_init_info("x", __x_map_info__, __off_info__, x, 1, sizeof(REAL), OMP_DATA_MAP_TO, OMP_DATA_MAP_AUTO);
@@ -166,6 +183,23 @@ double matvec_ompacc_mdev(REAL *a, REAL *x, REAL *y, long n) {
         omp_data_map_dist_init_info(__a_map_info__, 1, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
 
         printf("version 4: AUTO dist policy for loop, and x and y align with loop dist\n");
+    } else if (matvec_mdev_v == 5 || matvec_mdev_v == 6) { /* version 5 and 6 */
+        omp_loop_dist_init_info(__off_info__, 0, matvec_mdev_v == 5 ? OMP_DIST_POLICY_DYNAMIC : OMP_DIST_POLICY_GUIDED, 0, n, 0);
+        omp_data_map_dist_init_info(__x_map_info__, 0, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
+        omp_data_map_dist_align_with_loop(__y_map_info__, 0, 0, __off_info__, 0);
+        omp_data_map_dist_align_with_loop(__a_map_info__, 0, 0, __off_info__, 0);
+        omp_data_map_dist_init_info(__a_map_info__, 1, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
+
+        printf("version %d: %s dist policy for loop, and y and a align with loop dist\n", matvec_mdev_v, matvec_mdev_v == 5 ? "DYNAMIC" : "GUIDED");
+    } else if (matvec_mdev_v == 7) { /* version 7 */
+        omp_loop_dist_init_info(__off_info__, 0, OMP_DIST_POLICY_CYCLIC, 0, n, 0);
+        omp_loop_dist_set_chunk_size(__off_info__, 0, 16);
+        omp_data_map_dist_init_info(__x_map_info__, 0, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
+        omp_data_map_dist_align_with_loop(__y_map_info__, 0, 0, __off_info__, 0);
+        omp_data_map_dist_align_with_loop(__a_map_info__, 0, 0, __off_info__, 0);
+        omp_data_map_dist_init_info(__a_map_info__, 1, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
+
+        printf("version 7: CYCLIC dist policy of 16-row chunks for loop, and y and a align with loop dist\n");
     }
     else { /* default, version 2, block */
         omp_data_map_dist_init_info(__x_map_info__, 0, OMP_DIST_POLICY_DUPLICATE, 0, n, 0);
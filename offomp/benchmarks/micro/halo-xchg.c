@@ -0,0 +1,168 @@
+/*
+ * halo exchange microbenchmark of the runtime: for each pair of neighbour devices (seqid d and d+1 of a 1-D topology of the
+ * active devices), a 1-D array is BLOCK distributed over the two with a halo of width W on both sides, and the standalone
+ * halo exchange is repeated. It reports, per pair and W, the time per exchange (latency for the smallest W) and the
+ * bandwidth as the bytes moved in both directions over that time. At the end the exchange of all the devices together
+ * (each synchronizing only with its neighbours) is timed for the largest W. Before the exchanges each device overwrites
+ * its region, after them each device checks that its halo holds the new region of its neighbours, the program fails
+ * if not.
+ *
+ * gcc -O2 -fopenmp -DDEVICE_THSIM -I../../runtime -I../../util halo-xchg.c ../../runtime/homp.c ../../runtime/homp_dev.c \
+ *     ../../runtime/dev_xthread.c ../../util/iniparser.c ../../util/dictionary.c -o halo-xchg -lm -lrt -lpthread
+ * ./halo-xchg [max halo width in elements, default 1M] [repeats, default 100]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "homp.h"
+
+#define REAL double
+
+/* the value of element i once its device overwrote it (see halo_fill_launcher), the host array holds i */
+#define HALO_VALUE(i) (-(REAL)(i) - 1.0)
+
+struct halo_check_args {
+	REAL * A;
+	long W;
+	long errors; /* the halo elements of all the devices that differ from the region of the neighbour */
+};
+
+/* each device overwrites its region with HALO_VALUE, thus its neighbours have the new values only by the exchange */
+static void halo_fill_launcher(omp_offloading_t * off, void * args) {
+	struct halo_check_args * hargs = (struct halo_check_args *) args;
+	omp_data_map_t * map = omp_map_get_map(off, hargs->A, -1);
+	long offset = map->map_dist[0].offset;
+	long length = map->map_dist[0].length;
+	REAL * buf = (REAL *) malloc(sizeof(REAL) * length);
+	long i;
+	for (i=0; i<length; i++) buf[i] = HALO_VALUE(offset + i);
+	omp_map_memcpy_to(map->map_dev_ptr, map->dev, buf, sizeof(REAL) * length);
+	free(buf);
+}
+
+/* each device compares its left and right halo with the region of the neighbour on that side */
+static void halo_check_launcher(omp_offloading_t * off, void * args) {
+	struct halo_check_args * hargs = (struct halo_check_args *) args;
+	omp_data_map_t * map = omp_map_get_map(off, hargs->A, -1);
+	long W = hargs->W;
+	long offset = map->map_dist[0].offset;
+	long length = map->map_dist[0].length;
+	REAL * buf = (REAL *) malloc(sizeof(REAL) * W);
+	long errors = 0;
+	long i;
+	if (map->halo_mem[0].left_dev_seqid >= 0) {
+		omp_map_memcpy_from(buf, map->map_dev_wextra_ptr, map->dev, sizeof(REAL) * W);
+		for (i=0; i<W; i++) if (buf[i] != HALO_VALUE(offset - W + i)) errors++;
+	}
+	if (map->halo_mem[0].right_dev_seqid >= 0) {
+		omp_map_memcpy_from(buf, map->map_dev_ptr + sizeof(REAL) * length, map->dev, sizeof(REAL) * W);
+		for (i=0; i<W; i++) if (buf[i] != HALO_VALUE(offset + length + i)) errors++;
+	}
+	__atomic_add_fetch(&hargs->errors, errors, __ATOMIC_SEQ_CST);
+	free(buf);
+}
+
+/* time per exchange (ms) of the halo of width W of a 1-D array of length n distributed over top, the halo elements
+ * that differ from the neighbour after the exchanges are returned in errors */
+static double halo_xchg_time(omp_grid_topology_t * top, REAL * A, long n, long W, int repeats, long * errors) {
+	long i;
+	for (i=0; i<n; i++) A[i] = (REAL) i; /* a SHARED map overwrites the host array */
+	omp_offloading_info_t * enter = omp_offloading_init_info("halo enter", top, 0, OMP_OFFLOADING_ENTER_DATA, 1, NULL, NULL, 0);
+	omp_data_map_info_t * map_info = &enter->data_map_info[0];
+	omp_data_map_init_info("A", map_info, enter, A, 1, sizeof(REAL), OMP_DATA_MAP_TO, OMP_DATA_MAP_AUTO);
+	omp_data_map_info_set_dims_1d(map_info, n);
+	omp_data_map_dist_init_info(map_info, 0, OMP_DIST_POLICY_BLOCK, 0, n, 0);
+	omp_map_add_halo_region(map_info, 0, W, W, OMP_DIST_HALO_EDGING_REFLECTING);
+	omp_offloading_start(enter, 0);
+
+	struct halo_check_args hargs;
+	hargs.A = A;
+	hargs.W = W;
+	hargs.errors = 0;
+	omp_offloading_info_t * fill = omp_offloading_init_info("halo fill", top, 0, OMP_OFFLOADING_CODE, 0, halo_fill_launcher, &hargs, 0);
+	omp_offloading_start(fill, 0);
+
+	omp_data_map_halo_exchange_info_t x_halos[1];
+	x_halos[0].map_info = map_info;
+	x_halos[0].x_dim = 0;
+	x_halos[0].x_direction = OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT;
+	omp_offloading_info_t * xinfo = omp_offloading_standalone_data_exchange_init_info("halo exchange", top, 1, x_halos, 1);
+	omp_offloading_start(xinfo, 0); /* warm up, and the first exchange syncs all the neighbours */
+
+	double elapsed = read_timer_ms();
+	int it;
+	for (it=0; it<repeats; it++) omp_offloading_start(xinfo, 0);
+	elapsed = (read_timer_ms() - elapsed) / repeats;
+
+	omp_offloading_info_t * check = omp_offloading_init_info("halo check", top, 0, OMP_OFFLOADING_CODE, 0, halo_check_launcher, &hargs, 0);
+	omp_offloading_start(check, 0);
+	*errors = hargs.errors;
+
+	omp_offloading_info_t * exit_info = omp_offloading_init_info("halo exit", top, 0, OMP_OFFLOADING_EXIT_DATA, 1, NULL, NULL, 0);
+	omp_data_map_init_info("A", &exit_info->data_map_info[0], exit_info, A, 1, sizeof(REAL), OMP_DATA_MAP_FROM, OMP_DATA_MAP_AUTO);
+	omp_data_map_info_set_dims_1d(&exit_info->data_map_info[0], n);
+	omp_offloading_start(exit_info, 0);
+
+	omp_offloading_fini_info(check);
+	omp_offloading_fini_info(xinfo);
+	omp_offloading_fini_info(fill);
+	omp_offloading_fini_info(enter);
+	omp_offloading_fini_info(exit_info);
+	return elapsed;
+}
+
+int main(int argc, char * argv[]) {
+	long max_W = argc > 1 ? atol(argv[1]) : 1024*1024;
+	int repeats = argc > 2 ? atoi(argv[2]) : 100;
+	if (max_W < 1) max_W = 1;
+	if (repeats < 1) repeats = 1;
+
+	omp_init_devices();
+	int ndevs = omp_get_num_active_devices();
+	if (ndevs < 2) {
+		fprintf(stderr, "halo exchange needs at least 2 devices, %d active\n", ndevs);
+		omp_fini_devices();
+		return 1;
+	}
+	long n = ndevs * max_W; /* each device has at least max_W elements, as the halo cannot be wider than the neighbour */
+	REAL * A = (REAL *) malloc(sizeof(REAL) * n);
+	long errors;
+	int failed = 0;
+
+	printf("halo exchange of a 1-D array of double, %d repeats, bytes are those moved in both directions\n", repeats);
+	printf("pair\t\t\thalo(bytes)\ttime(us)\tGB/s\n");
+	int d;
+	for (d=0; d<ndevs-1; d++) {
+		omp_grid_topology_t * top = omp_grid_topology_init_simple(2, 1);
+		top->idmap[0] = omp_devices[d].id;
+		top->idmap[1] = omp_devices[d+1].id;
+		long W;
+		for (W=1; ; W *= 8) {
+			if (W > max_W) W = max_W;
+			double ms = halo_xchg_time(top, A, 2 * max_W, W, repeats, &errors);
+			long bytes = 2 * W * sizeof(REAL);
+			printf("%d(%s)<->%d(%s)\t%ld\t\t%.3f\t\t%.3f\n", d, omp_devices[d].name, d+1, omp_devices[d+1].name, bytes,
+				   ms * 1000.0, bytes / (ms * 1.0e6));
+			if (errors) {
+				fprintf(stderr, "%d<->%d, halo width %ld: %ld halo elements differ from the neighbour\n", d, d+1, W, errors);
+				failed = 1;
+			}
+			if (W == max_W) break;
+		}
+		omp_grid_topology_fini(top);
+	}
+
+	omp_grid_topology_t * top = omp_grid_topology_init_simple(ndevs, 1);
+	double ms = halo_xchg_time(top, A, n, max_W, repeats, &errors);
+	long bytes = 2 * (ndevs - 1) * max_W * sizeof(REAL);
+	printf("all %d devices\t\t%ld\t\t%.3f\t\t%.3f\n", ndevs, bytes, ms * 1000.0, bytes / (ms * 1.0e6));
+	if (errors) {
+		fprintf(stderr, "all %d devices, halo width %ld: %ld halo elements differ from the neighbour\n", ndevs, max_W, errors);
+		failed = 1;
+	}
+	omp_grid_topology_fini(top);
+
+	free(A);
+	omp_fini_devices();
+	if (failed) fprintf(stderr, "halo exchange verification FAILED\n");
+	return failed;
+}
@@ -0,0 +1,264 @@
+/*
+ * unstructured data microbenchmark of the runtime: a 1-D array is BLOCK distributed over the active devices by target
+ * enter data, and it reports the time of enter data followed by exit data, and of target update to and from the devices,
+ * per call and as bandwidth. It checks the present table of each device (see omp_data_map_present in homp.h) through the
+ * sequence below and fails if any check does not hold:
+ *   enter (TO) twice           the reference count is 2, the second enter does not map or copy the array again
+ *   update TO, kernel, update FROM   the update copies the host values into the present map and back
+ *   exit (FROM)                the count drops to 1, the array stays present and is not copied back yet
+ *   kernel, exit (FROM)        the count drops to 0, the array is copied back and released
+ *   enter twice, exit DELETE   the array is released regardless of the count
+ * The copies are only checked for the devices whose map is a copy, the others share the host array.
+ *
+ * gcc -O2 -fopenmp -DDEVICE_THSIM -I../../runtime -I../../util target-data.c ../../runtime/homp.c ../../runtime/homp_dev.c \
+ *     ../../runtime/dev_xthread.c ../../util/iniparser.c ../../util/dictionary.c -o target-data -lm -lrt -lpthread
+ * ./target-data [array length in elements, default 1M] [repeats, default 100]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "homp.h"
+
+#define REAL double
+
+/* the value of element i at a step of the sequence, written by the host or by the devices (see present_kernel_launcher) */
+#define HOST_VALUE(i, step) ((REAL)(i) * 10.0 + (step))
+
+/* what each device sees of the array in its present table, filled by present_probe_launcher on the helper thread,
+ * which is the only thread that accesses the table */
+struct present_probe_args {
+	REAL * A;
+	int step; /* the values the probe expects on the devices, or the kernel writes */
+	int * refcount; /* of each device, 0 if the array is not present */
+	omp_data_map_t ** map;
+	long errors; /* the elements of the present copies that differ from HOST_VALUE(i, step) */
+};
+
+static void present_probe_launcher(omp_offloading_t * off, void * args) {
+	struct present_probe_args * pargs = (struct present_probe_args *) args;
+	int seqid = off->devseqid;
+	omp_data_map_present_t * entry = omp_map_present_lookup(off->dev, pargs->A);
+	pargs->refcount[seqid] = entry == NULL ? 0 : entry->refcount;
+	pargs->map[seqid] = entry == NULL ? NULL : entry->map;
+	if (entry == NULL || entry->map->map_type != OMP_DATA_MAP_COPY) return;
+
+	omp_data_map_t * map = entry->map;
+	long offset = map->map_dist[0].offset;
+	long length = map->map_dist[0].length;
+	REAL * buf = (REAL *) malloc(sizeof(REAL) * length);
+	long errors = 0;
+	long i;
+	omp_map_memcpy_from(buf, map->map_dev_ptr, map->dev, sizeof(REAL) * length);
+	for (i=0; i<length; i++) if (buf[i] != HOST_VALUE(offset + i, pargs->step)) errors++;
+	__atomic_add_fetch(&pargs->errors, errors, __ATOMIC_SEQ_CST);
+	free(buf);
+}
+
+/* each device writes HOST_VALUE(i, step) to its region of the present map */
+static void present_kernel_launcher(omp_offloading_t * off, void * args) {
+	struct present_probe_args * pargs = (struct present_probe_args *) args;
+	omp_data_map_t * map = omp_map_get_map(off, pargs->A, -1);
+	long offset = map->map_dist[0].offset;
+	long length = map->map_dist[0].length;
+	REAL * buf = (REAL *) malloc(sizeof(REAL) * length);
+	long i;
+	for (i=0; i<length; i++) buf[i] = HOST_VALUE(offset + i, pargs->step);
+	omp_map_memcpy_to(map->map_dev_ptr, map->dev, buf, sizeof(REAL) * length);
+	free(buf);
+}
+
+static omp_offloading_info_t * target_data_info(const char * name, omp_grid_topology_t * top, omp_offloading_type_t type,
+												REAL * A, long n, omp_data_map_direction_t direction) {
+	omp_offloading_info_t * info = omp_offloading_init_info(name, top, 0, type, 1, NULL, NULL, 0);
+	omp_data_map_info_t * map_info = &info->data_map_info[0];
+	omp_data_map_init_info("A", map_info, info, A, 1, sizeof(REAL), direction, OMP_DATA_MAP_AUTO);
+	omp_data_map_info_set_dims_1d(map_info, n);
+	if (type == OMP_OFFLOADING_ENTER_DATA) omp_data_map_dist_init_info(map_info, 0, OMP_DIST_POLICY_BLOCK, 0, n, 0);
+	return info;
+}
+
+static void host_fill(REAL * A, long n, int step) {
+	long i;
+	for (i=0; i<n; i++) A[i] = HOST_VALUE(i, step);
+}
+
+/* the elements of the region of device seqid (as probed) of the host array that differ from HOST_VALUE(i, step) */
+static long host_check(struct present_probe_args * pargs, int seqid, int step) {
+	omp_data_map_t * map = pargs->map[seqid];
+	long offset = map->map_dist[0].offset;
+	long length = map->map_dist[0].length;
+	long errors = 0;
+	long i;
+	for (i=offset; i<offset+length; i++) if (pargs->A[i] != HOST_VALUE(i, step)) errors++;
+	return errors;
+}
+
+/* run the probe and check the reference count of every device, and the values of the copies against step if step >= 0 */
+static int present_probe(omp_grid_topology_t * top, struct present_probe_args * pargs, int step, int refcount, const char * when) {
+	int failed = 0;
+	int d;
+	pargs->step = step;
+	pargs->errors = 0;
+	omp_offloading_info_t * probe = omp_offloading_init_info("present probe", top, 0, OMP_OFFLOADING_CODE, 0, present_probe_launcher, pargs, 0);
+	omp_offloading_start(probe, 0);
+	omp_offloading_fini_info(probe);
+	for (d=0; d<top->nnodes; d++) {
+		if (pargs->refcount[d] != refcount) {
+			fprintf(stderr, "%s: dev %d has reference count %d, expected %d\n", when, d, pargs->refcount[d], refcount);
+			failed = 1;
+		}
+	}
+	if (step >= 0 && pargs->errors) {
+		fprintf(stderr, "%s: %ld elements on the devices differ from the expected values\n", when, pargs->errors);
+		failed = 1;
+	}
+	return failed;
+}
+
+static void present_kernel(omp_grid_topology_t * top, struct present_probe_args * pargs, int step) {
+	pargs->step = step;
+	omp_offloading_info_t * kernel = omp_offloading_init_info("present kernel", top, 0, OMP_OFFLOADING_CODE, 0, present_kernel_launcher, pargs, 0);
+	omp_offloading_start(kernel, 0);
+	omp_offloading_fini_info(kernel);
+}
+
+/* the reference counting sequence of the file header, returns 1 if a check fails */
+static int target_data_check(omp_grid_topology_t * top, REAL * A, long n) {
+	struct present_probe_args pargs;
+	pargs.A = A;
+	pargs.refcount = (int *) malloc(sizeof(int) * top->nnodes);
+	pargs.map = (omp_data_map_t **) malloc(sizeof(omp_data_map_t *) * top->nnodes);
+	omp_data_map_t ** maps = (omp_data_map_t **) malloc(sizeof(omp_data_map_t *) * top->nnodes);
+	int failed = 0;
+	int d;
+
+	omp_offloading_info_t * enter = target_data_info("enter A", top, OMP_OFFLOADING_ENTER_DATA, A, n, OMP_DATA_MAP_TO);
+	omp_offloading_info_t * enter_again = target_data_info("enter A again", top, OMP_OFFLOADING_ENTER_DATA, A, n, OMP_DATA_MAP_TO);
+	omp_offloading_info_t * update_to = target_data_info("update A to", top, OMP_OFFLOADING_UPDATE, A, n, OMP_DATA_MAP_TO);
+	omp_offloading_info_t * update_from = target_data_info("update A from", top, OMP_OFFLOADING_UPDATE, A, n, OMP_DATA_MAP_FROM);
+	omp_offloading_info_t * exit_from = target_data_info("exit A", top, OMP_OFFLOADING_EXIT_DATA, A, n, OMP_DATA_MAP_FROM);
+	omp_offloading_info_t * exit_delete = target_data_info("delete A", top, OMP_OFFLOADING_EXIT_DATA, A, n, OMP_DATA_MAP_DELETE);
+
+	host_fill(A, n, 1);
+	omp_offloading_start(enter, 0);
+	failed |= present_probe(top, &pargs, 1, 1, "enter");
+	for (d=0; d<top->nnodes; d++) maps[d] = pargs.map[d];
+
+	host_fill(A, n, 2); /* not copied by the second enter, the copies keep step 1 */
+	omp_offloading_start(enter_again, 0);
+	failed |= present_probe(top, &pargs, 1, 2, "second enter");
+	for (d=0; d<top->nnodes; d++) {
+		if (pargs.map[d] != maps[d]) {
+			fprintf(stderr, "second enter: dev %d mapped A again instead of using the present map\n", d);
+			failed = 1;
+		}
+	}
+
+	omp_offloading_start(update_to, 0);
+	failed |= present_probe(top, &pargs, 2, 2, "update to");
+
+	present_kernel(top, &pargs, 3);
+	omp_offloading_start(update_from, 0);
+	for (d=0; d<top->nnodes; d++) {
+		if (host_check(&pargs, d, 3)) {
+			fprintf(stderr, "update from: the host region of dev %d differs from the device\n", d);
+			failed = 1;
+		}
+	}
+
+	present_kernel(top, &pargs, 4);
+	host_fill(A, n, 5); /* not copied back by the first exit, A stays present */
+	omp_offloading_start(exit_from, 0);
+	failed |= present_probe(top, &pargs, 4, 1, "first exit");
+	for (d=0; d<top->nnodes; d++) {
+		if (pargs.map[d] != maps[d]) {
+			fprintf(stderr, "first exit: dev %d does not keep the present map\n", d);
+			failed = 1;
+		}
+		if (maps[d]->map_type == OMP_DATA_MAP_COPY && host_check(&pargs, d, 5)) {
+			fprintf(stderr, "first exit: the host region of dev %d is copied back before the count drops to 0\n", d);
+			failed = 1;
+		}
+	}
+
+	present_kernel(top, &pargs, 6);
+	omp_offloading_start(exit_from, 0);
+	for (d=0; d<top->nnodes; d++) pargs.map[d] = maps[d]; /* released, host_check only needs their regions */
+	for (d=0; d<top->nnodes; d++) {
+		if (host_check(&pargs, d, 6)) {
+			fprintf(stderr, "last exit: the host region of dev %d is not copied back\n", d);
+			failed = 1;
+		}
+	}
+	failed |= present_probe(top, &pargs, -1, 0, "last exit");
+
+	omp_offloading_start(enter, 0);
+	omp_offloading_start(enter_again, 0);
+	failed |= present_probe(top, &pargs, -1, 2, "enter twice");
+	omp_offloading_start(exit_delete, 0);
+	failed |= present_probe(top, &pargs, -1, 0, "delete");
+
+	omp_offloading_fini_info(enter);
+	omp_offloading_fini_info(enter_again);
+	omp_offloading_fini_info(update_to);
+	omp_offloading_fini_info(update_from);
+	omp_offloading_fini_info(exit_from);
+	omp_offloading_fini_info(exit_delete);
+	free(pargs.refcount);
+	free(pargs.map);
+	free(maps);
+	return failed;
+}
+
+int main(int argc, char * argv[]) {
+	long n = argc > 1 ? atol(argv[1]) : 1024*1024;
+	int repeats = argc > 2 ? atoi(argv[2]) : 100;
+	if (n < 1) n = 1;
+	if (repeats < 1) repeats = 1;
+
+	omp_init_devices();
+	int ndevs = omp_get_num_active_devices();
+	omp_grid_topology_t * top = omp_grid_topology_init_simple(ndevs, 1);
+	REAL * A = (REAL *) malloc(sizeof(REAL) * n);
+	int failed = target_data_check(top, A, n);
+
+	/* the timing, the enter and exit pair maps and releases A each time, the updates copy the whole array */
+	omp_offloading_info_t * enter = target_data_info("enter A", top, OMP_OFFLOADING_ENTER_DATA, A, n, OMP_DATA_MAP_TO);
+	omp_offloading_info_t * update_to = target_data_info("update A to", top, OMP_OFFLOADING_UPDATE, A, n, OMP_DATA_MAP_TO);
+	omp_offloading_info_t * update_from = target_data_info("update A from", top, OMP_OFFLOADING_UPDATE, A, n, OMP_DATA_MAP_FROM);
+	omp_offloading_info_t * exit_from = target_data_info("exit A", top, OMP_OFFLOADING_EXIT_DATA, A, n, OMP_DATA_MAP_FROM);
+	host_fill(A, n, 0);
+	int it;
+
+	double enter_exit = read_timer_ms();
+	for (it=0; it<repeats; it++) {
+		omp_offloading_start(enter, 0);
+		omp_offloading_start(exit_from, 0);
+	}
+	enter_exit = (read_timer_ms() - enter_exit) / repeats;
+
+	omp_offloading_start(enter, 0);
+	double to = read_timer_ms();
+	for (it=0; it<repeats; it++) omp_offloading_start(update_to, 0);
+	to = (read_timer_ms() - to) / repeats;
+	double from = read_timer_ms();
+	for (it=0; it<repeats; it++) omp_offloading_start(update_from, 0);
+	from = (read_timer_ms() - from) / repeats;
+	omp_offloading_start(exit_from, 0);
+
+	long bytes = n * sizeof(REAL);
+	printf("target data of a 1-D array of double over %d devices, %d repeats, bytes are those of the whole array\n", ndevs, repeats);
+	printf("operation\t\tbytes\t\ttime(us)\tGB/s\n");
+	printf("enter+exit\t\t%ld\t%.3f\t\t%.3f\n", bytes, enter_exit * 1000.0, 2 * bytes / (enter_exit * 1.0e6));
+	printf("update to\t\t%ld\t%.3f\t\t%.3f\n", bytes, to * 1000.0, bytes / (to * 1.0e6));
+	printf("update from\t\t%ld\t%.3f\t\t%.3f\n", bytes, from * 1000.0, bytes / (from * 1.0e6));
+
+	omp_offloading_fini_info(enter);
+	omp_offloading_fini_info(update_to);
+	omp_offloading_fini_info(update_from);
+	omp_offloading_fini_info(exit_from);
+	omp_grid_topology_fini(top);
+	free(A);
+	omp_fini_devices();
+	if (failed) fprintf(stderr, "target data verification FAILED\n");
+	return failed;
+}
@@ -10,6 +10,28 @@
 extern __global__ void stencil2d_nvgpu_kernel(int start_n, int len_n, long n, long m, int u_dimX, int u_dimY, REAL *u, REAL *uold, int radius, int coeff_dimX, REAL *coeff);
 #endif
 
+/* the range of the interior (without the radius border) of the device: rows [*x, *x+*len_x) and columns [*y, *y+*len_y).
+ * dist 1 and 2 distribute the rows or the columns with a 1-level loop, dist 3 both with a 2-level loop */
+static void stencil2d_get_range(omp_offloading_t *off, long n, long m, long *x, long *len_x, long *y, long *len_y) {
+    long start;
+    if (dist_dim == 1) {
+        *x = omp_loop_get_range(off, 0, &start, len_x) + start;
+        *y = 0; *len_y = m;
+    } else if (dist_dim == 2) {
+        *x = 0; *len_x = n;
+        *y = omp_loop_get_range(off, 0, &start, len_y) + start;
+    } else /* dist == 3 */ {
+        *x = omp_loop_get_range(off, 0, &start, len_x) + start;
+        *y = omp_loop_get_range(off, 1, &start, len_y) + start;
+    }
+}
+
+/* the element [x][y] of the array in the device buffer of the map, which is the packed box of the mapped region and its
+ * halo in every distributed dim, with rows of map_dev_dims[1] elements */
+static REAL * stencil2d_dev_element(omp_data_map_t *map, long x, long y) {
+    return (REAL*) map->map_dev_ptr + (x - map->map_dist[0].offset) * map->map_dev_dims[1] + y - map->map_dist[1].offset;
+}
+
 void stencil2d_omp_mdev_off_launcher(omp_offloading_t *off, void *args) {
     struct stencil2d_off_args * iargs = (struct stencil2d_off_args*) args;
     long n = iargs->n;
@@ -24,8 +46,8 @@ void stencil2d_omp_mdev_off_launcher(omp_offloading_t *off, void *args) {
     omp_data_map_t * map_uold = omp_map_get_map(off, iargs->uold, -1); /* 2 is for the map uld */
     omp_data_map_t * map_coeff = omp_map_get_map(off, iargs->coeff, -1); /* 2 is for the map uld */
 
-    REAL * u = (REAL*) map_u->map_dev_wextra_ptr;
-    REAL * uold = (REAL*) map_uold->map_dev_wextra_ptr;
+    REAL * u;
+    REAL * uold;
     REAL *coeff = (REAL*) map_coeff->map_dev_wextra_ptr;
     coeff = coeff + (2*radius+1) * radius + radius; /* TODO this should be a call to map a host-side address to dev-side address*/
     int count = 4*radius+1;
@@ -40,17 +62,13 @@ void stencil2d_omp_mdev_off_launcher(omp_offloading_t *off, void *args) {
     print_array("uold in device: ", "uolddev", uold, n, m);
 #endif
 
-    long offset;
-    long start;
-    long len;
-    if (dist_dim == 1) {
-        offset = omp_loop_get_range(off, 0, &start, &len);
-    } else if (dist_dim == 2) {
-        omp_loop_get_range(off, 0, &start, &len);
-    } else /* vx == 3) */ {
-        omp_loop_get_range(off, 0, &start, &len); /* todo */
-        omp_loop_get_range(off, 0, &start, &len); /* todo */
-    }
+    long x, len, y, len_y;
+    stencil2d_get_range(off, n, m, &x, &len, &y, &len_y);
+    /* u and uold from the top left corner of the halo of the range, u_dimY is the row length of the device buffers */
+    u_dimY = map_u->map_dev_dims[1];
+    u = stencil2d_dev_element(map_u, x, y);
+    uold = stencil2d_dev_element(map_uold, x, y);
+    int x_dim = dist_dim == 1 ? 0 : (dist_dim == 2 ? 1 : -1); /* -1 for both dims */
     omp_device_type_t devtype = off->dev->type;
     //printf("dev: %d, offset: %d, length: %d, local start: %d, u: %X, uold: %X, coeff-center: %X\n", off->devseqid, offset, len, start, u, uold, coeff);
 
@@ -59,9 +77,9 @@ void stencil2d_omp_mdev_off_launcher(omp_offloading_t *off, void *args) {
 #if defined (DEVICE_NVGPU_SUPPORT)
 		if (devtype == OMP_DEVICE_NVGPU) {
 			dim3 threads_per_team(16, 16);
-			dim3 teams_per_league((len+threads_per_team.x-1)/threads_per_team.x, (m+threads_per_team.y-1)/threads_per_team.y); /* we assume dividable */
+			dim3 teams_per_league((len+threads_per_team.x-1)/threads_per_team.x, (len_y+threads_per_team.y-1)/threads_per_team.y); /* we assume dividable */
             stencil2d_nvgpu_kernel<<<teams_per_league, threads_per_team, 0, off->stream->systream.cudaStream>>>
-                (start, len, n, m, u_dimX, u_dimY, u, uold, radius, coeff_dimX, coeff);
+                (0, len, n, len_y, u_dimX, u_dimY, u, uold, radius, coeff_dimX, coeff);
 		} else
 #endif
         if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
@@ -76,10 +94,10 @@ void stencil2d_omp_mdev_off_launcher(omp_offloading_t *off, void *args) {
 #endif
 //#pragma omp for private(ix, iy, ir)
             int ix, iy, ir;
-            for (ix = start; ix < start+len; ix++) {
+            for (ix = 0; ix < len; ix++) {
                 REAL * temp_u = &u[(ix+radius)*u_dimY+radius];
                 REAL * temp_uold = &uold[(ix+radius)*u_dimY+radius];
-                for (iy = 0; iy < m; iy++) {
+                for (iy = 0; iy < len_y; iy++) {
 //                    if (off->devseqid == 0)printf("dev: %d, [%d][%d]:%f\n", off->devseqid, ix, iy, temp_u[0]);
                     REAL result = temp_uold[0] * coeff[0];
                     /* 2/4 way loop unrolling */
@@ -105,8 +123,13 @@ void stencil2d_omp_mdev_off_launcher(omp_offloading_t *off, void *args) {
         }
 
         pthread_barrier_wait(&off->off_info->inter_dev_barrier);
-        if (it % 2 == 0) omp_halo_region_pull(map_u, 0, OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT);
-        else omp_halo_region_pull(map_uold, 0, OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT);
+        omp_data_map_t * map_x = it % 2 == 0 ? map_u : map_uold;
+        if (x_dim >= 0) omp_halo_region_pull(map_x, x_dim, OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT);
+        else { /* one dim after the other, the barrier in between lets the corners come from the diagonal neighbours */
+            omp_halo_region_pull(map_x, 0, OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT);
+            pthread_barrier_wait(&off->off_info->inter_dev_barrier);
+            omp_halo_region_pull(map_x, 1, OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT);
+        }
 
         REAL * tmp = uold;
         uold = u;
@@ -128,8 +151,8 @@ void stencil2d_omp_mdev_iterate_off_launcher(omp_offloading_t * off, void *args)
     omp_data_map_t * map_uold = omp_map_get_map(off, iargs->uold, -1); /* 2 is for the map uld */
     omp_data_map_t * map_coeff = omp_map_get_map(off, iargs->coeff, -1); /* 2 is for the map uld */
 
-    REAL * u = (REAL*) map_u->map_dev_wextra_ptr;
-    REAL * uold = (REAL*) map_uold->map_dev_wextra_ptr;
+    REAL * u;
+    REAL * uold;
     REAL *coeff = (REAL*) map_coeff->map_dev_wextra_ptr;
     coeff = coeff + (2*radius+1) * radius + radius; /* TODO this should be a call to map a host-side address to dev-side address*/
     int count = 4*radius+1;
@@ -144,17 +167,12 @@ void stencil2d_omp_mdev_iterate_off_launcher(omp_offloading_t * off, void *args)
     print_array("uold in device: ", "uolddev", uold, n, m);
 #endif
 
-    long offset;
-    long start;
-    long len;
-    if (dist_dim == 1) {
-        offset = omp_loop_get_range(off, 0, &start, &len);
-    } else if (dist_dim == 2) {
-        omp_loop_get_range(off, 0, &start, &len);
-    } else /* vx == 3) */ {
-        omp_loop_get_range(off, 0, &start, &len); /* todo */
-        omp_loop_get_range(off, 0, &start, &len); /* todo */
-    }
+    long x, len, y, len_y;
+    stencil2d_get_range(off, n, m, &x, &len, &y, &len_y);
+    /* u and uold from the top left corner of the halo of the range, u_dimY is the row length of the device buffers */
+    u_dimY = map_u->map_dev_dims[1];
+    u = stencil2d_dev_element(map_u, x, y);
+    uold = stencil2d_dev_element(map_uold, x, y);
     omp_device_type_t devtype = off->dev->type;
     //printf("dev: %d, offset: %d, length: %d, local start: %d, u: %X, uold: %X, coeff-center: %X\n", off->devseqid, offset, len, start, u, uold, coeff);
 
@@ -162,9 +180,9 @@ void stencil2d_omp_mdev_iterate_off_launcher(omp_offloading_t * off, void *args)
 #if defined (DEVICE_NVGPU_SUPPORT)
 	if (devtype == OMP_DEVICE_NVGPU) {
 		dim3 threads_per_team(16, 16);
-		dim3 teams_per_league((len+threads_per_team.x-1)/threads_per_team.x, (m+threads_per_team.y-1)/threads_per_team.y); /* we assume dividable */
+		dim3 teams_per_league((len+threads_per_team.x-1)/threads_per_team.x, (len_y+threads_per_team.y-1)/threads_per_team.y); /* we assume dividable */
            stencil2d_nvgpu_kernel<<<teams_per_league, threads_per_team, 0, off->stream->systream.cudaStream>>>
-               (start, len, n, m, u_dimX, u_dimY, u, uold, radius, coeff_dimX, coeff);
+               (0, len, n, len_y, u_dimX, u_dimY, u, uold, radius, coeff_dimX, coeff);
 	} else
 #endif
     if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
@@ -179,10 +197,10 @@ void stencil2d_omp_mdev_iterate_off_launcher(omp_offloading_t * off, void *args)
 #endif
 //#pragma omp for private(ix, iy, ir)
         int ix, iy, ir;
-        for (ix = start; ix < start + len; ix++) {
+        for (ix = 0; ix < len; ix++) {
             REAL *temp_u = &u[(ix + radius) * u_dimY + radius];
             REAL *temp_uold = &uold[(ix + radius) * u_dimY + radius];
-            for (iy = 0; iy < m; iy++) {
+            for (iy = 0; iy < len_y; iy++) {
 //                    if (off->devseqid == 0)printf("dev: %d, [%d][%d]:%f\n", off->devseqid, ix, iy, temp_u[0]);
                 REAL result = temp_uold[0] * coeff[0];
                 /* 2/4 way loop unrolling */
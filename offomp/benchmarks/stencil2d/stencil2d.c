@@ -72,7 +72,7 @@ REAL check_accdiff(const REAL *output, const REAL *reference, const long dimx, c
 void stencil2d_seq(long n, long m, REAL *u, int radius, REAL *filter, int num_its);
 void stencil2d_omp(long n, long m, REAL *u, int radius, REAL *coeff, int num_its);
 double stencil2d_omp_mdev(long u_dimX, long u_dimY, REAL *u, int radius, REAL *coeff, int num_its);
-double stencil2d_omp_mdev_iterate(long u_dimX, long u_dimY, REAL *u, int radius, REAL *coeff, int num_its);
+double stencil2d_omp_mdev_iterate(long u_dimX, long u_dimY, REAL *u, int radius, REAL *coeff, int num_its, int use_graph);
 
 int dist_dim;
 int dist_policy;
@@ -125,6 +125,7 @@ int main(int argc, char * argv[]) {
 	REAL * u_omp = (REAL *)malloc(sizeof(REAL)* u_volumn);
 	REAL * u_omp_mdev = (REAL *)omp_unified_malloc(sizeof(REAL)* u_volumn);
 	REAL * u_omp_mdev_iterate = (REAL *)omp_unified_malloc(sizeof(REAL)* u_volumn);
+	REAL * u_omp_mdev_graph = (REAL *)omp_unified_malloc(sizeof(REAL)* u_volumn);
 	REAL *coeff = (REAL *) omp_unified_malloc(sizeof(REAL)*coeff_volumn);
 
 	srand(0);
@@ -133,6 +134,7 @@ int main(int argc, char * argv[]) {
 	memcpy(u_omp, u, sizeof(REAL)*u_volumn);
 	memcpy(u_omp_mdev, u, sizeof(REAL)*u_volumn);
 	memcpy(u_omp_mdev_iterate, u, sizeof(REAL)*u_volumn);
+	memcpy(u_omp_mdev_graph, u, sizeof(REAL)*u_volumn);
 	//print_array("coeff", "coeff", coeff, 2*radius+1, 2*radius+1);
 	//print_array("original", "u", u, u_dimX, u_dimY);
 
@@ -155,7 +157,11 @@ int main(int argc, char * argv[]) {
 
 	printf("OMP mdev iterate execution\n");
 	REAL mdev_iterate_elapsed = 0.0;
-	mdev_iterate_elapsed = stencil2d_omp_mdev_iterate(n, m, u_omp_mdev_iterate, radius, coeff, num_its);
+	mdev_iterate_elapsed = stencil2d_omp_mdev_iterate(n, m, u_omp_mdev_iterate, radius, coeff, num_its, 0);
+
+	printf("OMP mdev graph execution\n");
+	REAL mdev_graph_elapsed = 0.0;
+	mdev_graph_elapsed = stencil2d_omp_mdev_iterate(n, m, u_omp_mdev_graph, radius, coeff, num_its, 1);
 
 	long flops = n*m*radius;
 #ifdef SQUARE_SETNCIL
@@ -173,11 +179,13 @@ int main(int argc, char * argv[]) {
 	printf("omp: \t\t%4f\t%4f \t\t%g\n", omp_elapsed, flops / (1.0e-3 * omp_elapsed), check_accdiff(u, u_omp, n, m, radius, 0.00001f));
 //	printf("omp_mdev: \t%4f\t%4f \t\t%g\n", mdev_elapsed, flops / (1.0e-3 * mdev_elapsed), check_accdiff(u, u_omp_mdev, n, m, radius, 0.00001f));
 	printf("omp_mdev_it: \t%4f\t%4f \t\t%g\n", mdev_iterate_elapsed, flops / (1.0e-3 * mdev_iterate_elapsed), check_accdiff(u, u_omp_mdev_iterate, n, m, radius, 0.00001f));
+	printf("omp_mdev_graph: %4f\t%4f \t\t%g\n", mdev_graph_elapsed, flops / (1.0e-3 * mdev_graph_elapsed), check_accdiff(u, u_omp_mdev_graph, n, m, radius, 0.00001f));
 
 	free(u);
 	free(u_omp);
 	omp_unified_free(u_omp_mdev);
 	omp_unified_free(u_omp_mdev_iterate);
+	omp_unified_free(u_omp_mdev_graph);
 	omp_unified_free(coeff);
 	omp_fini_devices();
 
@@ -436,8 +444,11 @@ double stencil2d_omp_mdev(long n, long m, REAL *u, int radius, REAL *coeff, int
 	off_args.uold = uold; off_args.coeff_center = coeff_center; off_args.coeff_dimX = coeff_dimX; off_args.u_dimX = u_dimX; off_args.u_dimY = u_dimY;
 	omp_offloading_info_t * __off_info__ =
 			omp_offloading_init_info("stencil2d kernel", __top__, 1, OMP_OFFLOADING_CODE, 0,
-									 stencil2d_omp_mdev_off_launcher, &off_args, 1);
-	omp_offloading_append_profile_per_iteration(__off_info__, 13*u_dimY, 7, 1);
+									 stencil2d_omp_mdev_off_launcher, &off_args, __top_ndims__);
+	/* an iteration is a row for dist 1, a column for dist 2 and an element for dist 3 (2-level loop) */
+	if (dist_dim == 1) omp_offloading_append_profile_per_iteration(__off_info__, 13*u_dimY, 7, 1);
+	else if (dist_dim == 2) omp_offloading_append_profile_per_iteration(__off_info__, 13*u_dimX, 7, 1);
+	else omp_offloading_append_profile_per_iteration(__off_info__, 13, 7, 1);
 
 	//printf("data copy off: %X, stencil2d off: %X\n", __copy_data_off_info__, __off_info__);
 
@@ -476,18 +487,18 @@ double stencil2d_omp_mdev(long n, long m, REAL *u, int radius, REAL *coeff, int
 		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_DUPLICATE, 0, u_dimY, 0);
 		omp_map_add_halo_region(__u_map_info__, 0, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
 		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, OMP_ALIGNEE_START, __u_map_info__, OMP_ALL_DIMENSIONS);
-  	} else if (dist_dim == 2) {
-		omp_data_map_dist_init_info(__u_map_info__, 0, OMP_DIST_POLICY_DUPLICATE, radius, n, 0);
-		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, n, 0);
-		omp_map_add_halo_region(__u_map_info__, 0, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
-		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, 0, __u_map_info__, OMP_ALL_DIMENSIONS);
-		omp_loop_dist_init_info(__off_info__, 1, OMP_DIST_POLICY_BLOCK, 0, m, 0);
+  	} else if (dist_dim == 2) { /* the column loop is the only level of the loop */
+		omp_data_map_dist_init_info(__u_map_info__, 0, OMP_DIST_POLICY_DUPLICATE, 0, u_dimX, 0);
+		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, m, 0);
+		omp_map_add_halo_region(__u_map_info__, 1, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
+		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, OMP_ALIGNEE_START, __u_map_info__, OMP_ALL_DIMENSIONS);
+		omp_loop_dist_init_info(__off_info__, 0, OMP_DIST_POLICY_BLOCK, 0, m, 0);
   	} else /* dist == 3 */{
 		omp_data_map_dist_init_info(__u_map_info__, 0, OMP_DIST_POLICY_BLOCK, radius, n, 0);
-		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, n, 1);
+		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, m, 1);
 		omp_map_add_halo_region(__u_map_info__, 0, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
 		omp_map_add_halo_region(__u_map_info__, 1, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
-		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, 0, __u_map_info__, OMP_ALL_DIMENSIONS);
+		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, OMP_ALIGNEE_START, __u_map_info__, OMP_ALL_DIMENSIONS);
 		omp_loop_dist_init_info(__off_info__, 0, OMP_DIST_POLICY_BLOCK, 0, n, 0);
 		omp_loop_dist_init_info(__off_info__, 1, OMP_DIST_POLICY_BLOCK, 0, m, 1);
   	}
@@ -533,7 +544,13 @@ double stencil2d_omp_mdev(long n, long m, REAL *u, int radius, REAL *coeff, int
 	return off_total;
 }
 
-double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coeff, int num_its) {
+/**
+ * with use_graph, the iterations are recorded once as a graph of two offloadings, the even iterations that compute u from
+ * uold and the odd ones that compute uold from u, each with its own args and halo exchange since the graph posts the
+ * iterations without waiting, thus the args cannot be swapped between them. The graph is replayed for the pairs of
+ * iterations and the last (num_its is odd) is the even offloading alone.
+ */
+double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coeff, int num_its, int use_graph) {
 	long u_dimX = n + 2 * radius;
 	long u_dimY = m + 2 * radius;
 	int coeff_dimX = 2*radius+1;
@@ -566,8 +583,11 @@ double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coe
 	off_args.uold = uold; off_args.coeff_center = coeff_center; off_args.coeff_dimX = coeff_dimX; off_args.u_dimX = u_dimX; off_args.u_dimY = u_dimY;
 	omp_offloading_info_t * __off_info__ =
 			omp_offloading_init_info("stencil2d kernel", __top__, 1, OMP_OFFLOADING_CODE, 0,
-									 stencil2d_omp_mdev_iterate_off_launcher, &off_args, 1);
-	omp_offloading_append_profile_per_iteration(__off_info__, 13*u_dimY, 7, 1);
+									 stencil2d_omp_mdev_iterate_off_launcher, &off_args, __top_ndims__);
+	/* an iteration is a row for dist 1, a column for dist 2 and an element for dist 3 (2-level loop) */
+	if (dist_dim == 1) omp_offloading_append_profile_per_iteration(__off_info__, 13*u_dimY, 7, 1);
+	else if (dist_dim == 2) omp_offloading_append_profile_per_iteration(__off_info__, 13*u_dimX, 7, 1);
+	else omp_offloading_append_profile_per_iteration(__off_info__, 13, 7, 1);
 
 	//printf("data copy off: %X, stencil2d off: %X\n", __copy_data_off_info__, __off_info__);
 
@@ -606,18 +626,18 @@ double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coe
 		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_DUPLICATE, 0, u_dimY, 0);
 		omp_map_add_halo_region(__u_map_info__, 0, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
 		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, OMP_ALIGNEE_START, __u_map_info__, OMP_ALL_DIMENSIONS);
-	} else if (dist_dim == 2) {
-		omp_data_map_dist_init_info(__u_map_info__, 0, OMP_DIST_POLICY_DUPLICATE, radius, n, 0);
-		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, n, 0);
-		omp_map_add_halo_region(__u_map_info__, 0, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
-		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, 0, __u_map_info__, OMP_ALL_DIMENSIONS);
-		omp_loop_dist_init_info(__off_info__, 1, OMP_DIST_POLICY_BLOCK, 0, m, 0);
+	} else if (dist_dim == 2) { /* the column loop is the only level of the loop */
+		omp_data_map_dist_init_info(__u_map_info__, 0, OMP_DIST_POLICY_DUPLICATE, 0, u_dimX, 0);
+		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, m, 0);
+		omp_map_add_halo_region(__u_map_info__, 1, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
+		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, OMP_ALIGNEE_START, __u_map_info__, OMP_ALL_DIMENSIONS);
+		omp_loop_dist_init_info(__off_info__, 0, OMP_DIST_POLICY_BLOCK, 0, m, 0);
 	} else /* dist == 3 */{
 		omp_data_map_dist_init_info(__u_map_info__, 0, OMP_DIST_POLICY_BLOCK, radius, n, 0);
-		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, n, 1);
+		omp_data_map_dist_init_info(__u_map_info__, 1, OMP_DIST_POLICY_BLOCK, radius, m, 1);
 		omp_map_add_halo_region(__u_map_info__, 0, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
 		omp_map_add_halo_region(__u_map_info__, 1, radius, radius, OMP_DIST_HALO_EDGING_REFLECTING);
-		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, 0, __u_map_info__, OMP_ALL_DIMENSIONS);
+		omp_data_map_dist_align_with_data_map_with_halo(__uold_map_info__, OMP_ALL_DIMENSIONS, OMP_ALIGNEE_START, __u_map_info__, OMP_ALL_DIMENSIONS);
 		omp_loop_dist_init_info(__off_info__, 0, OMP_DIST_POLICY_BLOCK, 0, n, 0);
 		omp_loop_dist_init_info(__off_info__, 1, OMP_DIST_POLICY_BLOCK, 0, m, 1);
 	}
@@ -633,12 +653,30 @@ double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coe
 		x_halos[0].x_dim = -1; /* means all the dimension */
 	}
 
+	/* the odd iterations of the graph, with the loop dist of the even ones */
+	struct stencil2d_off_args odd_args = off_args;
+	omp_data_map_halo_exchange_info_t odd_x_halos[1];
+	omp_offloading_info_t * __odd_off_info__ = NULL;
+
 //#define STANDALONE_DATA_X 1
 #if !defined (STANDALONE_DATA_X)
 	/* there are two approaches we handle halo exchange, appended data exchange or standalone one */
 	/* option 1: appended data exchange */
 	omp_offloading_append_data_exchange_info(__off_info__, x_halos, 1);
+	if (use_graph) {
+		odd_args.u = uold;
+		odd_args.uold = u;
+		__odd_off_info__ = omp_offloading_init_info("stencil2d kernel (odd)", __top__, 1, OMP_OFFLOADING_CODE, 0,
+													stencil2d_omp_mdev_iterate_off_launcher, &odd_args, __top_ndims__);
+		__odd_off_info__->per_iteration_profile = __off_info__->per_iteration_profile;
+		omp_loop_dist_align_with_loop(__odd_off_info__, OMP_ALL_DIMENSIONS, 0, __off_info__, OMP_ALL_DIMENSIONS);
+		odd_x_halos[0] = x_halos[0];
+		odd_x_halos[0].map_info = __uold_map_info__;
+		omp_offloading_append_data_exchange_info(__odd_off_info__, odd_x_halos, 1);
+	}
 #else
+	if (use_graph) fprintf(stderr, "the graph is only recorded with the appended halo exchange, now iterate without it\n");
+	use_graph = 0;
   	/* option 2: standalone offloading */
   	omp_offloading_info_t * uuold_halo_x_off_info = omp_offloading_standalone_data_exchange_init_info("u-uold halo exchange", __top__,1, x_halos, 1);
 #endif
@@ -659,7 +697,19 @@ double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coe
 //	printf("offloading from stencil now\n");
 	double off_kernel_time = read_timer_ms();
 	int itrun;
-	for (itrun =0; itrun < num_runs; itrun++) {
+	if (use_graph) {
+		/* a device only waits for its neighbours of the iteration before, the halo it reads and the halo they read */
+		omp_offloading_graph_t graph;
+		omp_offloading_graph_init(&graph, "stencil2d iterations");
+		int even = omp_offloading_graph_add(&graph, __off_info__);
+		int odd = omp_offloading_graph_add(&graph, __odd_off_info__);
+		omp_offloading_graph_add_dep(&graph, odd, even, OMP_OFFLOADING_DEP_NEIGHBOUR);
+		omp_offloading_graph_add_dep(&graph, even, odd, OMP_OFFLOADING_DEP_NEIGHBOUR); /* loop-carried */
+		for (itrun =0; itrun < num_runs; itrun++) {
+			omp_offloading_graph_run(&graph, num_its/2);
+			omp_offloading_start(__off_info__, 0);
+		}
+	} else for (itrun =0; itrun < num_runs; itrun++) {
 		int it;
 		for (it = 0; it < num_its; it++) {
 			if (it%2==0) {
@@ -690,6 +740,10 @@ double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coe
 	omp_offloading_info_report_profile(__copy_data_off_info__);
 	omp_offloading_info_report_profile(__off_info__);
 	int num_offs = 2;
+	if (use_graph) {
+		omp_offloading_info_report_profile(__odd_off_info__);
+		num_offs = 3;
+	}
 #if defined STANDALONE_DATA_X
 	omp_offloading_info_report_profile(uuold_halo_x_off_info);
 	num_offs = 3;
@@ -697,6 +751,7 @@ double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coe
 	omp_offloading_info_t *infos[num_offs];
 	infos[0] = __copy_data_off_info__;
 	infos[1] = __off_info__;
+	if (use_graph) infos[2] = __odd_off_info__;
 #if defined STANDALONE_DATA_X
 	infos[2] = uuold_halo_x_off_info;
 #endif
@@ -706,6 +761,7 @@ double stencil2d_omp_mdev_iterate(long n, long m, REAL *u, int radius, REAL *coe
 
 	omp_offloading_fini_info(__copy_data_off_info__);
 	omp_offloading_fini_info(__off_info__);
+	if (use_graph) omp_offloading_fini_info(__odd_off_info__);
 #if defined STANDALONE_DATA_X
 	omp_offloading_fini_info(uuold_halo_x_off_info);
 #endif
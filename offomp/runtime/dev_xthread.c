@@ -2,42 +2,328 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/timeb.h>
+#include <sched.h>
+#include <stddef.h>
+#if defined (__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
+#if defined (_OPENMP)
+#include <omp.h>
+#endif
 #include "homp.h"
 
 /**
- * notifying the helper threads to work on the offloading specified in off_info arg
- * It always start with copyto and may stops after copyto for target data
- * master is just the thread that will store
+ * enqueue an offloading request to the offload_queue of a device, called by any host thread.
+ * A producer reserves a ticket by CAS on the tail, and the slot of this ticket is free when its seq equals the ticket.
+ * After the request is stored, seq is set to ticket+1 to hand the slot over to the helper thread.
+ * If the queue is full, the producer waits until the helper thread frees a slot.
  */
-void omp_offloading_start(omp_offloading_info_t *off_info, int free_after_completion) {
-	off_info->free_after_completion = free_after_completion;
+static void omp_offloading_queue_enqueue(omp_device_t * dev, omp_offloading_info_t * off_info) {
+	omp_offloading_queue_t * queue = &dev->offload_queue;
+	omp_offloading_queue_slot_t * slot;
+	unsigned long ticket = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	while (1) {
+		slot = &queue->slots[ticket & (OMP_OFFLOADING_QUEUE_SIZE - 1)];
+		unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)seq - (long)ticket;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue->tail, &ticket, ticket + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+			/* ticket is reloaded by the failed CAS */
+		} else if (diff < 0) { /* queue is full, the helper thread has not consumed the slot of the previous round */
+			sched_yield();
+			ticket = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+		} else { /* other producer took this ticket */
+			ticket = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+		}
+	}
+	slot->off_info = off_info;
+	__atomic_store_n(&slot->seq, ticket + 1, __ATOMIC_RELEASE);
+	/* targeted wakeup of the helper thread of this device only */
+	__atomic_add_fetch(&queue->signal, 1, __ATOMIC_SEQ_CST);
+	omp_dev_wake_all(&queue->signal);
+}
+
+/**
+ * dequeue the next offloading request of the device, only called by the helper thread of the device.
+ * return NULL if no request is available
+ */
+static omp_offloading_info_t * omp_offloading_queue_dequeue(omp_device_t * dev) {
+	omp_offloading_queue_t * queue = &dev->offload_queue;
+	unsigned long ticket = queue->head;
+	omp_offloading_queue_slot_t * slot = &queue->slots[ticket & (OMP_OFFLOADING_QUEUE_SIZE - 1)];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ticket + 1) return NULL;
+	omp_offloading_info_t * off_info = slot->off_info;
+	queue->head = ticket + 1;
+	__atomic_store_n(&slot->seq, ticket + OMP_OFFLOADING_QUEUE_SIZE, __ATOMIC_RELEASE); /* free the slot for the next round */
+	return off_info;
+}
+
+/* serialize the posting of requests that target more than one device, see omp_offloading_post */
+static volatile int omp_offloading_post_lock = 0;
+
+/**
+ * post the offloading to the queue of each device of its topology, the deps of off_info have to be set up already.
+ *
+ * Each queue is lock-free, but a request to multiple devices must be enqueued in the same relative order
+ * on all its devices, otherwise two requests that both sync between devices (halo exchange or AUTO dist) may
+ * deadlock, e.g. dev 0 runs A then B and dev 1 runs B then A. So only the posting of such requests is serialized
+ * by a short spin lock, not the execution.
+ */
+static void omp_offloading_post(omp_offloading_info_t *off_info) {
 	omp_grid_topology_t * top = off_info->top;
     /* generate master trace file */
-
 	off_info->start_time = read_timer_ms(); /* only for the first time */
+	off_info->post_epoch++;
+	off_info->posted = 1;
 
 	int i;
+	if (top->nnodes > 1) {
+		while (__sync_lock_test_and_set(&omp_offloading_post_lock, 1)) {
+			while (omp_offloading_post_lock) sched_yield();
+		}
+	}
 	for (i = 0; i < top->nnodes; i++) {
 		omp_device_t * dev = &omp_devices[top->idmap[i]];
-		if (dev->offload_request != NULL) {
-			fprintf(stderr, "device %d is not ready for answering your request, offloading_start: %X. It is a bug so far\n", dev->id, off_info);
-		}
-		dev->offload_request = off_info;
+		omp_offloading_queue_enqueue(dev, off_info);
 		//printf("offloading to device: %d, %X\n", i, off_info);
-		/* TODO: this is data race if multiple host threads try to offload to the same devices,
-		 * FIX is to use cas operation to update this field
-		 */
 	}
+	if (top->nnodes > 1) __sync_lock_release(&omp_offloading_post_lock);
+}
+
+/**
+ * post the offloading specified in off_info arg to its devices and return without waiting for the completion,
+ * i.e. the nowait semantics. It always start with copyto and may stops after copyto for target data.
+ * The returned handle can be used with omp_offloading_wait/omp_offloading_test, and as the dependency of later offloadings.
+ *
+ * Offloadings posted to the same device are always executed in the posting order on that device, but a device
+ * does not wait for others to complete the previous offloadings. depend is an array of num_depend handles
+ * (i.e. depend(in:) semantics) that must be completed on ALL their devices before any device of this offloading
+ * starts it, which is needed when a device reads the data produced by other devices in the previous offloading,
+ * or when the previous offloading is on a different set of devices.
+ *
+ * Posting an off_info that has not been waited will first wait for it, use omp_offloading_graph_t to have
+ * multiple postings of the same offloading in flight.
+ */
+omp_offloading_handle_t omp_offloading_start_async(omp_offloading_info_t *off_info, int free_after_completion,
+												   omp_offloading_handle_t *depend, int num_depend) {
+	if (off_info->posted) omp_offloading_wait(off_info);
+	if (num_depend > OMP_OFFLOADING_MAX_DEPEND) {
+		fprintf(stderr, "offloading %s depends on %d offloadings, only %d are supported\n", off_info->name, num_depend, OMP_OFFLOADING_MAX_DEPEND);
+		abort();
+	}
+	off_info->free_after_completion = free_after_completion;
+
+	int i;
+	off_info->num_depend = 0;
+	for (i = 0; i < num_depend; i++) {
+		omp_offloading_info_t * dep = depend[i];
+		if (dep == NULL || dep == off_info || !dep->posted) continue; /* waited already, thus completed */
+		off_info->depend[off_info->num_depend] = dep;
+		/* the current posting of dep we depend on, not any later one */
+		off_info->depend_epoch[off_info->num_depend] = dep->post_epoch - (off_info->post_epoch + 1);
+		off_info->depend_type[off_info->num_depend] = OMP_OFFLOADING_DEP_ALL;
+		off_info->num_depend++;
+	}
+
+	omp_offloading_post(off_info);
+	return off_info;
+}
 
-	pthread_barrier_wait(&off_info->barrier);
+/**
+ * return 1 if all the postings of the offloading are completed by all its devices (including the collection of profiling),
+ * 0 otherwise. It does not wait and does not do the bookkeeping of omp_offloading_wait, which has to be called anyway.
+ */
+int omp_offloading_test(omp_offloading_handle_t handle) {
+	int i;
+	for (i=0; i<handle->top->nnodes; i++) {
+		if (__atomic_load_n(&handle->offloadings[i].compl_count, __ATOMIC_ACQUIRE) < handle->post_epoch) return 0;
+	}
+	return 1;
+}
 
-	if (off_info->count) off_info->count++; /* recurring, increment the number of offloading */
+/**
+ * wait for the completion of all the postings of an offloading
+ */
+void omp_offloading_wait(omp_offloading_handle_t handle) {
+	omp_offloading_info_t * off_info = handle;
+	if (!off_info->posted) return;
+	int i;
+	for (i=0; i<off_info->top->nnodes; i++) {
+		omp_offloading_t * off = &off_info->offloadings[i];
+		int compl_count;
+		while ((compl_count = __atomic_load_n(&off->compl_count, __ATOMIC_ACQUIRE)) < off_info->post_epoch)
+			omp_dev_wait_while_equal(NULL, &off->compl_count, compl_count);
+	}
+	off_info->posted = 0;
+
+	if (off_info->count) off_info->count += off_info->post_epoch - off_info->waited_epoch; /* recurring, increment the number of offloading */
+	off_info->waited_epoch = off_info->post_epoch;
 	off_info->compl_time = read_timer_ms();
+}
 
-#if defined (OMP_BREAKDOWN_TIMING)
-	pthread_barrier_wait(&off_info->barrier); /* this one make sure the profiling is collected */
-#endif
+/**
+ * notifying the helper threads to work on the offloading specified in off_info arg and wait for its completion
+ * It always start with copyto and may stops after copyto for target data
+ */
+void omp_offloading_start(omp_offloading_info_t *off_info, int free_after_completion) {
+	omp_offloading_start_async(off_info, free_after_completion, NULL, 0);
+	omp_offloading_wait(off_info);
+}
+
+void omp_offloading_graph_init(omp_offloading_graph_t * graph, const char * name) {
+	graph->name = name;
+	graph->num_nodes = 0;
+}
+
+/* append an offloading to the recorded sequence, return the node index */
+int omp_offloading_graph_add(omp_offloading_graph_t * graph, omp_offloading_info_t * off_info) {
+	int i;
+	for (i=0; i<graph->num_nodes; i++) {
+		if (graph->nodes[i].off_info == off_info) {
+			fprintf(stderr, "offloading %s is already in graph %s, an offloading can only be added once\n", off_info->name, graph->name);
+			abort();
+		}
+	}
+	if (graph->num_nodes == OMP_OFFLOADING_GRAPH_MAX_NODES) {
+		fprintf(stderr, "graph %s has too many offloadings, only %d are supported\n", graph->name, OMP_OFFLOADING_GRAPH_MAX_NODES);
+		abort();
+	}
+	omp_offloading_graph_node_t * node = &graph->nodes[graph->num_nodes];
+	node->off_info = off_info;
+	node->num_deps = 0;
+	return graph->num_nodes++;
+}
+
+/* node depends on dep_node, which is the previous iteration of dep_node if dep_node >= node */
+void omp_offloading_graph_add_dep(omp_offloading_graph_t * graph, int node, int dep_node, omp_offloading_dep_type_t type) {
+	omp_offloading_graph_node_t * n = &graph->nodes[node];
+	if (n->num_deps == OMP_OFFLOADING_MAX_DEPEND) {
+		fprintf(stderr, "offloading %s in graph %s has too many dependencies, only %d are supported\n", n->off_info->name, graph->name, OMP_OFFLOADING_MAX_DEPEND);
+		abort();
+	}
+	n->deps[n->num_deps] = dep_node;
+	n->dep_types[n->num_deps] = type;
+	n->num_deps++;
+}
+
+/**
+ * replay the graph for num_iterations and wait for the completion. The submitter posts all the iterations without waiting
+ * (bounded only by the device queue size), and each device runs ahead as far as the dependencies allow.
+ */
+void omp_offloading_graph_run(omp_offloading_graph_t * graph, int num_iterations) {
+	int i, j, it;
+	/* nothing of the graph can be in flight when the deps are changed */
+	for (i=0; i<graph->num_nodes; i++) omp_offloading_wait(graph->nodes[i].off_info);
+
+	/* each node is posted once per iteration, thus the relative epoch of a dep is fixed for all iterations */
+	for (i=0; i<graph->num_nodes; i++) {
+		omp_offloading_graph_node_t * node = &graph->nodes[i];
+		omp_offloading_info_t * off_info = node->off_info;
+		off_info->free_after_completion = 0;
+		off_info->num_depend = node->num_deps;
+		for (j=0; j<node->num_deps; j++) {
+			omp_offloading_info_t * dep = graph->nodes[node->deps[j]].off_info;
+			off_info->depend[j] = dep;
+			off_info->depend_epoch[j] = dep->post_epoch - off_info->post_epoch;
+			if (node->deps[j] >= i) off_info->depend_epoch[j]--; /* loop-carried */
+			off_info->depend_type[j] = node->dep_types[j];
+		}
+	}
+
+	for (it=0; it<num_iterations; it++) {
+		for (i=0; i<graph->num_nodes; i++) omp_offloading_post(graph->nodes[i].off_info);
+	}
+	for (i=0; i<graph->num_nodes; i++) {
+		omp_offloading_wait(graph->nodes[i].off_info);
+		graph->nodes[i].off_info->num_depend = 0;
+	}
+}
+
+/* wait for the epoch-th completion of off on dev */
+static void omp_offloading_wait_compl_count(omp_device_t * dev, omp_offloading_t * off, int epoch) {
+	int compl_count;
+	while ((compl_count = __atomic_load_n(&off->compl_count, __ATOMIC_ACQUIRE)) < epoch)
+		omp_dev_wait_while_equal(dev, &off->compl_count, compl_count);
+}
+
+/**
+ * wait for the offloadings the off depends on, epoch is the posting of off being run
+ */
+static void omp_offloading_wait_depend(omp_offloading_t * off, int epoch) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_device_t * dev = off->dev;
+	int i, j;
+	for (i=0; i<off_info->num_depend; i++) {
+		omp_offloading_info_t * dep = off_info->depend[i];
+		int dep_epoch = epoch + off_info->depend_epoch[i];
+		if (dep_epoch <= 0) continue;
+		omp_grid_topology_t * top = dep->top;
+		int seqid = omp_grid_topology_get_seqid(top, dev->id);
+		if (off_info->depend_type[i] == OMP_OFFLOADING_DEP_ALL || seqid < 0) {
+			for (j=0; j<top->nnodes; j++) omp_offloading_wait_compl_count(dev, &dep->offloadings[j], dep_epoch);
+		} else {
+			omp_offloading_wait_compl_count(dev, &dep->offloadings[seqid], dep_epoch);
+			if (off_info->depend_type[i] == OMP_OFFLOADING_DEP_NEIGHBOUR) {
+				for (j=0; j<top->ndims; j++) {
+					int left, right;
+					omp_topology_get_neighbors(top, seqid, j, 1, &left, &right); /* cyclic one includes periodic halo */
+					if (left >= 0) omp_offloading_wait_compl_count(dev, &dep->offloadings[left], dep_epoch);
+					if (right >= 0) omp_offloading_wait_compl_count(dev, &dep->offloadings[right], dep_epoch);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * whether the halo of dim is exchanged between map and its neighbour on the given side (0: left, 1: right) only through the
+ * host relay buffers, in both directions. Then neither reads the memory of the other and the relay counters alone order
+ * the exchange.
+ */
+static int omp_halo_relay_only(omp_data_map_t * map, int dim, int side) {
+	omp_data_map_halo_region_mem_t * halo_mem = &map->halo_mem[dim];
+	if (side == 0) {
+		omp_data_map_t * left_map = &map->info->maps[halo_mem->left_dev_seqid];
+		return halo_mem->left_in_host_relay_ptr != NULL && left_map->halo_mem[dim].right_in_host_relay_ptr != NULL;
+	} else {
+		omp_data_map_t * right_map = &map->info->maps[halo_mem->right_dev_seqid];
+		return halo_mem->right_in_host_relay_ptr != NULL && right_map->halo_mem[dim].left_in_host_relay_ptr != NULL;
+	}
+}
+
+/**
+ * the neighbour-only sync of the halo exchange, replacing the barrier of all the devices: increase the counter of off
+ * (x_arrived or x_pulled, given by the offset) and wait for the same counter of all the halo neighbours to catch up.
+ * A neighbour linked by relay only (see omp_halo_relay_only) is not waited for after the first run, the double-buffered
+ * relay lets it push the next exchange while this one still pulls. The first run waits since the neighbour may not
+ * have set up its map (and relay buffers) yet.
+ */
+static void omp_offloading_halo_neighbour_sync(omp_offloading_t * off, size_t counter_offset) {
+	omp_offloading_info_t * off_info = off->off_info;
+	volatile int * counter = (volatile int *)((char*)off + counter_offset);
+	int mine = __atomic_add_fetch(counter, 1, __ATOMIC_SEQ_CST);
+	omp_dev_wake_all(counter);
+
+	int i, dim;
+	for (i=0; i<off_info->num_maps_halo_x; i++) {
+		omp_data_map_halo_exchange_info_t * x_halos = &off_info->halo_x_info[i];
+		omp_data_map_t * map = &x_halos->map_info->maps[off->devseqid];
+		for (dim=0; dim<x_halos->map_info->num_dims; dim++) {
+			if (x_halos->x_dim >= 0 && dim != x_halos->x_dim) continue;
+			if (x_halos->map_info->halo_info[dim].left == 0 && x_halos->map_info->halo_info[dim].right == 0) continue;
+			int neighbours[2] = {map->halo_mem[dim].left_dev_seqid, map->halo_mem[dim].right_dev_seqid};
+			int j;
+			for (j=0; j<2; j++) {
+				if (neighbours[j] < 0 || neighbours[j] == off->devseqid) continue;
+				if (off->count > 1 && omp_halo_relay_only(map, dim, j)) continue;
+				volatile int * ncounter = (volatile int *)((char*)&off_info->offloadings[neighbours[j]] + counter_offset);
+				int n;
+				while ((n = __atomic_load_n(ncounter, __ATOMIC_ACQUIRE)) < mine) omp_dev_wait_while_equal(off->dev, ncounter, n);
+			}
+		}
+	}
 }
 
 #if defined (OMP_BREAKDOWN_TIMING)
@@ -54,11 +340,249 @@ int acc_ex_post_barrier_event_index = 7;/* host event */
 int acc_mapfrom_event_index = 8;		/* dev event */
 
 int sync_cleanup_event_index = 9;		/* host event */
-int barrier_wait_event_index = 10;		/* host event */
 
-int misc_event_index_start = 11;        /* other events, e.g. mapto/from for each array, start with 9*/
+int misc_event_index_start = 10;        /* other events, e.g. mapto/from for each array, start with 9*/
 #endif
 
+/**
+ * whether the rows of a map are exactly the loop iterations of the offloading on this device,
+ * so a chunk of the iterations only needs the same chunk of rows. A DUPLICATE map is never, even when the loop dist
+ * also covers the whole range, e.g. on a single device or for a DYNAMIC loop
+ */
+static int omp_map_aligned_with_loop(omp_data_map_t * map, omp_offloading_t * off) {
+	return map->map_type == OMP_DATA_MAP_COPY && !map->mem_noncontiguous && map->info->num_halo_dims == 0 &&
+		   map->info->dist_info[0].policy != OMP_DIST_POLICY_DUPLICATE &&
+		   map->map_size == map->map_wextra_size && map->map_dist[0].length > 0 &&
+		   map->map_dist[0].offset == off->loop_dist[0].offset && map->map_dist[0].length == off->loop_dist[0].length;
+}
+
+/* see omp_offloading_set_pipeline_chunks */
+static int omp_offloading_pipeline_eligible(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	if (off_info->num_pipeline_chunks <= 1 || off->dev->num_streams <= 1) return 0;
+	if (off_info->type != OMP_OFFLOADING_CODE && off_info->type != OMP_OFFLOADING_DATA_CODE) return 0;
+	if (off_info->loop_depth != 1 || off_info->halo_x_info != NULL || off_info->num_reductions > 0) return 0;
+	if (off->loop_dist[0].length < off_info->num_pipeline_chunks) return 0;
+	if (omp_dist_num_chunks(&off->loop_dist[0]) > 1) return 0; /* the CYCLIC chunks are not a range of the aligned maps */
+	return 1;
+}
+
+/**
+ * copy a chunk (rows [chunk_start, chunk_start+chunk_length)) of the aligned maps of the direction, or the whole of the
+ * other maps of the direction if chunk_length < 0
+ */
+static void omp_offloading_pipeline_copy(omp_offloading_t * off, int to, long chunk_start, long chunk_length, omp_dev_stream_t * stream) {
+	int i;
+	for (i=0; i<off->num_maps; i++) {
+		int inherited;
+		omp_data_map_t * map = omp_map_offcache_iterator(off, i, &inherited);
+		if (inherited) continue;
+		omp_data_map_direction_t direction = map->info->map_direction;
+		if (direction != OMP_DATA_MAP_TOFROM && direction != (to ? OMP_DATA_MAP_TO : OMP_DATA_MAP_FROM)) continue;
+		int aligned = omp_map_aligned_with_loop(map, off);
+		if (chunk_length < 0) {
+			if (aligned) continue;
+			if (to) omp_map_mapto_async(map, stream);
+			else omp_map_mapfrom_async(map, stream);
+		} else if (aligned) {
+			omp_map_register_host(map); /* the chunks only overlap if the host region is page-locked */
+			long row_size = map->map_size / map->map_dist[0].length;
+			long offset = chunk_start * row_size;
+			if (to) omp_map_memcpy_to_async(map->map_dev_ptr + offset, map->dev, map->map_source_ptr + offset, chunk_length * row_size, stream);
+			else omp_map_memcpy_from_async(map->map_source_ptr + offset, map->map_dev_ptr + offset, map->dev, chunk_length * row_size, stream);
+		}
+	}
+}
+
+/**
+ * run the copyto, kernel and copyfrom of a pipelined offloading chunk by chunk, the chunks are issued round-robin to the
+ * streams of the device so the operations of different chunks overlap. The non-aligned maps are copied in before
+ * the first chunk and copied out after the last one on the offloading stream.
+ */
+static void omp_offloading_pipeline_run(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_device_t * dev = off->dev;
+	omp_dev_stream_t * stream = off->stream;
+	int num_chunks = off_info->num_pipeline_chunks;
+	int i;
+
+	omp_offloading_pipeline_copy(off, 1, 0, -1, stream);
+	omp_stream_sync(stream); /* the chunks on other streams need them */
+
+	void * args = off_info->args;
+	void (*kernel_launcher)(omp_offloading_t *, void *) = off_info->kernel_launcher;
+	if (args == NULL) args = off->args;
+	if (kernel_launcher == NULL) kernel_launcher = off->kernel_launcher;
+
+	for (i=0; i<num_chunks; i++) {
+		omp_dev_stream_t * chunk_stream = &dev->devstreams[i % dev->num_streams];
+		long chunk_start, chunk_length;
+		omp_dist_block(0, off->loop_dist[0].length, i, num_chunks, &chunk_start, &chunk_length);
+		omp_offloading_pipeline_copy(off, 1, chunk_start, chunk_length, chunk_stream);
+		off->chunk_start = chunk_start;
+		off->chunk_length = chunk_length;
+		off->stream = chunk_stream;
+		kernel_launcher(off, args);
+		omp_offloading_pipeline_copy(off, 0, chunk_start, chunk_length, chunk_stream);
+	}
+	off->chunk_length = -1;
+	off->stream = stream;
+	for (i=0; i<dev->num_streams; i++) omp_stream_sync(&dev->devstreams[i]);
+
+	omp_offloading_pipeline_copy(off, 0, 0, -1, stream);
+}
+
+/**
+ * run a DYNAMIC/GUIDED loop: the device claims chunks of the iterations (see omp_loop_dist_claim_chunk) until all of them
+ * are claimed, and copies in, runs and copies out each chunk like a pipelined one, thus a faster device runs more chunks.
+ * A stream is synced before it gets a new chunk, so at most num_streams chunks of the device are in flight and the device
+ * does not claim more than it can start. With reductions, the chunks are run on the offloading stream one after another
+ * since the per-block results of a chunk are folded before the blocks are reused by the next one.
+ */
+static void omp_offloading_dynamic_run(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_device_t * dev = off->dev;
+	omp_dev_stream_t * stream = off->stream;
+	int num_streams = off_info->num_reductions > 0 ? 1 : dev->num_streams;
+	int i;
+
+	if (off_info->loop_depth != 1 || off_info->halo_x_info != NULL) {
+		fprintf(stderr, "DYNAMIC and GUIDED dist policies are only supported for a 1-level loop without halo exchange (%s)\n", off_info->name);
+		abort();
+	}
+
+	omp_offloading_pipeline_copy(off, 1, 0, -1, stream);
+	omp_stream_sync(stream); /* the chunks on other streams need them */
+
+	void * args = off_info->args;
+	void (*kernel_launcher)(omp_offloading_t *, void *) = off_info->kernel_launcher;
+	if (args == NULL) args = off->args;
+	if (kernel_launcher == NULL) kernel_launcher = off->kernel_launcher;
+
+	if (off_info->num_reductions > 0) omp_offloading_reduction_start(off);
+	for (i=0; ; i++) {
+		omp_dev_stream_t * chunk_stream = num_streams == 1 ? stream : &dev->devstreams[i % num_streams];
+		if (i >= num_streams) omp_stream_sync(chunk_stream);
+		long chunk_start, chunk_length;
+		chunk_length = omp_loop_dist_claim_chunk(off, &chunk_start);
+		if (chunk_length == 0) break;
+		omp_offloading_pipeline_copy(off, 1, chunk_start, chunk_length, chunk_stream);
+		off->chunk_start = chunk_start;
+		off->chunk_length = chunk_length;
+		off->stream = chunk_stream;
+		kernel_launcher(off, args);
+		if (off_info->num_reductions > 0) {
+			omp_offloading_reduction_copy_blocks(off);
+			omp_stream_sync(chunk_stream);
+			omp_offloading_reduction_fold_blocks(off);
+		}
+		omp_offloading_pipeline_copy(off, 0, chunk_start, chunk_length, chunk_stream);
+	}
+	off->chunk_length = -1;
+	off->stream = stream;
+	for (i=0; i<num_streams; i++) omp_stream_sync(num_streams == 1 ? stream : &dev->devstreams[i]);
+
+	omp_offloading_pipeline_copy(off, 0, 0, -1, stream);
+}
+
+/**
+ * target enter data: the arrays not present on the device are mapped, copied to the device (for TO and TOFROM) and
+ * added to the present table; for the present ones, only the reference count is increased.
+ * An array mapped by an enclosing target data is left to it.
+ */
+static void omp_offloading_enter_data(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_device_t * dev = off->dev;
+	int seqid = off->devseqid;
+	int i;
+	for (i=0; i<off_info->num_mapped_vars; i++) {
+		omp_data_map_info_t * map_info = &off_info->data_map_info[i];
+		omp_data_map_present_t * entry = omp_map_present_lookup(dev, map_info->source_ptr);
+		if (entry != NULL) {
+			entry->refcount++;
+			continue;
+		}
+		if (omp_map_get_map_inheritance(dev, map_info->source_ptr) != NULL) continue;
+
+		omp_data_map_t * map = &map_info->maps[seqid];
+		omp_data_map_init_map(map, map_info, dev);
+		omp_data_map_dist(map, seqid);
+		omp_map_malloc(map, off);
+		if (map_info->map_direction == OMP_DATA_MAP_TO || map_info->map_direction == OMP_DATA_MAP_TOFROM) {
+			omp_map_mapto_async(map, off->stream);
+		}
+		omp_map_present_add(dev, map);
+	}
+}
+
+/**
+ * target exit data: decrease the reference count of the present arrays (set to 0 for DELETE), the arrays whose
+ * count drops to 0 are copied back (for FROM and TOFROM), freed and removed from the present table
+ */
+static void omp_offloading_exit_data(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_device_t * dev = off->dev;
+	int i;
+	for (i=0; i<off_info->num_mapped_vars; i++) {
+		omp_data_map_info_t * map_info = &off_info->data_map_info[i];
+		omp_data_map_present_t * entry = omp_map_present_lookup(dev, map_info->source_ptr);
+		if (entry == NULL || entry->refcount <= 0) continue;
+		if (map_info->map_direction == OMP_DATA_MAP_DELETE) entry->refcount = 0;
+		else entry->refcount--;
+		if (entry->refcount == 0 && (map_info->map_direction == OMP_DATA_MAP_FROM || map_info->map_direction == OMP_DATA_MAP_TOFROM)) {
+			omp_map_mapfrom_async(entry->map, off->stream);
+		}
+	}
+	omp_stream_sync(off->stream);
+
+	for (i=dev->num_resident_data_maps-1; i>=0; i--) {
+		omp_data_map_present_t * entry = &dev->resident_data_maps[i];
+		if (entry->refcount > 0) continue;
+		omp_map_free(entry->map, off);
+		omp_map_present_remove(dev, entry);
+	}
+}
+
+/**
+ * target update of the host sub-range [source_ptr, source_ptr + the size given by dims) of each map, for the part of the
+ * sub-range mapped to this device. The device buffer mirrors the host range of the map, thus the update is one memcpy.
+ * Update from device does not copy the halo region since it is owned by the neighbours.
+ */
+static void omp_offloading_update(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_device_t * dev = off->dev;
+	int i, j;
+	for (i=0; i<off_info->num_mapped_vars; i++) {
+		omp_data_map_info_t * map_info = &off_info->data_map_info[i];
+		omp_data_map_t * map = omp_map_get_map_inheritance(dev, map_info->source_ptr);
+		if (map == NULL || map->map_type != OMP_DATA_MAP_COPY) continue; /* not present or shared with the host */
+		if (map->mem_noncontiguous || map->info->num_halo_dims) { /* the whole box of the map, see omp_map_mapto_async */
+			if (map_info->map_direction == OMP_DATA_MAP_TO) omp_map_mapto_async(map, off->stream);
+			else if (map_info->map_direction == OMP_DATA_MAP_FROM) omp_map_mapfrom_async(map, off->stream);
+			continue;
+		}
+
+		long size = map_info->sizeof_element;
+		for (j=0; j<map_info->num_dims; j++) size *= map_info->dims[j];
+		char * start = map_info->source_ptr;
+		char * end = start + size;
+
+		if (map_info->map_direction == OMP_DATA_MAP_TO) {
+			char * lo = start > map->map_source_wextra_ptr ? start : map->map_source_wextra_ptr;
+			char * hi = map->map_source_wextra_ptr + map->map_wextra_size;
+			if (end < hi) hi = end;
+			if (lo >= hi) continue;
+			omp_map_memcpy_to_async(map->map_dev_wextra_ptr + (lo - map->map_source_wextra_ptr), dev, lo, hi - lo, off->stream);
+		} else if (map_info->map_direction == OMP_DATA_MAP_FROM) {
+			char * lo = start > map->map_source_ptr ? start : map->map_source_ptr;
+			char * hi = map->map_source_ptr + map->map_size;
+			if (end < hi) hi = end;
+			if (lo >= hi) continue;
+			omp_map_memcpy_from_async(lo, map->map_dev_ptr + (lo - map->map_source_ptr), dev, hi - lo, off->stream);
+		}
+	}
+}
+
 /**
  * called by the shepherd thread
  */
@@ -72,6 +596,9 @@ void omp_offloading_run(omp_device_t * dev) {
 	int devid = dev->id;
 	int i = 0;
 
+	/* wait for the offloadings this one depends on */
+	omp_offloading_wait_depend(off, off->compl_count + 1);
+
 #if defined (OMP_BREAKDOWN_TIMING)
 	/* the num_mapped_vars * 2 +4 is the rough number of events needed */
 	/* the event (if mapto var is num_mapto, and mapfrom var is num_mapfrom (both including tofrom);
@@ -84,13 +611,12 @@ void omp_offloading_run(omp_device_t * dev) {
 	 * acc_kernel_exe_event_index+1: The accumulated time for mapfrom datamovement, measured from dev
 	 *     acc_kernel_exe_event_index+2 - xxxx: The time for each mapfrom datamovement, measured from dev (total num_mapfrom events)
 	 * xxxx: The time for cleanup resources (stream, event, data unmarshalling, etc), measured from host
-	 * xxxx: The time for barrier wait (for other kernel to complete), measured from host
 	 */
 
 	int num_events;
 	omp_event_t *events;
-	if (off_info->count <= 1) { /* the first time of recurring offloading or a non-recurring offloading */
-		num_events = off_info->num_mapped_vars * 2 + 11; /* the max posibble # of events to be used */
+	if (off->count <= 1) { /* the first time of recurring offloading or a non-recurring offloading */
+		num_events = off_info->num_mapped_vars * 2 + 10; /* the max posibble # of events to be used */
 		events = (omp_event_t *) malloc(sizeof(omp_event_t) * num_events); /**TODO: free this memory somewhere later */
 		off->num_events = num_events;
 		off->events = events;
@@ -102,12 +628,12 @@ void omp_offloading_run(omp_device_t * dev) {
 	int misc_event_index = misc_event_index_start;
 
 	/* set up stream and event */
-	if (off_info->count <= 1) omp_event_init(&events[total_event_index], dev, OMP_EVENT_HOST_RECORD);
+	if (off->count <= 1) omp_event_init(&events[total_event_index], dev, OMP_EVENT_HOST_RECORD);
 	omp_event_record_start(&events[total_event_index], NULL, "OFF_TOTAL", "Total offloading time (everything) on dev: %d", devid);
 #endif
 
 //	case OMP_OFFLOADING_INIT:
-	if (off_info->count <= 1) { /* the first time of recurring offloading or a non-recurring offloading */
+	if (off->count <= 1) { /* the first time of recurring offloading or a non-recurring offloading */
 #if defined USING_PER_OFFLOAD_STREAM
 		omp_stream_create(dev, &off->mystream);
 		off->stream = &off->mystream;
@@ -121,7 +647,6 @@ void omp_offloading_run(omp_device_t * dev) {
 
 		omp_event_init(&events[map_init_event_index], dev, OMP_EVENT_HOST_RECORD);
 		omp_event_init(&events[sync_cleanup_event_index], dev, OMP_EVENT_HOST_RECORD);
-		omp_event_init(&events[barrier_wait_event_index], dev, OMP_EVENT_HOST_RECORD);
 		omp_event_init(&events[acc_mapto_event_index], dev, OMP_EVENT_DEV_RECORD);
 		omp_event_init(&events[acc_kernel_exe_event_index], dev, OMP_EVENT_DEV_RECORD);
 		omp_event_init(&events[acc_mapfrom_event_index], dev, OMP_EVENT_DEV_RECORD);
@@ -138,6 +663,7 @@ void omp_offloading_run(omp_device_t * dev) {
 
 	    //case OMP_OFFLOADING_MAPMEM:
 		off->stage = OMP_OFFLOADING_MAPMEM;
+		off->num_maps = 0;
 		/* init data map and dev memory allocation */
 		/***************** for each mapped variable has to and tofrom, if it has region mapped to this __ndev_i__ id, we need code here *******************************/
 #if defined (OMP_BREAKDOWN_TIMING)
@@ -148,7 +674,7 @@ void omp_offloading_run(omp_device_t * dev) {
 		} else { /* OMP_OFFLOADING_DATA */
 			off->loop_dist_done = 1;
 		}
-		for (i=0; i<off_info->num_mapped_vars; i++) {
+		for (i=0; i<off_info->num_mapped_vars && !omp_offloading_unstructured_data(off_info->type); i++) {
 			/* we handle inherited map here, by each helper thread, and we only update the off object (not off_info)*/
 			omp_data_map_info_t * map_info = &off_info->data_map_info[i];
 
@@ -177,15 +703,67 @@ void omp_offloading_run(omp_device_t * dev) {
 
 	omp_dev_stream_t *stream = off->stream;
 
+	/* the adaptive AUTO dist times the copyto, kernel and copyfrom of each run by itself, since the events are only
+	 * recorded with OMP_BREAKDOWN_TIMING, and re-partitions the loop before the copyto of the next run */
+	int auto_adapt = omp_offloading_auto_adaptive(off);
+	double auto_time[5] = {0.0, 0.0, 0.0, 0.0, 0.0}; /* start of copyto, kernel, end of kernel, start of copyfrom, end of run */
+	if (auto_adapt && off->count > 1) omp_offloading_auto_adapt(off);
+
+	if (omp_offloading_unstructured_data(off_info->type)) {
+		off->stage = OMP_OFFLOADING_COPYTO;
+#if defined (OMP_BREAKDOWN_TIMING)
+		omp_event_record_start(&events[acc_mapto_event_index], stream, "ACC_MAPTO", "Time for target enter/exit data or update (%s)", off_info->name);
+#endif
+		if (off_info->type == OMP_OFFLOADING_ENTER_DATA) omp_offloading_enter_data(off);
+		else if (off_info->type == OMP_OFFLOADING_EXIT_DATA) omp_offloading_exit_data(off);
+		else omp_offloading_update(off);
+#if defined (OMP_BREAKDOWN_TIMING)
+		omp_event_record_stop(&events[acc_mapto_event_index]);
+#endif
+		goto omp_offloading_sync_cleanup;
+	}
+
 	if (off_info->type == OMP_OFFLOADING_STANDALONE_DATA_EXCHANGE) goto data_exchange;
-	if (off_info->type == OMP_OFFLOADING_DATA && off_info->count > 1) {
+	if (off_info->type == OMP_OFFLOADING_DATA && off->count > 1) {
 		goto omp_offloading_copyfrom;
 	}
 
+	if (omp_loop_dist_dynamic(off_info) && (off_info->type == OMP_OFFLOADING_CODE || off_info->type == OMP_OFFLOADING_DATA_CODE)) {
+		off->stage = OMP_OFFLOADING_KERNEL;
+#if defined (OMP_BREAKDOWN_TIMING)
+		omp_event_record_start(&events[acc_kernel_exe_event_index], stream, "KERN", "Time for copyto, kernel (%s) and copyfrom of the dynamically claimed chunks",
+							   off_info->name);
+#endif
+		omp_offloading_dynamic_run(off);
+#if defined (OMP_BREAKDOWN_TIMING)
+		omp_event_record_stop(&events[acc_kernel_exe_event_index]);
+#endif
+		off->stage = OMP_OFFLOADING_COPYFROM;
+		goto omp_offloading_sync_cleanup;
+	}
+
+	if (omp_offloading_pipeline_eligible(off)) {
+		off->stage = OMP_OFFLOADING_KERNEL;
+#if defined (OMP_BREAKDOWN_TIMING)
+		omp_event_record_start(&events[acc_kernel_exe_event_index], stream, "KERN", "Time for pipelined copyto, kernel (%s) and copyfrom of %d chunks",
+							   off_info->name, off_info->num_pipeline_chunks);
+#endif
+		/* the overlapped copies are timed as part of the kernel */
+		if (auto_adapt) auto_time[0] = auto_time[1] = read_timer_ms();
+		omp_offloading_pipeline_run(off);
+		if (auto_adapt) auto_time[2] = auto_time[3] = read_timer_ms();
+#if defined (OMP_BREAKDOWN_TIMING)
+		omp_event_record_stop(&events[acc_kernel_exe_event_index]);
+#endif
+		off->stage = OMP_OFFLOADING_COPYFROM;
+		goto omp_offloading_sync_cleanup;
+	}
+
 //	case OMP_OFFLOADING_COPYTO:
 	{
 omp_offloading_copyto: ;
 		off->stage = OMP_OFFLOADING_COPYTO;
+		if (auto_adapt) auto_time[0] = read_timer_ms();
 #if defined (OMP_BREAKDOWN_TIMING)
 		if (off_info->num_mapped_vars > 0)
 			omp_event_record_start(&events[acc_mapto_event_index], stream, "ACC_MAPTO", "Accumulated time for mapto data movement for all array");
@@ -198,6 +776,9 @@ omp_offloading_copyto: ;
 			if (map_info->map_direction == OMP_DATA_MAP_TO || map_info->map_direction == OMP_DATA_MAP_TOFROM) {
 #if defined (OMP_BREAKDOWN_TIMING)
 				omp_event_record_start(&events[misc_event_index], stream, "MAPTO_", "Time for mapto data movement for array %s", map_info->symbol);
+				events[misc_event_index].symbol = map_info->symbol;
+				events[misc_event_index].bytes = map->map_type == OMP_DATA_MAP_COPY ? map->map_wextra_size : 0;
+				events[acc_mapto_event_index].bytes += events[misc_event_index].bytes;
 #endif
 				omp_map_mapto_async(map, off->stream);
 				//omp_map_memcpy_to_async((void*)map->map_dev_ptr, dev, (void*)map->map_buffer, map->map_size, off->stream); /* memcpy from host to device */
@@ -230,7 +811,28 @@ omp_offloading_copyto: ;
 		void (*kernel_launcher)(omp_offloading_t *, void *) = off_info->kernel_launcher;
 		if (args == NULL) args = off->args;
 		if (kernel_launcher == NULL) kernel_launcher = off->kernel_launcher;
+		if (off_info->num_reductions > 0) omp_offloading_reduction_start(off);
+		if (auto_adapt) {
+			omp_stream_sync(off->stream);
+			auto_time[1] = read_timer_ms();
+		}
+		long long perf_counts[OMP_PERF_NUM_COUNTERS];
+		int perf_counted = dev->perf_fds[OMP_PERF_TASK_CLOCK] >= 0 || dev->perf_fds[OMP_PERF_CYCLES] >= 0;
+		double perf_time = 0.0;
+		if (perf_counted) {
+			omp_perf_counters_read(dev, perf_counts);
+			perf_time = read_timer_ms();
+		}
 		kernel_launcher(off, args);
+		if (perf_counted) {
+			omp_stream_sync(off->stream);
+			omp_perf_kernel_stop(off, perf_counts, read_timer_ms() - perf_time);
+		}
+		if (off_info->num_reductions > 0) omp_offloading_reduction_copy_blocks(off);
+		if (auto_adapt) {
+			omp_stream_sync(off->stream);
+			auto_time[2] = read_timer_ms();
+		}
 #if defined (OMP_BREAKDOWN_TIMING)
 		omp_event_record_stop(&events[acc_kernel_exe_event_index]);
 #endif
@@ -242,9 +844,9 @@ data_exchange:;
 	if (off_info->halo_x_info != NULL) {
 		omp_stream_sync(off->stream);/* make sure previous operation are complete, should NOT be timed for exchange */
 #if defined (OMP_BREAKDOWN_TIMING)
-		omp_event_record_start(&events[acc_ex_pre_barrier_event_index], NULL, "PRE_BAR_X", "Time for barrier sync before data exchange between devices");
+		omp_event_record_start(&events[acc_ex_pre_barrier_event_index], NULL, "PRE_BAR_X", "Time for sync with the neighbours before data exchange between devices");
 #endif
-		pthread_barrier_wait(&off_info->inter_dev_barrier); /* make sure everybody is completed so we can exchange now */
+		omp_offloading_halo_neighbour_sync(off, offsetof(omp_offloading_t, x_arrived)); /* make sure the neighbours are completed so we can exchange now */
 #if defined (OMP_BREAKDOWN_TIMING)
 		omp_event_record_stop(&events[acc_ex_pre_barrier_event_index]);
 #endif
@@ -252,20 +854,32 @@ data_exchange:;
 #if defined (OMP_BREAKDOWN_TIMING)
 		omp_event_record_start(&events[acc_ex_event_index], NULL, "DATA_X", "Time for data exchange between devices");
 #endif
-		for (i=0; i<off_info->num_maps_halo_x; i++) {
-			omp_data_map_halo_exchange_info_t * x_halos = &off_info->halo_x_info[i];
-			omp_data_map_info_t * map_info = x_halos->map_info;
-			//int devseqid = omp_grid_topology_get_seqid(map_info->top, dev->id);
+		/* the dims are exchanged one after another with the neighbours synced in between, thus the halo of a later dim
+		 * pulled from a neighbour includes what the neighbour got in the earlier dims, i.e. the corners of the diagonal ones */
+		int x_dim;
+		int x_dims_pulled = 0;
+		for (x_dim=0; x_dim<OMP_MAX_NUM_DIMENSIONS; x_dim++) {
+			int pulled = 0;
+			for (i=0; i<off_info->num_maps_halo_x; i++) {
+				omp_data_map_halo_exchange_info_t * x_halos = &off_info->halo_x_info[i];
+				omp_data_map_info_t * map_info = x_halos->map_info;
+				//int devseqid = omp_grid_topology_get_seqid(map_info->top, dev->id);
+				if (x_dim >= map_info->num_dims || (x_halos->x_dim >= 0 && x_halos->x_dim != x_dim)) continue;
+				if (map_info->halo_info[x_dim].left == 0 && map_info->halo_info[x_dim].right == 0) continue;
+				if (!pulled && x_dims_pulled) omp_offloading_halo_neighbour_sync(off, offsetof(omp_offloading_t, x_dim_done));
+				pulled = 1;
 
-			omp_data_map_t * map = &map_info->maps[seqid];
-			omp_halo_region_pull(map, x_halos->x_dim, x_halos->x_direction);
+				omp_data_map_t * map = &map_info->maps[seqid];
+				omp_halo_region_pull(map, x_dim, x_halos->x_direction);
+			}
+			x_dims_pulled += pulled;
 		}
 #if defined (OMP_BREAKDOWN_TIMING)
 		omp_event_record_stop(&events[acc_ex_event_index]);
-		omp_event_record_start(&events[acc_ex_post_barrier_event_index], NULL, "POST_BAR_X", "Time for barrier sync after data exchange between devices");
+		omp_event_record_start(&events[acc_ex_post_barrier_event_index], NULL, "POST_BAR_X", "Time for sync with the neighbours after data exchange between devices");
 #endif
 //		dev->offload_request = NULL; /* release this dev */
-		pthread_barrier_wait(&off_info->inter_dev_barrier);
+		omp_offloading_halo_neighbour_sync(off, offsetof(omp_offloading_t, x_pulled)); /* make sure the neighbours pulled from us */
 		//printf("dev: %d (seqid: %d) holo region pull\n", dev->id, seqid);
 
 #if defined (OMP_BREAKDOWN_TIMING)
@@ -278,6 +892,7 @@ data_exchange:;
 	{
 omp_offloading_copyfrom: ;
 		off->stage = OMP_OFFLOADING_COPYFROM;
+		if (auto_adapt) auto_time[3] = read_timer_ms();
 #if defined (OMP_BREAKDOWN_TIMING)
 		if (off_info->num_mapped_vars > 0)
 			omp_event_record_start(&events[acc_mapfrom_event_index], stream,  "ACC_MAPFROM", "Accumulated time for mapfrom data movement for all array");
@@ -292,6 +907,10 @@ omp_offloading_copyfrom: ;
 #if defined (OMP_BREAKDOWN_TIMING)
 				/* TODO bug here if this is reached from the above goto, since events is not available */
 				omp_event_record_start(&events[misc_event_index], stream, "MAPFROM_", "Time for mapfrom data movement for array %s", map_info->symbol);
+				events[misc_event_index].symbol = map_info->symbol;
+				events[misc_event_index].bytes = map->map_type == OMP_DATA_MAP_COPY ? map->map_wextra_size : 0;
+				if (events[misc_event_index].bytes && map->info->num_halo_dims) events[misc_event_index].bytes = map->map_size; /* the halo is not copied back */
+				events[acc_mapfrom_event_index].bytes += events[misc_event_index].bytes;
 #endif
 				omp_map_mapfrom_async(map, off->stream);
 				//omp_map_memcpy_from_async((void*)map->map_buffer, (void*)map->map_dev_ptr, dev, map->map_size, off->stream); /* memcpy from host to device */
@@ -312,9 +931,15 @@ omp_offloading_copyfrom: ;
 omp_offloading_sync_cleanup: ;
 		/* sync stream to wait for completion */
 		omp_stream_sync(off->stream); /*NOTE: we should NOT time this call as the event system already count in as previous async kernel or async memcpy */
+		if (auto_adapt) {
+			auto_time[4] = read_timer_ms();
+			omp_offloading_auto_measure(off, auto_time[2] - auto_time[1], (auto_time[1] - auto_time[0]) + (auto_time[4] - auto_time[3]));
+		}
 #if defined (OMP_BREAKDOWN_TIMING)
 		omp_event_record_start(&events[sync_cleanup_event_index], NULL, "FINI_1", "Time for dev sync and cleaning (event/stream/map, deallocation/unmarshalling)");
 #endif
+		if (off_info->num_reductions > 0 && (off_info->type == OMP_OFFLOADING_CODE || off_info->type == OMP_OFFLOADING_DATA_CODE))
+			omp_offloading_reduction_finish(off);
 		if (off->stage == OMP_OFFLOADING_SYNC) {
 			if (off_info->type == OMP_OFFLOADING_DATA) { /* this should be just an assertation */
 				/* put in the offloading stack */
@@ -348,14 +973,8 @@ omp_offloading_sync_cleanup: ;
 
 	//	case OMP_OFFLOADING_MDEV_BARRIER:
 	{
-#if defined (OMP_BREAKDOWN_TIMING)
-		omp_event_record_start(&events[barrier_wait_event_index], NULL, "BAR_FINI_2", "Time for barrier wait for other to complete");
-#endif
-		dev->offload_request = NULL; /* release this dev */
-		pthread_barrier_wait(&off_info->barrier);
-#if defined (OMP_BREAKDOWN_TIMING)
-		omp_event_record_stop(&events[barrier_wait_event_index]);
-#endif
+		/* no barrier with other devices or the submitter anymore, this dev moves on to its next request in the
+		 * queue, the submitter is notified by the num_completed counter below */
 		//off_info->stage = OMP_OFFLOADING_COMPLETE; /* data race for any access to off_info
 	}
 
@@ -365,12 +984,151 @@ omp_offloading_sync_cleanup: ;
 
 	/* print out the timing info */
 #if defined (OMP_BREAKDOWN_TIMING)
-	/* do timing accumulation if this is a recurring kernel */
+	/* do timing accumulation if this is a recurring kernel, and trace the events of a sampled run */
+	int traced = omp_trace_sampled(off->count);
 	for (i=0; i<num_events; i++) {
+		if (traced) omp_trace_event(&events[i], i, off_info->name, off->count);
 		omp_event_accumulate_elapsed_ms(&events[i]);
 	}
-	pthread_barrier_wait(&off_info->barrier);
 #endif
+	if (off->count) off->count++;
+	dev->offload_request = NULL; /* release this dev */
+	/* this has to be the last access to off_info since the submitter may reuse or free it once all devices completed.
+	 * The wakeup only uses the address, thus it is harmless even if off_info has been freed by a submitter that did not park */
+	__atomic_add_fetch(&off->compl_count, 1, __ATOMIC_SEQ_CST);
+	omp_dev_wake_all(&off->compl_count); /* the submitter and the devices of the dependent offloadings */
+}
+
+/* the share of a team member in the current loop of the team, see omp_dev_team_t */
+static void omp_dev_team_work(omp_dev_team_t * team, int member) {
+	if (team->chunk <= 0) {
+		long block = team->length / team->num_threads;
+		long rem = team->length % team->num_threads;
+		long start = team->start + member * block + (member < rem ? member : rem);
+		long length = block + (member < rem ? 1 : 0);
+		if (length > 0) team->body(start, length, team->args);
+	} else {
+		long end = team->start + team->length;
+		long start;
+		while ((start = __atomic_fetch_add(&team->next, team->chunk, __ATOMIC_RELAXED)) < end) {
+			long length = end - start < team->chunk ? end - start : team->chunk;
+			team->body(start, length, team->args);
+		}
+	}
+}
+
+static void * omp_dev_team_worker_main(void * arg) {
+	omp_dev_team_member_t * member = (omp_dev_team_member_t *) arg;
+	omp_device_t * dev = member->dev;
+	omp_dev_team_t * team = &dev->team;
+
+#if defined (__linux__) && defined (SYS_sched_setaffinity)
+	if (dev->num_bound_cpus) { /* bind to the member-th core of the device, i.e. all its hardware threads */
+		unsigned long mask[OMP_CPUMASK_WORDS];
+		const int bits = 8 * sizeof(unsigned long);
+		int cpu, core = -1, num = 0;
+		int seen[member->id + 1]; /* the distinct cores of the device in the order of their first cpu */
+		memset(mask, 0, sizeof(mask));
+		for (cpu = 0; cpu < OMP_MAX_HOST_CPUS && core < 0; cpu++) {
+			if (!((dev->cpumask[cpu / bits] >> (cpu % bits)) & 1UL)) continue;
+			int c = omp_host_topology.cpu_core[cpu];
+			int k;
+			for (k = 0; k < num && seen[k] != c; k++);
+			if (k < num) continue;
+			seen[num++] = c;
+			if (num == member->id + 1) core = c;
+		}
+		for (cpu = 0; cpu < OMP_MAX_HOST_CPUS && core >= 0; cpu++) {
+			if (((dev->cpumask[cpu / bits] >> (cpu % bits)) & 1UL) && omp_host_topology.cpu_core[cpu] == core) mask[cpu / bits] |= 1UL << (cpu % bits);
+		}
+		if (core >= 0) syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+	}
+#endif
+	omp_perf_counters_open(dev, member->perf_fds);
+
+	int epoch = 0;
+	while (1) {
+		int fork;
+		while ((fork = __atomic_load_n(&team->fork, __ATOMIC_ACQUIRE)) == epoch) omp_dev_wait_while_equal(NULL, &team->fork, epoch);
+		epoch = fork;
+		if (team->quit) break;
+		omp_dev_team_work(team, member->id);
+		if (__atomic_add_fetch(&team->join, 1, __ATOMIC_ACQ_REL) == team->num_threads - 1) omp_dev_wake_all(&team->join);
+	}
+	return NULL;
+}
+
+/* called by the helper thread of the device, see omp_dev_team_t */
+void omp_dev_team_init(omp_device_t * dev) {
+	omp_dev_team_t * team = &dev->team;
+	memset(team, 0, sizeof(omp_dev_team_t));
+	team->num_threads = 1;
+	if (!omp_dev_team_enabled || (dev->type != OMP_DEVICE_HOSTCPU && dev->type != OMP_DEVICE_THSIM) || dev->num_cores <= 1) return;
+
+	int num_workers = dev->num_cores - 1;
+	team->workers = (pthread_t *) malloc(sizeof(pthread_t) * num_workers);
+	team->members = (omp_dev_team_member_t *) malloc(sizeof(omp_dev_team_member_t) * num_workers);
+	int i;
+	for (i=0; i<num_workers; i++) {
+		omp_dev_team_member_t * member = &team->members[i];
+		member->dev = dev;
+		member->id = i + 1;
+		int j;
+		for (j=0; j<OMP_PERF_NUM_COUNTERS; j++) member->perf_fds[j] = -1;
+		if (pthread_create(&team->workers[i], NULL, omp_dev_team_worker_main, member)) {
+			fprintf(stderr, "%d|%s: cannot create the worker %d of the team, the team has %d threads\n", dev->id, dev->name, i + 1, i + 1);
+			break;
+		}
+	}
+	team->num_threads = i + 1;
+}
+
+/* called by omp_fini_devices after the helper thread is joined */
+void omp_dev_team_fini(omp_device_t * dev) {
+	omp_dev_team_t * team = &dev->team;
+	if (team->num_threads <= 1) return;
+	team->quit = 1;
+	__atomic_add_fetch(&team->fork, 1, __ATOMIC_RELEASE);
+	omp_dev_wake_all(&team->fork);
+	int i, j;
+	for (i=0; i<team->num_threads - 1; i++) {
+		pthread_join(team->workers[i], NULL);
+		for (j=0; j<OMP_PERF_NUM_COUNTERS; j++) if (team->members[i].perf_fds[j] >= 0) close(team->members[i].perf_fds[j]);
+	}
+	free(team->workers);
+	free(team->members);
+	team->workers = NULL;
+	team->members = NULL;
+	team->num_threads = 1;
+}
+
+/**
+ * called by the helper thread in a kernel launcher to run body on [start, start+length) by the team of the device, in static
+ * blocks if chunk is 0 or in dynamic chunks of the size otherwise. It returns when all the team is done. A device without
+ * team (e.g. NVGPU or 1 core) runs the whole range by the calling thread.
+ */
+void omp_dev_team_for(omp_device_t * dev, long start, long length, long chunk, omp_dev_team_body_t body, void * args) {
+	omp_dev_team_t * team = &dev->team;
+	if (team->num_threads <= 1 || length <= 1) {
+		if (length > 0) body(start, length, args);
+		return;
+	}
+	team->body = body;
+	team->args = args;
+	team->start = start;
+	team->length = length;
+	team->chunk = chunk;
+	team->next = start;
+	team->join = 0;
+	team->num_loops++;
+	__atomic_add_fetch(&team->fork, 1, __ATOMIC_RELEASE);
+	omp_dev_wake_all(&team->fork);
+
+	omp_dev_team_work(team, 0);
+
+	int joined;
+	while ((joined = __atomic_load_n(&team->join, __ATOMIC_ACQUIRE)) < team->num_threads - 1)
+		omp_dev_wait_while_equal(dev, &team->join, joined);
 }
 
 /* helper thread main */
@@ -378,20 +1136,34 @@ void helper_thread_main(void * arg) {
 	omp_device_t * dev = (omp_device_t*)arg;
 
 	omp_set_current_device_dev(dev);
+	omp_dev_bind(dev); /* before any allocation of the device, e.g. the streams */
+	omp_perf_counters_open(dev, dev->perf_fds);
+	omp_dev_team_init(dev);
 	omp_stream_create(dev, &dev->devstream);
-//	omp_set_num_threads(dev->num_cores);
+	int i;
+	for (i=0; i<dev->num_streams; i++) omp_stream_create(dev, &dev->devstreams[i]);
+#if defined (_OPENMP)
+	if (dev->type == OMP_DEVICE_HOSTCPU || dev->type == OMP_DEVICE_THSIM) omp_set_num_threads(dev->num_cores); /* for the kernels that create a team */
+#endif
 	omp_warmup_device(dev);
+	omp_calibrate_device(dev);
 	pthread_barrier_wait(&all_dev_sync_barrier);
 //	printf("helper threading (devid: %s) loop ....\n", dev->name);
 	/*************** loop *******************/
 	while (omp_device_complete == 0) {
 //		printf("helper threading (devid: %X) waiting ....\n", dev);
-		while (dev->offload_request == NULL) {
+		omp_offloading_info_t * off_info;
+		while (1) {
+			int signal = __atomic_load_n(&dev->offload_queue.signal, __ATOMIC_SEQ_CST); /* read before checking the queue, so a post after the check changes it */
+			if ((off_info = omp_offloading_queue_dequeue(dev)) != NULL) break;
 			if (omp_device_complete) return;
+			omp_dev_wait_while_equal(dev, &dev->offload_queue.signal, signal);
 		}
 //		printf("helper threading (devid: %X) offloading  ....\n", dev);
+		dev->offload_request = off_info;
 		omp_offloading_run(dev);
 	}
 
+	for (i=0; i<dev->num_streams; i++) omp_stream_destroy(&dev->devstreams[i]);
 	omp_stream_destroy(&dev->devstream);
 }
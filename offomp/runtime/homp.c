@@ -10,6 +10,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <limits.h>
+#include <float.h>
 
 #include "homp.h"
 
@@ -54,6 +56,7 @@ omp_offloading_info_t * omp_offloading_init_info(const char *name, omp_grid_topo
 	info->halo_x_info = NULL;
 	info->start_time = 0;
 	info->loop_depth = loop_nest_depth;
+	info->num_pipeline_chunks = 1;
 	for (i=0; i<loop_nest_depth; i++) {
 		info->loop_dist_info[i].target_type = OMP_DIST_TARGET_LOOP_ITERATION;
 		info->loop_dist_info[i].target = info;
@@ -70,9 +73,30 @@ omp_offloading_info_t * omp_offloading_init_info(const char *name, omp_grid_topo
 		off->off_info = info;
 		off->num_maps = 0;
 		off->stage = OMP_OFFLOADING_INIT;
+		off->count = info->count;
+		off->compl_count = 0;
+		off->x_arrived = 0;
+		off->x_pulled = 0;
+		off->x_dim_done = 0;
+		off->red_combined = 0;
+		memset(off->reduction_dev_blocks, 0, sizeof(off->reduction_dev_blocks));
+		memset(off->reduction_host_blocks, 0, sizeof(off->reduction_host_blocks));
+		memset(off->reduction_num_blocks, 0, sizeof(off->reduction_num_blocks));
+		memset(off->reduction_max_blocks, 0, sizeof(off->reduction_max_blocks));
+		off->auto_measured = 0;
+		off->auto_repartitions = 0;
+		off->chunk_length = -1;
+		memset(&off->kernel_counts, 0, sizeof(omp_perf_counts_t));
+		off->measured_flopss = 0.0;
 	}
 
-	pthread_barrier_init(&info->barrier, NULL, top->nnodes+1);
+	info->posted = 0;
+	info->post_epoch = 0;
+	info->waited_epoch = 0;
+	info->num_depend = 0;
+	info->num_reductions = 0;
+	info->auto_adapt_threshold = omp_dist_auto_adapt_threshold;
+	info->dyn_next = 0;
 	pthread_barrier_init(&info->inter_dev_barrier, NULL, top->nnodes);
 	return info;
 }
@@ -110,14 +134,249 @@ omp_offloading_info_t * omp_offloading_standalone_data_exchange_init_info(const
 		off->off_info = info;
 		off->num_maps = 0;
 		off->stage = OMP_OFFLOADING_INIT;
+		off->count = info->count;
+		off->compl_count = 0;
+		off->x_arrived = 0;
+		off->x_pulled = 0;
+		off->x_dim_done = 0;
+		off->red_combined = 0;
+		memset(off->reduction_dev_blocks, 0, sizeof(off->reduction_dev_blocks));
+		memset(off->reduction_host_blocks, 0, sizeof(off->reduction_host_blocks));
+		memset(off->reduction_num_blocks, 0, sizeof(off->reduction_num_blocks));
+		memset(off->reduction_max_blocks, 0, sizeof(off->reduction_max_blocks));
+		off->auto_measured = 0;
+		off->auto_repartitions = 0;
+		off->chunk_length = -1;
+		memset(&off->kernel_counts, 0, sizeof(omp_perf_counts_t));
+		off->measured_flopss = 0.0;
 	}
 
-	pthread_barrier_init(&info->barrier, NULL, top->nnodes+1);
+	info->posted = 0;
+	info->post_epoch = 0;
+	info->waited_epoch = 0;
+	info->num_depend = 0;
+	info->num_reductions = 0;
+	info->auto_adapt_threshold = omp_dist_auto_adapt_threshold;
+	info->dyn_next = 0;
 	pthread_barrier_init(&info->inter_dev_barrier, NULL, top->nnodes);
 	return info;
 }
 
 
+/**
+ * pipeline the offloading in num_chunks chunks of its loop iterations on devices that have multiple streams,
+ * i.e. copyto of chunk i+1 overlaps with the kernel of chunk i and copyfrom of chunk i-1.
+ * It is only applied to a 1-level non-CYCLIC loop without halo exchange or reduction, and only the data maps whose rows are aligned with the
+ * loop iterations are chunked, other maps are copied as a whole before and after the chunks. Thus the kernel must
+ * only access the rows of its own iterations of the aligned maps.
+ */
+void omp_offloading_set_pipeline_chunks(omp_offloading_info_t *info, int num_chunks) {
+	info->num_pipeline_chunks = num_chunks;
+}
+
+static int omp_reduction_type_size(omp_reduction_type_t type) {
+	switch (type) {
+		case OMP_REDUCTION_INT: return sizeof(int);
+		case OMP_REDUCTION_LONG: return sizeof(long);
+		case OMP_REDUCTION_FLOAT: return sizeof(float);
+		case OMP_REDUCTION_DOUBLE: return sizeof(double);
+	}
+	return 0;
+}
+
+/**
+ * add a reduction of the kernel to the offloading, like reduction(op:target), and return its index for
+ * omp_offloading_reduction_partial and omp_offloading_reduction_dev_blocks. It has to be done before the offloading is started.
+ *
+ * Before each run of the kernel, the runtime sets the partial of each device to the identity of op. The kernel combines its
+ * result into the partial of its device, or for a device-side reduction, writes the per-block results of
+ * xomp_inner_block_reduction_* to the buffer of omp_offloading_reduction_dev_blocks, which the runtime copies back and
+ * folds into the partial after the kernel. The partials are then combined along a binomial tree of the devices of the
+ * topology, log2(n) steps with each device only waiting for its children, and the root combines the result into the target.
+ * Thus the target is ready once the offloading completes, with no barrier and no summing by the submitter. The target
+ * must not be accessed by the host while the offloading is in flight.
+ */
+int omp_offloading_append_reduction(omp_offloading_info_t *info, void *target, omp_reduction_type_t type, omp_reduction_op_t op) {
+	if (info->num_reductions == OMP_OFFLOADING_MAX_REDUCTIONS) {
+		fprintf(stderr, "offloading %s has too many reductions, only %d are supported\n", info->name, OMP_OFFLOADING_MAX_REDUCTIONS);
+		abort();
+	}
+	if ((type == OMP_REDUCTION_FLOAT || type == OMP_REDUCTION_DOUBLE) && op >= OMP_REDUCTION_BITAND && op <= OMP_REDUCTION_BITXOR) {
+		fprintf(stderr, "bitwise reduction (%d) on a floating point variable of offloading %s\n", op, info->name);
+		abort();
+	}
+	omp_reduction_info_t * red = &info->reductions[info->num_reductions];
+	red->op = op;
+	red->type = type;
+	red->target = target;
+	return info->num_reductions++;
+}
+
+/* the partial of the reduction on the device of off, set to the identity of the op before each run of the kernel */
+void * omp_offloading_reduction_partial(omp_offloading_t *off, int index) {
+	return &off->reduction_partials[index];
+}
+
+/**
+ * return a device buffer for the per-block results of the reduction of the kernel launched by off, i.e. the grid_level_results
+ * of xomp_inner_block_reduction_*. After the kernel, the runtime copies the num_blocks results back asynchronously on the
+ * stream of the kernel and folds them into the partial of the device. The buffer is kept for the next runs of the offloading.
+ */
+void * omp_offloading_reduction_dev_blocks(omp_offloading_t *off, int index, long num_blocks) {
+	omp_reduction_info_t * red = &off->off_info->reductions[index];
+	long size = num_blocks * omp_reduction_type_size(red->type);
+	if (num_blocks > off->reduction_max_blocks[index]) {
+		omp_map_free_dev(off->dev, off->reduction_dev_blocks[index]);
+		omp_mem_pool_free(&omp_unified_mem_pool, off->reduction_host_blocks[index], NULL);
+		off->reduction_dev_blocks[index] = omp_map_malloc_dev(off->dev, size);
+		off->reduction_host_blocks[index] = omp_mem_pool_malloc(&omp_unified_mem_pool, size, NULL);
+		if (off->dev->type == OMP_DEVICE_NVGPU) omp_host_register(off->reduction_host_blocks[index], size);
+		off->reduction_max_blocks[index] = num_blocks;
+	}
+	off->reduction_num_blocks[index] = num_blocks;
+	return off->reduction_dev_blocks[index];
+}
+
+/* acc = acc op values[0] op ... op values[num-1], MINUS is PLUS since the kernel negates its own contributions */
+#define OMP_REDUCTION_FOLD(ctype, field, bitwise) { \
+	const ctype * v = (const ctype *) values; \
+	ctype a = acc->field; \
+	long i; \
+	switch (op) { \
+		case OMP_REDUCTION_PLUS: \
+		case OMP_REDUCTION_MINUS: for (i=0; i<num; i++) a += v[i]; break; \
+		case OMP_REDUCTION_MUL: for (i=0; i<num; i++) a *= v[i]; break; \
+		case OMP_REDUCTION_LOGAND: for (i=0; i<num; i++) a = a && v[i]; break; \
+		case OMP_REDUCTION_LOGOR: for (i=0; i<num; i++) a = a || v[i]; break; \
+		case OMP_REDUCTION_MIN: for (i=0; i<num; i++) if (v[i] < a) a = v[i]; break; \
+		case OMP_REDUCTION_MAX: for (i=0; i<num; i++) if (v[i] > a) a = v[i]; break; \
+		default: bitwise \
+	} \
+	acc->field = a; \
+}
+#define OMP_REDUCTION_FOLD_BITWISE \
+		if (op == OMP_REDUCTION_BITAND) for (i=0; i<num; i++) a &= v[i]; \
+		else if (op == OMP_REDUCTION_BITOR) for (i=0; i<num; i++) a |= v[i]; \
+		else if (op == OMP_REDUCTION_BITXOR) for (i=0; i<num; i++) a ^= v[i]; \
+		break;
+
+static void omp_reduction_fold(omp_reduction_op_t op, omp_reduction_type_t type, omp_reduction_value_t * acc, const void * values, long num) {
+	switch (type) {
+		case OMP_REDUCTION_INT: OMP_REDUCTION_FOLD(int, i, OMP_REDUCTION_FOLD_BITWISE) break;
+		case OMP_REDUCTION_LONG: OMP_REDUCTION_FOLD(long, l, OMP_REDUCTION_FOLD_BITWISE) break;
+		case OMP_REDUCTION_FLOAT: OMP_REDUCTION_FOLD(float, f, break;) break;
+		case OMP_REDUCTION_DOUBLE: OMP_REDUCTION_FOLD(double, d, break;) break;
+	}
+}
+#undef OMP_REDUCTION_FOLD
+#undef OMP_REDUCTION_FOLD_BITWISE
+
+static void omp_reduction_identity(omp_reduction_op_t op, omp_reduction_type_t type, omp_reduction_value_t * value) {
+	int one = op == OMP_REDUCTION_MUL || op == OMP_REDUCTION_LOGAND;
+	switch (type) {
+		case OMP_REDUCTION_INT:
+			value->i = op == OMP_REDUCTION_BITAND ? ~0 : op == OMP_REDUCTION_MIN ? INT_MAX : op == OMP_REDUCTION_MAX ? INT_MIN : one;
+			break;
+		case OMP_REDUCTION_LONG:
+			value->l = op == OMP_REDUCTION_BITAND ? ~0L : op == OMP_REDUCTION_MIN ? LONG_MAX : op == OMP_REDUCTION_MAX ? LONG_MIN : one;
+			break;
+		case OMP_REDUCTION_FLOAT:
+			value->f = op == OMP_REDUCTION_MIN ? FLT_MAX : op == OMP_REDUCTION_MAX ? -FLT_MAX : one;
+			break;
+		case OMP_REDUCTION_DOUBLE:
+			value->d = op == OMP_REDUCTION_MIN ? DBL_MAX : op == OMP_REDUCTION_MAX ? -DBL_MAX : one;
+			break;
+	}
+}
+
+/**
+ * called by the helper thread before the kernel: set the partials to the identity. The partials of the previous run
+ * are read by the parent in the combining tree, thus the device waits for the parent to have combined the previous run,
+ * which is normally done already.
+ */
+void omp_offloading_reduction_start(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	int seqid = off->devseqid;
+	int i;
+	if (seqid > 0) {
+		omp_offloading_t * parent = &off_info->offloadings[seqid - (seqid & -seqid)];
+		int n;
+		while ((n = __atomic_load_n(&parent->red_combined, __ATOMIC_ACQUIRE)) < off->red_combined)
+			omp_dev_wait_while_equal(off->dev, &parent->red_combined, n);
+	}
+	for (i=0; i<off_info->num_reductions; i++) {
+		omp_reduction_identity(off_info->reductions[i].op, off_info->reductions[i].type, &off->reduction_partials[i]);
+		off->reduction_num_blocks[i] = 0;
+	}
+}
+
+/**
+ * called by the helper thread right after launching the kernel: copy back the per-block results of the device-side
+ * reductions on the stream of the kernel
+ */
+void omp_offloading_reduction_copy_blocks(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	int i;
+	for (i=0; i<off_info->num_reductions; i++) {
+		if (off->reduction_num_blocks[i] == 0) continue;
+		long size = off->reduction_num_blocks[i] * omp_reduction_type_size(off_info->reductions[i].type);
+		omp_map_memcpy_from_async(off->reduction_host_blocks[i], off->reduction_dev_blocks[i], off->dev, size, off->stream);
+	}
+}
+
+/**
+ * called by the helper thread after the copied back blocks arrived: fold them into the partials so the blocks can be
+ * used by another kernel of the same run, e.g. the next chunk of a DYNAMIC loop
+ */
+void omp_offloading_reduction_fold_blocks(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	int i;
+	for (i=0; i<off_info->num_reductions; i++) {
+		omp_reduction_info_t * red = &off_info->reductions[i];
+		if (off->reduction_num_blocks[i] > 0)
+			omp_reduction_fold(red->op, red->type, &off->reduction_partials[i], off->reduction_host_blocks[i], off->reduction_num_blocks[i]);
+		off->reduction_num_blocks[i] = 0;
+	}
+}
+
+/**
+ * called by the helper thread after the stream of the offloading is synced: fold the per-block results into the partials and
+ * combine the partials of the subtree of this device, i.e. the devices seqid+1, seqid+2, seqid+4, ... below the lowest set
+ * bit of seqid. The root (seqid 0) combines the result into the targets.
+ */
+void omp_offloading_reduction_finish(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	int nnodes = off_info->top->nnodes;
+	int seqid = off->devseqid;
+	int epoch = off->red_combined + 1;
+	int i, stride;
+	omp_offloading_reduction_fold_blocks(off);
+
+	for (stride = 1; stride < nnodes && !(seqid & stride); stride <<= 1) {
+		if (seqid + stride >= nnodes) continue;
+		omp_offloading_t * child = &off_info->offloadings[seqid + stride];
+		int n;
+		while ((n = __atomic_load_n(&child->red_combined, __ATOMIC_ACQUIRE)) < epoch)
+			omp_dev_wait_while_equal(off->dev, &child->red_combined, n);
+		for (i=0; i<off_info->num_reductions; i++) {
+			omp_reduction_info_t * red = &off_info->reductions[i];
+			omp_reduction_fold(red->op, red->type, &off->reduction_partials[i], &child->reduction_partials[i], 1);
+		}
+	}
+
+	if (seqid == 0) {
+		for (i=0; i<off_info->num_reductions; i++) {
+			omp_reduction_info_t * red = &off_info->reductions[i];
+			omp_reduction_value_t result;
+			memcpy(&result, red->target, omp_reduction_type_size(red->type));
+			omp_reduction_fold(red->op, red->type, &result, &off->reduction_partials[i], 1);
+			memcpy(red->target, &result, omp_reduction_type_size(red->type));
+		}
+	}
+	__atomic_store_n(&off->red_combined, epoch, __ATOMIC_RELEASE);
+	omp_dev_wake_all(&off->red_combined);
+}
+
 void omp_offloading_append_profile_per_iteration(omp_offloading_info_t *info, long num_fp_operations, long num_loads,
 												 long num_stores) {
 	info->per_iteration_profile.num_fp_operations = num_fp_operations;
@@ -126,8 +385,16 @@ void omp_offloading_append_profile_per_iteration(omp_offloading_info_t *info, lo
 }
 
 void omp_offloading_fini_info(omp_offloading_info_t * info) {
-	pthread_barrier_destroy(&info->barrier);
 	pthread_barrier_destroy(&info->inter_dev_barrier);
+	int j, k;
+	for (j=0; j<info->top->nnodes; j++) {
+		omp_offloading_t * off = &info->offloadings[j];
+		for (k=0; k<info->num_reductions; k++) {
+			if (off->reduction_max_blocks[k] == 0) continue;
+			omp_map_free_dev(off->dev, off->reduction_dev_blocks[k]);
+			omp_mem_pool_free(&omp_unified_mem_pool, off->reduction_host_blocks[k], NULL);
+		}
+	}
 #if defined (OMP_BREAKDOWN_TIMING)
 	int i;
 	for (i=0; i<info->top->nnodes; i++) {
@@ -316,6 +583,8 @@ set ytics out nomirror ("device 0" 3, "device 1" 6, "device 2" 9, "device 3" 12,
 #endif
             }
 		}
+		omp_perf_print_counts(off);
+		omp_mem_pool_print_stats(&off->dev->mem_pool, "Device");
 		printf("---------------- End Profiling Report for Offloading(%s) on dev: %d ----------------------------\n", info->name, devid);
 
 #if defined(PROFILE_PLOT)
@@ -379,6 +648,7 @@ void omp_data_map_init_info(const char *symbol, omp_data_map_info_t *info, omp_o
 	//memset(info->maps, 0, sizeof(omp_data_map_t) * off_info->top->nnodes);
 	info->map_direction = map_direction;
 	info->map_type = map_type;
+	info->host_pinned = 0;
 	info->num_halo_dims = 0;
 	info->sizeof_element = sizeof_element;
 	int i;
@@ -403,6 +673,11 @@ void omp_data_map_info_set_dims_3d(omp_data_map_info_t * info, long dim0, long d
 	info->dims[2] = dim2;
 }
 
+/* register the host region of the COPY maps of this array so the copies are asynchronous DMA, see omp_host_register */
+void omp_data_map_info_set_pinned(omp_data_map_info_t * info, int pinned) {
+	info->host_pinned = pinned;
+}
+
 
 void omp_init_dist_info(omp_dist_info_t * dist_info, omp_dist_policy_t dist_policy, long start,
 						long length, int topdim) {
@@ -410,6 +685,7 @@ void omp_init_dist_info(omp_dist_info_t * dist_info, omp_dist_policy_t dist_poli
 	dist_info->length = length;
 	dist_info->policy = dist_policy;
 	dist_info->dim_index = topdim;
+	dist_info->chunk_size = 0;
 }
 
 void omp_data_map_dist_init_info(omp_data_map_info_t *map_info, int dim, omp_dist_policy_t dist_policy, long start,
@@ -424,6 +700,55 @@ void omp_loop_dist_init_info(omp_offloading_info_t *off_info, int level, omp_dis
 	omp_init_dist_info(dist_info, dist_policy, start, length, topdim);
 }
 
+/**
+ * the chunk size of a DYNAMIC or CYCLIC loop dist, or the minimum chunk size of a GUIDED one. The default (0) is
+ * length/(OMP_DIST_DYNAMIC_CHUNKS_PER_DEVICE*number of devices) for DYNAMIC and 1 for GUIDED and CYCLIC
+ */
+void omp_loop_dist_set_chunk_size(omp_offloading_info_t *off_info, int level, long chunk_size) {
+	off_info->loop_dist_info[level].chunk_size = chunk_size;
+}
+
+/* the chunk size of a CYCLIC dim of an array, the default (0) is 1 */
+void omp_data_map_dist_set_chunk_size(omp_data_map_info_t *map_info, int dim, long chunk_size) {
+	map_info->dist_info[dim].chunk_size = chunk_size;
+}
+
+/* whether the loop iterations are claimed in chunks by the devices at runtime instead of being dist-ed once */
+int omp_loop_dist_dynamic(omp_offloading_info_t *off_info) {
+	omp_dist_policy_t policy = off_info->loop_dist_info[0].policy;
+	return policy == OMP_DIST_POLICY_DYNAMIC || policy == OMP_DIST_POLICY_GUIDED;
+}
+
+/**
+ * claim the next chunk of a DYNAMIC/GUIDED loop for the run of the device, return its length (0 if all the iterations of
+ * the run are claimed) and its start relative to the loop dist of the device, which covers the whole loop
+ */
+long omp_loop_dist_claim_chunk(omp_offloading_t *off, long *chunk_start) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_dist_info_t * dist_info = &off_info->loop_dist_info[0];
+	int nnodes = off_info->top->nnodes;
+	long total = dist_info->length;
+	long base = (long)off->compl_count * total;
+	long end = base + total;
+	long next = __atomic_load_n(&off_info->dyn_next, __ATOMIC_RELAXED);
+	long length;
+	do {
+		if (next >= end) return 0;
+		if (dist_info->policy == OMP_DIST_POLICY_GUIDED) {
+			long min_chunk = dist_info->chunk_size > 0 ? dist_info->chunk_size : 1;
+			length = (end - next) / (2 * nnodes);
+			if (length < min_chunk) length = min_chunk;
+		} else {
+			length = dist_info->chunk_size;
+			if (length <= 0) length = total / (OMP_DIST_DYNAMIC_CHUNKS_PER_DEVICE * nnodes);
+			if (length <= 0) length = 1;
+		}
+		if (next + length > end) length = end - next;
+	} while (!__atomic_compare_exchange_n(&off_info->dyn_next, &next, next + length, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	*chunk_start = next - base;
+	return length;
+}
+
 static void omp_set_align_dist_policy(omp_dist_info_t * dist_info, omp_dist_target_type_t alignee_type, void * alignee, int alignee_dim, long start) {
 	omp_dist_info_t *alignee_dist_info = NULL;
 	if (alignee_type == OMP_DIST_TARGET_DATA_MAP) {
@@ -472,6 +797,7 @@ void omp_data_map_dist_align_with_data_map_with_halo(omp_data_map_info_t *map_in
 		if (alignee->num_halo_dims) {
 			omp_data_map_halo_region_info_t * halo_info = &alignee->halo_info[alignee_dim];
 			omp_map_add_halo_region(map_info, dim, halo_info->left, halo_info->right, halo_info->edging);
+			map_info->halo_info[dim].topdim = halo_info->topdim; /* the dim_index of an ALIGN dist is the alignee dim */
 		}
 	} else if (dim == OMP_ALL_DIMENSIONS && alignee_dim == OMP_ALL_DIMENSIONS){ /* for all the dimensions that will be aligned */
 		int i;
@@ -480,6 +806,7 @@ void omp_data_map_dist_align_with_data_map_with_halo(omp_data_map_info_t *map_in
 			if (alignee->num_halo_dims) {
 				omp_data_map_halo_region_info_t * halo_info = &alignee->halo_info[i];
 				omp_map_add_halo_region(map_info, i, halo_info->left, halo_info->right, halo_info->edging);
+				map_info->halo_info[i].topdim = halo_info->topdim;
 			}
 		}
 	} else if (dim == OMP_ALL_DIMENSIONS && alignee_dim >=0) {
@@ -489,6 +816,7 @@ void omp_data_map_dist_align_with_data_map_with_halo(omp_data_map_info_t *map_in
 			if (alignee->num_halo_dims) {
 				omp_data_map_halo_region_info_t * halo_info = &alignee->halo_info[alignee_dim];
 				omp_map_add_halo_region(map_info, i, halo_info->left, halo_info->right, halo_info->edging);
+				map_info->halo_info[i].topdim = halo_info->topdim;
 			}
 		}
 	} else {
@@ -613,7 +941,7 @@ int omp_map_is_map_inherited(omp_offloading_t *off, omp_data_map_t *map) {
 }
 
 
-/* get map from inheritance (off stack) */
+/* get map from inheritance (off stack), or from the present table */
 omp_data_map_t * omp_map_get_map_inheritance (omp_device_t * dev, void * host_ptr) {
 	int i;
 	for (i=dev->offload_stack_top; i>=0; i--) {
@@ -623,9 +951,48 @@ omp_data_map_t * omp_map_get_map_inheritance (omp_device_t * dev, void * host_pt
 			return map;
 		}
 	}
+	omp_data_map_present_t * entry = omp_map_present_lookup(dev, host_ptr);
+	if (entry != NULL) return entry->map;
 	return NULL;
 }
 
+/**
+ * the present table of a device, see omp_data_map_present in homp.h.
+ * The table is a small array searched linearly, the number of arrays resident on a device is small.
+ */
+omp_data_map_present_t * omp_map_present_lookup(omp_device_t * dev, void * host_ptr) {
+	int i;
+	char * ptr = (char*)host_ptr;
+	for (i=0; i<dev->num_resident_data_maps; i++) {
+		omp_data_map_present_t * entry = &dev->resident_data_maps[i];
+		if (ptr >= entry->host_start && ptr < entry->host_end) return entry;
+	}
+	return NULL;
+}
+
+void omp_map_present_add(omp_device_t * dev, omp_data_map_t * map) {
+	omp_data_map_info_t * info = map->info;
+	if (dev->num_resident_data_maps == dev->max_resident_data_maps) {
+		dev->max_resident_data_maps = dev->max_resident_data_maps == 0 ? 8 : dev->max_resident_data_maps * 2;
+		dev->resident_data_maps = (omp_data_map_present_t *) realloc(dev->resident_data_maps, sizeof(omp_data_map_present_t) * dev->max_resident_data_maps);
+	}
+	long size = info->sizeof_element;
+	int i;
+	for (i=0; i<info->num_dims; i++) size *= info->dims[i];
+
+	omp_data_map_present_t * entry = &dev->resident_data_maps[dev->num_resident_data_maps++];
+	entry->host_start = info->source_ptr;
+	entry->host_end = info->source_ptr + size;
+	entry->map = map;
+	entry->refcount = 1;
+}
+
+void omp_map_present_remove(omp_device_t * dev, omp_data_map_present_t * entry) {
+	int last = dev->num_resident_data_maps - 1;
+	*entry = dev->resident_data_maps[last]; /* the order does not matter */
+	dev->num_resident_data_maps = last;
+}
+
 /**
  * Given the host pointer (e.g. an array pointer), find the data map of the array onto a specific device,
  * which is provided as a off_loading_t object (the off_loading_t has devseq id as well as pointer to the
@@ -690,6 +1057,7 @@ void omp_data_map_init_map(omp_data_map_t *map, omp_data_map_info_t *info, omp_d
 	map->info = info;
 	map->dev = dev; /* mainly use as cache so we save one pointer deference */
 	map->mem_noncontiguous = 0;
+	map->map_staging_ptr = NULL;
 	map->map_type = info->map_type;
 
 	if (map->map_type == OMP_DATA_MAP_AUTO) {
@@ -703,13 +1071,12 @@ void omp_data_map_init_map(omp_data_map_t *map, omp_data_map_info_t *info, omp_d
 	} else if (map->map_type == OMP_DATA_MAP_SHARED && omp_device_mem_discrete(dev->mem_type)) {
 		fprintf(stderr, "direct sharing data between host and the dev: %d is not possible with discrete mem space, we use COPY approach now\n", dev->id);
 		map->map_type = OMP_DATA_MAP_COPY;
+	} else if (map->map_type == OMP_DATA_MAP_ZEROCOPY && dev->type != OMP_DEVICE_NVGPU) {
+		map->map_type = OMP_DATA_MAP_SHARED; /* host devices access the host memory directly anyway */
 	}
 	map->access_level = OMP_DATA_MAP_ACCESS_LEVEL_1;
 }
 
-/* forward declaration to suppress compiler warning */
-void omp_topology_get_neighbors(omp_grid_topology_t * top, int seqid, int topdim, int cyclic, int* left, int* right);
-
 
 void omp_dist_block(long start, long full_length, long position, int dim, long * offstart, long *length) {
 	/* partition the array region into subregion and save it to the map */
@@ -729,6 +1096,36 @@ void omp_dist_block(long start, long full_length, long position, int dim, long *
 }
 
 #define LINEAR_MODEL_2 1
+
+/**
+ * solve the AUTO dist of total iterations for nnodes devices whose time for n iterations is T = n*A+B, given as n = T*Ar + Br,
+ * i.e. find T0 that all the devices finish at the same time. The rounding error is taken from the last devices
+ */
+static void omp_dist_auto_lengths(int nnodes, const double * Ar, const double * Br, long total, long * lengths) {
+	double allArs = 0.0;
+	double allBrs = 0.0;
+	int i;
+	for (i =0; i <nnodes; i++) {
+		allArs += Ar[i];
+		allBrs += Br[i];
+	}
+	double T0 = (total - allBrs)/allArs; /* the predicted execution time by all the devices of the loop */
+	long sum = 0;
+	for (i =0; i <nnodes; i++) {
+		long length = (long)(T0*Ar[i] + Br[i] + 0.5);
+		if (length <= 0) length = 0;
+		if (length >= total) length = total;
+		lengths[i] = length;
+		sum += length;
+	}
+	long diff = total - sum; /* fix rounding error */
+	for (i = nnodes-1; i >= 0 && diff != 0; i--) {
+		long adj = lengths[i] + diff < 0 ? -lengths[i] : diff;
+		lengths[i] += adj;
+		diff -= adj;
+	}
+}
+
 /**
  * The general dist algorithm that applies to both data distribution and iteration distribution
  */
@@ -737,6 +1134,7 @@ void omp_dist(omp_dist_info_t *dist_info, omp_dist_t *dist, omp_grid_topology_t
 	omp_device_t * dev = &omp_devices[top->idmap[seqid]];
 
 	int dim_index = dist_info->dim_index;
+	dist->chunk_size = 0;
 	//	printf("dim_index: %d\n", dim_index);
 	if (dist_info->policy == OMP_DIST_POLICY_BLOCK) { /* even distributions */
 		int topdimcoord = coords[dim_index]; /* dim_indx is top dim the dist is applied onto */
@@ -759,6 +1157,32 @@ void omp_dist(omp_dist_info_t *dist_info, omp_dist_t *dist, omp_grid_topology_t
 	} else if (dist_info->policy == OMP_DIST_POLICY_DUPLICATE) { /* full rang dist_info */
 		dist->length = n;
 		dist->offset = dist_info->start;
+	} else if (dist_info->policy == OMP_DIST_POLICY_CYCLIC) {
+		int topdimcoord = coords[dim_index];
+		int topdimsize = top->dims[dim_index];
+		long chunk_size = dist_info->chunk_size > 0 ? dist_info->chunk_size : 1;
+		long stride = chunk_size * topdimsize;
+		long first = chunk_size * topdimcoord;
+		long length = 0;
+		if (first < n) {
+			long num_chunks = (n - first + stride - 1) / stride;
+			long last = first + (num_chunks - 1) * stride;
+			length = (num_chunks - 1) * chunk_size + (n - last < chunk_size ? n - last : chunk_size);
+		} else first = n;
+		dist->offset = dist_info->start + first;
+		dist->length = length;
+		dist->chunk_size = chunk_size;
+		dist->stride = stride;
+		dist->limit = dist_info->start + n;
+	} else if (dist_info->policy == OMP_DIST_POLICY_DYNAMIC || dist_info->policy == OMP_DIST_POLICY_GUIDED) {
+		if (dist_info->target_type != OMP_DIST_TARGET_LOOP_ITERATION) {
+			fprintf(stderr, "DYNAMIC and GUIDED dist policies are only applied to loop iterations\n");
+			abort();
+		}
+		/* every device may run any chunk, thus the maps aligned with the loop cover the whole loop on every device
+		 * and only the rows of the claimed chunks are copied, see omp_offloading_dynamic_run */
+		dist->length = n;
+		dist->offset = dist_info->start;
 	} else if (dist_info->policy == OMP_DIST_POLICY_ALIGN) {
 		omp_dist_info_t *alignee_dist_info = NULL;
 		omp_dist_t *alignee_dist = NULL;
@@ -794,6 +1218,9 @@ void omp_dist(omp_dist_info_t *dist_info, omp_dist_t *dist, omp_grid_topology_t
 		}
 		dist->length = alignee_dist->length;
 		dist->offset = alignee_dist->offset - alignee_dist_info->start + dist_info->start;
+		dist->chunk_size = alignee_dist->chunk_size; /* the same chunks of a CYCLIC alignee */
+		dist->stride = alignee_dist->stride;
+		dist->limit = alignee_dist->limit - alignee_dist_info->start + dist_info->start;
 //		printf("aligned dist on dev %d: offset: %d, length: %d\n", seqid, alignee_dist->offset, alignee_dist->length);
 	} else if (dist_info->policy == OMP_DIST_POLICY_AUTO) {
 		/* in LINEAR_MODEL_1, only computation is considered */
@@ -860,9 +1287,9 @@ void omp_dist(omp_dist_info_t *dist_info, omp_dist_t *dist, omp_grid_topology_t
 		int num_transfer = 0;
 		for (i=0; i<off_info->num_mapped_vars; i++) {
 			omp_data_map_info_t * map_info = &off_info->data_map_info[i];
-			if (map_info->map_type == OMP_DATA_MAP_FROM || map_info->map_type == OMP_DATA_MAP_TO) {
+			if (map_info->map_direction == OMP_DATA_MAP_FROM || map_info->map_direction == OMP_DATA_MAP_TO) {
 				num_transfer++;
-			} else if (map_info->map_type == OMP_DATA_MAP_TOFROM) {
+			} else if (map_info->map_direction == OMP_DATA_MAP_TOFROM) {
 				num_transfer += 2;
 			} else continue;
 
@@ -888,7 +1315,7 @@ void omp_dist(omp_dist_info_t *dist_info, omp_dist_t *dist, omp_grid_topology_t
 				}
 			}
 			map->map_size = map_size;
-			if (map_info->map_type == OMP_DATA_MAP_TOFROM) {
+			if (map_info->map_direction == OMP_DATA_MAP_TOFROM) {
 				map_size = map_size*2;
 			}
 			if (align_maps[i].align_dist != NULL) { /* we have an alignment */
@@ -900,7 +1327,9 @@ void omp_dist(omp_dist_info_t *dist_info, omp_dist_t *dist, omp_grid_topology_t
 
 		A = A/(dev->bandwidth*10.0e6); /* bandwidth in MB/s */
 		B = B/(dev->bandwidth*10.0e6);
-		A += off_info->per_iteration_profile.num_fp_operations/(dev->total_real_flopss * 10.0e9); /* FLOPs is in GFLOPs/s */
+		/* the flops achieved by the counted runs of this offloading (see omp_perf_kernel_stop) is used instead of the dev spec */
+		double flopss = off->measured_flopss > 0.0 ? off->measured_flopss : dev->total_real_flopss;
+		A += off_info->per_iteration_profile.num_fp_operations/(flopss * 10.0e9); /* FLOPs is in GFLOPs/s */
 		B += num_transfer * (dev->latency * 10.0e-6); /* latency in us */
 		/* here T = n*A+B --> n = T/A - B/A. We have then Ar = 1/A, and Br = -B/A*/
 
@@ -912,33 +1341,20 @@ void omp_dist(omp_dist_info_t *dist_info, omp_dist_t *dist, omp_grid_topology_t
 		/* sync so to make sure all received this info */
 		pthread_barrier_wait(&off_info->inter_dev_barrier);
 		/* solve the linear system */
-		double allArs = 0.0;
-		double allBrs = 0.0;
-		for (i =0; i <off_info->top->nnodes; i++) {
-			omp_offloading_t * anoff = &off_info->offloadings[i];
-			allArs += anoff->Ar;
-			allBrs += anoff->Br;
+		int nnodes = off_info->top->nnodes;
+		double allAr[nnodes];
+		double allBr[nnodes];
+		long lengths[nnodes];
+		for (i =0; i <nnodes; i++) {
+			allAr[i] = off_info->offloadings[i].Ar;
+			allBr[i] = off_info->offloadings[i].Br;
 		}
-		//printf("allArs: %f, allBrs: %f\n", allArs, allBrs);
-		double T0 = (dist_info->length - allBrs)/allArs; /* the predicted execution time by all the devices of the loop */
+		omp_dist_auto_lengths(nnodes, allAr, allBr, dist_info->length, lengths);
 		/* now compute the offset and length for AUTO dist policy */
 		offset = 0;
-		for (i =0; i <off_info->top->nnodes; i++) {
-			omp_offloading_t * anoff = &off_info->offloadings[i];
-			long length = (long)(T0*anoff->Ar + anoff->Br + 0.5);
-			if (length <= 0) length = 0;
-			if (length >= dist_info->length) length = dist_info->length;
-			if (i == off_info->top->nnodes-1 && offset + length != dist_info->length) { /* fix rounding error */
-				length = dist_info->length - offset;
-			}
-			if (seqid == i) {
-				dist->length = length;
-				dist->offset = offset;
-			}
-//			printf("LINEAR_MODEL_2: Dev %d: offset: %d, length: %d of total length: %d from start: %d, predicted exe time: %f\n",
-//				   i, offset, length, dist_info->length, dist_info->start, T0);
-			offset += length;
-		}
+		for (i =0; i <seqid; i++) offset += lengths[i];
+		dist->length = lengths[seqid];
+		dist->offset = dist_info->start + offset;
 
 		/* do the alignment map for arrays */
 		for (i=0; i<off_info->num_mapped_vars; i++) {
@@ -977,6 +1393,150 @@ void omp_loop_iteration_dist(omp_offloading_t * off) {
 	off->loop_dist_done = 1;
 }
 
+/**
+ * re-partition a recurring AUTO loop between the runs from the measured timings instead of the static flops/bandwidth/latency
+ * of the dev spec, which drift from the reality, e.g. thermal throttling or a shared node. threshold is the hysteresis: a new
+ * partition is only taken if it is predicted to be faster than the current one by more than the fraction threshold
+ * (e.g. 0.1), 0 disables it. The default is OMP_DIST_AUTO_ADAPTIVE (percent).
+ *
+ * Only the maps of the offloading itself (copied in and out by every run) that ALIGN with the loop are re-distributed
+ * with the loop, thus it is not applied if such a map is inherited from an enclosing target data or has halo region.
+ */
+void omp_offloading_set_auto_adaptive(omp_offloading_info_t *info, double threshold) {
+	info->auto_adapt_threshold = threshold;
+}
+
+/* whether the map has a dimension ALIGN with the loop of off_info */
+static int omp_map_aligned_with_auto_loop(omp_data_map_info_t * map_info, omp_offloading_info_t * off_info) {
+	int i;
+	for (i=0; i<map_info->num_dims; i++) {
+		omp_dist_info_t * dist_info = &map_info->dist_info[i];
+		if (dist_info->policy == OMP_DIST_POLICY_ALIGN && dist_info->alignee_type == OMP_DIST_TARGET_LOOP_ITERATION &&
+			dist_info->alignee.loop_iteration == off_info) return 1;
+	}
+	return 0;
+}
+
+int omp_offloading_auto_adaptive(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	if (off_info->auto_adapt_threshold <= 0.0 || off->count == 0 || off_info->loop_depth < 1) return 0;
+	if (off_info->loop_dist_info[0].policy != OMP_DIST_POLICY_AUTO) return 0;
+	if (off_info->type != OMP_OFFLOADING_CODE && off_info->type != OMP_OFFLOADING_DATA_CODE) return 0;
+	int i;
+	for (i=0; i<off->num_maps; i++) {
+		int inherited;
+		omp_data_map_t * map = omp_map_offcache_iterator(off, i, &inherited);
+		if (!omp_map_aligned_with_auto_loop(map->info, off_info)) continue;
+		if (inherited || map->info->num_halo_dims) return 0;
+	}
+	return 1;
+}
+
+/**
+ * feed the measured time (ms) of the kernel and of the copyto and copyfrom of a run into the model T = n*A + B of this device.
+ * The copy time is split between A and B by the bytes of the maps that are aligned with the loop and those that are not.
+ * A and B are smoothed over the runs so a single noisy run does not move the partition.
+ */
+void omp_offloading_auto_measure(omp_offloading_t * off, double kernel_ms, double copy_ms) {
+	omp_offloading_info_t * off_info = off->off_info;
+	int run = off->auto_measured;
+	long n = off->loop_dist[0].length;
+	double aligned_bytes = 0.0;
+	double total_bytes = 0.0;
+	int i;
+	for (i=0; i<off->num_maps; i++) {
+		int inherited;
+		omp_data_map_t * map = omp_map_offcache_iterator(off, i, &inherited);
+		if (inherited) continue;
+		omp_data_map_direction_t direction = map->info->map_direction;
+		double bytes = 0.0;
+		if (direction == OMP_DATA_MAP_TO || direction == OMP_DATA_MAP_TOFROM) bytes += map->map_wextra_size;
+		if (direction == OMP_DATA_MAP_FROM || direction == OMP_DATA_MAP_TOFROM) bytes += map->map_size;
+		total_bytes += bytes;
+		if (omp_map_aligned_with_auto_loop(map->info, off_info)) aligned_bytes += bytes;
+	}
+	double aligned_fraction = total_bytes > 0.0 ? aligned_bytes / total_bytes : 0.0;
+	double A = n > 0 ? (kernel_ms + copy_ms * aligned_fraction) / n : 0.0;
+	double B = copy_ms * (1.0 - aligned_fraction);
+	if (run > 0) {
+		double prevA = off->auto_model[(run-1) & 1].A;
+		double prevB = off->auto_model[(run-1) & 1].B;
+		if (A <= 0.0) A = prevA; /* no iteration in this run, nothing measured for A */
+		else if (prevA > 0.0) A = 0.5 * (A + prevA);
+		B = 0.5 * (B + prevB);
+	}
+	off->auto_model[run & 1].A = A;
+	off->auto_model[run & 1].B = B;
+	off->auto_model[run & 1].n = n;
+	__atomic_store_n(&off->auto_measured, run + 1, __ATOMIC_RELEASE);
+	omp_dev_wake_all(&off->auto_measured);
+}
+
+/**
+ * called by the helper thread before the copyto of a run of an adaptive AUTO offloading (see omp_offloading_set_auto_adaptive).
+ * Each device waits for the measurement of the previous run of all the devices, which also means they have copied out
+ * their range, and then solves the same partition from the same measurements, so no other sync is needed. If the new
+ * partition is taken, the loop and the aligned maps of this device are re-distributed and their buffers re-allocated.
+ */
+void omp_offloading_auto_adapt(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_dist_info_t * dist_info = &off_info->loop_dist_info[0];
+	int nnodes = off_info->top->nnodes;
+	int run = off->auto_measured;
+	if (run == 0) return;
+	int slot = (run - 1) & 1;
+	double A[nnodes], B[nnodes], Ar[nnodes], Br[nnodes];
+	long n[nnodes], lengths[nnodes];
+	double sumA = 0.0;
+	int numA = 0;
+	int i;
+	for (i=0; i<nnodes; i++) {
+		omp_offloading_t * anoff = &off_info->offloadings[i];
+		int m;
+		while ((m = __atomic_load_n(&anoff->auto_measured, __ATOMIC_ACQUIRE)) < run) omp_dev_wait_while_equal(off->dev, &anoff->auto_measured, m);
+		A[i] = anoff->auto_model[slot].A;
+		B[i] = anoff->auto_model[slot].B;
+		n[i] = anoff->auto_model[slot].n;
+		if (A[i] > 0.0) {
+			sumA += A[i];
+			numA++;
+		}
+	}
+	if (numA == 0) return;
+	double cur = 0.0;
+	for (i=0; i<nnodes; i++) {
+		if (A[i] <= 0.0) A[i] = sumA / numA; /* never ran an iteration, assume an average device */
+		Ar[i] = 1.0 / A[i];
+		Br[i] = 0.0 - B[i] / A[i];
+		double T = n[i] * A[i] + B[i];
+		if (T > cur) cur = T;
+	}
+	omp_dist_auto_lengths(nnodes, Ar, Br, dist_info->length, lengths);
+	double predicted = 0.0;
+	for (i=0; i<nnodes; i++) {
+		double T = lengths[i] * A[i] + B[i];
+		if (T > predicted) predicted = T;
+	}
+	if (cur - predicted <= off_info->auto_adapt_threshold * cur) return; /* hysteresis, not worth moving the data */
+
+	long offset = dist_info->start;
+	for (i=0; i<off->devseqid; i++) offset += lengths[i];
+	if (off->loop_dist[0].offset == offset && off->loop_dist[0].length == lengths[off->devseqid]) return;
+	off->auto_repartitions++;
+	off->loop_dist[0].offset = offset;
+	off->loop_dist[0].length = lengths[off->devseqid];
+
+	for (i=0; i<off->num_maps; i++) {
+		int inherited;
+		omp_data_map_t * map = omp_map_offcache_iterator(off, i, &inherited);
+		if (!omp_map_aligned_with_auto_loop(map->info, off_info)) continue;
+		omp_map_free(map, off);
+		map->access_level = OMP_DATA_MAP_ACCESS_LEVEL_1;
+		omp_data_map_dist(map, off->devseqid);
+		omp_map_malloc(map, off);
+	}
+}
+
 /**
  * Apply map to device seqid, seqid is the sequence id of the device in the grid topology
  *
@@ -1014,6 +1574,14 @@ void omp_data_map_dist(omp_data_map_t *map, int seqid) {
 		map_size *= length;
 		offset_from0 += mt_from0 * offset;
 		mt_from0 *= map_info->dims[i];
+		if (omp_dist_num_chunks(&map->map_dist[i]) > 1) {
+			/* the CYCLIC chunks are packed in the device buffer, see omp_map_gather, and there is no halo between them */
+			if (map_info->num_halo_dims) {
+				fprintf(stderr, "CYCLIC dist policy of array %s cannot be used with halo region\n", map_info->symbol);
+				abort();
+			}
+			map->mem_noncontiguous = 1;
+		}
 		if (i>0 && (length != map_info->dims[i])) {
 			/* check the dimension from 1 to the highest, if any one is not the full range of the dimension in the original array,
 			 * we have non-contiguous memory space and we need to marshall data
@@ -1021,6 +1589,8 @@ void omp_data_map_dist(omp_data_map_t *map, int seqid) {
 			map->mem_noncontiguous = 1;
 		}
 
+		map->halo_mem[i].left_dev_seqid = -1;
+		map->halo_mem[i].right_dev_seqid = -1;
 		if (map_info->num_halo_dims) {
 			omp_data_map_halo_region_info_t *halo = &map_info->halo_info[i];
 
@@ -1030,7 +1600,9 @@ void omp_data_map_dist(omp_data_map_t *map, int seqid) {
 				omp_data_map_halo_region_mem_t *halo_mem = &map->halo_mem[i];
 				int *left = &halo_mem->left_dev_seqid;
 				int *right = &halo_mem->right_dev_seqid;
-				omp_topology_get_neighbors(top, seqid, halo->topdim, halo->edging == OMP_DIST_HALO_EDGING_PERIODIC, left, right);
+				if (dist_info->policy == OMP_DIST_POLICY_DUPLICATE) { /* the whole dim is here, a periodic halo wraps around itself */
+					*left = *right = halo->edging == OMP_DIST_HALO_EDGING_PERIODIC ? seqid : -1;
+				} else omp_topology_get_neighbors(top, seqid, halo->topdim, halo->edging == OMP_DIST_HALO_EDGING_PERIODIC, left, right);
 //				if (*left >= 0) {
 					length += halo->left;
 					offset = offset - halo->left;
@@ -1040,6 +1612,8 @@ void omp_data_map_dist(omp_data_map_t *map, int seqid) {
 //				}
 			}
 		}
+		if (i>0 && length != map_info->dims[i]) map->mem_noncontiguous = 1; /* the halo of the dim is not part of the rows */
+		map->map_wextra_dims[i] = length;
 		map_wextra_size *= length;
 		offset_wextra_from0 += mt_wextra_from0 * offset;
 		mt_wextra_from0 *= map_info->dims[i];
@@ -1052,12 +1626,67 @@ void omp_data_map_dist(omp_data_map_t *map, int seqid) {
 	map->access_level = OMP_DATA_MAP_ACCESS_LEVEL_2;
 }
 
+/* the number of chunks of a dist, 1 unless it is CYCLIC with more than one chunk on the device */
+long omp_dist_num_chunks(omp_dist_t * dist) {
+	if (dist->chunk_size <= 0 || dist->length == 0) return 1;
+	return (dist->length + dist->chunk_size - 1) / dist->chunk_size;
+}
+
+/**
+ * the index-th chunk of a dist: its start in the local (packed) index space of the dist and its length. Return the
+ * offset of the chunk, i.e. the original index of local index i in the chunk is offset + i, same as dist->offset
+ * for a contiguous dist
+ */
+long omp_dist_get_chunk(omp_dist_t * dist, long index, long * start, long * length) {
+	if (dist->chunk_size <= 0) {
+		*start = 0;
+		*length = dist->length;
+		return dist->offset;
+	}
+	long first = dist->offset + index * dist->stride; /* the original index of the first element of the chunk */
+	*start = index * dist->chunk_size;
+	*length = dist->limit - first < dist->chunk_size ? dist->limit - first : dist->chunk_size;
+	if (*length < 0) *length = 0;
+	return first - *start;
+}
+
+/**
+ * the number of chunks of the loop iterations of a device, see omp_loop_get_chunk. A kernel of a loop that may be CYCLIC
+ * iterates the chunks and uses omp_loop_get_chunk instead of omp_loop_get_range if it needs the original iteration index.
+ */
+long omp_loop_get_num_chunks(omp_offloading_t *off, int loop_level) {
+	if (off->loop_dist[loop_level].info == NULL) {
+		omp_loop_iteration_dist(off);
+	}
+	if (off->chunk_length >= 0 && loop_level == 0) return 1;
+	return omp_dist_num_chunks(&off->loop_dist[loop_level]);
+}
+
+/**
+ * the index-th chunk of the loop iterations of a device: its start and length in the local index space, which are the
+ * rows of the maps aligned with the loop. Return the offset of the chunk, i.e. the original index of local iteration i
+ * is offset + i. Same as omp_loop_get_range for a contiguous dist.
+ */
+long omp_loop_get_chunk(omp_offloading_t *off, int loop_level, long index, long *start, long *length) {
+	if (off->loop_dist[loop_level].info == NULL) {
+		omp_loop_iteration_dist(off);
+	}
+	if (off->loop_dist[loop_level].chunk_size <= 0 || (off->chunk_length >= 0 && loop_level == 0))
+		return omp_loop_get_range(off, loop_level, start, length);
+	return omp_dist_get_chunk(&off->loop_dist[loop_level], index, start, length);
+}
+
 long omp_loop_get_range(omp_offloading_t *off, int loop_level, long *start, long *length) {
 	if (off->loop_dist[loop_level].info == NULL) {
 		omp_loop_iteration_dist(off);
 	}
-	*start = 0;
-	*length = off->loop_dist[loop_level].length;
+	if (off->chunk_length >= 0 && loop_level == 0) { /* a chunk of a pipelined offloading */
+		*start = off->chunk_start;
+		*length = off->chunk_length;
+	} else {
+		*start = 0;
+		*length = off->loop_dist[loop_level].length;
+	}
 	return off->loop_dist[loop_level].offset;
 }
 
@@ -1107,6 +1736,40 @@ long omp_map_element_offset(omp_data_map_t * map) {
 	return off;
 }
 
+/**
+ * the box of the halo region of a map in dim that starts at start (of the wextra region) and has width elements in dim,
+ * it has the full extents (including the halo) of the lower dims and only the mapped region of the higher dims: the dims
+ * are exchanged from the lowest, thus the box carries the corners of the lower dims, which are exchanged already, but
+ * not the halo of the higher dims, which is not yet. The latter matters for a SHARED map, whose halo is the region of
+ * other devices in place. Return the offset and length of the box in the dims of the wextra region.
+ */
+static void omp_halo_region_box_range(omp_data_map_t * map, int dim, long start, long width, long * offset, long * length) {
+	int i;
+	for (i=0; i<map->info->num_dims; i++) {
+		if (i == dim) {
+			offset[i] = start;
+			length[i] = width;
+		} else if (i < dim) {
+			offset[i] = 0;
+			length[i] = map->map_wextra_dims[i];
+		} else {
+			offset[i] = map->info->halo_info[i].left;
+			length[i] = map->map_dist[i].length;
+		}
+	}
+}
+
+/* the first element and the size of the packed box (see omp_halo_region_box_range) in the device buffer of a map */
+static char * omp_halo_region_box(omp_data_map_t * map, int dim, long start, long width, long * size) {
+	long offset[OMP_MAX_NUM_DIMENSIONS], length[OMP_MAX_NUM_DIMENSIONS];
+	int ndims = map->info->num_dims;
+	int i;
+	omp_halo_region_box_range(map, dim, start, width, offset, length);
+	*size = map->info->sizeof_element;
+	for (i=0; i<ndims; i++) *size *= length[i];
+	return map->map_dev_wextra_ptr + map->info->sizeof_element * omp_array_element_offset(ndims, map->map_dev_dims, offset);
+}
+
 /**
  * this function creates host buffer, if needed, and marshall data to the host buffer,
  *
@@ -1119,16 +1782,54 @@ void omp_map_malloc(omp_data_map_t *map, omp_offloading_t *off) {
 	omp_grid_topology_t * top = off_info->top;
 	int sizeof_element = map_info->sizeof_element;
 
+	if (map->map_type != OMP_DATA_MAP_COPY && map_info->num_halo_dims) {
+		/* the halo of a SHARED or ZEROCOPY map is the host array in place, thus the map has to be COPY if its halo wraps
+		 * around (periodic), or if the box is not within the array since the halo exchange would then write to the next
+		 * rows or out of the array. The halo of dim 0 out of the array is fine if no other dim has halo, it is never accessed */
+		int other_halo = 0;
+		for (i = 1; i < map_info->num_dims; i++) {
+			if (map_info->halo_info[i].left != 0 || map_info->halo_info[i].right != 0) other_halo = 1;
+		}
+		for (i = 0; i < map_info->num_dims; i++) {
+			omp_data_map_halo_region_info_t *halo_info = &map_info->halo_info[i];
+			long lo = map->map_dist[i].offset - halo_info->left;
+			long hi = lo + map->map_wextra_dims[i];
+			if ((halo_info->left != 0 || halo_info->right != 0) && halo_info->edging == OMP_DIST_HALO_EDGING_PERIODIC)
+				map->map_type = OMP_DATA_MAP_COPY;
+			else if ((lo < 0 || hi > map_info->dims[i]) && (i > 0 || other_halo))
+				map->map_type = OMP_DATA_MAP_COPY;
+		}
+	}
+	if (map->map_type == OMP_DATA_MAP_SHARED) {
+		/* the CYCLIC chunks of a device are only contiguous in a packed copy */
+		for (i = 0; i < map_info->num_dims; i++) {
+			if (omp_dist_num_chunks(&map->map_dist[i]) > 1) map->map_type = OMP_DATA_MAP_COPY;
+		}
+	}
+	if (map->map_type == OMP_DATA_MAP_ZEROCOPY) {
+		/* the device pointer of the registered host region, fall back to COPY if the array cannot be registered,
+		 * or if the region is not a contiguous range of the array */
+		map->map_dev_wextra_ptr = NULL;
+		if (!map->mem_noncontiguous && omp_map_info_register_host(map_info))
+			map->map_dev_wextra_ptr = omp_host_get_dev_ptr(map->dev, map->map_source_wextra_ptr);
+		if (map->map_dev_wextra_ptr == NULL) map->map_type = OMP_DATA_MAP_COPY;
+	}
+
 	if (map->map_type == OMP_DATA_MAP_SHARED) {
 		map->map_dev_ptr = map->map_source_ptr;
 		map->map_dev_wextra_ptr = map->map_source_wextra_ptr;
 	} else if (map->map_type == OMP_DATA_MAP_COPY) {
-		map->map_dev_wextra_ptr = omp_map_malloc_dev(map->dev, map->map_wextra_size);
+		map->map_dev_wextra_ptr = omp_map_malloc_dev_async(map->dev, map->map_wextra_size, off->stream);
+		map->map_dev_ptr = map->map_dev_wextra_ptr; /* this will be updated if there is halo region */
+	} else if (map->map_type == OMP_DATA_MAP_ZEROCOPY) {
 		map->map_dev_ptr = map->map_dev_wextra_ptr; /* this will be updated if there is halo region */
 	} else {
 		printf("unknown map type at this stage: map: %X, %d\n", map, map->map_type);
 		abort();
 	}
+	for (i = 0; i < map_info->num_dims; i++) {
+		map->map_dev_dims[i] = map->map_type == OMP_DATA_MAP_SHARED ? map_info->dims[i] : map->map_wextra_dims[i];
+	}
 
 	/*
 	* The halo memory management use an attached approach, i.e. the halo region is part of the main computation subregion, and those
@@ -1142,61 +1843,48 @@ void omp_map_malloc(omp_data_map_t *map, omp_offloading_t *off) {
 	/************************* Barrier may be needed among all participating devs since we are now using neighborhood devs **********************************/
 	/*********************************************************************************************************************************************************/
 
-	/* TODO: so far, we only handle row-wise halo region in the first dimension of an array, i.e. contiginous memory space */
 	if (map_info->num_halo_dims) {
 		/* TODO: assert map->map_size != map->map_wextra_size; */
-		if (map->mem_noncontiguous) {
-			printf("So far, we only handle row-wise halo region in the first dimension of an array\n");
-			abort();
-		}
 		//		BEGIN_SERIALIZED_PRINTF(off->devseqid);
-		/* mem size of a row */
-		long row_size = sizeof_element;
-		for (i = 1; i < map_info->num_dims; i++) {
-			row_size *= map_info->dims[i];
-		}
-		omp_data_map_halo_region_info_t *halo_info = &map_info->halo_info[0];
-		omp_data_map_halo_region_mem_t *halo_mem = &map->halo_mem[0];
-		halo_mem->left_in_size = halo_info->left * row_size;
-		map->map_dev_ptr = map->map_dev_wextra_ptr + halo_mem->left_in_size;
-		halo_mem->left_in_ptr = map->map_dev_wextra_ptr;
-		halo_mem->left_out_size = halo_info->right * row_size;
-		halo_mem->left_out_ptr = map->map_dev_ptr;
-		//printf("dev: %d, halo left in size: %d, left in ptr: %X, left out size: %d, left out ptr: %X\n", off->devseqid,
-		//	   halo_mem->left_in_size,halo_mem->left_in_ptr,halo_mem->left_out_size,halo_mem->left_out_ptr);
-		if (halo_mem->left_dev_seqid >= 0) {
-			omp_device_t *leftdev = &omp_devices[top->idmap[halo_mem->left_dev_seqid]];
-			if (!omp_map_enable_memcpy_DeviceToDevice(leftdev, map->dev)) { /* no peer2peer access available, use host relay */
-				/** FIXME, mem leak here and we have not thought where to free */
-				halo_mem->left_in_host_relay_ptr = (char *) malloc(halo_mem->left_in_size);
-				halo_mem->left_in_data_in_relay_pushed = 0;
-				halo_mem->left_in_data_in_relay_pulled = 0;
-
-			//	printf("dev: %d, map: %X, left: %d, left host relay buffer allocated\n", off->devseqid, map, halo_mem->left_dev_seqid);
-			} else {
-			//	printf("dev: %d, map: %X, left: %d, left dev: p2p enabled\n", off->devseqid, map, halo_mem->left_dev_seqid);
-				halo_mem->left_in_host_relay_ptr = NULL;
+		long halo_left[OMP_MAX_NUM_DIMENSIONS];
+		for (i = 0; i < map_info->num_dims; i++) halo_left[i] = map_info->halo_info[i].left;
+		map->map_dev_ptr = map->map_dev_wextra_ptr + sizeof_element * omp_array_element_offset(map_info->num_dims, map->map_dev_dims, halo_left);
+
+		for (i = 0; i < map_info->num_dims; i++) {
+			omp_data_map_halo_region_info_t *halo_info = &map_info->halo_info[i];
+			omp_data_map_halo_region_mem_t *halo_mem = &map->halo_mem[i];
+			if (halo_info->left == 0 && halo_info->right == 0) continue;
+			long length = map->map_dist[i].length;
+			halo_mem->left_in_ptr = omp_halo_region_box(map, i, 0, halo_info->left, &halo_mem->left_in_size);
+			halo_mem->left_out_ptr = omp_halo_region_box(map, i, halo_info->left, halo_info->right, &halo_mem->left_out_size);
+			//printf("dev: %d, halo left in size: %d, left in ptr: %X, left out size: %d, left out ptr: %X\n", off->devseqid,
+			//	   halo_mem->left_in_size,halo_mem->left_in_ptr,halo_mem->left_out_size,halo_mem->left_out_ptr);
+			halo_mem->left_in_host_relay_ptr = NULL;
+			if (halo_mem->left_dev_seqid >= 0 && halo_mem->left_dev_seqid != off->devseqid) {
+				omp_device_t *leftdev = &omp_devices[top->idmap[halo_mem->left_dev_seqid]];
+				if (!omp_map_enable_memcpy_DeviceToDevice(leftdev, map->dev)) { /* no peer2peer access available, use host relay */
+					/** FIXME, mem leak here and we have not thought where to free */
+					halo_mem->left_in_host_relay_ptr = (char *) malloc(halo_mem->left_in_size * OMP_HALO_RELAY_SLOTS);
+					halo_mem->left_in_data_in_relay_pushed = 0;
+					halo_mem->left_in_data_in_relay_pulled = 0;
+				//	printf("dev: %d, map: %X, left: %d, left host relay buffer allocated\n", off->devseqid, map, halo_mem->left_dev_seqid);
+				}
 			}
-		} //else map->map_dev_ptr = map->map_dev_wextra_ptr;
-
-		halo_mem->right_in_size = halo_info->right * row_size;
-		halo_mem->right_in_ptr = &((char *) map->map_dev_ptr)[map->map_size];
-		halo_mem->right_out_size = halo_info->left * row_size;
-		halo_mem->right_out_ptr = &((char *) halo_mem->right_in_ptr)[0 - halo_mem->right_out_size];
-		//printf("dev: %d, halo right in size: %d, right in ptr: %X, right out size: %d, right out ptr: %X\n", off->devseqid,
-		//	   halo_mem->right_in_size,halo_mem->right_in_ptr,halo_mem->right_out_size,halo_mem->right_out_ptr);
-		if (halo_mem->right_dev_seqid >= 0) {
-			omp_device_t *rightdev = &omp_devices[top->idmap[halo_mem->right_dev_seqid]];
-			if (!omp_map_enable_memcpy_DeviceToDevice(rightdev, map->dev)) { /* no peer2peer access available, use host relay */
-				/** FIXME, mem leak here and we have not thought where to free */
-				halo_mem->right_in_host_relay_ptr = (char *) malloc(halo_mem->right_in_size);
-				halo_mem->right_in_data_in_relay_pushed = 0;
-				halo_mem->right_in_data_in_relay_pulled = 0;
-
-			//	printf("dev: %d, map: %X, right: %d, right host relay buffer allocated\n", off->devseqid, map, halo_mem->right_dev_seqid);
-			} else {
-			//	printf("dev: %d, map: %X, right: %d, right host p2p enabled\n", off->devseqid, map, halo_mem->right_dev_seqid);
-				halo_mem->right_in_host_relay_ptr = NULL;
+
+			halo_mem->right_in_ptr = omp_halo_region_box(map, i, halo_info->left + length, halo_info->right, &halo_mem->right_in_size);
+			halo_mem->right_out_ptr = omp_halo_region_box(map, i, length, halo_info->left, &halo_mem->right_out_size);
+			//printf("dev: %d, halo right in size: %d, right in ptr: %X, right out size: %d, right out ptr: %X\n", off->devseqid,
+			//	   halo_mem->right_in_size,halo_mem->right_in_ptr,halo_mem->right_out_size,halo_mem->right_out_ptr);
+			halo_mem->right_in_host_relay_ptr = NULL;
+			if (halo_mem->right_dev_seqid >= 0 && halo_mem->right_dev_seqid != off->devseqid) {
+				omp_device_t *rightdev = &omp_devices[top->idmap[halo_mem->right_dev_seqid]];
+				if (!omp_map_enable_memcpy_DeviceToDevice(rightdev, map->dev)) { /* no peer2peer access available, use host relay */
+					/** FIXME, mem leak here and we have not thought where to free */
+					halo_mem->right_in_host_relay_ptr = (char *) malloc(halo_mem->right_in_size * OMP_HALO_RELAY_SLOTS);
+					halo_mem->right_in_data_in_relay_pushed = 0;
+					halo_mem->right_in_data_in_relay_pulled = 0;
+				//	printf("dev: %d, map: %X, right: %d, right host relay buffer allocated\n", off->devseqid, map, halo_mem->right_dev_seqid);
+				}
 			}
 		}
 		//		END_SERIALIZED_PRINTF();
@@ -1209,8 +1897,15 @@ void omp_map_malloc(omp_data_map_t *map, omp_offloading_t *off) {
  * seqid is the sequence id of the device in the top, it is also used as index to access maps
  */
 void omp_map_free(omp_data_map_t *map, omp_offloading_t *off) {
-	if (map->map_type == OMP_DATA_MAP_COPY)
-		omp_map_free_dev(map->dev, map->map_dev_wextra_ptr);
+	if (map->map_type == OMP_DATA_MAP_COPY) {
+		/* the stream of an offloading is destroyed after the offloading, so the pool cannot keep it with the block */
+		omp_dev_stream_t * stream = off->stream == &off->mystream ? NULL : off->stream;
+		omp_map_free_dev_async(map->dev, map->map_dev_wextra_ptr, stream);
+	}
+	if (map->map_staging_ptr != NULL) { /* the stream of the copies with it is synced before the map is freed */
+		omp_mem_pool_free(&omp_unified_mem_pool, map->map_staging_ptr, NULL);
+		map->map_staging_ptr = NULL;
+	}
 }
 
 void omp_print_map_info(omp_data_map_info_t * info) {
@@ -1242,6 +1937,8 @@ void omp_print_data_map(omp_data_map_t * map) {
 	char * mem = "COPY";
 	if (map->map_type == OMP_DATA_MAP_SHARED) {
 		mem = "SHARED";
+	} else if (map->map_type == OMP_DATA_MAP_ZEROCOPY) {
+		mem = "ZEROCOPY";
 	}
 	printf(", size: %d, size wextra: %d, mem: %s\n",map->map_size, map->map_wextra_size, mem);
 	printf("\t\tsrc ptr: %X, src wextra ptr: %X, dev ptr: %X, dev wextra ptr: %X\n", map->map_source_ptr, map->map_source_wextra_ptr, map->map_dev_ptr, map->map_dev_wextra_ptr);
@@ -1276,81 +1973,131 @@ void omp_print_off_maps(omp_offloading_t * off) {
  */
 #define CORRECTNESS_CHECK 1
 #undef CORRECTNESS_CHECK
+/**
+ * copy the halo region box of dim that starts at src_start of src_map to the one that starts at dst_start of dst_map. If a map
+ * is NULL, its side is the packed box in the host relay buffer
+ */
+static void omp_halo_region_copy(omp_data_map_t * dst_map, char * dst_relay, long dst_start,
+								 omp_data_map_t * src_map, char * src_relay, long src_start, int dim, long width) {
+	omp_data_map_t * map = dst_map != NULL ? dst_map : src_map;
+	int ndims = map->info->num_dims;
+	long dst_offset[OMP_MAX_NUM_DIMENSIONS], src_offset[OMP_MAX_NUM_DIMENSIONS], length[OMP_MAX_NUM_DIMENSIONS];
+	long zero[OMP_MAX_NUM_DIMENSIONS] = {0};
+	omp_halo_region_box_range(map, dim, dst_start, width, dst_offset, length);
+	omp_halo_region_box_range(map, dim, src_start, width, src_offset, length);
+	if (dst_map != NULL && src_map != NULL) {
+		int i;
+		for (i=0; i<ndims; i++) {
+			long dst_extent = i < dim ? dst_map->map_wextra_dims[i] : dst_map->map_dist[i].length;
+			long src_extent = i < dim ? src_map->map_wextra_dims[i] : src_map->map_dist[i].length;
+			if (i != dim && dst_extent != src_extent) {
+				fprintf(stderr, "halo of %s in dim %d: neighbours have different extents in dim %d (%ld vs %ld)\n", map->info->symbol,
+						dim, i, dst_extent, src_extent);
+				abort();
+			}
+		}
+	}
+	omp_map_memcpy_box(dst_map != NULL ? dst_map->map_dev_wextra_ptr : dst_relay, dst_map != NULL ? dst_map->dev : NULL,
+					   dst_map != NULL ? dst_map->map_dev_dims : length, dst_map != NULL ? dst_offset : zero,
+					   src_map != NULL ? src_map->map_dev_wextra_ptr : src_relay, src_map != NULL ? src_map->dev : NULL,
+					   src_map != NULL ? src_map->map_dev_dims : length, src_map != NULL ? src_offset : zero,
+					   length, ndims, map->info->sizeof_element);
+}
+
 void omp_halo_region_pull(omp_data_map_t * map, int dim, omp_data_map_exchange_direction_t from_left_right) {
 	omp_data_map_info_t * info = map->info;
-	/*FIXME: let us only handle 2-D array now */
-	if (dim != 0 || map->mem_noncontiguous) {
-		fprintf(stderr, "we only handle noncontiguous distribution and halo at dimension 0 so far!\n");
-		omp_print_map_info(map->info);
+	if (dim < 0) {
+		/* corners come from the diagonal neighbours only if the neighbours are synced between the dims, as the helper
+		 * threads do for the appended and standalone data exchange */
+		for (dim = 0; dim < info->num_dims; dim++) {
+			if (info->halo_info[dim].left != 0 || info->halo_info[dim].right != 0) omp_halo_region_pull(map, dim, from_left_right);
+		}
 		return;
 	}
 
 	omp_data_map_halo_region_mem_t * halo_mem = &map->halo_mem[dim];
+	omp_data_map_halo_region_info_t * halo_info = &info->halo_info[dim];
+	long length = map->map_dist[dim].length;
 #if CORRECTNESS_CHECK
     BEGIN_SERIALIZED_PRINTF(map->dev->id);
 	printf("dev: %d, map: %X, left: %d, right: %d\n", map->dev->id, map, halo_mem->left_dev_seqid, halo_mem->right_dev_seqid);
 #endif
 
-	if (halo_mem->left_dev_seqid >= 0 && (from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_LEFT_ONLY || from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT)) { /* pull from left */
-		omp_data_map_t * left_map = &info->maps[halo_mem->left_dev_seqid];
-		omp_data_map_halo_region_mem_t * left_halo_mem = &left_map->halo_mem[dim];
+	int from_left = halo_mem->left_dev_seqid >= 0 && (from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_LEFT_ONLY || from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT);
+	int from_right = halo_mem->right_dev_seqid >= 0 && (from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_RIGHT_ONLY || from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT);
+	omp_data_map_t * left_map = from_left ? &info->maps[halo_mem->left_dev_seqid] : NULL;
+	omp_data_map_t * right_map = from_right ? &info->maps[halo_mem->right_dev_seqid] : NULL;
 
+	/* push to the host relay buffers of both neighbours before pulling from any of them, otherwise the devices of a
+	 * periodic ring would all wait for the left neighbour to push */
+	if (from_left) {
+		omp_data_map_halo_region_mem_t * left_halo_mem = &left_map->halo_mem[dim];
 		/* if I need to push right_out data to the host relay buffer for the left_map, I should do it first */
 		if (left_halo_mem->right_in_host_relay_ptr != NULL) {
-			/* wait make sure the data in the right_in_host_relay buffer is already pulled */
-			while (left_halo_mem->right_in_data_in_relay_pushed > left_halo_mem->right_in_data_in_relay_pulled);
+			/* wait for a free slot in the right_in_host_relay buffer, i.e. the data pushed two exchanges ago is already pulled */
+			int pushed = left_halo_mem->right_in_data_in_relay_pushed;
+			int pulled;
+			while (pushed - (pulled = left_halo_mem->right_in_data_in_relay_pulled) >= OMP_HALO_RELAY_SLOTS)
+				omp_dev_wait_while_equal(map->dev, &left_halo_mem->right_in_data_in_relay_pulled, pulled);
 			//if (map->map_type == OMP_DATA_MAP_COPY || left_map->map_type == OMP_DATA_MAP_COPY)
-			omp_map_memcpy_from((void*)left_halo_mem->right_in_host_relay_ptr, (void*)halo_mem->left_out_ptr, map->dev, halo_mem->left_out_size);
-			left_halo_mem->right_in_data_in_relay_pushed ++;
+			char * slot = left_halo_mem->right_in_host_relay_ptr + (pushed % OMP_HALO_RELAY_SLOTS) * left_halo_mem->right_in_size;
+			omp_halo_region_copy(NULL, slot, 0, map, NULL, halo_info->left, dim, halo_info->right);
+			__atomic_add_fetch(&left_halo_mem->right_in_data_in_relay_pushed, 1, __ATOMIC_SEQ_CST);
+			omp_dev_wake_all(&left_halo_mem->right_in_data_in_relay_pushed);
 		} else {
 			/* do nothing here because the left_map helper thread will do a direct device-to-device pull */
 		}
-
-		if (halo_mem->left_in_host_relay_ptr == NULL) { /* no need host relay */
-			omp_map_memcpy_DeviceToDevice((void*)halo_mem->left_in_ptr, map->dev, (void*)left_halo_mem->right_out_ptr, left_map->dev, halo_mem->left_in_size);
-#if CORRECTNESS_CHECK
-			printf("dev: %d, dev2dev memcpy from left: %X <----- %X\n", map->dev->id, halo_mem->left_in_ptr, left_halo_mem->right_out_ptr);
-#endif
-		} else { /* need host relay */
-			/*
-			omp_set_current_device_dev(left_map->dev);
-			omp_map_memcpy_from(halo_mem->left_in_host_relay_ptr, left_map->halo_mem[dim].right_out_ptr, left_map->dev, halo_mem->left_in_size);
-			omp_set_current_device_dev(map->dev);
-			*/
-			while (halo_mem->left_in_data_in_relay_pushed <= halo_mem->left_in_data_in_relay_pulled); /* wait for the data to be ready in the relay buffer on host */
-			/* wait for the data in the relay buffer is ready */
-			omp_map_memcpy_to((void*)halo_mem->left_in_ptr, map->dev, (void*)halo_mem->left_in_host_relay_ptr, halo_mem->left_in_size);
-			halo_mem->left_in_data_in_relay_pulled++;
-		}
 	}
-	if (halo_mem->right_dev_seqid >= 0 && (from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_RIGHT_ONLY || from_left_right == OMP_DATA_MAP_EXCHANGE_FROM_LEFT_RIGHT)) {
-		omp_data_map_t * right_map = &info->maps[halo_mem->right_dev_seqid];
+	if (from_right) {
 		omp_data_map_halo_region_mem_t * right_halo_mem = &right_map->halo_mem[dim];
-
 		/* if I need to push left_out data to the host relay buffer for the right_map, I should do it first */
 		if (right_halo_mem->left_in_host_relay_ptr != NULL) {
-			while (right_halo_mem->left_in_data_in_relay_pushed > right_halo_mem->left_in_data_in_relay_pulled);
-			omp_map_memcpy_from((void*)right_halo_mem->left_in_host_relay_ptr, (void*)halo_mem->right_out_ptr, map->dev, halo_mem->right_out_size);
-			right_halo_mem->left_in_data_in_relay_pushed ++;
+			int pushed = right_halo_mem->left_in_data_in_relay_pushed;
+			int pulled;
+			while (pushed - (pulled = right_halo_mem->left_in_data_in_relay_pulled) >= OMP_HALO_RELAY_SLOTS)
+				omp_dev_wait_while_equal(map->dev, &right_halo_mem->left_in_data_in_relay_pulled, pulled);
+			char * slot = right_halo_mem->left_in_host_relay_ptr + (pushed % OMP_HALO_RELAY_SLOTS) * right_halo_mem->left_in_size;
+			omp_halo_region_copy(NULL, slot, 0, map, NULL, length, dim, halo_info->left);
+			__atomic_add_fetch(&right_halo_mem->left_in_data_in_relay_pushed, 1, __ATOMIC_SEQ_CST);
+			omp_dev_wake_all(&right_halo_mem->left_in_data_in_relay_pushed);
 		} else {
-			/* do nothing here because the left_map helper thread will do a direct device-to-device pull */
+			/* do nothing here because the right_map helper thread will do a direct device-to-device pull */
 		}
+	}
 
+	if (from_left) { /* pull from left */
+		if (halo_mem->left_in_host_relay_ptr == NULL) { /* no need host relay */
+			omp_halo_region_copy(map, NULL, 0, left_map, NULL, left_map->map_dist[dim].length, dim, halo_info->left);
+#if CORRECTNESS_CHECK
+			printf("dev: %d, dev2dev memcpy from left: %X <----- %X\n", map->dev->id, halo_mem->left_in_ptr, left_map->halo_mem[dim].right_out_ptr);
+#endif
+		} else { /* need host relay */
+			int pushed;
+			int pulled = halo_mem->left_in_data_in_relay_pulled;
+			while ((pushed = halo_mem->left_in_data_in_relay_pushed) <= pulled) /* wait for the data to be ready in the relay buffer on host */
+				omp_dev_wait_while_equal(map->dev, &halo_mem->left_in_data_in_relay_pushed, pushed);
+			char * slot = halo_mem->left_in_host_relay_ptr + (pulled % OMP_HALO_RELAY_SLOTS) * halo_mem->left_in_size;
+			omp_halo_region_copy(map, NULL, 0, NULL, slot, 0, dim, halo_info->left);
+			__atomic_add_fetch(&halo_mem->left_in_data_in_relay_pulled, 1, __ATOMIC_SEQ_CST);
+			omp_dev_wake_all(&halo_mem->left_in_data_in_relay_pulled);
+		}
+	}
+	if (from_right) {
 		if (halo_mem->right_in_host_relay_ptr == NULL) {
-			omp_map_memcpy_DeviceToDevice((void*)halo_mem->right_in_ptr, map->dev, (void*)right_halo_mem->left_out_ptr, right_map->dev, halo_mem->right_in_size);
+			omp_halo_region_copy(map, NULL, halo_info->left + length, right_map, NULL, halo_info->left, dim, halo_info->right);
 #if CORRECTNESS_CHECK
-			printf("dev: %d, dev2dev memcpy from right: %X <----- %X\n", map->dev->id, halo_mem->right_in_ptr, right_halo_mem->left_out_ptr);
+			printf("dev: %d, dev2dev memcpy from right: %X <----- %X\n", map->dev->id, halo_mem->right_in_ptr, right_map->halo_mem[dim].left_out_ptr);
 #endif
 
 		} else {
-			/*
-			omp_set_current_device_dev(right_map->dev);
-			omp_map_memcpy_from(halo_mem->right_in_host_relay_ptr, right_map->halo_mem[dim].left_out_ptr, right_map->dev, halo_mem->right_in_size);
-			omp_set_current_device_dev(map->dev);
-			*/
-			while (halo_mem->right_in_data_in_relay_pushed <= halo_mem->right_in_data_in_relay_pulled); /* wait for the data to be ready in the relay buffer on host */
-			omp_map_memcpy_to((void*)halo_mem->right_in_ptr, map->dev, (void*)halo_mem->right_in_host_relay_ptr, halo_mem->right_in_size);
-			halo_mem->right_in_data_in_relay_pulled++;
+			int pushed;
+			int pulled = halo_mem->right_in_data_in_relay_pulled;
+			while ((pushed = halo_mem->right_in_data_in_relay_pushed) <= pulled) /* wait for the data to be ready in the relay buffer on host */
+				omp_dev_wait_while_equal(map->dev, &halo_mem->right_in_data_in_relay_pushed, pushed);
+			char * slot = halo_mem->right_in_host_relay_ptr + (pulled % OMP_HALO_RELAY_SLOTS) * halo_mem->right_in_size;
+			omp_halo_region_copy(map, NULL, halo_info->left + length, NULL, slot, 0, dim, halo_info->right);
+			__atomic_add_fetch(&halo_mem->right_in_data_in_relay_pulled, 1, __ATOMIC_SEQ_CST);
+			omp_dev_wake_all(&halo_mem->right_in_data_in_relay_pulled);
 		}
 	}
 #if CORRECTNESS_CHECK
@@ -1361,82 +2108,6 @@ void omp_halo_region_pull(omp_data_map_t * map, int dim, omp_data_map_exchange_d
 
 #undef CORRECTNESS_CHECK
 
-void omp_map_unmarshal(omp_data_map_t * map) {
-	if (!map->mem_noncontiguous) return;
-	omp_data_map_info_t * info = map->info;
-	int sizeof_element = info->sizeof_element;
-	int i;
-	switch (info->num_dims) {
-		case 1: {
-			fprintf(stderr, "data unmarshall can only do 2-d or 3-d array, currently is 1-d\n");
-			break;
-		}
-		case 2: {
-			long region_line_size = map->map_dist[1].length*sizeof_element;
-			long full_line_size = info->dims[1]*sizeof_element;
-			long region_off = 0;
-			long full_off = 0;
-			char * src_ptr = &info->source_ptr[sizeof_element*info->dims[1]*map->map_dist[0].offset + sizeof_element*map->map_dist[1].offset];
-			for (i=0; i<map->map_dist[0].length; i++) {
-				memcpy((void*)&src_ptr[full_off], (void*)&map->map_source_ptr[region_off], region_line_size);
-				region_off += region_line_size;
-				full_off += full_line_size;
-			}
-			break;
-		}
-		case 3: {
-			break;
-		}
-		default: {
-			fprintf(stderr, "data unmarshall can only do 2-d or 3-d array\n");
-			break;
-		}
-	}
-//	printf("total %ld bytes of data unmarshalled\n", region_off);
-}
-
-/**
- *  so far works for at most 2D
- */
-void * omp_map_marshal(omp_data_map_t *map) {
-	omp_data_map_info_t * info = map->info;
-	int sizeof_element = info->sizeof_element;
-	int i;
-	switch (info->num_dims) {
-		case 1: {
-			fprintf(stderr,
-					"data marshall can only do 2-d or 3-d array, currently is 1-d\n");
-			break;
-		}
-		case 2: {
-			void *map_buffer = (void*) malloc(map->map_size);
-			long region_line_size = map->map_dist[1].length * sizeof_element;
-			long full_line_size = info->dims[1] * sizeof_element;
-			long region_off = 0;
-			long full_off = 0;
-			char * src_ptr = &info->source_ptr[sizeof_element * info->dims[1] * map->map_dist[0].offset
-											   + sizeof_element * map->map_dist[1].offset];
-			for (i = 0; i < map->map_dist[0].length; i++) {
-				memcpy((void*)&map_buffer[region_off], (void*)&src_ptr[full_off], region_line_size);
-				region_off += region_line_size;
-				full_off += full_line_size;
-			}
-			return map_buffer;
-			break;
-		}
-		case 3: {
-			break;
-		}
-		default: {
-			fprintf(stderr, "data marshall can only do 2-d or 3-d array\n");
-			break;
-		}
-	}
-
-	return NULL;
-//	printf("total %ld bytes of data marshalled\n", region_off);
-}
-
 /**
  * utilities
  */
@@ -1607,8 +2278,17 @@ void omp_topology_print(omp_grid_topology_t * top) {
 		printf("[%d]", top->dims[i]);
 	printf("\n");
 	for (i=0; i<top->nnodes; i++) {
-		printf("%d->%d\n", i, top->idmap[i]);
+		omp_device_t * dev = &omp_devices[top->idmap[i]];
+		printf("%d->%d (%s", i, top->idmap[i], dev->name);
+		if (dev->num_bound_cpus) {
+			char cpus[256];
+			omp_cpumask_print(dev->cpumask, cpus, sizeof(cpus));
+			printf(", cpus %s", cpus);
+		}
+		if (dev->numa_node >= 0) printf(", NUMA node %d", dev->numa_node);
+		printf(")\n");
 	}
+	printf("host: %d cpus, %d cores, %d NUMA nodes\n", omp_host_topology.num_cpus, omp_host_topology.num_cores, omp_host_topology.num_nodes);
 	printf("\n");
 }
 
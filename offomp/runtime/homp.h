@@ -30,6 +30,7 @@ extern int omp_get_num_devices();
 
 typedef struct omp_device omp_device_t;
 typedef struct omp_data_map omp_data_map_t;
+typedef struct omp_data_map_present omp_data_map_present_t;
 typedef struct omp_data_map_info omp_data_map_info_t;
 typedef struct omp_offloading_info omp_offloading_info_t;
 typedef struct omp_offloading omp_offloading_t;
@@ -106,6 +107,218 @@ typedef enum omp_device_mem_type { /* the mem type related to the host mem */
  * The helper thread use the offload_queue to keep track of a list of
  * offloading request to this device, see struct_offloading_dev_t struct definition
  */
+
+/**
+ * the offload_queue is a bounded lock-free ring of offloading requests, multiple host threads can post
+ * requests to it concurrently and the helper thread of the device is the only consumer, which drains
+ * the requests in the order they are posted. Each slot has a sequence number so that a producer knows
+ * the slot is free (seq == the ticket it reserved) and the consumer knows the slot is filled (seq == ticket+1)
+ */
+#define OMP_OFFLOADING_QUEUE_SIZE 16 /* must be a power of 2 */
+typedef struct omp_offloading_queue_slot {
+	volatile unsigned long seq;
+	omp_offloading_info_t * off_info;
+} omp_offloading_queue_slot_t;
+
+typedef struct omp_offloading_queue {
+	volatile unsigned long tail; /* the next ticket to be reserved by producers, updated by CAS */
+	volatile unsigned long head; /* the next ticket to be consumed, only updated by the helper thread */
+	omp_offloading_queue_slot_t slots[OMP_OFFLOADING_QUEUE_SIZE];
+	volatile int signal; /* increased for every posted request, the helper thread parks on it when the queue is empty */
+} omp_offloading_queue_t;
+
+/**
+ * how a helper thread waits for a new request or for the halo data from its neighbours (and how the host waits for
+ * the completion of a request): spin only (lowest latency, burn a core), park only (futex sleep, no cpu used), or
+ * adaptive (spin with pause for a bounded number of iterations and then park, the spin budget of each device is
+ * doubled when a wait completes while spinning, and halved when it has to park).
+ * Set by OMP_DEV_WAIT_POLICY (spin|park|adaptive) and OMP_DEV_SPIN_COUNT env variables
+ */
+typedef enum omp_dev_wait_policy {
+	OMP_DEV_WAIT_SPIN,
+	OMP_DEV_WAIT_PARK,
+	OMP_DEV_WAIT_ADAPTIVE,
+} omp_dev_wait_policy_t;
+
+#define OMP_DEV_DEFAULT_SPIN_COUNT 20000
+#define OMP_DEV_MIN_SPIN_COUNT 100
+
+/* the max number of concurrent streams per device, set by OMP_DEV_NUM_STREAMS env variable, default is
+ * OMP_DEV_DEFAULT_NUM_STREAMS for NVGPU and 1 for the host devices whose memcpy and kernel are synchronous */
+#define OMP_DEV_MAX_STREAMS 4
+#define OMP_DEV_DEFAULT_NUM_STREAMS 3
+
+/**
+ * the caching memory pool behind omp_map_malloc_dev/omp_map_free_dev (one per device) and omp_unified_malloc/free (one
+ * for the host). A freed block is kept in the bin of its size class (4 classes between two powers of 2, from 256 bytes)
+ * and reused by a later allocation of the same class, so a recurring offloading does not pay cudaMalloc/cudaFree or
+ * malloc/free every time. A block freed with a stream (omp_map_free_dev_async) may still be used by that stream and is
+ * only handed to another stream after the stream is synced. The pool of a host device (HOSTCPU/THSIM) allocates the big
+ * blocks from the NUMA node of the device helper thread.
+ * The max bytes cached by a pool is set by OMP_DEV_MEM_POOL_LIMIT (MB), 0 disables the caching.
+ */
+#define OMP_MEM_POOL_MIN_LG 8 /* the smallest size class is 2^8 bytes */
+#define OMP_MEM_POOL_MAX_LG 48 /* blocks bigger than 2^48 bytes are not cached */
+#define OMP_MEM_POOL_NUM_BINS (4*(OMP_MEM_POOL_MAX_LG-OMP_MEM_POOL_MIN_LG)+1)
+#define OMP_MEM_POOL_HASH_SIZE 256 /* must be a power of 2 */
+#define OMP_MEM_POOL_DEFAULT_LIMIT (1024L*1024*1024)
+#define OMP_MEM_POOL_MMAP_THRESHOLD (64*1024) /* host blocks of this size or bigger are mmaped and bound to a NUMA node */
+
+/* the host side of omp_map_memcpy_box: copies of this size or bigger are split among omp_map_copy_num_threads threads,
+ * and those of the NT size or bigger use non-temporal stores since the destination is not read by the copying thread */
+#define OMP_MAP_COPY_PARALLEL_THRESHOLD (1024L*1024)
+#define OMP_MAP_COPY_NT_THRESHOLD (8L*1024*1024)
+
+typedef struct omp_mem_block {
+	void * ptr;
+	long size; /* the size of the size class */
+	long requested; /* the size requested by the allocation */
+	omp_dev_stream_t * stream; /* the stream that may still use a freed block, NULL if none */
+	struct omp_mem_block * next;
+} omp_mem_block_t;
+
+typedef struct omp_mem_pool {
+	omp_device_t * dev; /* NULL for the host pool of omp_unified_malloc */
+	pthread_mutex_t lock;
+	omp_mem_block_t * bins[OMP_MEM_POOL_NUM_BINS]; /* the cached free blocks of each size class */
+	omp_mem_block_t * inuse[OMP_MEM_POOL_HASH_SIZE]; /* the blocks in use, hashed by ptr */
+	long limit;
+
+	/* statistics */
+	long num_allocs;
+	long num_hits; /* allocations served by cached blocks */
+	long bytes_inuse; /* in size-class bytes */
+	long bytes_requested; /* the requested bytes of the blocks in use, for the internal fragmentation */
+	long peak_bytes_inuse;
+	long bytes_cached;
+} omp_mem_pool_t;
+
+/**
+ * tracing: when OMP_TRACE_FILE=<prefix> is set, every event recorded by a helper thread (see omp_event_t) is also
+ * pushed as a fixed-size binary record into the trace ring of its device. The helper thread is the only producer of
+ * its ring and never blocks, a record is dropped (and counted) if the ring is full. A flusher thread drains all the
+ * rings every OMP_TRACE_FLUSH_INTERVAL ms to <prefix>.bin (an omp_trace_header_t, the device names and then the
+ * records), which omp_fini_devices exports to <prefix>.json in the Chrome trace-event format (chrome://tracing,
+ * ui.perfetto.dev), one track per device. OMP_TRACE_SAMPLE=N only traces every Nth run of a recurring offloading.
+ */
+#define OMP_TRACE_RING_SIZE 4096 /* must be a power of 2 */
+#define OMP_TRACE_FLUSH_INTERVAL 10
+#define OMP_TRACE_NAME_LENGTH 24
+#define OMP_TRACE_MAGIC "HOMPTRC"
+#define OMP_TRACE_VERSION 1
+
+typedef struct omp_trace_record {
+	double start; /* ms, read_timer_ms */
+	double duration; /* ms */
+	long bytes; /* the bytes moved by a data movement event, 0 for others */
+	int dev;
+	int stage; /* the event index, e.g. acc_kernel_exe_event_index */
+	int run; /* the run of a recurring offloading, 0 for non-recurring */
+	int host; /* 1 if the time is recorded by the host, 0 by the device */
+	char name[OMP_TRACE_NAME_LENGTH]; /* the event name, with the array symbol for a per-array event */
+	char offloading[OMP_TRACE_NAME_LENGTH];
+} omp_trace_record_t;
+
+typedef struct omp_trace_ring {
+	omp_trace_record_t * records;
+	volatile unsigned long head; /* the next record to be written, only updated by the helper thread */
+	volatile unsigned long tail; /* the next record to be flushed, only updated by the flusher thread */
+	long dropped;
+} omp_trace_ring_t;
+
+typedef struct omp_trace_header {
+	char magic[8];
+	int version;
+	int num_devices; /* followed by num_devices names of 64 chars */
+	int record_size;
+	int name_length;
+} omp_trace_header_t;
+
+/**
+ * the host topology for placing the HOSTCPU/THSIM devices, discovered from the Linux sysfs (online cpus, the core and package
+ * of each cpu and the cpus of each NUMA node) without depending on hwloc. The unit of placement is a physical core (all
+ * its hardware threads), the cores are ordered by node so a device gets the cores of one node if it fits in the free cores
+ * of the node. Each device is given a disjoint set of dev->num_cores cores, its helper thread (and thus the OpenMP threads
+ * it creates) is bound to the set and the host memory of its maps is allocated (first-touched) on the node of the set.
+ * OMP_DEV_BIND=auto (default) binds only if the devices fit in the cores of the host, true always binds (the cores are
+ * reused round robin if not enough) and false never binds.
+ */
+#define OMP_MAX_HOST_CPUS 1024
+#define OMP_CPUMASK_WORDS (OMP_MAX_HOST_CPUS/(8*sizeof(unsigned long)))
+
+typedef struct omp_host_topology {
+	int num_cpus; /* the online hardware threads */
+	int num_cores;
+	int num_nodes;
+	int cpu_core[OMP_MAX_HOST_CPUS]; /* the core of each cpu, -1 if offline */
+	int core_node[OMP_MAX_HOST_CPUS]; /* the NUMA node of each core, the cores are ordered by node */
+} omp_host_topology_t;
+
+typedef enum omp_dev_bind_policy {
+	OMP_DEV_BIND_AUTO,
+	OMP_DEV_BIND_TRUE,
+	OMP_DEV_BIND_FALSE,
+} omp_dev_bind_policy_t;
+
+/**
+ * the hardware counters of the helper thread and the team (see omp_dev_team_t) of a HOSTCPU/THSIM device around the KERNEL stage of
+ * omp_offloading_run, enabled by OMP_DEV_PERF_COUNTERS=true, through Linux perf_event counting in user space. The memory traffic
+ * is estimated as LLC misses * OMP_PERF_CACHE_LINE_SIZE. A counter the host does not provide (e.g. the hardware counters in most
+ * VMs) is -1 and reported as n/a. With the per-iteration profile of the offloading, the counts give the achieved flops of the
+ * offloading over the wall time of its kernel (the task clock is summed over the helper thread and the team), which the AUTO dist
+ * uses instead of the flops of the dev spec (see omp_perf_kernel_stop).
+ */
+typedef enum omp_perf_counter {
+	OMP_PERF_CYCLES,
+	OMP_PERF_INSTRUCTIONS,
+	OMP_PERF_LLC_MISSES,
+	OMP_PERF_TASK_CLOCK, /* ns of cpu time, a software counter available even if the hardware ones are not */
+	OMP_PERF_NUM_COUNTERS,
+} omp_perf_counter_t;
+#define OMP_PERF_CACHE_LINE_SIZE 64
+
+typedef struct omp_perf_counts {
+	long long counts[OMP_PERF_NUM_COUNTERS]; /* -1 if not available */
+	double iterations; /* the loop iterations of the counted kernels */
+	double time; /* ms, the wall time of the counted kernels */
+	int runs;
+} omp_perf_counts_t;
+
+/**
+ * the persistent worker team of a HOSTCPU/THSIM device for running the loop of a kernel in parallel: dev->num_cores threads
+ * including the helper thread (member 0), the workers are created once by the helper thread and each is bound to one core of
+ * the device if it is bound (see omp_host_topology_t). A kernel launcher calls omp_dev_team_for with the range from
+ * omp_loop_get_range and a body for a sub-range, the helper thread starts the team by increasing the fork epoch, runs its
+ * own share and waits for the join counter, the workers wait for the next fork with omp_dev_wait_while_equal (spin, then park
+ * by the OMP_DEV_WAIT_POLICY). The range is divided into static blocks (chunk 0) or claimed in dynamic chunks of the given
+ * size. OMP_DEV_TEAM=false disables the teams, the helper thread runs the whole range.
+ */
+typedef void (*omp_dev_team_body_t)(long start, long length, void * args);
+
+typedef struct omp_dev_team_member {
+	omp_device_t * dev;
+	int id; /* from 1, 0 is the helper thread */
+	int perf_fds[OMP_PERF_NUM_COUNTERS]; /* counted with those of the helper thread, see omp_perf_counters_read */
+} omp_dev_team_member_t;
+
+typedef struct omp_dev_team {
+	int num_threads; /* including the helper thread, 1 if the device has no worker */
+	pthread_t * workers;
+	omp_dev_team_member_t * members; /* of the workers, the helper thread is not included */
+	volatile int fork; /* the epoch of the loop, increased by the helper thread to start a loop or to quit */
+	volatile int join; /* the number of workers done with the loop */
+	volatile int quit;
+
+	/* the current loop */
+	omp_dev_team_body_t body;
+	void * args;
+	long start;
+	long length;
+	long chunk; /* 0 for static blocks, or the size of the dynamic chunks */
+	volatile long next; /* the next dynamic chunk */
+	long num_loops;
+} omp_dev_team_t;
+
 struct omp_device {
 	int id; /* the id from omp view */
 	long sysid; /* the handle from the system view, e.g.
@@ -131,9 +344,11 @@ struct omp_device {
 
 	double total_real_flopss; /* the sustained flops/s after testing, GFLOPs/s */
 	double flopss_percore; /* per core performance GFLOPs/s */
+	int calibrated; /* the flops, bandwidth and latency are measured by omp_calibrate_device or loaded from the calibration cache */
 
 	int status;
-	volatile omp_offloading_info_t * offload_request; /* this is the notification flag that the helper thread will pick up the offloading request */
+	omp_offloading_queue_t offload_queue; /* the queue of offloading requests posted to this device */
+	omp_offloading_info_t * offload_request; /* the offloading request that the helper thread is working on, only accessed by the helper thread */
 
 	omp_offloading_t * offload_stack[4];
 	/* the stack for keeping the nested but unfinished offloading request, we actually only need 2 so far.
@@ -145,10 +360,29 @@ struct omp_device {
 	int offload_stack_top;
 	
 	omp_dev_stream_t devstream; /* per dev stream. Purpose: for queuing and sync, which means you can set up the sequence for every device to deal with the dist/map asyn/sync*/
-
-	omp_data_map_t ** resident_data_maps; /* a link-list or an array for resident data maps (data maps cross multiple offloading region */
+	omp_dev_stream_t devstreams[OMP_DEV_MAX_STREAMS]; /* the concurrent streams for pipelining the chunks of an offloading */
+	int num_streams; /* the number of devstreams, pipelining is disabled if it is 1 */
+
+	omp_data_map_present_t * resident_data_maps; /* the present table, i.e. the data maps resident cross multiple offloading regions, see omp_data_map_present */
+	int num_resident_data_maps;
+	int max_resident_data_maps; /* the allocated size of resident_data_maps */
+	omp_mem_pool_t mem_pool; /* the pool of device memory for data maps */
+	int numa_node; /* the NUMA node the helper thread runs on, -1 if unknown */
+	unsigned long cpumask[OMP_CPUMASK_WORDS]; /* the cpus the helper thread is bound to, see omp_host_topology_t */
+	int num_bound_cpus; /* 0 if not bound */
+	omp_dev_team_t team; /* the worker team of a host device, see omp_dev_team_for */
 
 	pthread_t helperth;
+
+	/* wait statistics of the helper thread, see omp_dev_wait_while_equal */
+	long spin_count; /* the current spin budget of adaptive wait */
+	double spin_time; /* ms spent in spinning */
+	double idle_time; /* ms spent parked */
+	long num_parks;
+
+	omp_trace_ring_t trace_ring; /* see omp_trace_event */
+
+	int perf_fds[OMP_PERF_NUM_COUNTERS]; /* the perf_event counters of the helper thread, -1 if not opened */
 };
 
 /**
@@ -173,7 +407,8 @@ typedef struct omp_event {
 	char event_description[OMP_EVENT_MSG_LENGTH];
 	int count; /* a counter for accumulating recurring event */
 	int recorded; /* everytime stop_record is called, this flag is set, and when a elapsed is calculated, this flag is reset */
-
+	long bytes; /* the bytes moved by a data movement event, for tracing, reset by omp_event_record_start */
+	const char * symbol; /* the array of a per-array event, for tracing, reset by omp_event_record_start */
 
 #if defined (DEVICE_NVGPU_SUPPORT)
 	cudaEvent_t start_event_dev;
@@ -187,27 +422,7 @@ typedef struct omp_event {
 	double elapsed_host;
 } omp_event_t;
 
-/* tracing
- * The event tracing are performed by each helper thread that writes traces to a file.
- * The master thread (who starts the offloading) will write a master trace file.
- * Traces are stored in multiple files (1 index + #targets trace files), the trace_name is:
- * <offloading_name>_<uid>_<recur_id>
- *
- * The master index file is named as <trace_name>.index
- * Each trace file is named as <trace_name>_vdevid_pdevid.txt
- *
- * The content of master index:
- * trace_name
- * vdevid pdevid (one per line)
- * ...
- * starter time_stamp
- * end time_stamp
- *
- * Trace file content:
- * event_name start_timestamp stop_timestamp
- * ....
- *
- */
+/* tracing of the events is done through the per-device trace ring, see omp_trace_ring_t */
 //#define OMP_BREAKDOWN_TIMING 1
 #if defined (OMP_BREAKDOWN_TIMING)
 
@@ -223,7 +438,6 @@ extern int acc_ex_post_barrier_event_index;	/* host event */
 extern int acc_mapfrom_event_index;			/* dev event */
 
 extern int sync_cleanup_event_index;		/* host event */
-extern int barrier_wait_event_index;		/* host event */
 
 extern int misc_event_index_start;      	/* other events, e.g. mapto/from for each array, start with 9*/
 extern void omp_offloading_info_sum_profile(omp_offloading_info_t ** infos, int count, double start_time, double compl_time);
@@ -248,6 +462,11 @@ extern int omp_num_devices;
 extern omp_device_t * omp_devices; /* an array of all device objects */
 extern pthread_barrier_t all_dev_sync_barrier; /* this barrier sync with all device threads and the init thread, when needed */
 extern volatile int omp_device_complete;
+extern omp_dev_wait_policy_t omp_dev_wait_policy;
+extern int omp_dev_num_streams;
+extern long omp_dev_max_spin_count;
+extern void omp_dev_wait_while_equal(omp_device_t * dev, volatile int * addr, int val);
+extern void omp_dev_wake_all(volatile int * addr);
 extern volatile int omp_printf_turn;
 #define BEGIN_SERIALIZED_PRINTF(myturn) while (omp_printf_turn != myturn);
 #define END_SERIALIZED_PRINTF() omp_printf_turn = (omp_printf_turn + 1)%omp_num_devices;
@@ -267,21 +486,28 @@ typedef enum omp_data_map_direction {
 	OMP_DATA_MAP_FROM,
 	OMP_DATA_MAP_TOFROM,
 	OMP_DATA_MAP_ALLOC,
+	OMP_DATA_MAP_RELEASE, /* for target exit data, decrease the reference count */
+	OMP_DATA_MAP_DELETE, /* for target exit data, remove the map regardless of the reference count */
 } omp_data_map_direction_t;
 
 typedef enum omp_data_map_type {
 	OMP_DATA_MAP_AUTO, /* system choose, it is shared, but system will use either copy or shared depending on whether real sharing  is possible or not */
 	OMP_DATA_MAP_SHARED,//for CPU
 	OMP_DATA_MAP_COPY,//for GPU
+	OMP_DATA_MAP_ZEROCOPY, /* the device accesses the (registered) host memory directly, e.g. for streaming access, SHARED for host devices */
 } omp_data_map_type_t;
 
+#define OMP_DIST_DYNAMIC_CHUNKS_PER_DEVICE 8 /* the default DYNAMIC chunk size is length/(this*number of devices) */
+
 typedef enum omp_dist_policy {
 	OMP_DIST_POLICY_BLOCK,
 	OMP_DIST_POLICY_DUPLICATE,
 	OMP_DIST_POLICY_AUTO, /* the balanced data distribution so computation is balanced distributed, ideally */
 	OMP_DIST_POLICY_ALIGN,
-	OMP_DIST_POLICY_CYCLIC, /* user defined */
+	OMP_DIST_POLICY_CYCLIC, /* block-cyclic: chunks of chunk_size (default 1) are dealt round-robin to the devices of the dim */
 	OMP_DIST_POLICY_FIX, /* fixed dist */
+	OMP_DIST_POLICY_DYNAMIC, /* loop only: chunks of chunk_size iterations are claimed by the devices at runtime */
+	OMP_DIST_POLICY_GUIDED, /* loop only: like DYNAMIC, but the chunks shrink with the remaining iterations down to chunk_size */
 } omp_dist_policy_t;
 
 typedef enum omp_dist_target_type {
@@ -348,6 +574,7 @@ struct omp_data_map_info {
 	int sizeof_element;
 	omp_data_map_direction_t map_direction; /* the map type, to, from, or tofrom */
 	omp_data_map_type_t map_type;
+	int host_pinned; /* register (page-lock) the host region of COPY maps, see omp_host_register */
 	omp_data_map_t * maps; /* a list of data maps of this array */
 
 	/*
@@ -377,6 +604,8 @@ typedef enum omp_data_map_access_level {
 
 } omp_data_map_access_level_t;
 
+#define OMP_HALO_RELAY_SLOTS 2 /* double-buffered host relay of halo exchange */
+
 typedef struct omp_data_map_halo_region_mem {
 	/* the mem for halo management */
 	/* the in/out pointer is the buffer for the halo regions.
@@ -387,6 +616,9 @@ typedef struct omp_data_map_halo_region_mem {
 	int left_dev_seqid; /* left devseqid, can be used to access left_map and left_dev */
 	int right_dev_seqid;
 
+	/* the halo region of a dim is the box of the full extents (including halo) of the other dims, so the in/out ptr is
+	 * the first element of the box and the size is that of the packed box, the relay buffers keep the box packed
+	 */
 	char * left_in_ptr; /* the halo region this needs */
 	long left_in_size; /* for pull update, == right_out_size if push protocol is used */
 	char * left_out_ptr; /* the halo region this will privide to the left */
@@ -399,13 +631,16 @@ typedef struct omp_data_map_halo_region_mem {
 
 	/* if p2p communication is not available, we will need buffer at host to relay the halo exchange.
 	 * Each data map only maintains the relay pointers for halo that they need, i.e. a pull
-	 * protocol should be applied for halo exchange.
+	 * protocol should be applied for halo exchange. A relay buffer has OMP_HALO_RELAY_SLOTS slots of in_size each,
+	 * the n-th push goes to slot n%OMP_HALO_RELAY_SLOTS, thus the source can push the next exchange before the
+	 * receiver pulled the current one.
 	 */
 	char * left_in_host_relay_ptr;
 	volatile int left_in_data_in_relay_pushed;
 	volatile int left_in_data_in_relay_pulled;
 	/* the push flag is set when the data is pushed by the source to the host relay so the receiver side can pull,
-	 * a simple busy-wait is used to wait for the data to arrive
+	 * omp_dev_wait_while_equal is used to wait for the data to arrive (pushed > pulled) or a free slot
+	 * (pushed - pulled < OMP_HALO_RELAY_SLOTS) and whoever increases a flag wakes up the other side
 	 */
 	char * right_in_host_relay_ptr;
 	volatile int right_in_data_in_relay_pushed;
@@ -415,10 +650,18 @@ typedef struct omp_data_map_halo_region_mem {
 /**
  * dist object, a subregion of the whole region defined in info object
  */
+/**
+ * the dist of a device. For a CYCLIC dist (chunk_size > 0), the device has the chunks of chunk_size starting at offset,
+ * offset+stride, ... up to limit (the last one may be shorter), and length is their total, i.e. the chunks are packed
+ * one after another in the local index space, see omp_dist_get_chunk
+ */
 typedef struct omp_dist {
 	omp_dist_info_t * info; /* not yet used so far */
 	long offset;
 	long length;
+	long chunk_size; /* 0 if the dist is the contiguous range [offset, offset+length) */
+	long stride;
+	long limit;
 } omp_dist_t;
 
 /* for each device, we maintain a list such objects, each for one mapped array */
@@ -442,12 +685,37 @@ struct omp_data_map {
 	char * map_dev_ptr; /* the mapped buffer on device, only for the mapped array region (not including halo region) */
 	char * map_dev_wextra_ptr; /* the mapped buffer on device, include extras, such as halo region */
 
+	/* the extents of the mapped region with halo (map_wextra_size is their product), and the row-major dims of the buffer
+	 * map_dev_wextra_ptr points into: the same as the wextra extents for a COPY map, i.e. the device buffer is the packed
+	 * box of the region and its halo, and the dims of the array for a SHARED map that works on the host array in place.
+	 * map_dev_ptr is the first element of the mapped region in the same buffer, thus a kernel indexes both of them with the
+	 * strides of map_dev_dims.
+	 */
+	long map_wextra_dims[OMP_MAX_NUM_DIMENSIONS];
+	long map_dev_dims[OMP_MAX_NUM_DIMENSIONS];
+	char * map_staging_ptr; /* the packed host image of the device buffer, see omp_map_marshal, kept till omp_map_free */
+
 	omp_data_map_halo_region_mem_t halo_mem [OMP_MAX_NUM_DIMENSIONS];
 
-	int mem_noncontiguous;
+	int mem_noncontiguous; /* the mapped region or its halo is not a contiguous range of rows of the array */
 	//omp_dev_stream_t * stream; /* the stream operations of this data map are registered with, mostly it will be the stream created for an offloading */
 };
 
+/**
+ * an entry of the present table of a device. A map created by a target enter data offloading (OMP_OFFLOADING_ENTER_DATA)
+ * stays on the device till the matching target exit data (OMP_OFFLOADING_EXIT_DATA) drops its reference count to 0, and
+ * any offloading in between that maps an address in [host_start, host_end) uses it without allocation and copy, same as
+ * inheriting a map from an enclosing target data. The map is the one of the enter data offloading, thus the
+ * omp_offloading_info_t of the enter data must not be freed before the exit data completes.
+ * Only the helper thread of the device accesses the table.
+ */
+struct omp_data_map_present {
+	char * host_start; /* the host address range of the whole array */
+	char * host_end;
+	omp_data_map_t * map;
+	int refcount;
+};
+
 /**
  * the data exchange direction, FROM is for pull, TO is for push
  */
@@ -478,12 +746,20 @@ typedef enum omp_offloading_type {
 	/* data exchange offloading, while a regular offloading can carry data exchange that will
 	 * be performed after finishing the offloading tasks, this type of offloading is a standalone data exchange offloading */
 	OMP_OFFLOADING_STANDALONE_DATA_EXCHANGE,
+
+	/* unstructured data offloading, see omp_data_map_present. For target update, the source_ptr and dims of each map
+	 * give the host sub-range to be updated, with direction OMP_DATA_MAP_TO (host to device) or OMP_DATA_MAP_FROM */
+	OMP_OFFLOADING_ENTER_DATA, /* e.g. omp target enter data */
+	OMP_OFFLOADING_EXIT_DATA, /* e.g. omp target exit data, with direction FROM, RELEASE or DELETE for each map */
+	OMP_OFFLOADING_UPDATE, /* e.g. omp target update */
 } omp_offloading_type_t;
+#define omp_offloading_unstructured_data(type) (type >= OMP_OFFLOADING_ENTER_DATA)
 
 /**
  * A sequence of calls in one offloading involve.
- * set up stream and event for queuing and sync purpose, we currently only one stream per
- * device at a time, i.e. multiple concurrent streams are not supported.
+ * set up stream and event for queuing and sync purpose. The steps use the device stream (devstream), except
+ * for a pipelined offloading (see omp_offloading_set_pipeline_chunks) whose chunks use the num_streams devstreams
+ * of the device so the copyto of a chunk overlaps with the kernel and copyfrom of other chunks.
  * 1. compute data mapping region for each variables, allocate device memory to store mapped data
  * 2. copy data from host to device (could happen while allocating device memory)
  * 3. launch the kernel that will work on the data
@@ -529,6 +805,57 @@ typedef struct omp_kernel_profile_info {
   *
   * when an off_info being forwarded to dev helper thread, it should be read-only
   */
+#define OMP_OFFLOADING_MAX_DEPEND 8
+
+/* which devices of the dependent offloading a device waits for */
+typedef enum omp_offloading_dep_type {
+	OMP_OFFLOADING_DEP_ALL, /* all the devices of the dependent offloading */
+	OMP_OFFLOADING_DEP_NEIGHBOUR, /* the same device and its neighbours in the topology, e.g. when reading halo region */
+	OMP_OFFLOADING_DEP_DEVICE, /* the same device only */
+} omp_offloading_dep_type_t;
+
+/**
+ * reduction of the offloading across its devices, see omp_offloading_append_reduction.
+ * The op codes are the same as the XOMP_REDUCTION_* of xomp_cuda_lib_inlined.cu so they can be passed to the
+ * xomp_inner_block_reduction_* kernels as is. MINUS is combined as PLUS, as in the kernels.
+ */
+typedef enum omp_reduction_op {
+	OMP_REDUCTION_PLUS = 6,
+	OMP_REDUCTION_MINUS = 7,
+	OMP_REDUCTION_MUL = 8,
+	OMP_REDUCTION_BITAND = 9,
+	OMP_REDUCTION_BITOR = 10,
+	OMP_REDUCTION_BITXOR = 11,
+	OMP_REDUCTION_LOGAND = 12,
+	OMP_REDUCTION_LOGOR = 13,
+	OMP_REDUCTION_MIN = 14,
+	OMP_REDUCTION_MAX = 15,
+} omp_reduction_op_t;
+
+typedef enum omp_reduction_type {
+	OMP_REDUCTION_INT,
+	OMP_REDUCTION_LONG,
+	OMP_REDUCTION_FLOAT,
+	OMP_REDUCTION_DOUBLE,
+} omp_reduction_type_t;
+
+typedef union omp_reduction_value {
+	int i;
+	long l;
+	float f;
+	double d;
+} omp_reduction_value_t;
+
+#define OMP_OFFLOADING_MAX_REDUCTIONS 4
+typedef struct omp_reduction_info {
+	omp_reduction_op_t op;
+	omp_reduction_type_t type;
+	void * target; /* the host variable, it is combined with the partials of all the devices, like reduction(op:target) */
+} omp_reduction_info_t;
+
+/* the handle of an asynchronous offloading, which is simply the offloading info object */
+typedef omp_offloading_info_t * omp_offloading_handle_t;
+
 struct omp_offloading_info {
 	/************** per-offloading var, shared by all target devices ******/
 	omp_grid_topology_t * top; /* target devices */
@@ -551,6 +878,7 @@ struct omp_offloading_info {
 	/* max three level of loop nest */
 	omp_dist_info_t loop_dist_info[OMP_MAX_NUM_DIMENSIONS];
 	int loop_depth; /* max 3 so far */
+	int num_pipeline_chunks; /* the number of chunks to pipeline copyto, kernel and copyfrom, see omp_offloading_set_pipeline_chunks */
 
 	/* the universal kernel launcher and args, the helper thread will use this one if no dev-specific one is provided */
 	/* the helper thread will first check these two field, if they are not null, it will use them, otherwise, it will use the dev-specific one */
@@ -566,8 +894,36 @@ struct omp_offloading_info {
 	omp_data_map_halo_exchange_info_t * halo_x_info;
 	int num_maps_halo_x;
 
+	/* completion tracking: each device increases its offloadings[i].compl_count once it is done with the request
+	 * (including profiling collection). The n-th posting of the request is complete when all the compl_count >= n.
+	 * The off_info pointer itself is the completion handle returned by omp_offloading_start_async
+	 */
+	volatile int posted; /* the request is posted and not yet waited by the submitter */
+	int post_epoch; /* the number of times this offloading is posted */
+	int waited_epoch; /* the number of postings that have been waited by the submitter */
+
+	/* the offloadings that have to be completed before this one starts, see omp_offloading_start_async.
+	 * depend_epoch is relative to the posting of this offloading, i.e. when a device runs the n-th posting of this one,
+	 * it waits for the (n+depend_epoch[i])-th posting of depend[i], so the same deps can be used for an offloading
+	 * that has multiple postings in flight
+	 */
+	omp_offloading_info_t * depend[OMP_OFFLOADING_MAX_DEPEND];
+	int depend_epoch[OMP_OFFLOADING_MAX_DEPEND];
+	omp_offloading_dep_type_t depend_type[OMP_OFFLOADING_MAX_DEPEND];
+	int num_depend;
+
+	/* the reductions of the kernel, the partials of the devices are combined along a tree of the devices and the root writes
+	 * the target, which is thus ready when the offloading completes, see omp_offloading_append_reduction */
+	omp_reduction_info_t reductions[OMP_OFFLOADING_MAX_REDUCTIONS];
+	int num_reductions;
+
+	double auto_adapt_threshold; /* the hysteresis of the adaptive AUTO dist, 0 for the static one, see omp_offloading_set_auto_adaptive */
+
+	/* the next iteration to be claimed by the devices for a DYNAMIC/GUIDED loop dist. It is never reset, the n-th run
+	 * (from 0) of the offloading claims the iterations [n*length, (n+1)*length) of it, see omp_loop_dist_claim_chunk */
+	volatile long dyn_next;
+
 	/* the participating barrier */
-	pthread_barrier_t barrier; /* this barrier sync with offloading thread */
 	pthread_barrier_t inter_dev_barrier; /* this barrier sync between devices only */
 
 };
@@ -592,6 +948,23 @@ struct omp_offloading {
 	omp_device_t * dev; /* the dev object, as cached info */
 	omp_offloading_stage_t stage;
 
+	/* the device-side view of recurring and completion, a device may run ahead of others (see omp_offloading_graph_t),
+	 * thus it cannot use the count of off_info which is maintained by the submitter */
+	int count; /* the same meaning as off_info->count, but increased by this device after each run */
+	volatile int compl_count; /* the number of times this device completed this offloading */
+	volatile int x_arrived; /* the number of times this device arrived at the halo exchange */
+	volatile int x_pulled; /* the number of times this device completed pulling halo region */
+	volatile int x_dim_done; /* the number of times this device completed pulling the halo of a dim before the next dim */
+
+	/* the partial of each reduction on this device, and the per-block partials of the device-side stage
+	 * (see omp_offloading_reduction_dev_blocks), which are copied back and folded into the partial after the kernel */
+	omp_reduction_value_t reduction_partials[OMP_OFFLOADING_MAX_REDUCTIONS];
+	void * reduction_dev_blocks[OMP_OFFLOADING_MAX_REDUCTIONS];
+	void * reduction_host_blocks[OMP_OFFLOADING_MAX_REDUCTIONS];
+	long reduction_num_blocks[OMP_OFFLOADING_MAX_REDUCTIONS]; /* the blocks used by the current kernel, 0 if none */
+	long reduction_max_blocks[OMP_OFFLOADING_MAX_REDUCTIONS]; /* the capacity of the block buffers */
+	volatile int red_combined; /* the number of times the partials of this device include those of its subtree */
+
 	/* we will use a simple fix-sized array for simplicity and performance (than a linked list) */
 	/* an offload can has as many as OFFLOADING_MAP_CACHE_SIZE mapped variable */
 	struct {
@@ -601,8 +974,14 @@ struct omp_offloading {
 	int num_maps;
 
 	omp_dist_t loop_dist[3];
+	/* when a pipelined offloading runs a chunk of the loop, omp_loop_get_range returns this chunk instead of the
+	 * whole dist (chunk_length < 0 if not chunked) */
+	long chunk_start;
+	long chunk_length;
 	omp_kernel_profile_info_t kernel_profile;
 	omp_kernel_profile_info_t per_iteration_profile;
+	omp_perf_counts_t kernel_counts; /* the counters of the KERNEL stage accumulated over the runs, see omp_perf_counter_t */
+	double measured_flopss; /* GFLOPs/s achieved by the last counted kernel with a per-iteration profile, 0 if none */
 	int loop_dist_done; /* a flag */
 
 	/* for profiling purpose */
@@ -612,6 +991,16 @@ struct omp_offloading {
 	/* the auto model purpose */
 	double Ar;
 	double Br;
+	/* the adaptive AUTO dist (see omp_offloading_set_auto_adaptive): the per-iteration cost A and the constant cost B (ms) of
+	 * T = n*A + B measured by the runs of this device, and the iterations n of the run. Double-buffered by the parity of the run
+	 * since a device may complete its next run while others still read the previous one */
+	struct {
+		double A;
+		double B;
+		long n;
+	} auto_model[2];
+	volatile int auto_measured; /* the number of runs measured */
+	int auto_repartitions; /* the number of times the range of this device is changed by the adaptive AUTO dist */
 
 	/* kernel info */
 	long X1, Y1, Z1; /* the first level kernel thread configuration, e.g. CUDA blockDim */
@@ -620,6 +1009,28 @@ struct omp_offloading {
 	void (*kernel_launcher)(omp_offloading_t *, void *); /* device specific kernel, if any */
 };
 
+/**
+ * A recorded sequence of offloadings (nodes) and the dependencies between them, which is replayed for a number of
+ * iterations without the submitter waiting between offloadings. Each device runs the nodes in order, and the only
+ * cross-device syncs are the dependencies (per-device, per-neighbour or all devices) and the neighbour-only halo
+ * exchange, so a device can start the next iteration as soon as the devices it depends on are done.
+ * A dependency on a node that is at or after the dependent node in the sequence is a loop-carried one, i.e. on the
+ * previous iteration of that node. A node can only appear once in a graph.
+ */
+#define OMP_OFFLOADING_GRAPH_MAX_NODES 16
+typedef struct omp_offloading_graph_node {
+	omp_offloading_info_t * off_info;
+	int num_deps;
+	int deps[OMP_OFFLOADING_MAX_DEPEND]; /* the index of the nodes it depends on */
+	omp_offloading_dep_type_t dep_types[OMP_OFFLOADING_MAX_DEPEND];
+} omp_offloading_graph_node_t;
+
+typedef struct omp_offloading_graph {
+	const char * name;
+	int num_nodes;
+	omp_offloading_graph_node_t nodes[OMP_OFFLOADING_GRAPH_MAX_NODES];
+} omp_offloading_graph_t;
+
 /* init the device objects, num_of_devices, helper threads, default_device_var ICV etc 
     return # of devices initialized 
 */
@@ -634,11 +1045,49 @@ extern int omp_set_current_device_dev(omp_device_t * d); /* return the current d
 extern int omp_set_current_device(int id); /* return the current device id */
 extern void helper_thread_main(void * arg);
 extern void omp_warmup_device(omp_device_t * dev);
+extern omp_host_topology_t omp_host_topology;
+extern omp_dev_bind_policy_t omp_dev_bind_policy;
+extern void omp_host_topology_discover(omp_host_topology_t * topo);
+extern void omp_place_devices();
+extern void omp_dev_bind(omp_device_t * dev);
+extern int omp_dev_team_enabled;
+extern void omp_dev_team_init(omp_device_t * dev);
+extern void omp_dev_team_fini(omp_device_t * dev);
+extern void omp_dev_team_for(omp_device_t * dev, long start, long length, long chunk, omp_dev_team_body_t body, void * args);
+extern int omp_cpumask_print(unsigned long * mask, char * buf, int length);
+
+/**
+ * calibration of the device specs: with OMP_DEV_CALIBRATE=true, the flops (HOSTCPU/THSIM, per core times the cores of the device),
+ * the host-to-device memcpy bandwidth and the latency of a small async copy and stream sync are measured by each helper thread
+ * (one device at a time) at omp_init_devices, instead of using the typed values of the dev spec. The results are saved to
+ * OMP_DEV_CALIBRATION_FILE (default $HOME/.homp_devices.ini) in the dev spec format, with the version, hostname and cpu model
+ * it is measured on, so the later startups on the same machine with the same devices load them without probing.
+ * OMP_DEV_CALIBRATE=force probes again and overwrites the file.
+ */
+#define OMP_DEV_CALIBRATION_VERSION 1
+#define OMP_DEV_CALIBRATION_COPY_SIZE (16L*1024*1024)
+#define OMP_DEV_CALIBRATION_REPEATS 5
+#define OMP_DEV_CALIBRATION_LATENCY_REPEATS 100
+extern int omp_dev_calibrate; /* 0: no, 1: use the cache if it matches, 2: force probing */
+extern void omp_calibrate_device(omp_device_t * dev);
 
 extern omp_offloading_info_t * omp_offloading_init_info(const char *name, omp_grid_topology_t *top, int recurring,
 														omp_offloading_type_t off_type, int num_maps,
 														void (*kernel_launcher)(omp_offloading_t *, void *), void *args,
 														int loop_nest_depth);
+extern void omp_offloading_set_pipeline_chunks(omp_offloading_info_t *info, int num_chunks);
+extern int omp_offloading_append_reduction(omp_offloading_info_t *info, void *target, omp_reduction_type_t type, omp_reduction_op_t op);
+extern void * omp_offloading_reduction_partial(omp_offloading_t *off, int index);
+extern void * omp_offloading_reduction_dev_blocks(omp_offloading_t *off, int index, long num_blocks);
+extern void omp_offloading_reduction_start(omp_offloading_t * off);
+extern void omp_offloading_reduction_copy_blocks(omp_offloading_t * off);
+extern void omp_offloading_reduction_fold_blocks(omp_offloading_t * off);
+extern void omp_offloading_reduction_finish(omp_offloading_t * off);
+extern double omp_dist_auto_adapt_threshold;
+extern void omp_offloading_set_auto_adaptive(omp_offloading_info_t *info, double threshold);
+extern int omp_offloading_auto_adaptive(omp_offloading_t * off);
+extern void omp_offloading_auto_measure(omp_offloading_t * off, double kernel_ms, double copy_ms);
+extern void omp_offloading_auto_adapt(omp_offloading_t * off);
 extern void omp_offloading_append_profile_per_iteration(omp_offloading_info_t *info, long num_fp_operations,
 														long num_loads, long num_stores);
 extern void omp_offloading_fini_info(omp_offloading_info_t * info);
@@ -648,6 +1097,14 @@ extern void omp_offloading_append_data_exchange_info (omp_offloading_info_t * in
 extern omp_offloading_info_t * omp_offloading_standalone_data_exchange_init_info(const char *name, omp_grid_topology_t *top, int recurring,
 																				 omp_data_map_halo_exchange_info_t *halo_x_info, int num_maps_halo_x);
 extern void omp_offloading_start(omp_offloading_info_t *off_info, int free_after_completion);
+extern omp_offloading_handle_t omp_offloading_start_async(omp_offloading_info_t *off_info, int free_after_completion,
+														  omp_offloading_handle_t *depend, int num_depend);
+extern void omp_offloading_wait(omp_offloading_handle_t handle);
+extern int omp_offloading_test(omp_offloading_handle_t handle);
+extern void omp_offloading_graph_init(omp_offloading_graph_t * graph, const char * name);
+extern int omp_offloading_graph_add(omp_offloading_graph_t * graph, omp_offloading_info_t * off_info);
+extern void omp_offloading_graph_add_dep(omp_offloading_graph_t * graph, int node, int dep_node, omp_offloading_dep_type_t type);
+extern void omp_offloading_graph_run(omp_offloading_graph_t * graph, int num_iterations);
 
 extern void omp_stream_create(omp_device_t *d, omp_dev_stream_t *stream);
 extern void omp_stream_destroy(omp_dev_stream_t * st);
@@ -662,6 +1119,19 @@ extern void omp_event_print_profile_header();
 extern void omp_event_print_elapsed(omp_event_t *ev, double reference, double *start_time, double *elapsed);
 extern void omp_event_elapsed_ms(omp_event_t * ev);
 extern void omp_event_accumulate_elapsed_ms(omp_event_t * ev);
+
+extern int omp_dev_perf_counters;
+extern void omp_perf_counters_open(omp_device_t * dev, int * fds);
+extern void omp_perf_counters_close(omp_device_t * dev);
+extern void omp_perf_counters_read(omp_device_t * dev, long long counts[]);
+extern void omp_perf_kernel_stop(omp_offloading_t * off, long long start_counts[], double time);
+extern void omp_perf_print_counts(omp_offloading_t * off);
+
+extern char * omp_trace_file; /* the prefix of the trace files, NULL if tracing is disabled */
+extern int omp_trace_sample;
+extern int omp_trace_sampled(int run);
+extern void omp_trace_event(omp_event_t * ev, int stage, const char * offloading, int run);
+extern int omp_trace_export_json(const char * binfile, const char * jsonfile);
 extern void omp_offloading_clear_report_info(omp_offloading_info_t * info);
 
 extern omp_grid_topology_t * omp_grid_topology_init_simple(int nnodes, int ndims);
@@ -670,6 +1140,8 @@ extern void omp_grid_topology_fini(omp_grid_topology_t * top);
 extern void omp_factor(int n, int factor[], int dims);
 extern void omp_topology_print(omp_grid_topology_t * top);
 extern int omp_grid_topology_get_seqid(omp_grid_topology_t * top, int devid);
+/* the seqids of the left and right neighbours of seqid in dimension topdim of the topology, -1 for none (unless cyclic) */
+extern void omp_topology_get_neighbors(omp_grid_topology_t * top, int seqid, int topdim, int cyclic, int* left, int* right);
 
 extern void omp_data_map_init_info(const char *symbol, omp_data_map_info_t *info, omp_offloading_info_t *off_info,
                             void *source_ptr, int num_dims, int sizeof_element, omp_data_map_direction_t map_direction,
@@ -677,9 +1149,16 @@ extern void omp_data_map_init_info(const char *symbol, omp_data_map_info_t *info
 extern void omp_data_map_info_set_dims_1d(omp_data_map_info_t * info, long dim0);
 extern void omp_data_map_info_set_dims_2d(omp_data_map_info_t * info, long dim0, long dim1);
 extern void omp_data_map_info_set_dims_3d(omp_data_map_info_t * info, long dim0, long dim1, long dim2);
+extern void omp_data_map_info_set_pinned(omp_data_map_info_t * info, int pinned);
 
 extern void omp_print_map_info(omp_data_map_info_t * info);
 
+extern void omp_loop_dist_set_chunk_size(omp_offloading_info_t *off_info, int level, long chunk_size);
+extern void omp_data_map_dist_set_chunk_size(omp_data_map_info_t *map_info, int dim, long chunk_size);
+extern long omp_dist_num_chunks(omp_dist_t * dist);
+extern long omp_dist_get_chunk(omp_dist_t * dist, long index, long * start, long * length);
+extern int omp_loop_dist_dynamic(omp_offloading_info_t *off_info);
+extern long omp_loop_dist_claim_chunk(omp_offloading_t *off, long *chunk_start);
 extern void omp_data_map_dist_init_info(omp_data_map_info_t *map_info, int dim, omp_dist_policy_t dist_policy,
 										long start, long length, int topdim);
 extern void omp_loop_dist_init_info(omp_offloading_info_t *off_info, int level, omp_dist_policy_t dist_policy,
@@ -698,6 +1177,7 @@ extern void omp_loop_dist_align_with_loop(omp_offloading_info_t *loop_off_info,
 extern void omp_data_map_init_map(omp_data_map_t *map, omp_data_map_info_t *info, omp_device_t *dev);
 extern void omp_data_map_dist(omp_data_map_t *map, int seqid);
 extern void omp_loop_iteration_dist(omp_offloading_t * off);
+extern void omp_dist_block(long start, long full_length, long position, int dim, long * offstart, long *length);
 extern void omp_map_add_halo_region(omp_data_map_info_t *info, int dim, int left, int right,
 									omp_dist_halo_edging_type_t edging);
 //extern int omp_data_map_has_halo(omp_data_map_info_t * info, int dim);
@@ -708,16 +1188,34 @@ extern omp_data_map_t *omp_map_offcache_iterator(omp_offloading_t *off, int inde
 extern void omp_map_append_map_to_offcache(omp_offloading_t *off, omp_data_map_t *map, int inherited);
 extern int omp_map_is_map_inherited(omp_offloading_t *off, omp_data_map_t *map);
 extern omp_data_map_t * omp_map_get_map_inheritance (omp_device_t * dev, void * host_ptr);
+extern omp_data_map_present_t * omp_map_present_lookup(omp_device_t * dev, void * host_ptr);
+extern void omp_map_present_add(omp_device_t * dev, omp_data_map_t * map);
+extern void omp_map_present_remove(omp_device_t * dev, omp_data_map_present_t * entry);
 extern omp_data_map_t * omp_map_get_map(omp_offloading_t *off, void * host_ptr, int map_index);
 extern void omp_print_data_map(omp_data_map_t * map);
 extern void omp_map_malloc(omp_data_map_t *map, omp_offloading_t *off);
 extern void * omp_map_marshal(omp_data_map_t *map);
-
 extern void omp_map_unmarshal(omp_data_map_t * map);
 extern void omp_map_free_dev(omp_device_t * dev, void * ptr);
 extern void * omp_map_malloc_dev(omp_device_t * dev, long size);
+extern void omp_map_free_dev_async(omp_device_t * dev, void * ptr, omp_dev_stream_t * stream);
+extern void * omp_map_malloc_dev_async(omp_device_t * dev, long size, omp_dev_stream_t * stream);
 extern void * omp_unified_malloc(long size);
 extern void omp_unified_free(void *ptr);
+extern long omp_mem_pool_limit;
+extern omp_mem_pool_t omp_unified_mem_pool;
+extern void omp_mem_pool_init(omp_mem_pool_t * pool, omp_device_t * dev);
+extern void omp_mem_pool_fini(omp_mem_pool_t * pool);
+extern void * omp_mem_pool_malloc(omp_mem_pool_t * pool, long size, omp_dev_stream_t * stream);
+extern void omp_mem_pool_free(omp_mem_pool_t * pool, void * ptr, omp_dev_stream_t * stream);
+extern void omp_mem_pool_print_stats(omp_mem_pool_t * pool, const char * name);
+extern int omp_map_copy_num_threads;
+extern int omp_host_pin_policy;
+extern int omp_host_register(void * ptr, long size);
+extern void omp_host_unregister(void * ptr, long size);
+extern void * omp_host_get_dev_ptr(omp_device_t * dev, void * ptr);
+extern int omp_map_info_register_host(omp_data_map_info_t * info);
+extern int omp_map_register_host(omp_data_map_t * map);
 extern void omp_map_mapto(omp_data_map_t * map);
 extern void omp_map_mapto_async(omp_data_map_t * map, omp_dev_stream_t * stream);
 extern void omp_map_mapfrom(omp_data_map_t * map);
@@ -726,6 +1224,12 @@ extern void omp_map_memcpy_to(void * dst, omp_device_t * dstdev, const void * sr
 extern void omp_map_memcpy_to_async(void * dst, omp_device_t * dstdev, const void * src, long size, omp_dev_stream_t * stream);
 extern void omp_map_memcpy_from(void * dst, const void * src, omp_device_t * srcdev, long size);
 extern void omp_map_memcpy_from_async(void * dst, const void * src, omp_device_t * srcdev, long size, omp_dev_stream_t * stream);
+extern void omp_map_memcpy_box(void * dst, omp_device_t * dstdev, const long * dst_dims, const long * dst_offset,
+							   const void * src, omp_device_t * srcdev, const long * src_dims, const long * src_offset,
+							   const long * length, int ndims, int sizeof_element);
+extern void omp_map_memcpy_box_async(void * dst, omp_device_t * dstdev, const long * dst_dims, const long * dst_offset,
+									 const void * src, omp_device_t * srcdev, const long * src_dims, const long * src_offset,
+									 const long * length, int ndims, int sizeof_element, omp_dev_stream_t * stream);
 extern int omp_map_enable_memcpy_DeviceToDevice(omp_device_t * dstdev, omp_device_t * srcdev);
 extern void omp_map_memcpy_DeviceToDevice(void * dst, omp_device_t * dstdev, void * src, omp_device_t * srcdev, int size) ;
 extern void omp_map_memcpy_DeviceToDeviceAsync(void * dst, omp_device_t * dstdev, void * src, omp_device_t * srcdev, int size, omp_dev_stream_t * srcstream);
@@ -759,6 +1263,8 @@ extern void xomp_beyond_block_reduction_float_stream_callback(cudaStream_t strea
  *
  */
 extern long omp_loop_get_range(omp_offloading_t *off, int loop_level, long *start, long *length);
+extern long omp_loop_get_num_chunks(omp_offloading_t *off, int loop_level);
+extern long omp_loop_get_chunk(omp_offloading_t *off, int loop_level, long index, long *start, long *length);
 
 /* util */
 extern double read_timer_ms();
@@ -22,6 +22,18 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/mman.h>
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined (__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+#endif
 #include "homp.h"
 #include "../util/iniparser.h"
 
@@ -56,13 +68,14 @@ double addmul(double add, double mul, int ops){
 }
 
 double cpu_sustain_gflopss (double * flopss) {
-	double x=M_PI;
+	volatile double x=M_PI; /* volatile, otherwise the unused result and thus the call is optimized away */
 	double y=1.0+1e-8;
 	int n = 1000000;
 	double timer = read_timer();
 	x=addmul(x,y,n);
 	timer = read_timer() - timer;
 	*flopss = n/timer/1e9;
+	return *flopss;
 }
 
 
@@ -83,6 +96,106 @@ int omp_num_devices;
 omp_device_t * omp_devices;
 pthread_barrier_t all_dev_sync_barrier;
 volatile int omp_device_complete = 0;
+omp_dev_wait_policy_t omp_dev_wait_policy = OMP_DEV_WAIT_ADAPTIVE;
+long omp_dev_max_spin_count = OMP_DEV_DEFAULT_SPIN_COUNT;
+int omp_dev_num_streams = 0; /* 0 means the default of each device type */
+double omp_dist_auto_adapt_threshold = 0.0; /* see omp_offloading_set_auto_adaptive */
+int omp_map_copy_num_threads = 0; /* the threads of a big host copy, 0 means the cores shared by the helper threads */
+int omp_dev_perf_counters = 0; /* see omp_perf_counter_t */
+int omp_dev_calibrate = 0; /* see omp_calibrate_device */
+omp_host_topology_t omp_host_topology;
+omp_dev_bind_policy_t omp_dev_bind_policy = OMP_DEV_BIND_AUTO;
+int omp_dev_team_enabled = 1; /* see omp_dev_team_t */
+static char omp_dev_calibration_file[PATH_MAX];
+static int omp_calibration_load();
+static void omp_calibration_save();
+char * omp_trace_file = NULL; /* see omp_trace_ring_t */
+int omp_trace_sample = 1;
+static void omp_trace_init();
+static void omp_trace_fini();
+
+/**
+ * the cache of registered (page-locked) host regions. The copy between a pageable host region and a NVGPU is staged
+ * and synchronous, while it is asynchronous DMA if the region is registered, and a ZEROCOPY map needs the registration
+ * for the device to access the host memory directly. Registration is costly, thus a region is registered once (page
+ * aligned, portable and mapped to serve both purposes) and kept till it is unregistered or omp_fini_devices.
+ * The host region of a COPY map is registered if OMP_DATA_MAP_PIN=true or by omp_data_map_info_set_pinned, the
+ * registration is done with the first copy thus its cost shows in the MAPTO/MAPFROM events. The maps register the whole
+ * array (see omp_map_info_register_host) instead of their sub-regions, since the sub-regions of neighbouring devices share
+ * the boundary pages and a region overlapping with a registered one cannot be registered.
+ */
+typedef struct omp_host_region {
+	char * start;
+	char * end;
+	struct omp_host_region * next;
+} omp_host_region_t;
+
+int omp_host_pin_policy = 0;
+static omp_host_region_t * omp_host_regions = NULL;
+static pthread_mutex_t omp_host_regions_lock = PTHREAD_MUTEX_INITIALIZER;
+static long omp_host_region_lookups = 0;
+static long omp_host_region_hits = 0;
+static long omp_host_region_bytes = 0;
+
+static inline void omp_cpu_relax() {
+#if defined (__x86_64__) || defined (__i386__)
+	__asm__ __volatile__ ("pause" ::: "memory");
+#else
+	__asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+/* park the calling thread until *addr is no longer val or it is woken up by omp_dev_wake_all, spurious wakeup is possible */
+static void omp_dev_park(volatile int * addr, int val) {
+#if defined (__linux__)
+	syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+	sched_yield();
+#endif
+}
+
+/**
+ * wait until *addr != val using the omp_dev_wait_policy. dev is the device whose helper thread is waiting and it is used
+ * for the spin budget and the spin/idle time, it could be NULL if the host thread is waiting.
+ * Whoever changes *addr must call omp_dev_wake_all(addr) after that.
+ */
+void omp_dev_wait_while_equal(omp_device_t * dev, volatile int * addr, int val) {
+	if (*addr != val) return;
+	long spin_count = omp_dev_max_spin_count;
+	if (omp_dev_wait_policy == OMP_DEV_WAIT_PARK) spin_count = 0;
+	else if (omp_dev_wait_policy == OMP_DEV_WAIT_ADAPTIVE && dev != NULL) spin_count = dev->spin_count;
+
+	double start = read_timer_ms();
+	long i;
+	for (i=0; omp_dev_wait_policy == OMP_DEV_WAIT_SPIN || i<spin_count; i++) {
+		if (*addr != val) {
+			if (dev != NULL) {
+				dev->spin_time += read_timer_ms() - start;
+				if (dev->spin_count < omp_dev_max_spin_count) dev->spin_count *= 2;
+			}
+			return;
+		}
+		omp_cpu_relax();
+	}
+
+	double park_start = read_timer_ms();
+	while (*addr == val) omp_dev_park(addr, val);
+	if (dev != NULL) {
+		double end = read_timer_ms();
+		dev->spin_time += park_start - start;
+		dev->idle_time += end - park_start;
+		dev->num_parks++;
+		if (dev->spin_count > OMP_DEV_MIN_SPIN_COUNT) dev->spin_count /= 2;
+	}
+}
+
+/* wake up all the threads that are parked on addr */
+void omp_dev_wake_all(volatile int * addr) {
+	if (omp_dev_wait_policy == OMP_DEV_WAIT_SPIN) return;
+#if defined (__linux__)
+	syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
 
 volatile int omp_printf_turn = 0; /* a simple mechanism to allow multiple dev shepherd threads to print in turn so the output do not scramble together */
 omp_device_type_info_t omp_device_types[OMP_NUM_DEVICE_TYPES] = {
@@ -404,6 +517,367 @@ void omp_probe_devices() {
 
 	}
 }
+/* read a line of a sysfs file, return 0 on success */
+static int omp_sysfs_read(const char * path, char * buf, int length) {
+	FILE * file = fopen(path, "r");
+	if (file == NULL) return -1;
+	char * line = fgets(buf, length, file);
+	fclose(file);
+	if (line == NULL) return -1;
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static int omp_sysfs_read_int(const char * path, int def) {
+	char buf[32];
+	if (omp_sysfs_read(path, buf, sizeof(buf)) != 0) return def;
+	return atoi(buf);
+}
+
+/* parse a sysfs cpu or node list, e.g. "0-9,20-29", into the mask, return the number of entries */
+static int omp_cpulist_parse(const char * list, unsigned long * mask) {
+	const int bits = 8 * sizeof(unsigned long);
+	int num = 0;
+	memset(mask, 0, sizeof(unsigned long) * OMP_CPUMASK_WORDS);
+	while (*list != '\0') {
+		char * end;
+		long first = strtol(list, &end, 10);
+		if (end == list) break;
+		long last = first;
+		if (*end == '-') last = strtol(end + 1, &end, 10);
+		long i;
+		for (i = first; i <= last && i < OMP_MAX_HOST_CPUS; i++) {
+			if (i < 0) continue;
+			if (!(mask[i / bits] & (1UL << (i % bits)))) num++;
+			mask[i / bits] |= 1UL << (i % bits);
+		}
+		list = end;
+		if (*list == ',') list++;
+	}
+	return num;
+}
+
+static inline int omp_cpumask_isset(unsigned long * mask, int i) {
+	const int bits = 8 * sizeof(unsigned long);
+	return (mask[i / bits] >> (i % bits)) & 1UL;
+}
+
+/* print the mask as a cpu list, e.g. "0-3,20-23", return the number of cpus */
+int omp_cpumask_print(unsigned long * mask, char * buf, int length) {
+	int i, num = 0, pos = 0;
+	buf[0] = '\0';
+	for (i = 0; i < OMP_MAX_HOST_CPUS; i++) {
+		if (!omp_cpumask_isset(mask, i)) continue;
+		int last = i;
+		while (last + 1 < OMP_MAX_HOST_CPUS && omp_cpumask_isset(mask, last + 1)) last++;
+		if (pos < length) {
+			if (last == i) pos += snprintf(buf + pos, length - pos, "%s%d", num ? "," : "", i);
+			else pos += snprintf(buf + pos, length - pos, "%s%d-%d", num ? "," : "", i, last);
+		}
+		num += last - i + 1;
+		i = last;
+	}
+	return num;
+}
+
+/* discover the cpus, cores and NUMA nodes of the host from sysfs, see omp_host_topology_t */
+void omp_host_topology_discover(omp_host_topology_t * topo) {
+	char path[128];
+	char buf[1024];
+	unsigned long online[OMP_CPUMASK_WORDS];
+	unsigned long mask[OMP_CPUMASK_WORDS];
+	int i, n;
+
+	if (omp_sysfs_read("/sys/devices/system/cpu/online", buf, sizeof(buf)) != 0 || omp_cpulist_parse(buf, online) == 0) {
+		long num = sysconf(_SC_NPROCESSORS_ONLN);
+		snprintf(buf, sizeof(buf), "0-%ld", (num > 0 ? num : 1) - 1);
+		omp_cpulist_parse(buf, online);
+	}
+
+	/* the node of each cpu */
+	static int cpu_node[OMP_MAX_HOST_CPUS];
+	for (i = 0; i < OMP_MAX_HOST_CPUS; i++) cpu_node[i] = 0;
+	topo->num_nodes = 1;
+	unsigned long nodes[OMP_CPUMASK_WORDS];
+	if (omp_sysfs_read("/sys/devices/system/node/online", buf, sizeof(buf)) == 0 && (n = omp_cpulist_parse(buf, nodes)) > 0) {
+		topo->num_nodes = n;
+		for (n = 0; n < OMP_MAX_HOST_CPUS; n++) {
+			if (!omp_cpumask_isset(nodes, n)) continue;
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+			if (omp_sysfs_read(path, buf, sizeof(buf)) != 0) continue;
+			omp_cpulist_parse(buf, mask);
+			for (i = 0; i < OMP_MAX_HOST_CPUS; i++) if (omp_cpumask_isset(mask, i)) cpu_node[i] = n;
+		}
+	}
+
+	/* the cores, identified by (node, package, core_id) */
+	static int core_package[OMP_MAX_HOST_CPUS];
+	static int core_id[OMP_MAX_HOST_CPUS];
+	static int core_node[OMP_MAX_HOST_CPUS];
+	static int cpu_core[OMP_MAX_HOST_CPUS];
+	int num_cores = 0;
+	topo->num_cpus = 0;
+	for (i = 0; i < OMP_MAX_HOST_CPUS; i++) {
+		cpu_core[i] = -1;
+		if (!omp_cpumask_isset(online, i)) continue;
+		topo->num_cpus++;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+		int package = omp_sysfs_read_int(path, 0);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+		int id = omp_sysfs_read_int(path, i);
+		int c;
+		for (c = 0; c < num_cores; c++)
+			if (core_node[c] == cpu_node[i] && core_package[c] == package && core_id[c] == id) break;
+		if (c == num_cores) {
+			core_node[c] = cpu_node[i];
+			core_package[c] = package;
+			core_id[c] = id;
+			num_cores++;
+		}
+		cpu_core[i] = c;
+	}
+
+	/* order the cores by node, so the cores of a node are consecutive */
+	static int order[OMP_MAX_HOST_CPUS];
+	int next = 0;
+	for (n = 0; n < OMP_MAX_HOST_CPUS && next < num_cores; n++) {
+		int c;
+		for (c = 0; c < num_cores; c++) {
+			if (core_node[c] != n) continue;
+			order[c] = next;
+			topo->core_node[next] = n;
+			next++;
+		}
+	}
+	for (i = 0; i < OMP_MAX_HOST_CPUS; i++) topo->cpu_core[i] = cpu_core[i] < 0 ? -1 : order[cpu_core[i]];
+	topo->num_cores = num_cores;
+}
+
+/**
+ * give each HOSTCPU/THSIM device a disjoint set of cores of the host topology, see omp_host_topology_t. A device starts at the
+ * next node if it does not fit in the free cores of the current node, as long as the cores left are still enough for the rest.
+ * Called before the helper threads are created, which bind themselves (omp_dev_bind).
+ */
+void omp_place_devices() {
+	omp_host_topology_t * topo = &omp_host_topology;
+	int i;
+	int total = 0;
+	for (i = 0; i < omp_num_devices; i++) {
+		omp_device_t * dev = &omp_devices[i];
+		memset(dev->cpumask, 0, sizeof(dev->cpumask));
+		dev->num_bound_cpus = 0;
+		if (dev->type == OMP_DEVICE_HOSTCPU || dev->type == OMP_DEVICE_THSIM) total += dev->num_cores > 0 ? dev->num_cores : 1;
+	}
+	if (omp_dev_bind_policy == OMP_DEV_BIND_FALSE || total == 0 || topo->num_cores == 0) return;
+	if (omp_dev_bind_policy == OMP_DEV_BIND_AUTO && total > topo->num_cores) {
+		printf("The HOSTCPU/THSIM devices need %d cores but the host has %d, they are not bound (set OMP_DEV_BIND=true to bind anyway).\n",
+			   total, topo->num_cores);
+		return;
+	}
+
+	int next = 0; /* the next free core */
+	int remaining = total;
+	for (i = 0; i < omp_num_devices; i++) {
+		omp_device_t * dev = &omp_devices[i];
+		if (dev->type != OMP_DEVICE_HOSTCPU && dev->type != OMP_DEVICE_THSIM) continue;
+		int num = dev->num_cores > 0 ? dev->num_cores : 1;
+		if (num > topo->num_cores) num = topo->num_cores;
+		if (next >= topo->num_cores) next = 0; /* OMP_DEV_BIND=true with not enough cores, reuse them round robin */
+
+		int node = topo->core_node[next];
+		int end = next;
+		while (end < topo->num_cores && topo->core_node[end] == node) end++;
+		if (end - next < num && end + num <= topo->num_cores && topo->num_cores - end >= remaining) next = end;
+
+		int c;
+		for (c = next; c < next + num; c++) {
+			int core = c % topo->num_cores;
+			int cpu;
+			for (cpu = 0; cpu < OMP_MAX_HOST_CPUS; cpu++) {
+				if (topo->cpu_core[cpu] != core) continue;
+				dev->cpumask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+				dev->num_bound_cpus++;
+			}
+		}
+		dev->numa_node = topo->core_node[next];
+		next += num;
+		remaining -= num;
+	}
+}
+
+/* called by the helper thread to bind itself to the cpus of its device, or only to find its NUMA node if not bound */
+void omp_dev_bind(omp_device_t * dev) {
+#if defined (__linux__) && defined (SYS_sched_setaffinity)
+	if (dev->num_bound_cpus && syscall(SYS_sched_setaffinity, 0, sizeof(dev->cpumask), dev->cpumask) != 0) {
+		fprintf(stderr, "%d|%s: cannot bind the helper thread to its cpus, it is not bound\n", dev->id, dev->name);
+		dev->num_bound_cpus = 0;
+		dev->numa_node = -1;
+	}
+#else
+	dev->num_bound_cpus = 0;
+	dev->numa_node = -1;
+#endif
+#if defined (__linux__) && defined (SYS_getcpu)
+	unsigned int cpu, node;
+	if (!dev->num_bound_cpus && syscall(SYS_getcpu, &cpu, &node, NULL) == 0) dev->numa_node = node; /* for the NUMA-local memory pool */
+#endif
+}
+
+static const char * omp_calibration_typename(omp_device_t * dev) {
+	if (dev->type == OMP_DEVICE_HOSTCPU) return "cpu";
+	else if (dev->type == OMP_DEVICE_THSIM) return "thsim";
+	else return "gpu";
+}
+
+/* the section of a device in the calibration file, its name without the ':' that iniparser uses for the section:key */
+static void omp_calibration_section(omp_device_t * dev, char * section, int length) {
+	snprintf(section, length, "%s", dev->name);
+	char * c;
+	for (c = section; *c != '\0'; c++) if (*c == ':' || *c == ' ' || *c == '[' || *c == ']') *c = '_';
+}
+
+/* the machine a calibration is valid for, the hostname and the cpu model of /proc/cpuinfo */
+static void omp_calibration_machine(char * hostname, int hostname_length, char * cpu, int cpu_length) {
+	if (gethostname(hostname, hostname_length) != 0) snprintf(hostname, hostname_length, "unknown");
+	hostname[hostname_length-1] = '\0';
+	snprintf(cpu, cpu_length, "unknown");
+	FILE * cpuinfo = fopen("/proc/cpuinfo", "r");
+	if (cpuinfo == NULL) return;
+	char line[256];
+	while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+		if (strncmp(line, "model name", 10) != 0) continue;
+		char * value = strchr(line, ':');
+		if (value == NULL) break;
+		value++;
+		while (*value == ' ' || *value == '\t') value++;
+		snprintf(cpu, cpu_length, "%s", value);
+		break;
+	}
+	fclose(cpuinfo);
+	char * c;
+	for (c = cpu; *c != '\0'; c++) if (*c == '\n' || *c == '"' || *c == '#' || *c == ';') *c = ' ';
+	for (c = cpu + strlen(cpu); c > cpu && c[-1] == ' '; c--) c[-1] = '\0';
+}
+
+/* load the calibration of all the devices if the file is of this version, machine and devices. Return 1 if loaded */
+static int omp_calibration_load() {
+	if (access(omp_dev_calibration_file, R_OK) != 0) return 0;
+	dictionary * ini = iniparser_load(omp_dev_calibration_file);
+	if (ini == NULL) return 0;
+	char hostname[128];
+	char cpu[128];
+	omp_calibration_machine(hostname, sizeof(hostname), cpu, sizeof(cpu));
+	int loaded = 0;
+	if (iniparser_getint(ini, "calibration:version", -1) == OMP_DEV_CALIBRATION_VERSION &&
+		strcmp(iniparser_getstring(ini, "calibration:hostname", ""), hostname) == 0 &&
+		strcmp(iniparser_getstring(ini, "calibration:cpu", ""), cpu) == 0 &&
+		iniparser_getint(ini, "calibration:devices", -1) == omp_num_devices) {
+		int i;
+		char section[64];
+		char keyname[96];
+		for (i=0; i<omp_num_devices; i++) {
+			omp_device_t * dev = &omp_devices[i];
+			omp_calibration_section(dev, section, sizeof(section));
+			sprintf(keyname, "%s:type", section);
+			if (strcasecmp(iniparser_getstring(ini, keyname, ""), omp_calibration_typename(dev)) != 0) break;
+			sprintf(keyname, "%s:ncores", section);
+			if (iniparser_getint(ini, keyname, -1) != (int)dev->num_cores) break;
+		}
+		if (i == omp_num_devices) {
+			for (i=0; i<omp_num_devices; i++) {
+				omp_device_t * dev = &omp_devices[i];
+				omp_calibration_section(dev, section, sizeof(section));
+				sprintf(keyname, "%s:flopss", section);
+				dev->total_real_flopss = iniparser_getdouble(ini, keyname, dev->total_real_flopss);
+				if (dev->num_cores > 0) dev->flopss_percore = dev->total_real_flopss / dev->num_cores;
+				sprintf(keyname, "%s:bandwidth", section);
+				dev->bandwidth = iniparser_getdouble(ini, keyname, dev->bandwidth);
+				sprintf(keyname, "%s:latency", section);
+				dev->latency = iniparser_getdouble(ini, keyname, dev->latency);
+				dev->calibrated = 1;
+			}
+			loaded = 1;
+		}
+	}
+	iniparser_freedict(ini);
+	if (!loaded) printf("The device calibration in %s is not of this runtime, machine or devices, calibrating again.\n", omp_dev_calibration_file);
+	return loaded;
+}
+
+/* save the calibration in the dev spec format, thus it can also be used as OMP_DEV_SPEC_FILE */
+static void omp_calibration_save() {
+	FILE * file = fopen(omp_dev_calibration_file, "w");
+	if (file == NULL) {
+		fprintf(stderr, "cannot write the device calibration to %s\n", omp_dev_calibration_file);
+		return;
+	}
+	char hostname[128];
+	char cpu[128];
+	omp_calibration_machine(hostname, sizeof(hostname), cpu, sizeof(cpu));
+	fprintf(file, "# device specs calibrated by the HOMP runtime (OMP_DEV_CALIBRATE), can also be used as OMP_DEV_SPEC_FILE\n");
+	fprintf(file, "[calibration]\nnum = 0\nversion = %d\nhostname = %s\ncpu = \"%s\"\ndevices = %d\n\n", OMP_DEV_CALIBRATION_VERSION,
+			hostname, cpu, omp_num_devices);
+	int i;
+	for (i=0; i<omp_num_devices; i++) {
+		omp_device_t * dev = &omp_devices[i];
+		char section[64];
+		omp_calibration_section(dev, section, sizeof(section));
+		fprintf(file, "[%s]\nnum = 1\nsysid = %ld\ntype = %s\nncores = %lu\n", section, dev->sysid, omp_calibration_typename(dev), dev->num_cores);
+		fprintf(file, "FLOPss = %g # GFLOPS/s\nBandwidth = %g # MB/s\nLatency = %g #us\n", dev->total_real_flopss, dev->bandwidth, dev->latency);
+		if (dev->mem_type == OMP_DEVICE_MEM_SHARED) fprintf(file, "Memory = shared\n");
+		else if (dev->mem_type == OMP_DEVICE_MEM_DISCRETE) fprintf(file, "Memory = discrete\n");
+		fprintf(file, "\n");
+	}
+	fclose(file);
+}
+
+/**
+ * called by the helper thread of the device before it is ready, probes the device unless it is loaded from the calibration
+ * cache. The devices are probed one at a time so they do not disturb each other. The flops of a NVGPU are not probed since
+ * that needs a device kernel, the dev spec value is kept.
+ */
+void omp_calibrate_device(omp_device_t * dev) {
+	static pthread_mutex_t calibration_lock = PTHREAD_MUTEX_INITIALIZER;
+	if (!omp_dev_calibrate || dev->calibrated) return;
+	pthread_mutex_lock(&calibration_lock);
+	int i;
+	if (dev->type == OMP_DEVICE_HOSTCPU || dev->type == OMP_DEVICE_THSIM) {
+		double best = 0.0;
+		for (i=0; i<OMP_DEV_CALIBRATION_REPEATS; i++) {
+			double flopss;
+			cpu_sustain_gflopss(&flopss);
+			if (flopss > best) best = flopss;
+		}
+		dev->flopss_percore = best;
+		dev->total_real_flopss = best * (dev->num_cores > 0 ? dev->num_cores : 1);
+	}
+
+	long size = OMP_DEV_CALIBRATION_COPY_SIZE;
+	char * host = (char *) malloc(size);
+	memset(host, 1, size);
+	void * devptr = omp_map_malloc_dev(dev, size);
+	omp_map_memcpy_to(devptr, dev, host, size); /* warm up, e.g. the page faults of the device memory */
+	double best = -1.0;
+	for (i=0; i<OMP_DEV_CALIBRATION_REPEATS; i++) {
+		double timer = read_timer_ms();
+		omp_map_memcpy_to(devptr, dev, host, size);
+		timer = read_timer_ms() - timer;
+		if (best < 0.0 || timer < best) best = timer;
+	}
+	if (best > 0.0) dev->bandwidth = (size / 1.0e6) / (best / 1000.0); /* MB/s */
+
+	double timer = read_timer_ms();
+	for (i=0; i<OMP_DEV_CALIBRATION_LATENCY_REPEATS; i++) {
+		omp_map_memcpy_to_async(devptr, dev, host, sizeof(double), &dev->devstream);
+		omp_stream_sync(&dev->devstream);
+	}
+	dev->latency = (read_timer_ms() - timer) * 1000.0 / OMP_DEV_CALIBRATION_LATENCY_REPEATS; /* us */
+	omp_map_free_dev(dev, devptr);
+	free(host);
+	dev->calibrated = 1;
+	pthread_mutex_unlock(&calibration_lock);
+}
+
 /* init the device objects, num_of_devices, helper threads, default_device_var ICV etc
  *
  */
@@ -413,6 +887,72 @@ int omp_init_devices() {
 
 	int i;
 
+	char * wait_policy = getenv("OMP_DEV_WAIT_POLICY");
+	if (wait_policy != NULL) {
+		if (strncasecmp(wait_policy, "spin", 4) == 0) omp_dev_wait_policy = OMP_DEV_WAIT_SPIN;
+		else if (strncasecmp(wait_policy, "park", 4) == 0) omp_dev_wait_policy = OMP_DEV_WAIT_PARK;
+		else omp_dev_wait_policy = OMP_DEV_WAIT_ADAPTIVE;
+	}
+	char * spin_count = getenv("OMP_DEV_SPIN_COUNT");
+	if (spin_count != NULL) {
+		omp_dev_max_spin_count = atol(spin_count);
+		if (omp_dev_max_spin_count < OMP_DEV_MIN_SPIN_COUNT) omp_dev_max_spin_count = OMP_DEV_MIN_SPIN_COUNT;
+	}
+
+	char * num_streams = getenv("OMP_DEV_NUM_STREAMS");
+	if (num_streams != NULL) {
+		omp_dev_num_streams = atoi(num_streams);
+		if (omp_dev_num_streams < 1) omp_dev_num_streams = 1;
+		if (omp_dev_num_streams > OMP_DEV_MAX_STREAMS) omp_dev_num_streams = OMP_DEV_MAX_STREAMS;
+	}
+
+	char * pool_limit = getenv("OMP_DEV_MEM_POOL_LIMIT");
+	if (pool_limit != NULL) {
+		omp_mem_pool_limit = atol(pool_limit) * 1024L * 1024L;
+		if (omp_mem_pool_limit < 0) omp_mem_pool_limit = 0;
+		omp_unified_mem_pool.limit = omp_mem_pool_limit;
+	}
+
+	char * pin = getenv("OMP_DATA_MAP_PIN");
+	if (pin != NULL && (strncasecmp(pin, "true", 4) == 0 || strcmp(pin, "1") == 0)) omp_host_pin_policy = 1;
+
+	char * copy_threads = getenv("OMP_MAP_COPY_THREADS");
+	if (copy_threads != NULL) omp_map_copy_num_threads = atoi(copy_threads);
+
+	char * auto_adaptive = getenv("OMP_DIST_AUTO_ADAPTIVE");
+	if (auto_adaptive != NULL) omp_dist_auto_adapt_threshold = atof(auto_adaptive) / 100.0;
+
+	char * bind = getenv("OMP_DEV_BIND");
+	if (bind != NULL) {
+		if (strncasecmp(bind, "true", 4) == 0 || strcmp(bind, "1") == 0) omp_dev_bind_policy = OMP_DEV_BIND_TRUE;
+		else if (strncasecmp(bind, "false", 5) == 0 || strcmp(bind, "0") == 0) omp_dev_bind_policy = OMP_DEV_BIND_FALSE;
+		else omp_dev_bind_policy = OMP_DEV_BIND_AUTO;
+	}
+
+	char * team = getenv("OMP_DEV_TEAM");
+	if (team != NULL && (strncasecmp(team, "false", 5) == 0 || strcmp(team, "0") == 0)) omp_dev_team_enabled = 0;
+
+	char * calibrate = getenv("OMP_DEV_CALIBRATE");
+	if (calibrate != NULL) {
+		if (strncasecmp(calibrate, "force", 5) == 0) omp_dev_calibrate = 2;
+		else if (strncasecmp(calibrate, "true", 4) == 0 || strcmp(calibrate, "1") == 0) omp_dev_calibrate = 1;
+	}
+	char * calibration_file = getenv("OMP_DEV_CALIBRATION_FILE");
+	if (calibration_file != NULL) snprintf(omp_dev_calibration_file, PATH_MAX, "%s", calibration_file);
+	else if (getenv("HOME") != NULL) snprintf(omp_dev_calibration_file, PATH_MAX, "%s/.homp_devices.ini", getenv("HOME"));
+	else snprintf(omp_dev_calibration_file, PATH_MAX, "homp_devices.ini");
+
+	char * perf_counters = getenv("OMP_DEV_PERF_COUNTERS");
+	if (perf_counters != NULL && (strncasecmp(perf_counters, "true", 4) == 0 || strcmp(perf_counters, "1") == 0)) omp_dev_perf_counters = 1;
+
+	omp_trace_file = getenv("OMP_TRACE_FILE");
+	if (omp_trace_file != NULL && omp_trace_file[0] == '\0') omp_trace_file = NULL;
+	char * trace_sample = getenv("OMP_TRACE_SAMPLE");
+	if (trace_sample != NULL) {
+		omp_trace_sample = atoi(trace_sample);
+		if (omp_trace_sample < 1) omp_trace_sample = 1;
+	}
+
 	char * dev_spec_file = getenv("OMP_DEV_SPEC_FILE");
 	if (dev_spec_file != NULL) {
 		omp_read_device_spec(dev_spec_file);
@@ -424,9 +964,18 @@ int omp_init_devices() {
 	} else {
 		default_device_var = -1;
 	}
+	if (omp_map_copy_num_threads <= 0) {
+		omp_map_copy_num_threads = sysconf(_SC_NPROCESSORS_ONLN) / (omp_num_devices > 0 ? omp_num_devices : 1);
+		if (omp_map_copy_num_threads < 1) omp_map_copy_num_threads = 1;
+	}
 	omp_device_types[OMP_DEVICE_HOSTCPU].num_devs = num_hostcpu_dev;
 	omp_device_types[OMP_DEVICE_THSIM].num_devs = num_thsim_dev;
 	omp_device_types[OMP_DEVICE_NVGPU].num_devs = num_nvgpu_dev;
+	for (i=0; i<omp_num_devices; i++) omp_devices[i].calibrated = 0;
+	omp_host_topology_discover(&omp_host_topology);
+	omp_place_devices();
+	int calibration_cached = 0;
+	if (omp_dev_calibrate == 1) calibration_cached = omp_calibration_load();
 
 	/* create the helper thread for each device */
 	/* the helper thread setup */
@@ -443,16 +992,40 @@ int omp_init_devices() {
 
 		dev->status = 1;
 		dev->resident_data_maps = NULL;
+		dev->num_resident_data_maps = 0;
+		dev->max_resident_data_maps = 0;
 		dev->offload_request = NULL;
+		memset(&dev->offload_queue, 0, sizeof(omp_offloading_queue_t));
+		int j;
+		for (j=0; j<OMP_OFFLOADING_QUEUE_SIZE; j++) dev->offload_queue.slots[j].seq = j;
+		dev->spin_count = omp_dev_max_spin_count;
+		dev->spin_time = 0.0;
+		dev->idle_time = 0.0;
+		dev->num_parks = 0;
+		if (omp_dev_num_streams) dev->num_streams = omp_dev_num_streams;
+		else if (dev->type == OMP_DEVICE_NVGPU) dev->num_streams = OMP_DEV_DEFAULT_NUM_STREAMS;
+		else dev->num_streams = 1;
 		dev->offload_stack_top = -1;
+		if (!dev->num_bound_cpus) dev->numa_node = -1; /* set by the helper thread */
+		omp_mem_pool_init(&dev->mem_pool, dev);
+		memset(&dev->trace_ring, 0, sizeof(omp_trace_ring_t));
+		memset(&dev->team, 0, sizeof(omp_dev_team_t));
+		dev->team.num_threads = 1; /* the workers are created by the helper thread */
+		if (omp_trace_file != NULL) dev->trace_ring.records = (omp_trace_record_t *) malloc(sizeof(omp_trace_record_t) * OMP_TRACE_RING_SIZE);
+		for (j=0; j<OMP_PERF_NUM_COUNTERS; j++) dev->perf_fds[j] = -1; /* opened by the helper thread */
 
 		int rt = pthread_create(&dev->helperth, &attr, (void *(*)(void *))helper_thread_main, (void *) dev);
 		if (rt) {fprintf(stderr, "cannot create helper threads for devices.\n"); exit(1); }
 	}
+	if (omp_trace_file != NULL) omp_trace_init();
+	pthread_barrier_wait(&all_dev_sync_barrier); /* the helper threads are ready and the devices are calibrated */
+	if (omp_dev_calibrate && !calibration_cached) omp_calibration_save();
 
 	printf("=====================================================================================================================\n");
 	printf("System has total %d devices, %d HOSTCPU (one CPU is one dev), %d GPU and %d THSIM; default dev: %d.\n", omp_num_devices,
 		   num_hostcpu_dev, num_nvgpu_dev, num_thsim_dev, default_device_var);
+	printf("Host has %d cpus, %d cores and %d NUMA nodes.\n", omp_host_topology.num_cpus, omp_host_topology.num_cores,
+		   omp_host_topology.num_nodes);
 	for (i=0; i<omp_num_devices; i++) {
 		omp_device_t * dev = &omp_devices[i];
 		char * mem_type = "SHARED";
@@ -462,6 +1035,11 @@ int omp_init_devices() {
 		printf("\t%d|sysid: %d, type: %s, name: %s, ncores: %d, mem: %s, flops: %0.2fGFLOPS/s, bandwidth: %.2fMB/s, latency: %.2fus\n",
 			   dev->id, dev->sysid, omp_get_device_typename(dev), dev->name, dev->num_cores, mem_type, dev->total_real_flopss, dev->bandwidth,
 			   dev->latency);
+		if (dev->num_bound_cpus) {
+			char cpus[256];
+			omp_cpumask_print(dev->cpumask, cpus, sizeof(cpus));
+			printf("\t\tbound to cpus %s (NUMA node %d)\n", cpus, dev->numa_node);
+		}
 		//printf("\t\tstream dev: %s\n", dev->devstream.dev->name);
 		if (dev->type == OMP_DEVICE_NVGPU) {
 			if (dev->mem_type == OMP_DEVICE_MEM_DISCRETE) {
@@ -487,9 +1065,27 @@ int omp_init_devices() {
 	printf("\t\tOMP_NUM_NVGPU_DEVICES for selecting a number of NVIDIA GPU devices from dev 0 (default, total available).\n");
 	printf("\t\t\tThis variable is overwritten by OMP_NVGPU_DEVICES).\n");
 	printf("\t\tOMP_NVGPU_DEVICES for selecting specific NVGPU devices (e.g., \"0,2,3\",no spaces)\n");
+	printf("\tTo control how the helper threads wait for requests and halo data, using the following environment variable\n");
+	printf("\t\tOMP_DEV_WAIT_POLICY for selecting spin|park|adaptive wait (default adaptive, spin then park).\n");
+	printf("\t\tOMP_DEV_SPIN_COUNT for the max number of spin iterations before parking (default %d).\n", OMP_DEV_DEFAULT_SPIN_COUNT);
+	printf("\tOMP_DEV_NUM_STREAMS for the number of concurrent streams per device for pipelined offloading (max %d, default %d for NVGPU and 1 for others).\n",
+		   OMP_DEV_MAX_STREAMS, OMP_DEV_DEFAULT_NUM_STREAMS);
+	printf("\tOMP_DEV_MEM_POOL_LIMIT for the max MB of freed memory cached by the memory pool of each device (default %ld, 0 for no caching).\n",
+		   OMP_MEM_POOL_DEFAULT_LIMIT/(1024L*1024L));
+	printf("\tOMP_DATA_MAP_PIN for registering (page-locking) the host memory of COPY maps to NVGPU, true|false (default false).\n");
+	printf("\tOMP_MAP_COPY_THREADS for the number of threads of a big host copy or data marshalling (default %d, the cores per device).\n",
+		   omp_map_copy_num_threads);
+	printf("\tOMP_DIST_AUTO_ADAPTIVE for re-partitioning recurring AUTO loops from the measured timings when the predicted gain is over the percent (default 0, static).\n");
+	printf("\tOMP_DEV_BIND for binding the HOSTCPU/THSIM devices to disjoint cores and their NUMA nodes, auto|true|false (default auto, if the cores are enough).\n");
+	printf("\tOMP_DEV_TEAM for running the kernel loops of a HOSTCPU/THSIM device by a persistent team of ncores threads, true|false (default true).\n");
+	printf("\tOMP_DEV_CALIBRATE for measuring the flops, bandwidth and latency of the devices at startup, true|force|false (default false), cached in\n");
+	printf("\t\tOMP_DEV_CALIBRATION_FILE (now %s, %s).\n", omp_dev_calibration_file,
+		   !omp_dev_calibrate ? "not used" : (calibration_cached ? "loaded" : "saved"));
+	printf("\tOMP_DEV_PERF_COUNTERS for counting cycles, instructions, LLC misses and cpu time of the kernels of HOSTCPU/THSIM devices, true|false (default false).\n");
+	printf("\tOMP_TRACE_FILE for tracing the events to <prefix>.bin and exporting them to <prefix>.json (Chrome trace/Perfetto) at exit (default none).\n");
+	printf("\tOMP_TRACE_SAMPLE for tracing every Nth run of a recurring offloading (default 1, all).\n");
 	printf("=====================================================================================================================\n");
 
-	pthread_barrier_wait(&all_dev_sync_barrier);
 	return omp_num_devices;
 }
 
@@ -531,9 +1127,25 @@ void omp_fini_devices() {
 	int i;
 
 	omp_device_complete = 1;
+	for (i=0; i<omp_num_devices; i++) {
+		omp_device_t * dev = &omp_devices[i];
+		__atomic_add_fetch(&dev->offload_queue.signal, 1, __ATOMIC_SEQ_CST);
+		omp_dev_wake_all(&dev->offload_queue.signal);
+	}
+	printf("Helper thread wait (policy: %s) and memory pool statistics:\n", omp_dev_wait_policy == OMP_DEV_WAIT_SPIN ? "spin" :
+		   (omp_dev_wait_policy == OMP_DEV_WAIT_PARK ? "park" : "adaptive"));
 	for (i=0; i<omp_num_devices; i++) {
 		omp_device_t * dev = &omp_devices[i];
 		int rt = pthread_join(dev->helperth, NULL);
+		omp_dev_team_fini(dev);
+		printf("\t%d|%s: spin %.2fms, idle (parked) %.2fms, %ld parks\n", dev->id, dev->name, dev->spin_time, dev->idle_time, dev->num_parks);
+		printf("\t%d|%s: ", dev->id, dev->name);
+		omp_mem_pool_print_stats(&dev->mem_pool, "device");
+		omp_set_current_device_dev(dev);
+		free(dev->resident_data_maps);
+		omp_mem_pool_fini(&dev->mem_pool);
+		omp_perf_counters_close(dev);
+		if (dev->trace_ring.dropped) printf("\t%d|%s: %ld trace records dropped, the trace ring is full\n", dev->id, dev->name, dev->trace_ring.dropped);
 		omp_device_type_t devtype = dev->type;
 #if defined (DEVICE_NVGPU_SUPPORT)
 		if (devtype == OMP_DEVICE_NVGPU) {
@@ -542,6 +1154,15 @@ void omp_fini_devices() {
 #endif
 	}
 
+	printf("\thost: ");
+	omp_mem_pool_print_stats(&omp_unified_mem_pool, "unified");
+	if (omp_host_region_lookups) {
+		printf("\thost: registration cache: %ld lookups, hit rate %.1f%%, %.2fMB registered\n", omp_host_region_lookups,
+			   100.0 * omp_host_region_hits / omp_host_region_lookups, omp_host_region_bytes / 1048576.0);
+	}
+	omp_host_unregister(NULL, LONG_MAX);
+	if (omp_trace_file != NULL) omp_trace_fini();
+
 	pthread_barrier_destroy(&all_dev_sync_barrier);
 	free(omp_devices);
 }
@@ -557,87 +1178,363 @@ int omp_set_current_device_dev(omp_device_t * d) {
 	return d->id;
 }
 
+/* return 1 if the host region [ptr, ptr+size) is registered, either found in the cache or registered by this call */
+int omp_host_register(void * ptr, long size) {
+	unsigned long pagesize = sysconf(_SC_PAGESIZE);
+	char * start = (char*)((unsigned long)ptr & ~(pagesize-1));
+	char * end = (char*)(((unsigned long)ptr + size + pagesize - 1) & ~(pagesize-1));
+	int registered = 0;
+	omp_host_region_t * region;
+
+	pthread_mutex_lock(&omp_host_regions_lock);
+	omp_host_region_lookups++;
+	for (region = omp_host_regions; region != NULL; region = region->next) {
+		if (start >= region->start && end <= region->end) break;
+	}
+	if (region != NULL) {
+		omp_host_region_hits++;
+		registered = 1;
+	} else {
+#if defined (DEVICE_NVGPU_SUPPORT)
+		if (cudaHostRegister(start, end - start, cudaHostRegisterPortable | cudaHostRegisterMapped) == cudaSuccess) {
+			region = (omp_host_region_t *) malloc(sizeof(omp_host_region_t));
+			region->start = start;
+			region->end = end;
+			region->next = omp_host_regions;
+			omp_host_regions = region;
+			omp_host_region_bytes += end - start;
+			registered = 1;
+		} else {
+			cudaGetLastError(); /* e.g. it overlaps with a registered region, we stay with the pageable copy */
+		}
+#endif
+	}
+	pthread_mutex_unlock(&omp_host_regions_lock);
+	return registered;
+}
+
+/* unregister the cached regions that overlap with [ptr, ptr+size), e.g. before the memory is freed */
+void omp_host_unregister(void * ptr, long size) {
+	char * start = (char*)ptr;
+	char * end = start + size;
+	omp_host_region_t ** prev = &omp_host_regions;
+	pthread_mutex_lock(&omp_host_regions_lock);
+	while (*prev != NULL) {
+		omp_host_region_t * region = *prev;
+		if (region->start < end && start < region->end) {
+#if defined (DEVICE_NVGPU_SUPPORT)
+			cudaHostUnregister(region->start);
+#endif
+			omp_host_region_bytes -= region->end - region->start;
+			*prev = region->next;
+			free(region);
+		} else prev = &region->next;
+	}
+	pthread_mutex_unlock(&omp_host_regions_lock);
+}
+
+/* the device pointer of a registered host address for zero-copy access, NULL if the device cannot access it */
+void * omp_host_get_dev_ptr(omp_device_t * dev, void * ptr) {
+#if defined (DEVICE_NVGPU_SUPPORT)
+	if (dev->type == OMP_DEVICE_NVGPU) {
+		void * dev_ptr;
+		if (cudaHostGetDevicePointer(&dev_ptr, ptr, 0) == cudaSuccess) return dev_ptr;
+		cudaGetLastError();
+	}
+#else
+	(void) dev;
+	(void) ptr;
+#endif
+	return NULL;
+}
+
+/* register the whole host array of the maps, registered once by the first map and found in the cache by the others */
+int omp_map_info_register_host(omp_data_map_info_t * info) {
+	long size = info->sizeof_element;
+	int i;
+	for (i=0; i<info->num_dims; i++) size *= info->dims[i];
+	return omp_host_register(info->source_ptr, size);
+}
+
+/* register the host region of a COPY map to NVGPU if it is asked for, return 1 if registered */
+int omp_map_register_host(omp_data_map_t * map) {
+	if (map->map_type != OMP_DATA_MAP_COPY || map->dev->type != OMP_DEVICE_NVGPU) return 0;
+	if (!map->info->host_pinned && !omp_host_pin_policy) return 0;
+	return omp_map_info_register_host(map->info);
+}
+
+/**
+ * copy the mapped region with halo of a map from the array to dst of dst_dims, i.e. the device buffer or the packed
+ * host buffer of omp_map_marshal, box by box. The part of the halo out of the array is wrapped
+ * around for a periodic halo, and is not copied otherwise (it is either filled by the halo exchange or not used at all).
+ * Each dim has at most three segments: wrapped from the right end of the array, within the array, and wrapped from
+ * the left end, except a CYCLIC dim (which has no halo) whose segments are its chunks, packed one after another.
+ */
+static void omp_map_gather(omp_data_map_t * map, char * dst, omp_device_t * dstdev, const long * dst_dims, omp_dev_stream_t * stream) {
+	omp_data_map_info_t * info = map->info;
+	int ndims = info->num_dims;
+	long host_start[OMP_MAX_NUM_DIMENSIONS][3];
+	long dev_start[OMP_MAX_NUM_DIMENSIONS][3];
+	long seg_length[OMP_MAX_NUM_DIMENSIONS][3];
+	long num_segs[OMP_MAX_NUM_DIMENSIONS];
+	int i;
+	for (i=0; i<ndims; i++) {
+		long dim = info->dims[i];
+		if (omp_dist_num_chunks(&map->map_dist[i]) > 1) {
+			num_segs[i] = omp_dist_num_chunks(&map->map_dist[i]);
+			continue;
+		}
+		long lo = map->map_dist[i].offset - (info->num_halo_dims ? info->halo_info[i].left : 0);
+		long hi = lo + map->map_wextra_dims[i];
+		int periodic = info->num_halo_dims && info->halo_info[i].edging == OMP_DIST_HALO_EDGING_PERIODIC;
+		int n = 0;
+		if (lo < 0 && periodic) {
+			host_start[i][n] = lo + dim; dev_start[i][n] = 0; seg_length[i][n] = -lo; n++;
+		}
+		long a = lo > 0 ? lo : 0;
+		long b = hi < dim ? hi : dim;
+		if (a < b) {
+			host_start[i][n] = a; dev_start[i][n] = a - lo; seg_length[i][n] = b - a; n++;
+		}
+		if (hi > dim && periodic) {
+			host_start[i][n] = 0; dev_start[i][n] = dim - lo; seg_length[i][n] = hi - dim; n++;
+		}
+		if (n == 0) return;
+		num_segs[i] = n;
+	}
+
+	long seg[OMP_MAX_NUM_DIMENSIONS] = {0};
+	while (1) {
+		long host_offset[OMP_MAX_NUM_DIMENSIONS], dev_offset[OMP_MAX_NUM_DIMENSIONS], length[OMP_MAX_NUM_DIMENSIONS];
+		for (i=0; i<ndims; i++) {
+			if (omp_dist_num_chunks(&map->map_dist[i]) > 1) {
+				host_offset[i] = omp_dist_get_chunk(&map->map_dist[i], seg[i], &dev_offset[i], &length[i]) + dev_offset[i];
+				continue;
+			}
+			host_offset[i] = host_start[i][seg[i]];
+			dev_offset[i] = dev_start[i][seg[i]];
+			length[i] = seg_length[i][seg[i]];
+		}
+		omp_map_memcpy_box_async(dst, dstdev, dst_dims, dev_offset, info->source_ptr, NULL, info->dims, host_offset,
+								 length, ndims, info->sizeof_element, stream);
+		for (i=ndims-1; i>=0; i--) { /* the next combination of segments */
+			if (++seg[i] < num_segs[i]) break;
+			seg[i] = 0;
+		}
+		if (i < 0) break;
+	}
+}
+
+/* copy the mapped region (not the halo) of a map from src of src_dims (see omp_map_gather) to the array, chunk by chunk
+ * for the CYCLIC dims */
+static void omp_map_scatter(omp_data_map_t * map, char * src, omp_device_t * srcdev, const long * src_dims, omp_dev_stream_t * stream) {
+	omp_data_map_info_t * info = map->info;
+	long host_offset[OMP_MAX_NUM_DIMENSIONS], dev_offset[OMP_MAX_NUM_DIMENSIONS], length[OMP_MAX_NUM_DIMENSIONS];
+	long chunk[OMP_MAX_NUM_DIMENSIONS] = {0};
+	int i;
+	while (1) {
+		for (i=0; i<info->num_dims; i++) {
+			host_offset[i] = omp_dist_get_chunk(&map->map_dist[i], chunk[i], &dev_offset[i], &length[i]) + dev_offset[i];
+			if (info->num_halo_dims) dev_offset[i] += info->halo_info[i].left;
+		}
+		omp_map_memcpy_box_async(info->source_ptr, NULL, info->dims, host_offset, src, srcdev, src_dims, dev_offset,
+								 length, info->num_dims, info->sizeof_element, stream);
+		for (i=info->num_dims-1; i>=0; i--) { /* the next combination of chunks */
+			if (++chunk[i] < omp_dist_num_chunks(&map->map_dist[i])) break;
+			chunk[i] = 0;
+		}
+		if (i < 0) break;
+	}
+}
+
+static char * omp_map_staging_buffer(omp_data_map_t * map) {
+	if (map->map_staging_ptr == NULL) {
+		map->map_staging_ptr = omp_mem_pool_malloc(&omp_unified_mem_pool, map->map_wextra_size, NULL);
+		if (map->dev->type == OMP_DEVICE_NVGPU) omp_host_register(map->map_staging_ptr, map->map_wextra_size);
+	}
+	return map->map_staging_ptr;
+}
+
+/**
+ * marshal the mapped region with halo of a map into a packed host buffer of map_wextra_dims, the layout of the device
+ * buffer of a COPY map. The buffer is from the unified memory pool and is kept in
+ * map_staging_ptr for the next marshalling or unmarshalling of the map till omp_map_free, it is registered to NVGPU so
+ * the copy to the device is one asynchronous DMA. The packing is done by omp_map_memcpy_box, in parallel with
+ * non-temporal stores for big maps. A map of a contiguous range of the array needs no marshalling and the returned
+ * buffer is the range in the array.
+ */
+void * omp_map_marshal(omp_data_map_t *map) {
+	if (!map->mem_noncontiguous && !map->info->num_halo_dims) return map->map_source_wextra_ptr;
+	omp_map_gather(map, omp_map_staging_buffer(map), NULL, map->map_wextra_dims, NULL);
+	return map->map_staging_ptr;
+}
+
+/* unmarshal the mapped region (not the halo) from the buffer of the last omp_map_marshal to the array */
+void omp_map_unmarshal(omp_data_map_t * map) {
+	if (map->map_staging_ptr == NULL) return;
+	omp_map_scatter(map, map->map_staging_ptr, NULL, map->map_wextra_dims, NULL);
+}
+
+/* a non-contiguous map to NVGPU is packed on host for one DMA, the cudaMemcpy3D of many short pageable lines is slow */
+static int omp_map_staged(omp_data_map_t * map) {
+	return map->mem_noncontiguous && map->dev->type == OMP_DEVICE_NVGPU;
+}
+
 void omp_map_mapto(omp_data_map_t * map) {
-	if (map->map_type == OMP_DATA_MAP_COPY) omp_map_memcpy_to((void*)map->map_dev_wextra_ptr, map->dev, (void*)map->map_source_wextra_ptr, map->map_wextra_size);
+	omp_map_mapto_async(map, NULL);
 }
 
 void omp_map_mapto_async(omp_data_map_t * map, omp_dev_stream_t * stream) {
-	if (map->map_type == OMP_DATA_MAP_COPY) {
+	omp_map_register_host(map);
+	if (map->map_type != OMP_DATA_MAP_COPY) return;
+	if (omp_map_staged(map)) {
+		void * buffer = omp_map_marshal(map);
+		if (stream != NULL) omp_map_memcpy_to_async((void*)map->map_dev_wextra_ptr, map->dev, buffer, map->map_wextra_size, stream);
+		else omp_map_memcpy_to((void*)map->map_dev_wextra_ptr, map->dev, buffer, map->map_wextra_size);
+	} else if (map->mem_noncontiguous || map->info->num_halo_dims) {
+		omp_map_gather(map, map->map_dev_wextra_ptr, map->dev, map->map_dev_dims, stream);
+	} else if (stream != NULL) {
 		omp_map_memcpy_to_async((void*)map->map_dev_wextra_ptr, map->dev, (void*)map->map_source_wextra_ptr, map->map_wextra_size, stream);
 	//	printf("%s, dev: %d, mapto: %X <--- %X\n", map->info->symbol, map->dev->id, map->map_dev_ptr, map->map_source_ptr);
 	//	printf("%s, dev: %d, mapto: %X <--- %X of extra\n",  map->info->symbol, map->dev->id, map->map_dev_wextra_ptr, map->map_source_wextra_ptr);
+	} else {
+		omp_map_memcpy_to((void*)map->map_dev_wextra_ptr, map->dev, (void*)map->map_source_wextra_ptr, map->map_wextra_size);
 	}
 }
 
 void omp_map_mapfrom(omp_data_map_t * map) {
-	if (map->map_type == OMP_DATA_MAP_COPY)
-		omp_map_memcpy_from((void*)map->map_source_wextra_ptr, (void*)map->map_dev_wextra_ptr, map->dev, map->map_wextra_size); /* memcpy from host to device */
+	omp_map_mapfrom_async(map, NULL);
 }
 
 void omp_map_mapfrom_async(omp_data_map_t * map, omp_dev_stream_t * stream) {
-	if (map->map_type == OMP_DATA_MAP_COPY) {
+	omp_map_register_host(map);
+	if (map->map_type != OMP_DATA_MAP_COPY) return;
+	if (omp_map_staged(map)) { /* the unmarshalling needs the data, thus it waits for the copy */
+		omp_map_staging_buffer(map);
+		if (stream != NULL) {
+			omp_map_memcpy_from_async(map->map_staging_ptr, (void*)map->map_dev_wextra_ptr, map->dev, map->map_wextra_size, stream);
+			omp_stream_sync(stream);
+		} else omp_map_memcpy_from(map->map_staging_ptr, (void*)map->map_dev_wextra_ptr, map->dev, map->map_wextra_size);
+		omp_map_unmarshal(map);
+	} else if (map->mem_noncontiguous) {
+		omp_map_scatter(map, map->map_dev_wextra_ptr, map->dev, map->map_dev_dims, stream);
+	} else if (map->info->num_halo_dims) { /* the halo belongs to the neighbours */
+		if (stream != NULL) omp_map_memcpy_from_async((void*)map->map_source_ptr, (void*)map->map_dev_ptr, map->dev, map->map_size, stream);
+		else omp_map_memcpy_from((void*)map->map_source_ptr, (void*)map->map_dev_ptr, map->dev, map->map_size);
+	} else if (stream != NULL) {
 	//	omp_map_memcpy_from_async((void*)map->map_source_ptr, (void*)map->map_dev_ptr, map->dev, map->map_size, stream); /* memcpy from host to device */
 		omp_map_memcpy_from_async((void*)map->map_source_wextra_ptr, (void*)map->map_dev_wextra_ptr, map->dev, map->map_wextra_size, stream); /* memcpy from host to device */
 	//	printf("%s, dev: %d, mapfrom: %X <--- %X\n", map->info->symbol, map->dev->id, map->map_source_ptr, map->map_dev_ptr);
 	//	printf("%s, dev: %d, mapfrom: %X <--- %X of extra\n",  map->info->symbol, map->dev->id, map->map_source_wextra_ptr, map->map_dev_wextra_ptr);
+	} else {
+		omp_map_memcpy_from((void*)map->map_source_wextra_ptr, (void*)map->map_dev_wextra_ptr, map->dev, map->map_wextra_size); /* memcpy from host to device */
 	}
 }
 
-void * omp_unified_malloc(long size) {
-	void * ptr = NULL;
-#if defined (DEVICE_NVGPU_SUPPORT) && defined (DEVICE_NVGPU_VSHAREDM)
-#if defined (DEVICE_NVGPU_CUDA_UNIFIEDMEM)
-	/* this is only for kepler and > 4.0 cuda rt */
-	cudaMallocManaged(&ptr, size, 0);
-#else
-	/* cuda zero-copy */
-	cudaError_t result;
-	result = cudaHostAlloc(&ptr, size, cudaHostAllocPortable || cudaHostAllocMapped);
-	devcall_assert(result);
-#endif
-#else
-	ptr = malloc(size);
+/**
+ * the memory pools, see omp_mem_pool_t in homp.h
+ */
+long omp_mem_pool_limit = OMP_MEM_POOL_DEFAULT_LIMIT;
+/* statically initialized since omp_unified_malloc can be called before omp_init_devices */
+omp_mem_pool_t omp_unified_mem_pool = { .dev = NULL, .lock = PTHREAD_MUTEX_INITIALIZER, .limit = OMP_MEM_POOL_DEFAULT_LIMIT };
+
+/* return the size class of a request and its bin, -1 for the bin if the block is too big to be cached.
+ * e.g. the classes between 1024 and 2048 are 1280, 1536, 1792 and 2048 */
+static long omp_mem_pool_size_class(long size, int * bin) {
+	long min = 1L << OMP_MEM_POOL_MIN_LG;
+	if (size <= min) {
+		*bin = 0;
+		return min;
+	}
+	int lg = 63 - __builtin_clzl((unsigned long)(size - 1)); /* 2^lg < size <= 2^(lg+1) */
+	long step = 1L << (lg - 2);
+	long q = ((size - 1 - (1L << lg)) >> (lg - 2)) + 1; /* 1 to 4 */
+	if (lg >= OMP_MEM_POOL_MAX_LG) *bin = -1;
+	else *bin = (lg - OMP_MEM_POOL_MIN_LG) * 4 + (int)q;
+	return (1L << lg) + q * step;
+}
+
+static inline int omp_mem_pool_hash(void * ptr) {
+	return (int)((((unsigned long)ptr) * 0x9E3779B97F4A7C15UL) >> 56) & (OMP_MEM_POOL_HASH_SIZE - 1);
+}
+
+/* the host memory of a device, the big blocks are mmaped, bound to the NUMA node of the helper thread (raw mbind
+ * syscall, so we do not depend on libnuma) and first-touched by the helper thread */
+#define OMP_MPOL_PREFERRED 1
+static void * omp_mem_pool_host_malloc(long size, int numa_node) {
+	if (size < OMP_MEM_POOL_MMAP_THRESHOLD) return malloc(size);
+	void * ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) return NULL;
+#if defined (__linux__) && defined (SYS_mbind)
+	if (numa_node >= 0 && numa_node < (int)(sizeof(unsigned long) * 8)) {
+		unsigned long nodemask = 1UL << numa_node;
+		syscall(SYS_mbind, ptr, size, OMP_MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0);
+	}
 #endif
+	/* first touch by the allocating (helper) thread, which is bound to the cores of the node if the device is bound */
+	long pagesize = sysconf(_SC_PAGESIZE);
+	long offset;
+	for (offset = 0; offset < size; offset += pagesize) ((volatile char *)ptr)[offset] = 0;
 	return ptr;
 }
 
-void omp_unified_free(void * ptr) {
+static void omp_mem_pool_host_free(void * ptr, long size) {
+	if (size < OMP_MEM_POOL_MMAP_THRESHOLD) free(ptr);
+	else munmap(ptr, size);
+}
+
+/* allocate/free from the system, i.e. when the pool has no cached block */
+static void * omp_mem_pool_sys_malloc(omp_mem_pool_t * pool, long size) {
+	void * ptr = NULL;
+	omp_device_t * dev = pool->dev;
+	if (dev == NULL) { /* the host pool for omp_unified_malloc */
 #if defined (DEVICE_NVGPU_SUPPORT) && defined (DEVICE_NVGPU_VSHAREDM)
 #if defined (DEVICE_NVGPU_CUDA_UNIFIEDMEM)
-	/* match cudaMallocManaged */
-	cudaFree(ptr);
+		/* this is only for kepler and > 4.0 cuda rt */
+		if (cudaMallocManaged(&ptr, size, 0) != cudaSuccess) ptr = NULL;
 #else
-	/* cuda zero-copy */
-	cudaFreeHost(ptr);
+		/* cuda zero-copy */
+		if (cudaHostAlloc(&ptr, size, cudaHostAllocPortable | cudaHostAllocMapped) != cudaSuccess) ptr = NULL;
 #endif
 #else
-	free(ptr);
+		ptr = malloc(size);
 #endif
-	return;
-}
+		return ptr;
+	}
 
-void * omp_map_malloc_dev(omp_device_t * dev, long size) {
 	omp_device_type_t devtype = dev->type;
-	void * ptr = NULL;
 #if defined (DEVICE_NVGPU_SUPPORT)
 	if (devtype == OMP_DEVICE_NVGPU) {
-		if (cudaErrorMemoryAllocation == cudaMalloc(&ptr, size)) {
-			fprintf(stderr, "cudaMalloc error to allocate mem on device\n");
-		}
+		if (cudaMalloc(&ptr, size) != cudaSuccess) ptr = NULL;
 	} else
 #endif
 	if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
-		ptr = malloc(size);
+		ptr = omp_mem_pool_host_malloc(size, dev->numa_node);
 	} else {
 		fprintf(stderr, "device type is not supported for this call\n");
 		abort();
 	}
-
-	//printf("dev memory allocated on %d, %X\n", dev->id, ptr);
 	return ptr;
 }
 
-void omp_map_free_dev(omp_device_t * dev, void * ptr) {
+static void omp_mem_pool_sys_free(omp_mem_pool_t * pool, void * ptr, long size) {
+	omp_device_t * dev = pool->dev;
+	if (dev == NULL) {
+		omp_host_unregister(ptr, size); /* in case a map registered it */
+#if defined (DEVICE_NVGPU_SUPPORT) && defined (DEVICE_NVGPU_VSHAREDM)
+#if defined (DEVICE_NVGPU_CUDA_UNIFIEDMEM)
+		/* match cudaMallocManaged */
+		cudaFree(ptr);
+#else
+		/* cuda zero-copy */
+		cudaFreeHost(ptr);
+#endif
+#else
+		free(ptr);
+#endif
+		return;
+	}
+
 	omp_device_type_t devtype = dev->type;
 #if defined (DEVICE_NVGPU_SUPPORT)
 	if (devtype == OMP_DEVICE_NVGPU) {
@@ -646,13 +1543,178 @@ void omp_map_free_dev(omp_device_t * dev, void * ptr) {
 	} else
 #endif
 	if (devtype == OMP_DEVICE_THSIM || devtype == OMP_DEVICE_HOSTCPU) {
-		free(ptr);
+		omp_mem_pool_host_free(ptr, size);
 	} else {
 		fprintf(stderr, "device type is not supported for this call\n");
 		abort();
 	}
 }
 
+void omp_mem_pool_init(omp_mem_pool_t * pool, omp_device_t * dev) {
+	memset(pool, 0, sizeof(omp_mem_pool_t));
+	pool->dev = dev;
+	pool->limit = omp_mem_pool_limit;
+	pthread_mutex_init(&pool->lock, NULL);
+}
+
+/* return the cached blocks to the system until no more than keep bytes are cached */
+static void omp_mem_pool_release(omp_mem_pool_t * pool, long keep) {
+	int i;
+	omp_mem_block_t * list = NULL;
+	pthread_mutex_lock(&pool->lock);
+	for (i=OMP_MEM_POOL_NUM_BINS-1; i>=0 && pool->bytes_cached > keep; i--) { /* the biggest first */
+		while (pool->bins[i] != NULL && pool->bytes_cached > keep) {
+			omp_mem_block_t * blk = pool->bins[i];
+			pool->bins[i] = blk->next;
+			pool->bytes_cached -= blk->size;
+			blk->next = list;
+			list = blk;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	while (list != NULL) {
+		omp_mem_block_t * blk = list;
+		list = blk->next;
+		omp_mem_pool_sys_free(pool, blk->ptr, blk->size);
+		free(blk);
+	}
+}
+
+void omp_mem_pool_fini(omp_mem_pool_t * pool) {
+	omp_mem_pool_release(pool, 0);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+void * omp_mem_pool_malloc(omp_mem_pool_t * pool, long size, omp_dev_stream_t * stream) {
+	int bin;
+	long csize = omp_mem_pool_size_class(size, &bin);
+	omp_mem_block_t * blk = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->num_allocs++;
+	if (bin >= 0 && pool->bins[bin] != NULL) {
+		/* prefer a block that is idle or last used by the same stream, which needs no sync */
+		omp_mem_block_t ** prev = &pool->bins[bin];
+		for (blk = *prev; blk != NULL; prev = &blk->next, blk = blk->next) {
+			if (blk->stream == NULL || blk->stream == stream) break;
+		}
+		if (blk == NULL) {
+			prev = &pool->bins[bin];
+			blk = *prev;
+		}
+		*prev = blk->next;
+		pool->bytes_cached -= blk->size;
+		pool->num_hits++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (blk != NULL) {
+		if (blk->stream != NULL && blk->stream != stream) omp_stream_sync(blk->stream);
+	} else {
+		void * ptr = omp_mem_pool_sys_malloc(pool, csize);
+		if (ptr == NULL) { /* give the cached blocks back and try again */
+			omp_mem_pool_release(pool, 0);
+			ptr = omp_mem_pool_sys_malloc(pool, csize);
+			if (ptr == NULL) {
+				fprintf(stderr, "cannot allocate %ld bytes of memory on dev %d\n", size, pool->dev == NULL ? -1 : pool->dev->id);
+				return NULL;
+			}
+		}
+		blk = (omp_mem_block_t *) malloc(sizeof(omp_mem_block_t));
+		blk->ptr = ptr;
+		blk->size = csize;
+	}
+	blk->requested = size;
+	blk->stream = NULL;
+
+	int h = omp_mem_pool_hash(blk->ptr);
+	pthread_mutex_lock(&pool->lock);
+	blk->next = pool->inuse[h];
+	pool->inuse[h] = blk;
+	pool->bytes_inuse += blk->size;
+	pool->bytes_requested += size;
+	if (pool->bytes_inuse > pool->peak_bytes_inuse) pool->peak_bytes_inuse = pool->bytes_inuse;
+	pthread_mutex_unlock(&pool->lock);
+
+	return blk->ptr;
+}
+
+/* the block may be used by the stream till the stream is synced, NULL stream means the block is idle */
+void omp_mem_pool_free(omp_mem_pool_t * pool, void * ptr, omp_dev_stream_t * stream) {
+	if (ptr == NULL) return;
+	int h = omp_mem_pool_hash(ptr);
+	omp_mem_block_t * blk;
+	omp_mem_block_t ** prev = &pool->inuse[h];
+
+	pthread_mutex_lock(&pool->lock);
+	for (blk = *prev; blk != NULL; prev = &blk->next, blk = blk->next) {
+		if (blk->ptr == ptr) break;
+	}
+	if (blk == NULL) {
+		pthread_mutex_unlock(&pool->lock);
+		fprintf(stderr, "memory %p is not allocated from the memory pool of dev %d\n", ptr, pool->dev == NULL ? -1 : pool->dev->id);
+		abort();
+	}
+	*prev = blk->next;
+	pool->bytes_inuse -= blk->size;
+	pool->bytes_requested -= blk->requested;
+
+	int bin;
+	omp_mem_pool_size_class(blk->requested, &bin);
+	if (bin >= 0 && pool->bytes_cached + blk->size <= pool->limit) {
+		blk->stream = stream;
+		blk->next = pool->bins[bin];
+		pool->bins[bin] = blk;
+		pool->bytes_cached += blk->size;
+		blk = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (blk != NULL) { /* not cached */
+		if (stream != NULL) omp_stream_sync(stream);
+		omp_mem_pool_sys_free(pool, blk->ptr, blk->size);
+		free(blk);
+	}
+}
+
+void omp_mem_pool_print_stats(omp_mem_pool_t * pool, const char * name) {
+	pthread_mutex_lock(&pool->lock);
+	double hit_rate = pool->num_allocs ? 100.0 * pool->num_hits / pool->num_allocs : 0.0;
+	double frag = pool->bytes_inuse ? 100.0 * (pool->bytes_inuse - pool->bytes_requested) / pool->bytes_inuse : 0.0;
+	printf("%s memory pool: %ld allocs, hit rate %.1f%%, in use %.2fMB (peak %.2fMB), cached %.2fMB, internal fragmentation %.1f%%\n",
+		   name, pool->num_allocs, hit_rate, pool->bytes_inuse / 1048576.0, pool->peak_bytes_inuse / 1048576.0,
+		   pool->bytes_cached / 1048576.0, frag);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void * omp_unified_malloc(long size) {
+	return omp_mem_pool_malloc(&omp_unified_mem_pool, size, NULL);
+}
+
+void omp_unified_free(void * ptr) {
+	omp_mem_pool_free(&omp_unified_mem_pool, ptr, NULL);
+}
+
+void * omp_map_malloc_dev_async(omp_device_t * dev, long size, omp_dev_stream_t * stream) {
+	void * ptr = omp_mem_pool_malloc(&dev->mem_pool, size, stream);
+	//printf("dev memory allocated on %d, %X\n", dev->id, ptr);
+	return ptr;
+}
+
+void * omp_map_malloc_dev(omp_device_t * dev, long size) {
+	return omp_map_malloc_dev_async(dev, size, NULL);
+}
+
+/* the stream must outlive the cached block, i.e. it should be one of the device streams, not the stream of an offloading */
+void omp_map_free_dev_async(omp_device_t * dev, void * ptr, omp_dev_stream_t * stream) {
+	omp_mem_pool_free(&dev->mem_pool, ptr, stream);
+}
+
+void omp_map_free_dev(omp_device_t * dev, void * ptr) {
+	omp_map_free_dev_async(dev, ptr, NULL);
+}
+
 void omp_map_memcpy_to(void * dst, omp_device_t * dstdev, const void * src, long size) {
 	omp_device_type_t devtype = dstdev->type;
 #if defined (DEVICE_NVGPU_SUPPORT)
@@ -727,6 +1789,124 @@ void omp_map_memcpy_from_async(void * dst, const void * src, omp_device_t * srcd
 	}
 }
 
+/* copy a line of a host box copy, with non-temporal (streaming) stores that bypass the cache if asked */
+static void omp_map_copy_line(char * dst, const char * src, long size, int nontemporal) {
+#if defined (__SSE2__)
+	if (nontemporal && size >= 256) {
+		long head = (16 - ((unsigned long)dst & 15)) & 15;
+		memcpy(dst, src, head);
+		dst += head;
+		src += head;
+		size -= head;
+		long i, n = size / 16;
+		for (i=0; i<n; i++) _mm_stream_si128((__m128i*)dst + i, _mm_loadu_si128((const __m128i*)src + i));
+		memcpy(dst + n * 16, src + n * 16, size - n * 16);
+		_mm_sfence();
+		return;
+	}
+#endif
+	memcpy(dst, src, size);
+}
+
+/**
+ * copy a box (sub-block) of up to 3 dims between two row-major arrays, each given by the pointer to its first element,
+ * its device (NULL for host memory, e.g. a relay buffer), its dims and the offset of the box in it. The inner dims that
+ * are copied whole are folded into the outer ones so a line is as long as possible, a box that is a contiguous range of
+ * both arrays is thus a single memcpy. Between host memory it copies line by line, with strided loops for lines of a
+ * single element, e.g. the column halo of width 1. A big copy is split among omp_map_copy_num_threads OpenMP threads
+ * (serial if the runtime is built without OpenMP), see OMP_MAP_COPY_PARALLEL_THRESHOLD. With an NVGPU on either side
+ * it is one cudaMemcpy3D call, so the DMA engine does the gather and scatter. A stream of NULL makes the NVGPU copy
+ * synchronous.
+ */
+void omp_map_memcpy_box_async(void * dst, omp_device_t * dstdev, const long * dst_dims, const long * dst_offset,
+							  const void * src, omp_device_t * srcdev, const long * src_dims, const long * src_offset,
+							  const long * length, int ndims, int sizeof_element, omp_dev_stream_t * stream) {
+	long len[3], ddims[3], doff[3], sdims[3], soff[3];
+	int i, j;
+	for (i=0; i<3; i++) { /* normalize to 3-D, the missing outer dims have one element */
+		j = i - (3 - ndims);
+		len[i] = j < 0 ? 1 : length[j];
+		ddims[i] = j < 0 ? 1 : dst_dims[j];
+		doff[i] = j < 0 ? 0 : dst_offset[j];
+		sdims[i] = j < 0 ? 1 : src_dims[j];
+		soff[i] = j < 0 ? 0 : src_offset[j];
+		if (len[i] <= 0) return;
+	}
+	for (i=0; i<2 && len[2] == ddims[2] && len[2] == sdims[2]; i++) { /* fold the whole inner dim into the next one */
+		len[2] *= len[1]; doff[2] = doff[1] * ddims[2]; ddims[2] *= ddims[1]; soff[2] = soff[1] * sdims[2]; sdims[2] *= sdims[1];
+		len[1] = len[0]; doff[1] = doff[0]; ddims[1] = ddims[0]; soff[1] = soff[0]; sdims[1] = sdims[0];
+		len[0] = 1; doff[0] = 0; ddims[0] = 1; soff[0] = 0; sdims[0] = 1;
+	}
+
+	long line = len[2] * sizeof_element;
+	long dpitch = ddims[2] * sizeof_element;
+	long spitch = sdims[2] * sizeof_element;
+	long dslice = ddims[1] * dpitch;
+	long sslice = sdims[1] * spitch;
+	char * d = (char*)dst + doff[0] * dslice + doff[1] * dpitch + doff[2] * sizeof_element;
+	const char * s = (const char*)src + soff[0] * sslice + soff[1] * spitch + soff[2] * sizeof_element;
+	if (d == s && dpitch == spitch && dslice == sslice) return; /* e.g. the halo of SHARED maps of the same array */
+
+	int dst_nvgpu = dstdev != NULL && dstdev->type == OMP_DEVICE_NVGPU;
+	int src_nvgpu = srcdev != NULL && srcdev->type == OMP_DEVICE_NVGPU;
+#if defined (DEVICE_NVGPU_SUPPORT)
+	if (dst_nvgpu || src_nvgpu) {
+		cudaError_t result;
+		struct cudaMemcpy3DParms parms;
+		memset(&parms, 0, sizeof(parms));
+		parms.dstPtr = make_cudaPitchedPtr(d, dpitch, line, ddims[1]);
+		parms.srcPtr = make_cudaPitchedPtr((void*)s, spitch, line, sdims[1]);
+		parms.extent = make_cudaExtent(line, len[1], len[0]);
+		parms.kind = cudaMemcpyDefault; /* unified addressing tells the direction, including peer copies */
+		if (stream != NULL) result = cudaMemcpy3DAsync(&parms, stream->systream.cudaStream);
+		else result = cudaMemcpy3D(&parms);
+		devcall_assert(result);
+		return;
+	}
+#endif
+	(void) stream; /* the host copies are synchronous */
+	if (dst_nvgpu || src_nvgpu) {
+		fprintf(stderr, "device type is not supported for this call: %s:%d\n", __FILE__, __LINE__);
+		abort();
+	}
+	long nlines = len[0] * len[1];
+	long total = nlines * line;
+	int nontemporal = total >= OMP_MAP_COPY_NT_THRESHOLD;
+	int nthreads = total >= OMP_MAP_COPY_PARALLEL_THRESHOLD ? omp_map_copy_num_threads : 1;
+	long k, l, x;
+	if (nthreads > 1 && nlines == 1) { /* one contiguous range, each thread copies a part of it */
+		long chunk = ((line + nthreads - 1) / nthreads + 63) & ~63L;
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+		for (x=0; x<nthreads; x++) {
+			long start = x * chunk;
+			if (start < line) omp_map_copy_line(d + start, s + start, start + chunk > line ? line - start : chunk, nontemporal);
+		}
+	} else if (nthreads > 1) {
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+		for (x=0; x<nlines; x++) {
+			long xk = x / len[1];
+			long xl = x % len[1];
+			omp_map_copy_line(d + xk * dslice + xl * dpitch, s + xk * sslice + xl * spitch, line, nontemporal);
+		}
+	} else for (k=0; k<len[0]; k++) {
+		char * dline = d + k * dslice;
+		const char * sline = s + k * sslice;
+		if (line == sizeof(uint64_t) && sizeof_element == sizeof(uint64_t)) { /* a strided column, gather/scatter by elements */
+			for (l=0; l<len[1]; l++) *(uint64_t*)(dline + l * dpitch) = *(const uint64_t*)(sline + l * spitch);
+		} else if (line == sizeof(uint32_t) && sizeof_element == sizeof(uint32_t)) {
+			for (l=0; l<len[1]; l++) *(uint32_t*)(dline + l * dpitch) = *(const uint32_t*)(sline + l * spitch);
+		} else {
+			for (l=0; l<len[1]; l++) omp_map_copy_line(dline + l * dpitch, sline + l * spitch, line, nontemporal);
+		}
+	}
+}
+
+void omp_map_memcpy_box(void * dst, omp_device_t * dstdev, const long * dst_dims, const long * dst_offset,
+						const void * src, omp_device_t * srcdev, const long * src_dims, const long * src_offset,
+						const long * length, int ndims, int sizeof_element) {
+	omp_map_memcpy_box_async(dst, dstdev, dst_dims, dst_offset, src, srcdev, src_dims, src_offset, length, ndims, sizeof_element, NULL);
+}
+
 /**
  * this should be calling from src for NGVPU implementation
  */
@@ -923,6 +2103,8 @@ void omp_event_record_start(omp_event_t * ev, omp_dev_stream_t * stream,  const
 	ev->stream = stream;
 	omp_event_record_method_t rm = ev->record_method;
 	ev->event_name = event_name;
+	ev->bytes = 0;
+	ev->symbol = NULL;
 	va_list l;
 	va_start(l, event_msg);
     vsnprintf(ev->event_description, OMP_EVENT_MSG_LENGTH, event_msg, l);
@@ -1042,6 +2224,323 @@ void omp_event_accumulate_elapsed_ms(omp_event_t * ev) {
 	ev->recorded = 0;
 }
 
+/* called by the helper thread (fds is dev->perf_fds) or a team worker, the counters count the thread that opens them */
+void omp_perf_counters_open(omp_device_t * dev, int * fds) {
+	int i;
+	for (i=0; i<OMP_PERF_NUM_COUNTERS; i++) fds[i] = -1;
+	if (!omp_dev_perf_counters || (dev->type != OMP_DEVICE_HOSTCPU && dev->type != OMP_DEVICE_THSIM)) return;
+#if defined (__linux__) && defined (SYS_perf_event_open)
+	static const struct {
+		unsigned int type;
+		unsigned long long config;
+	} events[OMP_PERF_NUM_COUNTERS] = {
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+	};
+	for (i=0; i<OMP_PERF_NUM_COUNTERS; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.exclude_kernel = 1; /* allowed with perf_event_paranoid <= 2 */
+		attr.exclude_hv = 1;
+		fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	if (fds == dev->perf_fds && (fds[OMP_PERF_CYCLES] < 0 || fds[OMP_PERF_TASK_CLOCK] < 0))
+		fprintf(stderr, "%d|%s: some perf counters are not available (e.g. hardware counters in a VM or perf_event_paranoid > 2), reported as n/a\n",
+				dev->id, dev->name);
+#endif
+}
+
+void omp_perf_counters_close(omp_device_t * dev) {
+	int i;
+	for (i=0; i<OMP_PERF_NUM_COUNTERS; i++) {
+		if (dev->perf_fds[i] >= 0) close(dev->perf_fds[i]);
+		dev->perf_fds[i] = -1;
+	}
+}
+
+/* the sum of the counters of the helper thread and the team workers */
+void omp_perf_counters_read(omp_device_t * dev, long long counts[]) {
+	int i, j;
+	for (i=0; i<OMP_PERF_NUM_COUNTERS; i++) {
+		long long value;
+		if (dev->perf_fds[i] >= 0 && read(dev->perf_fds[i], &value, sizeof(value)) == sizeof(value)) counts[i] = value;
+		else counts[i] = -1;
+		for (j=0; j<dev->team.num_threads-1 && counts[i] >= 0; j++) {
+			int fd = dev->team.members[j].perf_fds[i];
+			if (fd >= 0 && read(fd, &value, sizeof(value)) == sizeof(value)) counts[i] += value;
+		}
+	}
+}
+
+/**
+ * called by the helper thread after the kernel with the counts read before it and the wall time of the kernel (ms),
+ * accumulates the counts of the kernel to off->kernel_counts and updates the achieved flops of the offloading from the
+ * per-iteration profile and the wall time
+ */
+void omp_perf_kernel_stop(omp_offloading_t * off, long long start_counts[], double time) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_perf_counts_t * kc = &off->kernel_counts;
+	long long counts[OMP_PERF_NUM_COUNTERS];
+	omp_perf_counters_read(off->dev, counts);
+	int i;
+	for (i=0; i<OMP_PERF_NUM_COUNTERS; i++) {
+		if (counts[i] < 0 || start_counts[i] < 0) kc->counts[i] = -1;
+		else if (kc->runs == 0) kc->counts[i] = counts[i] - start_counts[i];
+		else if (kc->counts[i] >= 0) kc->counts[i] += counts[i] - start_counts[i];
+	}
+	double iterations = 1.0;
+	for (i=0; i<off_info->loop_depth; i++) iterations *= off->loop_dist[i].length;
+	kc->iterations += iterations;
+	kc->time += time;
+	kc->runs++;
+
+	double fp = off_info->per_iteration_profile.num_fp_operations * iterations;
+	if (fp > 0.0 && time > 0.0) off->measured_flopss = fp / (time * 1.0e6); /* flops per ns is GFLOPs/s */
+}
+
+/**
+ * print the accumulated counters of the kernel, with the arithmetic intensity achieved (the declared flops over the bytes
+ * estimated from the LLC misses) and declared by the per-iteration profile, whose loads and stores are assumed to be of the
+ * element size of the first mapped array
+ */
+void omp_perf_print_counts(omp_offloading_t * off) {
+	omp_offloading_info_t * off_info = off->off_info;
+	omp_perf_counts_t * kc = &off->kernel_counts;
+	if (kc->runs == 0) return;
+	long long * c = kc->counts;
+	char buf[OMP_PERF_NUM_COUNTERS][32];
+	int i;
+	for (i=0; i<OMP_PERF_NUM_COUNTERS; i++) {
+		if (c[i] < 0) snprintf(buf[i], 32, "n/a");
+		else snprintf(buf[i], 32, "%lld", c[i]);
+	}
+	printf("KERNEL perf counters (%d runs, %.0f iterations): cycles %s, instructions %s", kc->runs, kc->iterations,
+		   buf[OMP_PERF_CYCLES], buf[OMP_PERF_INSTRUCTIONS]);
+	if (c[OMP_PERF_CYCLES] > 0 && c[OMP_PERF_INSTRUCTIONS] >= 0) printf(" (IPC %.2f)", (double)c[OMP_PERF_INSTRUCTIONS] / c[OMP_PERF_CYCLES]);
+	printf(", LLC misses %s", buf[OMP_PERF_LLC_MISSES]);
+	double bytes = c[OMP_PERF_LLC_MISSES] >= 0 ? (double)c[OMP_PERF_LLC_MISSES] * OMP_PERF_CACHE_LINE_SIZE : -1.0;
+	if (bytes >= 0.0) {
+		printf(" (%.2fMB", bytes / 1048576.0);
+		if (kc->time > 0.0) printf(", %.2fGB/s", bytes / (kc->time * 1.0e6));
+		printf(")");
+	}
+	if (c[OMP_PERF_TASK_CLOCK] >= 0) printf(", cpu time %.3fms\n", c[OMP_PERF_TASK_CLOCK] / 1.0e6);
+	else printf(", cpu time n/a\n");
+
+	omp_kernel_profile_info_t * profile = &off_info->per_iteration_profile;
+	if (profile->num_fp_operations == 0) return;
+	double fp = (double)profile->num_fp_operations * kc->iterations;
+	int sizeof_element = off_info->num_mapped_vars > 0 ? off_info->data_map_info[0].sizeof_element : (int)sizeof(double);
+	double declared_bytes = (double)(profile->num_load + profile->num_store) * sizeof_element;
+	printf("KERNEL arithmetic intensity (flops/byte): declared ");
+	if (declared_bytes > 0.0) printf("%.3f", profile->num_fp_operations / declared_bytes);
+	else printf("n/a");
+	if (bytes > 0.0) printf(", achieved %.3f", fp / bytes);
+	else printf(", achieved n/a");
+	if (kc->time > 0.0) printf(", %.3fGFLOPs/s\n", fp / (kc->time * 1.0e6));
+	else printf("\n");
+}
+
+/* the trace rings are drained by the flusher thread, see omp_trace_ring_t */
+static FILE * omp_trace_fp = NULL;
+static pthread_t omp_trace_flusher;
+static volatile int omp_trace_flusher_stop = 0;
+
+/* whether the given run of an offloading is traced, run is 0 for a non-recurring offloading and from 1 for a recurring one */
+int omp_trace_sampled(int run) {
+	if (omp_trace_file == NULL) return 0;
+	return run <= 1 || (run - 1) % omp_trace_sample == 0;
+}
+
+/**
+ * push a recorded event into the trace ring of its device, it must be called by the helper thread of the device before the
+ * event is accumulated (omp_event_accumulate_elapsed_ms resets the recorded flag). The record is dropped if the ring is full.
+ * The time of a dev-recorded event is the host time of its start and stop marks, thus all the tracks share the same clock.
+ */
+void omp_trace_event(omp_event_t * ev, int stage, const char * offloading, int run) {
+	if (!ev->recorded) return;
+	omp_trace_ring_t * ring = &ev->dev->trace_ring;
+	if (ring->records == NULL) return;
+	unsigned long head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= OMP_TRACE_RING_SIZE) {
+		ring->dropped++;
+		return;
+	}
+	omp_trace_record_t * rec = &ring->records[head & (OMP_TRACE_RING_SIZE - 1)];
+	if (ev->record_method == OMP_EVENT_HOST_RECORD) {
+		rec->start = ev->start_time_host;
+		rec->duration = ev->stop_time_host - ev->start_time_host;
+		rec->host = 1;
+	} else {
+		rec->start = ev->start_time_dev;
+		rec->duration = ev->stop_time_dev - ev->start_time_dev;
+		rec->host = 0;
+	}
+	rec->bytes = ev->bytes;
+	rec->dev = ev->dev->id;
+	rec->stage = stage;
+	rec->run = run;
+	snprintf(rec->name, OMP_TRACE_NAME_LENGTH, "%s%s", ev->event_name, ev->symbol != NULL ? ev->symbol : "");
+	snprintf(rec->offloading, OMP_TRACE_NAME_LENGTH, "%s", offloading != NULL ? offloading : "");
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void omp_trace_drain() {
+	int i;
+	for (i=0; i<omp_num_devices; i++) {
+		omp_trace_ring_t * ring = &omp_devices[i].trace_ring;
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = ring->tail;
+		while (tail != head) {
+			unsigned long index = tail & (OMP_TRACE_RING_SIZE - 1);
+			unsigned long n = head - tail;
+			if (n > OMP_TRACE_RING_SIZE - index) n = OMP_TRACE_RING_SIZE - index;
+			fwrite(&ring->records[index], sizeof(omp_trace_record_t), n, omp_trace_fp);
+			tail += n;
+		}
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+static void * omp_trace_flusher_main(void * arg) {
+	(void) arg;
+	while (!omp_trace_flusher_stop) {
+		usleep(OMP_TRACE_FLUSH_INTERVAL * 1000);
+		omp_trace_drain();
+	}
+	return NULL;
+}
+
+static void omp_trace_init() {
+	char binfile[PATH_MAX];
+	snprintf(binfile, PATH_MAX, "%s.bin", omp_trace_file);
+	omp_trace_fp = fopen(binfile, "wb");
+	if (omp_trace_fp == NULL) {
+		fprintf(stderr, "cannot open trace file %s, tracing is disabled\n", binfile);
+		omp_trace_file = NULL;
+		return;
+	}
+	omp_trace_header_t header;
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, OMP_TRACE_MAGIC, sizeof(header.magic));
+	header.version = OMP_TRACE_VERSION;
+	header.num_devices = omp_num_devices;
+	header.record_size = sizeof(omp_trace_record_t);
+	header.name_length = OMP_TRACE_NAME_LENGTH;
+	fwrite(&header, sizeof(header), 1, omp_trace_fp);
+	int i;
+	for (i=0; i<omp_num_devices; i++) fwrite(omp_devices[i].name, sizeof(omp_devices[i].name), 1, omp_trace_fp);
+
+	omp_trace_flusher_stop = 0;
+	int rt = pthread_create(&omp_trace_flusher, NULL, omp_trace_flusher_main, NULL);
+	if (rt) {fprintf(stderr, "cannot create the trace flusher thread.\n"); exit(1); }
+}
+
+/* called by omp_fini_devices after the helper threads are joined, i.e. no more producers */
+static void omp_trace_fini() {
+	omp_trace_flusher_stop = 1;
+	pthread_join(omp_trace_flusher, NULL);
+	omp_trace_drain();
+	fclose(omp_trace_fp);
+	omp_trace_fp = NULL;
+	int i;
+	for (i=0; i<omp_num_devices; i++) {
+		free(omp_devices[i].trace_ring.records);
+		omp_devices[i].trace_ring.records = NULL;
+	}
+
+	char binfile[PATH_MAX];
+	char jsonfile[PATH_MAX];
+	snprintf(binfile, PATH_MAX, "%s.bin", omp_trace_file);
+	snprintf(jsonfile, PATH_MAX, "%s.json", omp_trace_file);
+	if (omp_trace_export_json(binfile, jsonfile) == 0) printf("Trace exported to %s (load it in chrome://tracing or ui.perfetto.dev)\n", jsonfile);
+}
+
+static void omp_trace_print_string(FILE * fp, const char * str, int max) {
+	int i;
+	fputc('"', fp);
+	for (i=0; i<max && str[i] != '\0'; i++) {
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+		else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+		else fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+/**
+ * convert a binary trace file written by the flusher to the Chrome trace-event JSON format, one complete ("X") event per
+ * record with the time in us from the earliest record, and one track (tid) per device. Return 0 on success.
+ */
+int omp_trace_export_json(const char * binfile, const char * jsonfile) {
+	FILE * in = fopen(binfile, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "cannot open trace file %s\n", binfile);
+		return -1;
+	}
+	omp_trace_header_t header;
+	if (fread(&header, sizeof(header), 1, in) != 1 || strncmp(header.magic, OMP_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != OMP_TRACE_VERSION || header.record_size != sizeof(omp_trace_record_t) ||
+		header.name_length != OMP_TRACE_NAME_LENGTH || header.num_devices < 0) {
+		fprintf(stderr, "%s is not a trace file of this runtime\n", binfile);
+		fclose(in);
+		return -1;
+	}
+	char (*names)[64] = (char (*)[64]) malloc(64 * (header.num_devices + 1));
+	if (header.num_devices > 0 && fread(names, 64, header.num_devices, in) != (size_t)header.num_devices) {
+		fprintf(stderr, "%s is truncated\n", binfile);
+		free(names);
+		fclose(in);
+		return -1;
+	}
+	long records_offset = ftell(in);
+
+	/* the first pass for the earliest start */
+	omp_trace_record_t rec;
+	double start = -1.0;
+	while (fread(&rec, sizeof(rec), 1, in) == 1) {
+		if (start < 0.0 || rec.start < start) start = rec.start;
+	}
+
+	FILE * out = fopen(jsonfile, "w");
+	if (out == NULL) {
+		fprintf(stderr, "cannot open %s for the trace export\n", jsonfile);
+		free(names);
+		fclose(in);
+		return -1;
+	}
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"HOMP\"}}");
+	int i;
+	for (i=0; i<header.num_devices; i++) {
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":", i);
+		char devname[80];
+		snprintf(devname, sizeof(devname), "%d|%.64s", i, names[i]);
+		omp_trace_print_string(out, devname, sizeof(devname));
+		fprintf(out, "}}");
+	}
+
+	fseek(in, records_offset, SEEK_SET);
+	while (fread(&rec, sizeof(rec), 1, in) == 1) {
+		fprintf(out, ",\n{\"name\":");
+		omp_trace_print_string(out, rec.name, OMP_TRACE_NAME_LENGTH);
+		fprintf(out, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"offloading\":",
+				rec.host ? "host" : "dev", (rec.start - start) * 1000.0, rec.duration * 1000.0, rec.dev);
+		omp_trace_print_string(out, rec.offloading, OMP_TRACE_NAME_LENGTH);
+		fprintf(out, ",\"run\":%d,\"stage\":%d,\"bytes\":%ld}}", rec.run, rec.stage, rec.bytes);
+	}
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	fclose(in);
+	free(names);
+	return 0;
+}
+
 int omp_get_max_threads_per_team(omp_device_t * dev) {
 	omp_device_type_t devtype = dev->type;
 #if defined (DEVICE_NVGPU_SUPPORT)